@@ -0,0 +1,182 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_CPU_MODULE_H_
+#define _C_CPU_MODULE_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOutModule.h>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+#include <deque>
+
+namespace osgPPU
+{
+    //! Module processing the unit's input on the cpu by a pool of worker threads
+    /**
+    * The module reads the input textures back through the input PBOs of the unit and
+    * splits the output into tiles of rows, which are processed by processTile() on worker
+    * threads. The results are uploaded to the output textures through the output PBOs. The
+    * draw thread only copies the data from and to the PBOs, it does not wait for the workers.
+    *
+    * The results of the input rendered in frame k are uploaded in frame k+N, where N is the
+    * frame latency (default 2). The read back takes one frame, so the workers have N-1 frames
+    * to finish the processing. If they need longer, the last finished results are uploaded again,
+    * and if too many frames are in flight, new input is dropped. Only with a latency of 1 the
+    * draw thread waits for the workers.
+    *
+    * The data is given in the pixel format of the textures, i.e. four floats per pixel for
+    * GL_RGBA32F_ARB. All buffers and rows of such formats are 16 byte aligned, so that the
+    * kernels can use SIMD instructions directly on them.
+    **/
+    class OSGPPU_EXPORT CPUModule : public UnitInOutModule::Module
+    {
+        public:
+            //! Image data of an input or output
+            struct Image
+            {
+                Image() : data(NULL), width(0), height(0), rowSize(0), format(0), type(0) {}
+
+                //! Get pointer to the first pixel of the given row
+                inline unsigned char* row(unsigned int y) const { return data + y * rowSize; }
+
+                //! Content of the texture, layers and cubemap faces follow each other
+                unsigned char* data;
+
+                //! Number of pixels per row and number of rows over all layers
+                unsigned int width, height;
+
+                //! Size of a row in bytes
+                unsigned int rowSize;
+
+                //! Pixel format and data type of the pixels
+                GLenum format, type;
+            };
+
+            typedef std::map<int, Image> ImageMap;
+
+            //! Part of the output which is processed by one worker at once
+            struct Tile
+            {
+                //! Rows of the outputs to compute
+                unsigned int firstRow, numRows;
+
+                //! Complete inputs, so that filters can read neighbouring pixels
+                ImageMap inputs;
+
+                //! Complete outputs, only the rows of the tile must be written
+                ImageMap outputs;
+
+                //! Number of the processed frame, counted from the first processed one
+                unsigned int frame;
+            };
+
+            /**
+            * Create the module and enable the PBOs of the unit.
+            * @param numInputs Number of inputs which are read back
+            * @param numOutputs Number of outputs (MRTs) which are written
+            **/
+            CPUModule(UnitInOutModule* parent, unsigned int numInputs = 1, unsigned int numOutputs = 1);
+
+            //! Stop the workers and release the unit's PBO callback
+            virtual ~CPUModule();
+
+            //! Start the worker threads
+            virtual bool init();
+
+            //! Submit the read back input to the workers
+            virtual bool beginAndProcess();
+
+            /**
+            * Process a tile. Called concurrently from the worker threads, hence the
+            * implementation must not change any state shared between tiles.
+            **/
+            virtual void processTile(const Tile& tile) = 0;
+
+            //! Set number of worker threads (default number of processors). Takes effect on init().
+            inline void setNumThreads(unsigned int num) { _numThreads = num > 0 ? num : 1; }
+            inline unsigned int getNumThreads() const { return _numThreads; }
+
+            //! Set number of rows per tile (default 32)
+            inline void setTileRows(unsigned int rows) { _tileRows = rows > 0 ? rows : 1; }
+            inline unsigned int getTileRows() const { return _tileRows; }
+
+            //! Set number of frames between rendering of the input and upload of its results (default 2)
+            inline void setFrameLatency(unsigned int frames) { _frameLatency = frames > 0 ? frames : 1; }
+            inline unsigned int getFrameLatency() const { return _frameLatency; }
+
+            //! Get number of frames whose input was dropped, since the workers were too slow
+            inline unsigned int getNumDroppedFrames() const { return _numDroppedFrames; }
+
+        protected:
+            struct Job;
+            class Worker;
+            class Callback;
+            friend class Worker;
+            friend class Callback;
+
+            //! Copy the read back input of the current frame into the filled job
+            void readInput(int index, const void* data, unsigned int size);
+
+            //! Copy the results due in this frame into the output pbo
+            void writeOutput(int mrt, void* data, unsigned int size);
+
+            //! Get next task from the queue, blocks until one is available. Returns false on exit.
+            bool nextTask(Job*& job, unsigned int& tile);
+
+            //! Mark tile of the job as done
+            void finishTask(Job* job);
+
+            void startThreads();
+            void stopThreads();
+
+            unsigned int _numInputs;
+            unsigned int _numOutputs;
+            unsigned int _numThreads;
+            unsigned int _tileRows;
+            unsigned int _frameLatency;
+            unsigned int _numDroppedFrames;
+
+            osg::ref_ptr<Callback> _callback;
+            std::vector<Worker*> _workers;
+
+            //! Job filled by the current frame, jobs processed by the workers and the last finished one
+            osg::ref_ptr<Job> _filling;
+            std::deque<osg::ref_ptr<Job> > _inFlight;
+            osg::ref_ptr<Job> _result;
+            std::vector<osg::ref_ptr<Job> > _freeJobs;
+            unsigned int _numSubmitted;
+            bool _resultSelected;
+
+            //! Queue of tiles and synchronization with the workers
+            std::deque<std::pair<Job*, unsigned int> > _tasks;
+            OpenThreads::Mutex _mutex;
+            OpenThreads::Condition _taskCondition;
+            OpenThreads::Condition _doneCondition;
+            bool _quit;
+    };
+
+};
+
+#endif
@@ -25,6 +25,9 @@
 #include <osg/Camera>
 #include <osg/State>
 #include <osg/Geode>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include <set>
 
 #include <osgPPU/Export.h>
 
@@ -114,10 +117,29 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         inline void markUnitSubgraphNonDirty() {mbDirtyUnitGraph = false;}
 
+        /**
+        * Force the processor to recompute which units are part of the pipeline.
+        * Only units reachable from an active sink (UnitOut, UnitOutReadback, pinned units
+        * or units placed as last) are rendered. Units rendering in place into the output
+        * of a rendered unit, such as UnitText, are rendered as well. The method is
+        * called automatically whenever the active or pinned flag of a unit changes.
+        **/
+        inline void dirtyUnitLiveness()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mLivenessMutex);
+            mbDirtyUnitLiveness = true;
+        }
+
         /**
         * Search in the subgraph for a unit. To be able to find the unit
         * you have to use unique names for it, however this is not a strict rule.
         * If nothing found return NULL.
+        * The processor keeps an index of its units by their names, which is built
+        * when the unit subgraph is set up, hence the method is cheap enough to be
+        * called every frame. Names which are not found are not searched again and
+        * detached units are not recognized until dirtyUnitSubgraph() is called, hence
+        * mark the subgraph as dirty after adding or removing units. The method can be
+        * called from any thread.
         * @param name Unique name of the unit.
         **/
         Unit* findUnit(const std::string& name);
@@ -164,6 +186,50 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         void useColorClamp( bool useColorClamp = true ) {mUseColorClamp = useColorClamp; mbDirty = true;}
 
+        /**
+        * Statistics about the execution order of the units. The number of state
+        * changes is counted between consecutive units once in the order the units
+        * were found in the graph and once in the scheduled order.
+        **/
+        struct Statistics
+        {
+            Statistics() :
+                numUnits(0), numLevels(0),
+                numProgramChangesUnsorted(0), numFrameBufferChangesUnsorted(0), numTextureChangesUnsorted(0),
+                numProgramChanges(0), numFrameBufferChanges(0), numTextureChanges(0) {}
+
+            unsigned int numUnits;
+            unsigned int numLevels;
+
+            unsigned int numProgramChangesUnsorted;
+            unsigned int numFrameBufferChangesUnsorted;
+            unsigned int numTextureChangesUnsorted;
+
+            unsigned int numProgramChanges;
+            unsigned int numFrameBufferChanges;
+            unsigned int numTextureChanges;
+        };
+
+        /**
+        * Get statistics of the current execution order. The statistics are
+        * updated whenever the unit subgraph is set up.
+        **/
+        inline const Statistics& getStatistics() const { return mStatistics; }
+
+        /**
+        * Enable or disable sorting of independent units to minimize state changes.
+        * Units are always executed according to their dependencies, however units which do
+        * not depend on each other are sorted by program, input textures and framebuffer object.
+        * If disabled the units are executed in the order they are found in the graph.
+        * Default is enabled.
+        **/
+        inline void setUseStateSorting(bool b) { if (b != mUseStateSorting) dirtyUnitSubgraph(); mUseStateSorting = b; }
+
+        /**
+        * Check whenever units are sorted by their state.
+        **/
+        inline bool getUseStateSorting() const { return mUseStateSorting; }
+
         /**
         * Call this method whenever your main viewport of any of the used cameras
         * or a size of used external textures has changed. Processor will notify 
@@ -198,15 +264,35 @@ class OSGPPU_EXPORT Processor : public osg::Group {
 
     private:
 
+        //! Unit of the index, attached is false if the unit might be removed since the subgraph was dirtied
+        struct UnitIndexEntry
+        {
+            UnitIndexEntry() : attached(false) {}
+            UnitIndexEntry(Unit* u) : unit(u), attached(true) {}
+
+            osg::observer_ptr<Unit> unit;
+            bool attached;
+        };
+        typedef std::map<std::string, UnitIndexEntry> UnitIndex;
+
         bool      mbDirty;
         bool      mbDirtyUnitGraph;
+        bool      mbDirtyUnitLiveness;
+        OpenThreads::Mutex mLivenessMutex;
         bool      mUseColorClamp;
+        bool      mUseStateSorting;
+        Statistics mStatistics;
         osg::observer_ptr<osg::Camera> mCamera;
         std::list<Unit*> mLastUnits;
         osg::ref_ptr<osg::NodeCallback> mCollectLastUnitsCallback;
+        UnitIndex mUnitIndex;
+        std::set<std::string> mMissingUnitNames;
+        OpenThreads::Mutex mUnitIndexMutex;
 
         friend class SetupUnitRenderingVisitor;
         friend class CollectLastUnitsCallback;
+        friend class MarkUnitsLiveVisitor;
+        friend class Unit;
 
         /**
         * Add a unit to the list of last units. This will place a unit at the end of the execution pipeline.
@@ -215,6 +301,14 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         inline void addLastUnit(Unit* unit) { if (unit) mLastUnits.push_back(unit); }
 
+        /**
+        * Update the name index of the units. Called by the units whenever their name changes.
+        **/
+        void updateUnitIndex(Unit* unit, const std::string& oldName);
+
+        //! Check if the unit is still part of the processor's subgraph
+        bool isUnitAttached(Unit* unit);
+
 };
 
 
@@ -167,6 +167,12 @@ class OSGPPU_EXPORT ShaderAttribute : public osg::Program
          **/
         virtual void apply (osg::State &state) const;
 
+        /**
+         * Set the uniforms of this shader attribute to the program which was applied last.
+         * Used by programs which are build out of the shaders of this attribute.
+         **/
+        void applyUniforms(osg::State &state) const;
+
         /** @copydoc osg::StateAttribute::compare() **/
         virtual int compare(const osg::StateAttribute& sa) const
         {
@@ -26,6 +26,7 @@
 #include <osg/Geometry>
 #include <osg/BufferObject>
 #include <osg/FrameBufferObject>
+#include <osg/observer_ptr>
 
 #include <osgPPU/Export.h>
 #include <osgPPU/ColorAttribute.h>
@@ -38,6 +39,8 @@
 namespace osgPPU
 {
 
+class UnitInOut;
+
 //! Abstract base class of any unit
 /**
  * Units represents renderable units of the osgPPU library.
@@ -56,6 +59,7 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         typedef std::vector<unsigned int> IgnoreInputList;
         typedef std::map<osg::ref_ptr<Unit>, std::pair<std::string, unsigned int> > InputToUniformMap;
         typedef std::map<int, osg::ref_ptr<osg::PixelDataBufferObject> > PixelDataBufferObjectMap;
+        typedef std::map<unsigned int, osg::observer_ptr<Unit> > PreviousFrameInputMap;
 
         /**
         * Empty constructor. The unit will be initialized with default values.
@@ -72,6 +76,18 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         **/
         virtual ~Unit();
 
+        /**
+        * Release the GL objects of the unit. Fences of pending pbo transfers are
+        * deleted when the next unit is drawn in the same context.
+        **/
+        virtual void releaseGLObjects(osg::State* state = 0) const;
+
+        /**
+        * Set name of the unit. The name is used by the processor to find units.
+        **/
+        virtual void setName(const std::string& name);
+        inline void setName(const char* name) { setName(std::string(name)); }
+
         /**
         * Set an input from the given parent to be linked with the given
         * uniform name. This is required to automatically setup uniforms for
@@ -118,7 +134,11 @@ class OSGPPU_EXPORT Unit : public osg::Group {
          * Return an input texture of a certain index.
          * @param inputIndex Index of the input texture (index is equal to the texture unit)
         **/
-        inline osg::Texture* getInputTexture(int inputIndex) { return mInputTex[inputIndex].get(); }
+        inline osg::Texture* getInputTexture(int inputIndex) const
+        {
+            TextureMap::const_iterator it = mInputTex.find(inputIndex);
+            return it != mInputTex.end() ? it->second.get() : NULL;
+        }
 
         /**
         * Return complete index to texture mapping
@@ -131,7 +151,11 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         * it might end up in a NULL as output texture. For this purpose do use
         * the getOrCreateOutputTexture().
         **/
-        inline osg::Texture* getOutputTexture(int mrt = 0) { return mOutputTex[mrt].get(); }
+        inline osg::Texture* getOutputTexture(int mrt = 0) const
+        {
+            TextureMap::const_iterator it = mOutputTex.find(mrt);
+            return it != mOutputTex.end() ? it->second.get() : NULL;
+        }
 
         /**
         * Return an output texture of the certain MRT index.
@@ -164,6 +188,44 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         **/
         bool getIgnoreInput(unsigned int index) const;
 
+        /**
+        * Connect the output of the producer as rendered in the previous frame to the input
+        * slot of the consumer. The output of the producer becomes double buffered, so that
+        * the producer can be its own consumer or a child of the consumer without writing
+        * the texture which is read. Use this for feedback loops instead of cycles in the
+        * unit graph, which are resolved by barrier nodes in an order depending on the traversal.
+        * The slot should follow the inputs which the consumer gets from its parents.
+        **/
+        static void connectPreviousFrame(UnitInOut* producer, Unit* consumer, unsigned int slot);
+
+        /**
+        * Remove a previous frame input connected by connectPreviousFrame(). The output
+        * of the producer stays double buffered.
+        **/
+        void removePreviousFrameInput(unsigned int slot);
+
+        /**
+        * Get slot to producer mapping of the previous frame inputs
+        **/
+        inline const PreviousFrameInputMap& getPreviousFrameInputMap() const { return mPreviousFrameInput; }
+
+        /**
+        * Get the texture which is written instead of the given output texture on odd frames,
+        * NULL if the output is not double buffered.
+        **/
+        virtual osg::Texture* getOrCreateBufferedOutputTexture(const osg::Texture* output) { return NULL; }
+
+        /**
+        * Get the texture used instead of the given input texture in the given frame. Inputs
+        * of double buffered parents and previous frame inputs alternate with the frames,
+        * any other texture is returned unchanged. Units binding their inputs on their own,
+        * e.g. in the statesets of their passes, use this to get the texture of the frame.
+        **/
+        osg::Texture* getFrameParityInputTexture(osg::Texture* input, unsigned int frameNumber) const;
+
+        //! Get stateset binding the alternating inputs of the given frame, NULL if there are none
+        inline osg::StateSet* getFrameParityStateSet(unsigned int frameNumber) const { return mFrameParityStateSet[frameNumber % 2].get(); }
+
         /**
         * Initialze the unit. This method should be overwritten by the
         * derived classes to support non-standard initialization routines.
@@ -193,16 +255,55 @@ class OSGPPU_EXPORT Unit : public osg::Group {
 
         /**
          * Activate or deactive the ppu. An active ppu is updated during the update
-         * of the post processor.
+         * of the post processor. An inactive ppu is removed from the pipeline
+         * together with all its producers whose output is not consumed by any
+         * other live unit (@see isLive()).
          * @param b True to activate, false to deactive
         **/
-        inline void setActive(bool b) { mbActive = b; }
+        void setActive(bool b);
 
         /**
         * Check if the Unit's active flag
         **/
         inline bool getActive() const { return mbActive; }
 
+        /**
+        * Pin the unit as a live sink of the pipeline. Units like UnitOut or UnitOutReadback
+        * are always sinks. Pin a unit if its output is used outside of the unit
+        * graph (e.g. bound to a scene), otherwise it is removed from the pipeline
+        * as soon as no sink consumes its output. A pinned unit and all its
+        * producers are kept in the pipeline as long as the unit is active.
+        **/
+        void setPinned(bool b);
+
+        /**
+        * Check whenever the unit is pinned as a live sink.
+        **/
+        inline bool getPinned() const { return mbPinned; }
+
+        /**
+        * Check whenever the unit is part of the current pipeline. A unit is live
+        * if it is active and its output is reachable from at least one active
+        * sink. Units which are not live are neither updated nor rendered and
+        * their output textures are released until they become live again.
+        * The value is recomputed by the processor on the next traversal.
+        **/
+        inline bool isLive() const { return mbLive; }
+
+        /**
+        * Get dependency level of the unit. Units without any input unit are on level 0,
+        * every other unit is one level above its highest input unit. Units on the
+        * same level do not depend on each other. The value is computed by the processor
+        * when the unit subgraph is set up.
+        **/
+        inline unsigned int getExecutionLevel() const { return mExecutionLevel; }
+
+        /**
+        * Get position of the unit in the execution order computed by the processor.
+        * Units of the same level are ordered to minimize state changes between them.
+        **/
+        inline unsigned int getExecutionIndex() const { return mExecutionIndex; }
+
         /**
          * Change drawing position and size of this ppu by using the
          * new frustum planes in the orthogonal projection matrix.
@@ -254,6 +355,12 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         **/
         void setupBlockedChildren();
 
+        /**
+        * Setup the inputs which change every frame, i.e. double buffered outputs
+        * of the parents and previous frame inputs.
+        **/
+        void setupFrameParityInputs();
+
         /**
         * Set a new color attribute for this unit. This will replace the color attribute
         * if it is already set. The color attribute can be used to bind a color to
@@ -271,8 +378,16 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         * Return a PixelDataBufferObject associated with the input texture. 
         * If using of pbos is deactivated, then undefined result might be given back. 
         **/
-        inline const osg::PixelDataBufferObject* getInputPBO(int inputIndex) { return mInputPBO[inputIndex].get(); }
-        inline const osg::PixelDataBufferObject* getOutputPBO(int mrt) { return mOutputPBO[mrt].get(); }
+        inline const osg::PixelDataBufferObject* getInputPBO(int inputIndex) const
+        {
+            PixelDataBufferObjectMap::const_iterator it = mInputPBO.find(inputIndex);
+            return it != mInputPBO.end() ? it->second.get() : NULL;
+        }
+        inline const osg::PixelDataBufferObject* getOutputPBO(int mrt) const
+        {
+            PixelDataBufferObjectMap::const_iterator it = mOutputPBO.find(mrt);
+            return it != mOutputPBO.end() ? it->second.get() : NULL;
+        }
 
         inline const PixelDataBufferObjectMap& getInputPBOMap() const { return mInputPBO; }
         inline const PixelDataBufferObjectMap& getOutputPBOMap() const { return mOutputPBO; }
@@ -285,10 +400,54 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         *       of data in/to PBO isn't that costly, because data is copied in the video memory.
         **/
         void setUsePBOForInputTexture(int index, bool use);
-        inline bool getUsePBOForInputTexture(int index) { return mInputPBO[index].valid(); }
+        inline bool getUsePBOForInputTexture(int index) const { return getInputPBO(index) != NULL; }
 
         void setUsePBOForOutputTexture(int mrt, bool use);
-        inline bool getUsePBOForOutputTexture(int mrt) { return mOutputPBO[mrt].valid(); }
+        inline bool getUsePBOForOutputTexture(int mrt) const { return getOutputPBO(mrt) != NULL; }
+
+        /**
+        * Set the number of PBOs used per input and output texture (default 1). With more
+        * than one buffer the PBOs are used as a ring, so that the readback of an input started in frame k
+        * is handed over to the PBOCallback in frame k+N and the output written by the callback in frame k
+        * is uploaded into the output texture in frame k+N-1. Hence, the transfers run asynchronously
+        * to the CPU and mapping the buffer does not stall the pipeline. The rings advance once per frame,
+        * even if the unit is drawn several times in a frame.
+        * getInputPBO() and getOutputPBO() always return the buffer used in the current frame.
+        **/
+        void setNumPBOBuffers(unsigned int num);
+
+        /**
+        * Get the number of PBOs used per input and output texture.
+        **/
+        inline unsigned int getNumPBOBuffers() const { return mNumPBOBuffers; }
+
+        /**
+        * A PBO callback gets access to the mapped content of the input and output PBOs.
+        * The buffers are mapped by the unit only for the time of the call, so the given
+        * pointers must not be used afterwards. The unit waits until the GPU has finished
+        * the transfer before the buffer is mapped.
+        **/
+        struct PBOCallback : public virtual osg::Object
+        {
+                META_Object (osgPPU, PBOCallback);
+
+                PBOCallback(){}
+
+                PBOCallback(const PBOCallback&, const osg::CopyOp&){}
+
+                //! Read content of the input texture with the given index, as it was N frames before
+                virtual void readInput(osg::RenderInfo&, const Unit*, int index, const void* data, unsigned int size) const {}
+
+                //! Write data to the output pbo, which is uploaded to the output texture afterwards
+                virtual void writeOutput(osg::RenderInfo&, const Unit*, int mrt, void* data, unsigned int size) const {}
+        };
+
+        /**
+        * Set callback which is called with the mapped input and output PBOs.
+        **/
+        inline void setPBOCallback(PBOCallback* cb) { mPBOCallback = cb; }
+        inline PBOCallback* getPBOCallback() { return mPBOCallback.get(); }
+        inline const PBOCallback* getPBOCallback() const { return mPBOCallback.get(); }
 
         /** 
         * Push current FBO, so that it can safely be overwritten.
@@ -398,18 +557,37 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         **/
         virtual void setupInputsFromParents();
 
+        /**
+        * Traverse only the child units of this unit with the given visitor. This is used
+        * to pass the traversal through units which are not part of the pipeline.
+        **/
+        void traverseChildUnits(osg::NodeVisitor& nv);
+
         //! Method to let the unit know that the rendering will now beginns, if returned false, then drawable is not rendered
         virtual bool  noticeBeginRendering (osg::RenderInfo&, const osg::Drawable* ) { return true; }
 
         //! Let the unit know that the drawing is done.
         virtual void  noticeFinishRendering(osg::RenderInfo&, const osg::Drawable* ) {};
 
+        //! Ask the unit if the input textures should be read into the input PBOs in this frame
+        virtual bool noticeReadInputPBOs(osg::RenderInfo&) { return true; }
+
+        //! Ask the unit if the output PBOs should be uploaded into the output textures in this frame
+        virtual bool noticeWriteOutputPBOs(osg::RenderInfo&) { return true; }
+
         //! Notice derived classes, that viewport size has changed.
         virtual void noticeChangeViewport(osg::Viewport* newViewport) {}
 
         //! Notice derived classes, when input texture has changed.
         virtual void noticeChangeInput() {}
 
+        /**
+        * Notice derived classes, that the output of the unit is not required by the pipeline
+        * anymore (live=false), so that the output resources can be released, or that it is
+        * required again (live=true).
+        **/
+        virtual void noticeChangeLive(bool live) {}
+
         //! Assign the input texture to the quad object
         virtual void assignInputTexture();
 
@@ -434,12 +612,48 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         //! Output pbos of the textures
         PixelDataBufferObjectMap mOutputPBO;
 
+        //! Ring of pbos used by one input or output texture and the fences of the pending transfers
+        struct PixelDataBufferRing
+        {
+            std::vector<osg::ref_ptr<osg::PixelDataBufferObject> > buffers;
+            std::vector<osg::buffered_value<void*> > fences;
+        };
+        typedef std::map<int, PixelDataBufferRing> PixelDataBufferRingMap;
+
+        //! All buffers of the input and output pbos
+        PixelDataBufferRingMap mInputPBORing;
+        PixelDataBufferRingMap mOutputPBORing;
+
+        //! Number of pbos per texture
+        unsigned int mNumPBOBuffers;
+
+        //! Number of frames the pbos were used, selects the current buffer of the rings
+        osg::buffered_value<unsigned int> mPBOFrame;
+
+        //! Frame number (+1) of the last pbo transfer, so that the rings advance once per frame only
+        osg::buffered_value<unsigned int> mPBOFrameNumber;
+
+        //! Callback to access the mapped pbos
+        osg::ref_ptr<PBOCallback> mPBOCallback;
+
+        //! Resize the ring to the number of pbos and make the first one current
+        void setupPBORing(PixelDataBufferRing& ring, osg::ref_ptr<osg::PixelDataBufferObject>& current);
+
+        //! Release the fences of the pending transfers of a ring, they are deleted on the next draw
+        void releasePBORingFences(PixelDataBufferRing& ring);
+
         //! List of ignored inputs
         IgnoreInputList mIgnoreList;
 
         //! Map of the uniform to parent links
         InputToUniformMap mInputToUniformMap;
 
+        //! Producers of the previous frame inputs
+        PreviousFrameInputMap mPreviousFrameInput;
+
+        //! Input textures of even and odd frames, applied on top of the unit's state when culled or drawn by the unit itself
+        osg::ref_ptr<osg::StateSet> mFrameParityStateSet[2];
+
         //! Here we store a screen sized quad, so it can be used for rendering
         osg::ref_ptr<osg::Drawable> mDrawable;
 
@@ -449,6 +663,12 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         //! Modelview matrix of the ppu (default: identity matrix)
         osg::ref_ptr<osg::RefMatrix> sModelviewMatrix;
 
+        //! 2D ortho view shared by all units, used by passes rendered by the units themselves
+        static const osg::RefMatrix* getDefaultProjectionMatrix();
+
+        //! Identity matrix shared by all units
+        static const osg::RefMatrix* getDefaultModelviewMatrix();
+
         //! Store here the viewport of the camera, to which one this PPUs are applied
         osg::ref_ptr<osg::Viewport> mViewport;
 
@@ -471,6 +691,11 @@ class OSGPPU_EXPORT Unit : public osg::Group {
 
     private:
         bool mbActive;
+        bool mbPinned;
+        bool mbLive;
+        bool mbOutputReleased;
+        unsigned int mExecutionLevel;
+        unsigned int mExecutionIndex;
 
         // Separate both folowing variables to allow update and cull traversal in different threads
         bool mbUpdateTraversed; // requires to check whenever unit was already traversed by update visitor
@@ -485,6 +710,9 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         friend class CleanUpdateTraversedVisitor;
         friend class CleanCullTraversedVisitor;
         friend class SetMaximumInputsVisitor;
+        friend class MarkUnitsLiveVisitor;
+        friend class SetupUnitRenderingVisitor;
+        friend class UnitInOutRepeat;
 };
 
 };
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_INCONVOLVEOUT_H_
+#define _C_UNIT_INCONVOLVEOUT_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <osg/Texture2D>
+
+#define OSGPPU_CONVOLVE_INPUT_UNIFORM "osgppu_ConvolveInput"
+#define OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM "osgppu_ConvolveInputSize"
+#define OSGPPU_CONVOLVE_OUTPUT_SIZE_UNIFORM "osgppu_ConvolveOutputSize"
+
+namespace osgPPU
+{
+    //! Convolve the input texture with a separable kernel
+    /**
+    * The unit convolves its first input texture with a symmetric separable kernel,
+    * either a gaussian or arbitrary 1D weights. The horizontal and the vertical pass
+    * are rendered internally, using one intermediate texture. The shaders are generated
+    * by the unit with the kernel unrolled, two neighbouring taps are merged into one
+    * bilinear fetch, hence about half of the fetches are required. For this to be exact
+    * the input texture should use linear filtering.
+    *
+    * If the kernel radius exceeds the maximal radius, the input is downsampled first,
+    * convolved with the accordingly scaled kernel and upsampled to the output again.
+    **/
+    class OSGPPU_EXPORT UnitInConvolveOut : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitInConvolveOut);
+
+            //! Create default unit
+            UnitInConvolveOut();
+            UnitInConvolveOut(const UnitInConvolveOut&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitInConvolveOut();
+
+            //! Initialize the unit and generate the passes
+            virtual void init();
+
+            /**
+            * Use a gaussian kernel with the given standard deviation in pixels
+            * (default 2). The radius of the kernel is ceil(3 * sigma).
+            **/
+            void setGaussianKernel(float sigma);
+
+            //! Get sigma of the gaussian kernel, 0 if an arbitrary kernel is used
+            inline float getSigma() const { return mSigma; }
+
+            /**
+            * Use an arbitrary symmetric kernel. The weights are given for the
+            * taps 0..radius, where the weight of tap i is applied to the offsets -i and i.
+            * The kernel is normalized by the unit.
+            **/
+            void setKernel(const std::vector<float>& weights);
+
+            //! Get the weights of the taps 0..radius
+            inline const std::vector<float>& getKernel() const { return mKernel; }
+
+            /**
+            * Set the maximal radius which is convolved at full resolution (default 16).
+            * Larger kernels are convolved on a downsampled copy of the input.
+            **/
+            void setMaxRadius(unsigned int radius);
+
+            //! Get the maximal radius convolved at full resolution
+            inline unsigned int getMaxRadius() const { return mMaxRadius; }
+
+            //! Get the factor by which the input is downsampled before convolving, 1 if not
+            unsigned int getDownsampleFactor() const;
+
+        protected:
+            //! Bilinear tap, which combines two neighbouring texels
+            struct Tap
+            {
+                float offset;
+                float weight;
+            };
+
+            //! Compute the taps of the kernel scaled down by the given factor
+            std::vector<Tap> computeTaps(unsigned int factor) const;
+
+            //! Generate the shader of one convolution pass
+            osg::Program* createConvolveProgram(const std::vector<Tap>& taps, bool horizontal, bool rectangle) const;
+
+            //! Generate the shader which downsamples by the given factor
+            osg::Program* createDownsampleProgram(unsigned int factor, bool rectangle) const;
+
+            //! Generate the shader which copies the input with bilinear filtering
+            osg::Program* createUpsampleProgram() const;
+
+            //! Add a pass rendering into the given texture
+            void addPass(osg::Texture* input, osg::Texture* output, osg::Program* program, bool rectangle);
+
+            std::vector<float> mKernel;
+            float mSigma;
+            unsigned int mMaxRadius;
+    };
+
+};
+
+#endif
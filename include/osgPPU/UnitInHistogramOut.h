@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_INHISTOGRAMOUT_H_
+#define _C_UNIT_INHISTOGRAMOUT_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#define OSGPPU_HISTOGRAM_INPUT_UNIFORM "osgppu_HistogramInput"
+#define OSGPPU_HISTOGRAM_RANGE_UNIFORM "osgppu_HistogramRange"
+#define OSGPPU_HISTOGRAM_NUM_BINS_UNIFORM "osgppu_HistogramNumBins"
+#define OSGPPU_HISTOGRAM_WEIGHT_UNIFORM "osgppu_HistogramWeight"
+#define OSGPPU_HISTOGRAM_STEP_UNIFORM "osgppu_HistogramStep"
+
+namespace osgPPU
+{
+    //! Compute histogram of the input texture
+    /**
+    * The unit computes a histogram with N bins of one channel of its first input texture.
+    * The output texture is of size N x 1. Each texel of the input is scattered as a point
+    * into its bin and accumulated by additive blending, hence the output has a float format.
+    * The red component of a bin contains the number of texels in the bin and the green
+    * component the sum of their values. If normalization is enabled, both are divided by
+    * the number of sampled texels, so that the bins contain fractions.
+    *
+    * Values outside of the range are counted in the first or last bin. The histogram
+    * can be used as input by other units, i.e. to compute the exposure from a percentile,
+    * or read back to the CPU by an UnitOutReadback.
+    **/
+    class OSGPPU_EXPORT UnitInHistogramOut : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitInHistogramOut);
+
+            //! Value of a texel which is counted
+            enum Channel
+            {
+                RED,
+                GREEN,
+                BLUE,
+                ALPHA,
+
+                //! Luminance of the rgb components
+                LUMINANCE,
+
+                //! log2 of the luminance, i.e. to compute exposure in EV
+                LOG_LUMINANCE
+            };
+
+            //! Create default unit
+            UnitInHistogramOut();
+            UnitInHistogramOut(const UnitInHistogramOut&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitInHistogramOut();
+
+            //! Initialize the unit and generate the scatter geometry
+            virtual void init();
+
+            //! Set number of bins (default 64)
+            void setNumBins(unsigned int num);
+
+            //! Get number of bins
+            inline unsigned int getNumBins() const { return mNumBins; }
+
+            //! Set the channel used to compute the histogram (default LUMINANCE)
+            inline void setChannel(Channel channel) { mChannel = channel; dirty(); }
+
+            //! Get the channel used to compute the histogram
+            inline Channel getChannel() const { return mChannel; }
+
+            /**
+            * Set the range of values mapped to the bins (default [0,1]).
+            * For LOG_LUMINANCE the range is specified in log2 units.
+            **/
+            void setRange(float minValue, float maxValue);
+
+            //! Get minimal value of the range
+            inline float getRangeMin() const { return mRangeMin; }
+
+            //! Get maximal value of the range
+            inline float getRangeMax() const { return mRangeMax; }
+
+            /**
+            * Only every step-th texel in each direction is counted (default 1).
+            * Use this to reduce the amount of points for large inputs.
+            **/
+            void setSampleStep(unsigned int step);
+
+            //! Get sample step
+            inline unsigned int getSampleStep() const { return mSampleStep; }
+
+            //! Divide the bins by the number of sampled texels (default false)
+            void setNormalize(bool normalize);
+
+            //! Check whether the bins are normalized
+            inline bool getNormalize() const { return mNormalize; }
+
+        protected:
+            bool noticeBeginRendering (osg::RenderInfo&, const osg::Drawable* );
+
+            //! Generate the shader which scatters the texels into the bins
+            osg::Program* createHistogramProgram(bool rectangle) const;
+
+            //! Update the weight of a single texel
+            void updateWeight();
+
+            osg::ref_ptr<osg::Geometry> mScatterGeometry;
+
+            Channel mChannel;
+            unsigned int mNumBins;
+            float mRangeMin;
+            float mRangeMax;
+            unsigned int mSampleStep;
+            bool mNormalize;
+            unsigned int mNumSamples;
+    };
+
+};
+
+#endif
@@ -24,6 +24,8 @@
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitInOut.h>
 
+#include <osg/Program>
+
 namespace osgPPU
 {
     //! Compute mipmapped output texture based on the input data
@@ -40,6 +42,11 @@ namespace osgPPU
     * You can also setup this unit in that way, that it do generate
     * the mipmaps for the input texture and hence do not use any other output texture,
     * which of course save some memory. 
+    *
+    * 2D array and cubemap outputs are supported too. All layers or faces of a level
+    * are rendered by one draw using layered rendering, therefore a copy of the unit's program
+    * with an additional geometry shader is used. The shader gets the layer index in gl_TexCoord[0].z and for cubemaps
+    * the direction of the texel in gl_TexCoord[1].xyz.
     **/
     class OSGPPU_EXPORT UnitInMipmapOut : public UnitInOut {
         public:
@@ -89,21 +96,82 @@ namespace osgPPU
             **/
             bool getUseShader() const { return mUseShader; }
 
+            /**
+            * Set the number of mipmap levels generated by one pass (default 1, at most 6).
+            * With more than one level per pass, the levels between the first and the last
+            * generated level are computed by a built-in box filter running as compute shader.
+            * Each work group reduces its block of the first level of the pass down to the
+            * following levels in shared memory, so every level is built from the previous one.
+            * The first and the last level are still rendered by the shader of the unit. If compute
+            * shaders or the output format are not supported, then one pass per level is used.
+            **/
+            void setNumLevelsPerPass(unsigned int num);
+
+            //! Get the number of mipmap levels generated by one rendering pass
+            unsigned int getNumLevelsPerPass() const { return mNumLevelsPerPass; }
+
+            /**
+            * Restrict the mipmap chain to the levels [first, last]. The levels 0 to last are
+            * allocated, the levels below the last one are not created at all (the texture's
+            * max level is set to last). Only the levels [first, last] are rendered by the shader
+            * of the unit. The levels between 0 and first are the source of the first level, hence
+            * they are generated by the hardware (glGenerateMipmap) which is much cheaper than
+            * rendering them. Level 0 of an output which is not the input is still rendered by the shader.
+            * The range is passed to the shader by the osgppu_MipmapLevelFirst and
+            * osgppu_MipmapLevelLast uniforms.
+            * @param first First level to generate (default 0)
+            * @param last Last level to generate, -1 to generate the full chain down to 1x1 (default)
+            **/
+            void setMipmapLevelRange(int first, int last);
+
+            //! Get the first generated mipmap level
+            int getMipmapLevelFirst() const { return mFirstLevel; }
+
+            //! Get the last generated mipmap level, -1 if the full chain is generated
+            int getMipmapLevelLast() const { return mLastLevel; }
+
+            //! Levels are written by fbos of their own, hence the output is not double buffered
+            bool supportsDoubleBufferedOutput() const { return false; }
+
         protected:
         
             void enableMipmapGeneration();
             bool noticeBeginRendering (osg::RenderInfo&, const osg::Drawable* );
             void noticeFinishRendering(osg::RenderInfo &renderInfo, const osg::Drawable* drawable);
+            void noticeChangeLive(bool live);
             void createAndAttachFBOs(osg::Texture* output, int mrt);
+            void setupMultiLevelPasses();
+            osg::Program* createMultiLevelProgram(unsigned int numLevels, unsigned int groupSize, const char* format) const;
+            void applyLevelRange(osg::State& state, osg::Texture* output);
+            int getFirstRenderedLevel() const;
+            void generateSourceLevels(osg::RenderInfo& info);
         
             std::vector<osg::ref_ptr<FrameBufferObject> > mMipmapFBO;
             std::vector<osg::ref_ptr<osg::Viewport> > mMipmapViewport;
             std::vector<osg::ref_ptr<osg::Drawable> > mMipmapDrawable;
 
+            //! Pass of the built-in filter, computes numLevels levels starting with firstLevel
+            struct MultiLevelPass
+            {
+                osg::ref_ptr<osg::Program> program;
+                osg::ref_ptr<osg::Uniform> sourceLevel;
+                unsigned int groupSize;
+                int firstLevel;
+                int numLevels;
+            };
+            std::vector<MultiLevelPass> mMultiLevelPass;
+            unsigned int mNumLevelsPerPass;
+
             osg::ref_ptr<osg::RefMatrix> mProjectionMatrix;
             osg::ref_ptr<osg::RefMatrix> mModelviewMatrix;
 
             int mNumLevels;
+            int mFirstLevel;
+            int mLastLevel;
+
+            //! Texture object for which the level range was setted up, per context
+            osg::buffered_value<GLuint> mLevelRangeTextureID;
+
             int mGenerateMipmapInputIndex;
             bool mUseShader;
             
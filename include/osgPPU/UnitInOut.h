@@ -25,8 +25,12 @@
 #include <osgPPU/Unit.h>
 #include <osgPPU/Camera.h>
 
+#include <osg/Texture2D>
+
 #define OSGPPU_MIPMAP_LEVEL_UNIFORM "osgppu_MipmapLevel"
 #define OSGPPU_MIPMAP_LEVEL_NUM_UNIFORM "osgppu_MipmapLevelNum"
+#define OSGPPU_MIPMAP_LEVEL_FIRST_UNIFORM "osgppu_MipmapLevelFirst"
+#define OSGPPU_MIPMAP_LEVEL_LAST_UNIFORM "osgppu_MipmapLevelLast"
 #define OSGPPU_CUBEMAP_FACE_UNIFORM "osgppu_CubeMapFace"
 #define OSGPPU_3D_SLICE_NUMBER "osgppu_ZSliceNumber"
 #define OSGPPU_3D_SLICE_INDEX "osgppu_ZSliceIndex"
@@ -194,6 +198,28 @@ namespace osgPPU
             * Set a MRT to texture map for output textures
             **/
             inline void setOutputTextureMap(const TextureMap& map) { mOutputTex = map; dirty();}
+
+            /**
+            * Double buffer the 2D output textures. The unit writes to the output textures on even
+            * and to a second set of textures on odd frames. Children read the textures written
+            * in the current frame, while units connected by Unit::connectPreviousFrame() read the other ones.
+            * Code outside of the unit graph using getOutputTexture() directly sees the result
+            * of the last even frame. Units which do not render through the unit's fbo, e.g. units
+            * rendering their own passes, do not support double buffering and keep a single output.
+            **/
+            inline void setDoubleBufferedOutput(bool b) { mDoubleBufferedOutput = b; dirty(); }
+
+            //! Check if the output textures are double buffered
+            inline bool getDoubleBufferedOutput() const { return mDoubleBufferedOutput; }
+
+            //! Get the texture written instead of the given output on odd frames
+            virtual osg::Texture* getOrCreateBufferedOutputTexture(const osg::Texture* output);
+
+            //! Check if the unit can double buffer its output, see setDoubleBufferedOutput()
+            virtual bool supportsDoubleBufferedOutput() const { return !mRenderPasses; }
+
+            //! Get the number of passes of units which render several passes on their own
+            inline unsigned int getNumPasses() const { return mPassFBO.size(); }
     
         protected:
 
@@ -212,15 +238,103 @@ namespace osgPPU
         
             //! Viewport changed
             virtual void noticeChangeViewport(osg::Viewport*);
+
+            //! Release or reattach output textures when the unit is removed from or readded to the pipeline
+            virtual void noticeChangeLive(bool live);
     
             //! Reassign fbo if output textures changes
             virtual void assignOutputTexture();
 
             virtual void assignOutputPBO();
 
+            /**
+            * Number of layers of the given texture which are written by a layered
+            * rendering pass, i.e. 1 for 2D textures, the depth for 2D arrays and 6 for cubemaps.
+            * Returns 0 if the texture type is not supported.
+            **/
+            static unsigned int getNumOutputLayers(const osg::Texture* texture);
+
+            /**
+            * Create FBO attachment of the given mipmap level of a texture. 2D arrays and cubemaps
+            * are attached layered, so that all layers/faces are written by one draw.
+            * @return false if the texture type is not supported
+            **/
+            static bool createLevelAttachment(osg::Texture* texture, unsigned int level, osg::FrameBufferAttachment& attachment);
+
+            /**
+            * Create drawable rendering a screen sized quad into each of numLayers layers of a layered FBO.
+            * The layer is selected by the geometry shader of the program setted up
+            * by setupLayeredProgram(). The fragment shader gets the layer index in gl_TexCoord[0].z
+            * and for cubemaps the direction of the texel in gl_TexCoord[1].xyz.
+            **/
+            osg::Drawable* createLayeredQuadDrawable(unsigned int numLayers);
+
+            /**
+            * Setup the program used by the drawables of createLayeredQuadDrawable(). It consists of
+            * the shaders of the unit's program, the geometry shader for layered rendering and
+            * a pass-through vertex shader if required. The program of the unit stays untouched.
+            * The generated shaders forward gl_FrontColor and gl_TexCoord[0..3] only.
+            * @return false if the unit has no program which could be extended
+            **/
+            bool setupLayeredProgram(bool cubemap);
+
+            /**
+            * Render the passes of a unit which sets mRenderPasses. It is called by noticeBeginRendering()
+            * with the default matrices applied, the fbo is restored afterwards. Per default
+            * all passes are rendered in the order they were added.
+            **/
+            virtual void renderPasses(osg::RenderInfo&);
+
+            //! Render one pass, a pass without a drawable clears its fbo to 0
+            void renderPass(osg::RenderInfo&, unsigned int index);
+
+            //! Remove all passes, their textures are kept for acquirePassTexture()
+            void clearPasses();
+
+            //! Add pass rendering the drawable into the fbo, the drawable might be NULL to clear the fbo. Passes without fbo are ignored.
+            void appendPass(FrameBufferObject* fbo, osg::Drawable* drawable);
+
+            //! Create fbo rendering into the given texture, returns NULL if the texture type is not supported
+            FrameBufferObject* createPassFBO(osg::Texture* output) const;
+
+            /**
+            * Get intermediate texture of a pass. The textures of the previous setup are reused
+            * if possible, otherwise a new one is created.
+            * @param internalFormat Format of the texture, 0 to use the output internal format
+            **/
+            osg::Texture2D* acquirePassTexture(int width, int height, GLenum internalFormat = 0, osg::Texture::FilterMode filter = osg::Texture::LINEAR);
+
+            //! Release the textures of the previous setup, which were not reused
+            inline void releasePassTexturePool() { mPassTexturePool.clear(); }
+
             //! Framebuffer object where results are written
             osg::ref_ptr<FrameBufferObject>    mFBO;    
 
+            //! Program for layered rendering, see setupLayeredProgram()
+            osg::ref_ptr<osg::Program> mLayeredProgram;
+
+            typedef std::vector<osg::ref_ptr<osg::Texture2D> > PassTextureList;
+
+            //! Intermediate textures of the passes and the ones kept for reuse
+            PassTextureList mPassTexture;
+            PassTextureList mPassTexturePool;
+
+            //! Fbo and drawable of each pass
+            std::vector<osg::ref_ptr<FrameBufferObject> > mPassFBO;
+            std::vector<osg::ref_ptr<osg::Drawable> > mPassDrawable;
+
+            //! Does the unit render its passes instead of the quad into the output fbo
+            bool mRenderPasses;
+
+            //! Framebuffer object used on odd frames when the output is double buffered
+            osg::ref_ptr<FrameBufferObject>    mBufferedFBO;
+
+            //! Output textures written on odd frames
+            TextureMap mBufferedOutputTex;
+
+            //! Are the outputs double buffered
+            bool mDoubleBufferedOutput;
+
             //! index of the bypassed input
             int mBypassedInput;
 
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_INOUT_COMPUTE_H_
+#define _C_UNIT_INOUT_COMPUTE_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <osg/Program>
+
+namespace osgPPU
+{
+    //! Compute output textures by a compute shader instead of rendering a quad
+    /**
+    * The unit dispatches a compute shader over its output. The output textures are bound
+    * to the image units equal to their MRT index, so the shader writes them with imageStore().
+    * Inputs are bound as samplers to the texture units of their index, as for every other unit.
+    * Inputs can also be bound to image units by setInputImageUnit(), e.g. to read them with imageLoad().
+    *
+    * The number of work groups is derived from the viewport of the unit and the local size:
+    * ceil(width/x) * ceil(height/y) * ceil(depth/z), where depth is the number of layers of a
+    * 3D or 2D array output and 1 otherwise. The declaration of the local size is added by the unit,
+    * so the shader source must not contain it. Also the format qualifier of each output is
+    * given by the define OSGPPU_OUTPUT_FORMAT<mrt>, e.g.
+    *
+    *   layout(OSGPPU_OUTPUT_FORMAT0, binding = 0) writeonly uniform image2D output0;
+    *
+    * Uniforms of the unit's ShaderAttribute and of the unit's StateSet (i.e. input to uniform
+    * mappings) are applied to the compute program, so they can be used as with other units.
+    * The ShaderAttribute should not contain any shaders then. After the dispatch a memory
+    * barrier is issued, so that following units see the written texels.
+    *
+    * Requires OpenGL 4.3 or GL_ARB_compute_shader. Cubemap outputs are not supported.
+    **/
+    class OSGPPU_EXPORT UnitInOutCompute : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitInOutCompute);
+
+            //! Image units of the inputs
+            typedef std::map<unsigned int, unsigned int> InputImageUnitMap;
+
+            //! Create default unit
+            UnitInOutCompute();
+            UnitInOutCompute(const UnitInOutCompute&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitInOutCompute();
+
+            //! Initialize the unit and build the compute program
+            virtual void init();
+
+            /**
+            * Set the source of the compute shader. If the source starts with a #version
+            * directive it is kept, otherwise "#version 430" is used. The local size and the
+            * output format defines follow the #version and #extension directives at the beginning.
+            **/
+            inline void setComputeShaderSource(const std::string& source) { mComputeShaderSource = source; dirty(); }
+
+            //! Get source of the compute shader
+            inline const std::string& getComputeShaderSource() const { return mComputeShaderSource; }
+
+            //! Set size of the work groups (default 16x16x1)
+            void setLocalSize(unsigned int x, unsigned int y, unsigned int z = 1);
+
+            inline unsigned int getLocalSizeX() const { return mLocalSize[0]; }
+            inline unsigned int getLocalSizeY() const { return mLocalSize[1]; }
+            inline unsigned int getLocalSizeZ() const { return mLocalSize[2]; }
+
+            /**
+            * Bind the input texture with the given index also to an image unit, read only.
+            * Use image units which are not used by the outputs, i.e. greater or equal to the number of MRTs.
+            **/
+            inline void setInputImageUnit(unsigned int input, unsigned int imageUnit) { mInputImageUnit[input] = imageUnit; }
+
+            //! Do not bind the input to an image unit anymore
+            inline void removeInputImageUnit(unsigned int input) { mInputImageUnit.erase(input); }
+
+            //! Get image units of the inputs
+            inline const InputImageUnitMap& getInputImageUnitMap() const { return mInputImageUnit; }
+
+            //! Get the number of work groups dispatched by the unit
+            void getNumWorkGroups(unsigned int& x, unsigned int& y, unsigned int& z) const;
+
+            //! Outputs are written as images and not through the fbo, hence they are not double buffered
+            bool supportsDoubleBufferedOutput() const { return false; }
+
+            //! Get the program build from the compute shader source
+            inline osg::Program* getComputeProgram() { return mComputeProgram.get(); }
+
+        protected:
+            bool noticeBeginRendering (osg::RenderInfo&, const osg::Drawable* );
+            void noticeFinishRendering(osg::RenderInfo&, const osg::Drawable* );
+
+            //! Generate the compute program from the source, local size and output formats
+            osg::Program* createComputeProgram() const;
+
+            //! Apply uniforms of the given stateset to the program
+            static void applyUniforms(const osg::Program::PerContextProgram* program, const osg::StateSet* ss);
+
+            std::string mComputeShaderSource;
+            unsigned int mLocalSize[3];
+            InputImageUnitMap mInputImageUnit;
+
+            osg::ref_ptr<osg::Program> mComputeProgram;
+    };
+
+};
+
+#endif
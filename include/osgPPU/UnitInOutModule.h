@@ -24,11 +24,32 @@
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitInOut.h>
 #include <osgDB/DynamicLibrary>
+#include <osg/Timer>
+#include <OpenThreads/Mutex>
 
 //! Name of the function which is the entry point of the module 
 #define OSGPPU_MODULE_ENTRY osgppuInitModule
 #define OSGPPU_MODULE_ENTRY_STR "osgppuInitModule"
 
+//! Version of the module interface. Modules without a version function are treated as version 1.
+#define OSGPPU_MODULE_ABI_VERSION 2
+
+//! Name of the optional function returning the interface version the module was built with
+#define OSGPPU_MODULE_VERSION osgppuModuleVersion
+#define OSGPPU_MODULE_VERSION_STR "osgppuModuleVersion"
+
+//! Name of the optional function returning the capabilities of the module
+#define OSGPPU_MODULE_CAPABILITIES osgppuModuleCapabilities
+#define OSGPPU_MODULE_CAPABILITIES_STR "osgppuModuleCapabilities"
+
+/**
+* Define the version and capability functions in a module library, e.g.
+* OSGPPU_MODULE_DECLARE_ABI(MY_EXPORT, osgPPU::UnitInOutModule::MODULE_RELOADABLE)
+**/
+#define OSGPPU_MODULE_DECLARE_ABI(EXPORT, CAPABILITIES) \
+    extern "C" EXPORT unsigned int OSGPPU_MODULE_VERSION() { return OSGPPU_MODULE_ABI_VERSION; } \
+    extern "C" EXPORT unsigned int OSGPPU_MODULE_CAPABILITIES() { return CAPABILITIES; }
+
 namespace osgPPU
 {
     //! Apply some loaded module on the input texture to compute the output
@@ -48,6 +69,19 @@ namespace osgPPU
             //! Release it and used memory
             virtual ~UnitInOutModule();
 
+            //! Capabilities a module library can report
+            enum Capability
+            {
+                //! Module uses the asynchronous interface
+                MODULE_ASYNCHRONOUS = 1 << 0,
+
+                //! Library can be unloaded and loaded again while the application runs
+                MODULE_RELOADABLE = 1 << 1
+            };
+
+            //! Check if the module file has changed and schedule the reload
+            virtual void update();
+
             /**
             * Interface class of a module which can be used with this unit to process the input 
             * data.
@@ -72,12 +106,46 @@ namespace osgPPU
                     //! End rendering (@see noticeFinishRendering())
                     virtual void end() { }
 
+                    /**
+                    * Asynchronous modules are not called by beginAndProcess() and end(), but
+                    * by submit(), isComplete() and complete(). The processing may then take
+                    * several frames, while the output textures keep the last completed results.
+                    **/
+                    virtual bool isAsynchronous() const { return false; }
+
+                    /**
+                    * Start processing of the input PBOs. Called when the GPU has finished the
+                    * transfer of the input textures into the PBOs, so the module can use them without
+                    * waiting. The processing must not block, e.g. launch a kernel on a stream.
+                    * @return false if nothing was started
+                    **/
+                    virtual bool submit(osg::RenderInfo&) { return false; }
+
+                    /**
+                    * Check without blocking whether the processing started by submit() is done.
+                    * GL commands issued by submit() are tracked by the unit, so this method
+                    * only has to check the work done outside of GL.
+                    **/
+                    virtual bool isComplete(osg::RenderInfo&) { return true; }
+
+                    //! Finish the processing, the output PBOs are uploaded into the output textures afterwards
+                    virtual void complete(osg::RenderInfo&) { }
+
+                    /**
+                    * Called before the module is removed from the unit or its library is unloaded.
+                    * Asynchronous modules must finish or cancel running work here. Called with
+                    * the GL context current if the module is swapped by a reload.
+                    **/
+                    virtual void shutdown() { }
+
                 protected:
                     UnitInOutModule* _parent;
 
             };
 
             typedef bool (*OSGPPU_MODULE_ENTRY)(UnitInOutModule*);
+            typedef unsigned int (*OSGPPU_MODULE_VERSION)();
+            typedef unsigned int (*OSGPPU_MODULE_CAPABILITIES)();
 
             /**
             * Specify the file name of a dynamic libray containg the module.
@@ -103,6 +171,37 @@ namespace osgPPU
             Module* getModule() { return _module.get(); }
             const Module* getModule() const { return _module.get(); }
 
+            //! Get interface version of the loaded library
+            unsigned int getModuleVersion() const { return _moduleVersion; }
+
+            //! Get capabilities reported by the loaded library
+            unsigned int getModuleCapabilities() const { return _moduleCapabilities; }
+
+            /**
+            * Reload the module library whenever the file changes. The file is checked in
+            * update() every given number of seconds. Only libraries reporting MODULE_RELOADABLE
+            * are reloaded. The build should replace the library file instead of overwriting it in place.
+            **/
+            void setReloadOnChange(bool reload, double checkInterval = 1.0);
+            bool getReloadOnChange() const { return _reloadOnChange; }
+
+            /**
+            * Reload the library, or reinitialize the module if it was not loaded from a file,
+            * before the unit is rendered next time. The output textures and PBOs of the unit are kept.
+            * The library is loaded from a copy of the file and the current module is kept, if the
+            * new one cannot be loaded or initialized. Can be called from any thread.
+            **/
+            void requestReload();
+
+            //! Time in milliseconds spent to load the library by the last load
+            double getLastLoadTime() const { return _lastLoadTime; }
+
+            //! Time in milliseconds spent in Module::init() by the last load
+            double getLastInitTime() const { return _lastInitTime; }
+
+            //! Outputs are written by the module through pbos, hence they are not double buffered
+            bool supportsDoubleBufferedOutput() const { return false; }
+
         protected:
 
             //! Start cuda kernel running over the input textures
@@ -111,10 +210,79 @@ namespace osgPPU
             //! Stop cuda kernel execution and write results to the output textures
             virtual void noticeFinishRendering(osg::RenderInfo &, const osg::Drawable* );
 
+            //! Asynchronous modules get new input only when they are idle
+            virtual bool noticeReadInputPBOs(osg::RenderInfo&);
+
+            //! Asynchronous modules give new output only when they completed
+            virtual bool noticeWriteOutputPBOs(osg::RenderInfo&);
+
+            //! State of an asynchronous module
+            enum AsyncState
+            {
+                //! Input is read back in the next frame
+                ASYNC_IDLE,
+
+                //! Waiting until the read back of the input is done
+                ASYNC_WAIT_INPUT,
+
+                //! Module is processing the input
+                ASYNC_RUNNING,
+
+                //! Module has completed, output is uploaded in this frame
+                ASYNC_COMPLETED
+            };
+
+            AsyncState _asyncState;
+            void* _asyncFence;
+
+            //! Context in which the fence was inserted
+            unsigned int _asyncContextID;
+
+            //! Drop the state of the asynchronous processing
+            void resetAsyncState();
+
+            //! Swap the module against a freshly loaded one, called with the context current
+            void reloadModule(osg::RenderInfo&);
+
+            //! Load the module from the given library file, the current module is replaced only on success
+            bool loadModuleLibrary(const std::string& moduleFile, const std::string& libraryFile);
+
+            //! Get and clear the pending reload request
+            bool takeReloadRequest();
+
+            //! Set the module file, its modification time and the capabilities of the library
+            void setModuleFile(const std::string& file, long fileTime, unsigned int capabilities);
+
+            //! Copy the module library, so that it can be loaded by another name
+            static bool copyModuleFile(const std::string& src, const std::string& dst);
+
+            //! Get modification time of the module file, 0 if it does not exist
+            static long getModificationTime(const std::string& file);
+
+            unsigned int _moduleVersion;
+            unsigned int _moduleCapabilities;
+            bool _reloadOnChange;
+            double _reloadCheckInterval;
+            osg::Timer_t _lastReloadCheck;
+            long _moduleFileTime;
+            double _lastLoadTime;
+            double _lastInitTime;
+
+            //! Reload request, set by the update thread and taken by the draw thread
             bool  _moduleDirty;
+
+            //! Guards the reload request and the module file, its time and capabilities
+            OpenThreads::Mutex _moduleMutex;
+
+            //! Number of copies of the module file loaded so far
+            unsigned int _moduleCopyCount;
+
             osg::ref_ptr<Module> _module;
             osg::ref_ptr<osgDB::DynamicLibrary> _moduleLib;
             std::string _moduleFile;
+
+            //! File the library was actually loaded from, a copy of the module file on reload
+            std::string _moduleLibFile;
     };
 
 };
@@ -24,6 +24,10 @@
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitInOut.h>
 
+#include <osg/buffered_value>
+
+#include <list>
+
 namespace osgPPU
 {
     //! Implementation of repeatable UnitInOut (rendering several iterations)
@@ -36,14 +40,17 @@ namespace osgPPU
     * After all iterations the child of a last unit is executed with the output of the last unit in 
     * the repeatable subgraph.
     *
+    * The subgraph is culled only once per frame. The units between this and the last unit
+    * are rendered by this unit, which replays their drawables for every iteration in
+    * the draw traversal, so that the iterations do not cost any cull time.
+    *
     * This unit is derived from UnitInOut. Per default the data is just bypassed without any shader processing.
 	* You can specify your own shader to use the iteration unit as processing unit too. However, notice,
 	* that at least one child has to exists, otherwise the unit will write to itself, which is forbidden.
 	* Having at least one child makes sure, that the output of that child can be reused as input to the repeatable subgraph.
 	* One can use this to implement Ping-Ponging or similar techniques.
     *
-    * NOTE: Currently only 1 input to the repeat unit is supported!
-    *       Please check that last node (which output is reused) has also only 1 output specified!
+    * Each input of the repeat unit can be fed back by an output of the last unit, see setFeedback().
     **/
     class OSGPPU_EXPORT UnitInOutRepeat : public UnitInOut {
         public:
@@ -66,7 +73,8 @@ namespace osgPPU
             inline const Unit* getLastNode() const { return _lastNode.get(); }
 
             /**
-            * Set the amount of iterations (default 1).
+            * Set the amount of iterations (default 1). If a convergence check is
+            * enabled, then this is the maximal number of iterations.
             **/
             inline void setNumIterations(int num) { _numIterations = num; dirty(); }
             inline int getNumIterations() const { return _numIterations; }
@@ -76,8 +84,59 @@ namespace osgPPU
             * specify here the mrt index of the output you would like to use while iterating.
             * (default is 0)
             **/
-            inline void setLastNodeOutputIndex(unsigned index) { _lastNodeOutputIndex = index; dirty(); }
-            inline unsigned getLastNodeOutputIndex() const { return _lastNodeOutputIndex; }
+            inline void setLastNodeOutputIndex(unsigned index) { setFeedback(0, index); }
+            inline unsigned getLastNodeOutputIndex() const { return getFeedback(0); }
+
+            //! Mapping of the inputs of the repeat unit to the outputs of the last unit
+            typedef std::map<unsigned, unsigned> FeedbackMap;
+
+            /**
+            * Specify that from the second iteration on the input with the given index
+            * is replaced by the output of the last unit with the given mrt index.
+            * Per default the input 0 is replaced by the output 0.
+            **/
+            inline void setFeedback(unsigned inputIndex, unsigned lastNodeOutputIndex) { _feedback[inputIndex] = lastNodeOutputIndex; dirty(); }
+
+            //! Keep the input with the given index in all iterations
+            inline void removeFeedback(unsigned inputIndex) { _feedback.erase(inputIndex); dirty(); }
+
+            //! Get mrt index of the last unit's output fed back to the given input, the input index if none
+            inline unsigned getFeedback(unsigned inputIndex) const
+            {
+                FeedbackMap::const_iterator it = _feedback.find(inputIndex);
+                return it == _feedback.end() ? inputIndex : it->second;
+            }
+
+            //! Get the mapping of inputs to the last unit's outputs
+            inline const FeedbackMap& getFeedbackMap() const { return _feedback; }
+
+            /**
+            * Enable early exit of the iterations, when the result does not change anymore.
+            * Every interval iterations the output of the last unit is compared against the output
+            * of the repeat unit, i.e. the state the iteration started from. The pixels
+            * changing by more than epsilon in any channel are counted by an occlusion query.
+            * The query results are read asynchronously, also in the following frames, so
+            * iterations continue while they are not available yet. Once a result of at most
+            * threshold pixels is found, the remaining iterations are skipped and the following
+            * frames are limited to the iteration of that check. A check at the limit which
+            * has not converged raises the limit by interval iterations again.
+            * @param interval Number of iterations between two checks, 0 disables the check (default)
+            * @param epsilon Maximal change of a pixel which is still treated as converged
+            * @param threshold Maximal number of changing pixels for the result to be converged
+            **/
+            void setConvergenceCheck(unsigned interval, float epsilon, unsigned threshold = 0);
+            inline unsigned getConvergenceInterval() const { return _convergenceInterval; }
+            inline float getConvergenceEpsilon() const { return _convergenceEpsilon; }
+            inline unsigned getConvergenceThreshold() const { return _convergenceThreshold; }
+
+            /**
+            * Get number of iterations really rendered in the last frame. This is smaller than
+            * getNumIterations() if the convergence check stopped the iterations.
+            **/
+            inline unsigned getNumIterationsUsed() const { return _numIterationsUsed; }
+
+            //! Delete the query objects of the given context
+            virtual void releaseGLObjects(osg::State* state = 0) const;
 
         protected:
             //! Overriden method from the base class
@@ -86,9 +145,66 @@ namespace osgPPU
             //! Special treatment for traversing repeatable subgraph
             virtual void traverse(osg::NodeVisitor& nv);
 
+            //! Replay the iterations after the first one was rendered
+            virtual void noticeFinishRendering(osg::RenderInfo&, const osg::Drawable* );
+
+            //! Collect units between the given one and the last unit, returns true if the last unit is reachable
+            bool collectRegion(Unit* unit, std::map<Unit*, bool>& visited);
+
+            //! Render the drawables of a unit with its state, extra state is applied on top
+            void drawUnit(osg::RenderInfo& ri, Unit* unit, osg::StateSet* extra = NULL);
+
+            //! Setup the pass counting the changing pixels
+            void setupConvergenceCheck();
+
+            //! Render the counting pass inside of an occlusion query
+            void beginConvergenceCheck(osg::RenderInfo& ri, GLuint query);
+
+            //! Query issued after the given number of iterations
+            struct PendingQuery
+            {
+                GLuint query;
+                unsigned iteration;
+            };
+
+            //! Queries of one context, kept over frames until their result is available
+            struct ConvergenceState
+            {
+                ConvergenceState() : limit(0) {}
+
+                std::vector<GLuint> free;
+                std::list<PendingQuery> pending;
+
+                //! Number of iterations used by the next frames, 0 if not limited
+                unsigned limit;
+            };
+
+            //! Read the available results of the issued queries and adapt the limit, does not wait for the gpu
+            void updateConvergenceLimit(osg::RenderInfo& ri, ConvergenceState& cs);
+
             int _numIterations;
-            unsigned _lastNodeOutputIndex;
+            FeedbackMap _feedback;
             osg::ref_ptr<Unit>    _lastNode;
+
+            //! Units rendered by this unit in every iteration, sorted by execution order
+            std::vector<osg::ref_ptr<Unit> > _region;
+
+            //! Textures fed back from the last unit on even and odd frames
+            osg::ref_ptr<osg::StateSet> _feedbackStateSet[2];
+
+            bool _replaying;
+
+            unsigned _convergenceInterval;
+            float _convergenceEpsilon;
+            unsigned _convergenceThreshold;
+            unsigned _numIterationsUsed;
+
+            //! Pass counting the changing pixels
+            osg::ref_ptr<osg::Drawable> _checkDrawable;
+            osg::ref_ptr<FrameBufferObject> _checkFBO;
+
+            //! Query objects and iteration limit per context
+            mutable osg::buffered_object<ConvergenceState> _convergence;
     };
 
 };
@@ -0,0 +1,141 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_INREDUCEOUT_H_
+#define _C_UNIT_INREDUCEOUT_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <osg/Texture2D>
+#include <OpenThreads/Mutex>
+
+#define OSGPPU_REDUCE_INPUT_UNIFORM "osgppu_ReduceInput"
+#define OSGPPU_REDUCE_INPUT_SIZE_UNIFORM "osgppu_ReduceInputSize"
+#define OSGPPU_REDUCE_NUM_PIXELS_UNIFORM "osgppu_ReduceNumPixels"
+
+namespace osgPPU
+{
+    //! Reduce the input texture to a single value
+    /**
+    * The unit reduces its first input texture to a 1x1 output texture by applying
+    * the reduction operator in several passes. Each pass combines a block of
+    * factor x factor texels into one, so the number of passes is about
+    * log(size)/log(factor). The shaders of the passes are generated by the unit.
+    *
+    * The output texture can be used as input by other units. Additionally the
+    * result is read back asynchronously to the CPU (see Unit::setNumPBOBuffers())
+    * and can be accessed by getResult(). Reading back the result does never stall
+    * the pipeline, hence the result is a couple of frames old.
+    **/
+    class OSGPPU_EXPORT UnitInReduceOut : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitInReduceOut);
+
+            //! Operator used to combine the texels
+            enum Operator
+            {
+                //! Sum of all texels
+                SUM,
+
+                //! Component wise minimum
+                MIN,
+
+                //! Component wise maximum
+                MAX,
+
+                //! Arithmetic mean of all texels
+                MEAN,
+
+                //! Geometric mean exp(mean(log(delta + x))), i.e. used for the scene luminance
+                LOG_AVERAGE
+            };
+
+            //! Create default unit
+            UnitInReduceOut();
+            UnitInReduceOut(const UnitInReduceOut&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitInReduceOut();
+
+            //! Initialize the unit and generate the reduction passes
+            virtual void init();
+
+            //! Set the reduction operator (default MEAN)
+            inline void setOperator(Operator op) { mOperator = op; dirty(); }
+
+            //! Get the reduction operator
+            inline Operator getOperator() const { return mOperator; }
+
+            /**
+            * Set the number of texels in each direction which are combined
+            * in one pass (default 4, hence 4x4 texels are reduced to one).
+            **/
+            void setReductionFactor(unsigned int factor);
+
+            //! Get the reduction factor
+            inline unsigned int getReductionFactor() const { return mFactor; }
+
+            //! Check if a result was read back already
+            bool hasResult() const;
+
+            //! Get the last result which was read back to the CPU
+            osg::Vec4 getResult() const;
+
+            //! Get the number of the frame in which the last result was computed
+            unsigned int getResultFrameNumber() const;
+
+        protected:
+            //! Render the reduction passes and read the result
+            void renderPasses(osg::RenderInfo&);
+
+            //! Generate the shader of one reduction pass
+            osg::Program* createReduceProgram(bool first, bool last, bool rectangle) const;
+
+            //! Start reading the result into the pbo ring and fetch finished transfers
+            void readResult(osg::RenderInfo& ri);
+
+            //! Pixel buffer to read the result, together with the state of the transfer
+            struct Buffer
+            {
+                Buffer() : fence(NULL), pending(false), frameNumber(0) {}
+
+                osg::ref_ptr<osg::PixelDataBufferObject> pbo;
+                void* fence;
+                bool pending;
+                unsigned int frameNumber;
+            };
+
+            Operator mOperator;
+            unsigned int mFactor;
+
+            std::vector<Buffer> mBuffers;
+            unsigned int mCurrentBuffer;
+
+            mutable OpenThreads::Mutex mResultMutex;
+            osg::Vec4 mResult;
+            unsigned int mResultFrameNumber;
+            bool mHasResult;
+    };
+
+};
+
+#endif
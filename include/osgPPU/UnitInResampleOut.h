@@ -24,6 +24,11 @@
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitInOut.h>
 
+#define OSGPPU_RESAMPLE_INPUT_UNIFORM "osgppu_ResampleInput"
+#define OSGPPU_RESAMPLE_INPUT_SIZE_UNIFORM "osgppu_ResampleInputSize"
+#define OSGPPU_RESAMPLE_OUTPUT_SIZE_UNIFORM "osgppu_ResampleOutputSize"
+#define OSGPPU_RESAMPLE_OUTPUT_ORIGIN_UNIFORM "osgppu_ResampleOutputOrigin"
+
 namespace osgPPU
 {
     //! Same as UnitInOut but do resampling inbetween
@@ -32,10 +37,38 @@ namespace osgPPU
     * render the input data resampled to the output. Next PPU will work 
     * on the resampled one. NOTE: You loose information in your data after 
     * appling this PPU.
+    *
+    * Per default the input is resampled by the shader of the unit or by hardware
+    * filtering. Otherwise a filter can be selected, which takes the whole footprint of an
+    * output pixel in the first input texture into account, so that the input can be
+    * downsampled by any factor in a single pass. Additionally a fused shader can be
+    * attached, which processes the filtered color in the same pass.
     **/
     class OSGPPU_EXPORT UnitInResampleOut : public UnitInOut {
         public:
             META_Node(osgPPU,UnitInResampleOut);
+
+            //! Filter used to resample the input
+            enum Filter
+            {
+                //! Use the unit's shader, or hardware filtering if none
+                DEFAULT,
+
+                //! Average of all texels in the footprint
+                BOX,
+
+                //! Catmull-Rom bicubic filter, scaled to the footprint
+                BICUBIC,
+
+                //! Lanczos filter with 2 lobes, scaled to the footprint
+                LANCZOS,
+
+                //! Component wise minimum of the footprint, i.e. for depth
+                MIN,
+
+                //! Component wise maximum of the footprint, i.e. for depth
+                MAX
+            };
         
             //! Create default ppfx 
             UnitInResampleOut();
@@ -56,10 +89,37 @@ namespace osgPPU
             //! Get resampling factor
             float getFactorY() const { return mHeightFactor; }
     
+            /**
+            * Set the filter used to resample the first input texture (default DEFAULT).
+            * Any filter but DEFAULT replaces the shader of the unit by a generated one.
+            **/
+            void setFilter(Filter filter);
+
+            //! Get the filter used to resample the input
+            Filter getFilter() const { return mFilter; }
+
+            /**
+            * Set a fragment shader which is executed in the resampling pass. The shader
+            * has to define the function
+            *     vec4 osgppu_ResampleProcess(vec4 color, vec2 texCoord)
+            * which gets the filtered color and the normalized texture coordinates of the pixel.
+            * Specify NULL to disable it.
+            **/
+            void setFusedShader(osg::Shader* shader);
+
+            //! Get the shader executed in the resampling pass
+            osg::Shader* getFusedShader() const { return mFusedShader.get(); }
+
             void init();
             void dirty();
 
         protected:
+            //! Generate the resampling shader for the given ratio of input to output size
+            osg::Program* createResampleProgram(float ratioX, float ratioY, bool rectangle) const;
+
+            Filter mFilter;
+            osg::ref_ptr<osg::Shader> mFusedShader;
+
             float mWidthFactor, mHeightFactor;
             bool mDirtyFactor;
     };
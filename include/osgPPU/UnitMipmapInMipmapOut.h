@@ -35,6 +35,8 @@ namespace osgPPU
     *
     * In order that this unit work correctly the input texture and the output should be of the 
     * same dimensions, otherwise non 1:1 matching of mipmap levels is possible.
+    *
+    * 2D array and cubemap outputs are rendered layered, see UnitInMipmapOut.
     **/
     class OSGPPU_EXPORT UnitMipmapInMipmapOut : public UnitInOut {
         public:
@@ -48,6 +50,9 @@ namespace osgPPU
             
             //! Initialze the Processoring unit
             virtual void init();
+
+            //! Levels are written by fbos of their own, hence the output is not double buffered
+            bool supportsDoubleBufferedOutput() const { return false; }
             
         protected:
 
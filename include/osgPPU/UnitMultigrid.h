@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_MULTIGRID_H_
+#define _C_UNIT_MULTIGRID_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <osg/Texture2D>
+
+#define OSGPPU_MULTIGRID_SOLUTION_UNIFORM "osgppu_MultigridSolution"
+#define OSGPPU_MULTIGRID_RHS_UNIFORM "osgppu_MultigridRhs"
+#define OSGPPU_MULTIGRID_CORRECTION_UNIFORM "osgppu_MultigridCorrection"
+#define OSGPPU_MULTIGRID_RESIDUAL_UNIFORM "osgppu_MultigridResidual"
+#define OSGPPU_MULTIGRID_TEXEL_SIZE_UNIFORM "osgppu_MultigridTexelSize"
+#define OSGPPU_MULTIGRID_OUTPUT_SIZE_UNIFORM "osgppu_MultigridOutputSize"
+#define OSGPPU_MULTIGRID_GRID_SPACING_UNIFORM "osgppu_MultigridGridSpacing"
+#define OSGPPU_MULTIGRID_LEVEL_UNIFORM "osgppu_MultigridLevel"
+
+namespace osgPPU
+{
+    //! Solve a linear system given by a stencil with multigrid V-cycles
+    /**
+    * The unit solves A * u = f, where f is the first input texture and A is a stencil
+    * operator, e.g. the discrete laplacian of a diffusion or poisson problem. The optional
+    * second input is used as initial guess, otherwise the solution starts with 0.
+    * The solution is written to the output texture.
+    *
+    * The operator is given by two user programs:
+    *  - the smoother computes an improved solution, e.g. one Jacobi or Gauss-Seidel step
+    *  - the residual program computes r = f - A * u
+    *
+    * Both get the current solution in the osgppu_MultigridSolution sampler, the right hand side
+    * in osgppu_MultigridRhs, the texel size of the level in osgppu_MultigridTexelSize and the
+    * distance between the grid points relative to the finest level in osgppu_MultigridGridSpacing,
+    * which is 2^level and has to be used to scale the stencil.
+    *
+    * Each V-cycle smoothes the solution, restricts the residual to the next coarser level
+    * and solves the correction there recursively. The correction is then prolongated back,
+    * added to the solution and smoothed again. Since the low frequencies of the error
+    * are removed on the coarse levels, a few cycles give the accuracy of many more
+    * iterations on the finest level only. All passes are rendered by the unit in one block,
+    * the level textures are kept in a pool, so that they are reused when the unit is reinitialized.
+    * Use a float output format, since the corrections are signed.
+    **/
+    class OSGPPU_EXPORT UnitMultigrid : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitMultigrid);
+
+            //! Create default unit
+            UnitMultigrid();
+            UnitMultigrid(const UnitMultigrid&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitMultigrid();
+
+            //! Initialize the unit and generate the passes
+            virtual void init();
+
+            //! Set number of coarser levels below the input resolution (default 4)
+            void setNumLevels(unsigned int num);
+
+            //! Get number of coarser levels
+            inline unsigned int getNumLevels() const { return mNumLevels; }
+
+            //! Set number of V-cycles done per frame (default 1)
+            void setNumCycles(unsigned int num);
+
+            //! Get number of V-cycles done per frame
+            inline unsigned int getNumCycles() const { return mNumCycles; }
+
+            //! Set number of smoothing steps before and after the coarse grid correction (default 2, 2)
+            inline void setNumSmoothingSteps(unsigned int pre, unsigned int post) { mNumPreSmooth = pre; mNumPostSmooth = post; dirty(); }
+
+            //! Get number of smoothing steps before the coarse grid correction
+            inline unsigned int getNumPreSmoothingSteps() const { return mNumPreSmooth; }
+
+            //! Get number of smoothing steps after the coarse grid correction
+            inline unsigned int getNumPostSmoothingSteps() const { return mNumPostSmooth; }
+
+            //! Set number of smoothing steps on the coarsest level (default 8)
+            inline void setNumCoarseSmoothingSteps(unsigned int num) { mNumCoarseSmooth = num; dirty(); }
+
+            //! Get number of smoothing steps on the coarsest level
+            inline unsigned int getNumCoarseSmoothingSteps() const { return mNumCoarseSmooth; }
+
+            //! Set program doing one smoothing step
+            inline void setSmootherProgram(osg::Program* program) { mSmoother = program; dirty(); }
+
+            //! Get program doing one smoothing step
+            inline osg::Program* getSmootherProgram() const { return mSmoother.get(); }
+
+            //! Set program computing the residual
+            inline void setResidualProgram(osg::Program* program) { mResidual = program; dirty(); }
+
+            //! Get program computing the residual
+            inline osg::Program* getResidualProgram() const { return mResidual.get(); }
+
+            //! Get the number of passes rendered in the input resolution
+            inline unsigned int getNumFullResolutionPasses() const { return mNumFullResolutionPasses; }
+
+        protected:
+            //! Generate the shader averaging 2x2 texels of the finer level
+            osg::Program* createRestrictProgram() const;
+
+            //! Generate the shader adding the interpolated correction of the coarser level
+            osg::Program* createCorrectProgram() const;
+
+            //! Add a pass rendering into the output, the second input is bound to the second texture unit if valid
+            void addPass(osg::Texture* input, const char* inputName, osg::Texture* secondInput, const char* secondName, osg::Texture* output, osg::Program* program, unsigned int level);
+
+            //! Add smoothing steps alternating between the two solution textures, returns the final solution
+            osg::Texture* addSmoothPasses(unsigned int level, unsigned int num, osg::Texture* current, osg::Texture* first, osg::Texture* second, osg::Texture* rhs);
+
+            //! Add a pass clearing the output to 0
+            void addClearPass(osg::Texture* output);
+
+            unsigned int mNumLevels;
+            unsigned int mNumCycles;
+            unsigned int mNumPreSmooth;
+            unsigned int mNumPostSmooth;
+            unsigned int mNumCoarseSmooth;
+            unsigned int mNumFullResolutionPasses;
+            osg::ref_ptr<osg::Program> mSmoother;
+            osg::ref_ptr<osg::Program> mResidual;
+    };
+
+};
+
+#endif
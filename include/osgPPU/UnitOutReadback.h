@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_OUT_READBACK_H_
+#define _C_UNIT_OUT_READBACK_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <vector>
+
+namespace osgPPU
+{
+    //! Read the content of the input texture back to the CPU asynchronously
+    /**
+    * The unit renders a region of interest of its first input texture into an
+    * output texture of the output internal format (i.e. GL_RGBA8), so that the
+    * format conversion is done on the GPU. The output is then read into a ring of
+    * pixel buffer objects (see Unit::setNumPBOBuffers()) without stalling the
+    * pipeline. When a transfer is done, the buffer is mapped and passed to the
+    * callback, which is executed in a separate worker thread. Hence no copy of the
+    * data is required. As the worker has no OpenGL context, the buffer is unmapped
+    * in the first frame after the callback has returned and reused afterwards.
+    *
+    * With N buffers the data of frame k is given to the callback in frame k+N-1.
+    * The unit does support only one graphics context.
+    **/
+    class OSGPPU_EXPORT UnitOutReadback : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitOutReadback);
+
+            //! Description of the mapped data given to the callback
+            struct Frame
+            {
+                //! Pointer to the mapped memory, valid only while the callback is executed
+                const void* data;
+
+                //! Size of the region in pixels
+                unsigned int width, height;
+
+                //! Size of one row in bytes
+                unsigned int stride;
+
+                //! Pixel format and data type of the pixels, i.e. GL_RGBA and GL_UNSIGNED_BYTE
+                GLenum pixelFormat;
+                GLenum dataType;
+
+                //! Number of the frame in which the data was rendered
+                unsigned int frameNumber;
+            };
+
+            /**
+            * Callback which gets the read back data. It is called from the worker thread,
+            * hence it must not perform any OpenGL calls.
+            **/
+            struct Callback : public virtual osg::Object
+            {
+                    META_Object (osgPPU, Callback);
+
+                    Callback(){}
+
+                    Callback(const Callback&, const osg::CopyOp&){}
+
+                    virtual void operator()(const UnitOutReadback*, const Frame&) const {}
+            };
+
+            //! Create default unit
+            UnitOutReadback();
+            UnitOutReadback(const UnitOutReadback&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory, waits until the worker thread is done
+            virtual ~UnitOutReadback();
+
+            //! Initialize the unit
+            virtual void init();
+
+            //! Unmap the buffers and release their OpenGL objects and fences
+            virtual void releaseGLObjects(osg::State* state = 0) const;
+
+            //! Set callback to receive the data. Without a callback nothing is read back.
+            inline void setCallback(Callback* cb) { mCallback = cb; }
+            inline Callback* getCallback() { return mCallback.get(); }
+            inline const Callback* getCallback() const { return mCallback.get(); }
+
+            /**
+            * Specify the region of the input texture which has to be read back in pixels.
+            * Width or height of 0 means the whole input texture (default).
+            **/
+            void setRegionOfInterest(int x, int y, int width, int height);
+
+            //! Get region of interest
+            inline void getRegionOfInterest(int& x, int& y, int& width, int& height) const
+            {
+                x = mRegionX; y = mRegionY; width = mRegionWidth; height = mRegionHeight;
+            }
+
+        protected:
+            //! Start the readback of the rendered output before the fbo is unbound
+            virtual void noticeFinishRendering(osg::RenderInfo&, const osg::Drawable*);
+
+            //! Worker thread which executes the callback
+            class Worker;
+
+            /**
+            * Wait for the worker and unmap all buffers. Buffers can only be unmapped if
+            * the state of the context is given, otherwise the mapping is dropped
+            * together with the buffer objects.
+            **/
+            void releaseBuffers(osg::State* state);
+
+            //! Pixel buffer together with the state of its transfer
+            struct Buffer
+            {
+                Buffer() : fence(NULL), pending(false), mapped(false) {}
+
+                osg::ref_ptr<osg::PixelDataBufferObject> pbo;
+                void* fence;
+                bool pending;
+                bool mapped;
+                Frame frame;
+            };
+
+            std::vector<Buffer> mBuffers;
+            unsigned int mCurrentBuffer;
+            unsigned int mContextID;
+            Worker* mWorker;
+
+            osg::ref_ptr<Callback> mCallback;
+
+            int mRegionX, mRegionY, mRegionWidth, mRegionHeight;
+    };
+
+};
+
+#endif
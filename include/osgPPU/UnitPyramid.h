@@ -0,0 +1,126 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_PYRAMID_H_
+#define _C_UNIT_PYRAMID_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <osg/Texture2D>
+
+#define OSGPPU_PYRAMID_INPUT_UNIFORM "osgppu_PyramidInput"
+#define OSGPPU_PYRAMID_LEVEL_INPUT_UNIFORM "osgppu_PyramidLevelInput"
+#define OSGPPU_PYRAMID_TEXEL_SIZE_UNIFORM "osgppu_PyramidTexelSize"
+#define OSGPPU_PYRAMID_OUTPUT_SIZE_UNIFORM "osgppu_PyramidOutputSize"
+#define OSGPPU_PYRAMID_LEVEL_UNIFORM "osgppu_PyramidLevel"
+#define OSGPPU_PYRAMID_WEIGHT_UNIFORM "osgppu_PyramidWeight"
+#define OSGPPU_PYRAMID_UPPER_WEIGHT_UNIFORM "osgppu_PyramidUpperWeight"
+
+namespace osgPPU
+{
+    //! Downsample, process and upsample the input in one unit
+    /**
+    * The unit builds a chain of N levels of half resolution each out of its first
+    * input texture. Optionally a level program is applied to every level. Afterwards the
+    * levels are recombined upwards, the result of level i is
+    *
+    *     R(i) = weight(i) * P(i) + upsample(R(i+1)),  R(N) = weight(N) * P(N)
+    *
+    * where P(i) is the processed level and P(0) the input texture. R(0) is written to
+    * the output texture. Per default the weights of all levels are 0 except of the smallest
+    * level, which gives a blur of the input. Setting the weights of all levels accumulates them,
+    * as required for bloom or glow effects.
+    *
+    * The level program gets the level texture in the osgppu_PyramidInput sampler, the level
+    * index in osgppu_PyramidLevel and the size of the level in osgppu_PyramidOutputSize.
+    * All the passes are rendered by the unit in one block. The intermediate textures
+    * are kept in a pool, so that they are reused when the unit is reinitialized.
+    **/
+    class OSGPPU_EXPORT UnitPyramid : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitPyramid);
+
+            //! Filter used to downsample and upsample the levels
+            enum Filter
+            {
+                //! 2x2 box filter by one bilinear fetch
+                BOX,
+
+                //! Dual kawase filter, 5 fetches to downsample and 8 to upsample
+                DUAL_KAWASE
+            };
+
+            //! Create default unit
+            UnitPyramid();
+            UnitPyramid(const UnitPyramid&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitPyramid();
+
+            //! Initialize the unit and generate the passes
+            virtual void init();
+
+            //! Set the number of downsampled levels (default 4)
+            void setNumLevels(unsigned int num);
+
+            //! Get the number of downsampled levels
+            inline unsigned int getNumLevels() const { return mNumLevels; }
+
+            //! Set the filter used to downsample and upsample (default DUAL_KAWASE)
+            inline void setFilter(Filter filter) { mFilter = filter; dirty(); }
+
+            //! Get the filter used to downsample and upsample
+            inline Filter getFilter() const { return mFilter; }
+
+            //! Set program applied to each downsampled level, NULL to use the levels directly
+            inline void setLevelProgram(osg::Program* program) { mLevelProgram = program; dirty(); }
+
+            //! Get program applied to each downsampled level
+            inline osg::Program* getLevelProgram() const { return mLevelProgram.get(); }
+
+            /**
+            * Set weight of a level in the upward recombination. Level 0 is the input texture.
+            **/
+            void setLevelWeight(unsigned int level, float weight);
+
+            //! Get weight of a level in the upward recombination
+            float getLevelWeight(unsigned int level) const;
+
+        protected:
+            //! Generate the shader downsampling by a factor of 2
+            osg::Program* createDownsampleProgram() const;
+
+            //! Generate the shader upsampling the upper level and adding the weighted level
+            osg::Program* createUpsampleProgram() const;
+
+            //! Add a pass, level input is bound to the second texture unit if valid
+            osg::StateSet* addPass(osg::Texture* input, osg::Texture* levelInput, osg::Texture* output, osg::Program* program, unsigned int level);
+
+            unsigned int mNumLevels;
+            Filter mFilter;
+            osg::ref_ptr<osg::Program> mLevelProgram;
+            std::map<unsigned int, float> mWeights;
+    };
+
+};
+
+#endif
@@ -0,0 +1,127 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#ifndef _C_UNIT_TEMPORAL_RESOLVE_H_
+#define _C_UNIT_TEMPORAL_RESOLVE_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+
+#include <osg/Texture2D>
+#include <osg/observer_ptr>
+
+#define OSGPPU_TEMPORAL_COLOR_UNIFORM "osgppu_TemporalColor"
+#define OSGPPU_TEMPORAL_DEPTH_UNIFORM "osgppu_TemporalDepth"
+#define OSGPPU_TEMPORAL_HISTORY_UNIFORM "osgppu_TemporalHistory"
+#define OSGPPU_TEMPORAL_REPROJECTION_UNIFORM "osgppu_TemporalReprojection"
+#define OSGPPU_TEMPORAL_TEXEL_SIZE_UNIFORM "osgppu_TemporalTexelSize"
+#define OSGPPU_TEMPORAL_HISTORY_WEIGHT_UNIFORM "osgppu_TemporalHistoryWeight"
+
+namespace osgPPU
+{
+    //! Temporal antialiasing by reprojecting the resolved previous frame
+    /**
+    * The unit takes the current color as first and the depth (e.g. from a UnitDepthbufferBypass)
+    * as second input. Every frame the projection of the processor's camera is jittered by a subpixel
+    * offset of a Halton sequence, so that the accumulation of the frames gives supersampled edges.
+    *
+    * The history is the resolved result of the previous frame. It is owned by the unit and
+    * reprojected with the depth and the view-projection matrices of the current and the previous frame.
+    * Reprojected history values are clamped to the 3x3 neighbourhood of the current color,
+    * so that disoccluded pixels do not leave ghosts, and blended with the current color by the
+    * history weight. The resolved color is written to the output and to the history at once.
+    *
+    * The unit must be placed in the processor's subgraph, since the camera of the processor is
+    * used to get the matrices and to apply the jitter.
+    **/
+    class OSGPPU_EXPORT UnitTemporalResolve : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitTemporalResolve);
+
+            //! Create default unit
+            UnitTemporalResolve();
+            UnitTemporalResolve(const UnitTemporalResolve&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitTemporalResolve();
+
+            //! Initialize the unit and allocate the history
+            virtual void init();
+
+            //! Apply the jitter of the current frame to the camera
+            virtual void update();
+
+            //! Set weight of the history in the blend with the current frame (default 0.9)
+            inline void setHistoryWeight(float weight) { mHistoryWeight = weight; }
+
+            //! Get weight of the history in the blend with the current frame
+            inline float getHistoryWeight() const { return mHistoryWeight; }
+
+            /**
+            * Set number of jitter offsets before the sequence is repeated (default 8).
+            * Specify 0 to not jitter the camera at all.
+            **/
+            void setNumJitterSamples(unsigned int num);
+
+            //! Get number of jitter offsets
+            inline unsigned int getNumJitterSamples() const { return mNumJitterSamples; }
+
+            //! Get jitter offset in pixels applied in the current frame
+            inline const osg::Vec2& getJitter() const { return mJitter; }
+
+            //! Drop the history, e.g. after a camera cut
+            inline void resetHistory() { mHistoryValid = false; }
+
+        protected:
+            //! Compute the reprojection of the frame when culled
+            virtual void traverse(osg::NodeVisitor& nv);
+
+            //! Render the pass of the current frame
+            void renderPasses(osg::RenderInfo&);
+
+            //! Generate the resolve shader
+            osg::Program* createResolveProgram() const;
+
+            //! Compute matrices of the frame and the uniforms of the pass used by it
+            void updateReprojection(unsigned int frameNumber);
+
+            //! Remove the jitter from the camera's projection
+            void removeJitter();
+
+            //! History textures, written alternately by the frames
+            osg::ref_ptr<osg::Texture2D> mHistory[2];
+
+            osg::observer_ptr<osg::Camera> mCamera;
+            osg::Matrixd mBaseProjection;
+            osg::Matrixd mJitteredProjection;
+            osg::Matrixd mPreviousViewProjection;
+            osg::Vec2 mJitter;
+            unsigned int mJitterIndex;
+            unsigned int mLastCullFrame;
+            bool mHistoryValid;
+
+            float mHistoryWeight;
+            unsigned int mNumJitterSamples;
+    };
+
+};
+
+#endif
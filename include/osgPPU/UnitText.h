@@ -61,7 +61,7 @@ namespace osgPPU
             inline void setPosition(float x, float y) { mText->setPosition(osg::Vec3(x,y,0)); }
 
             //! Text Unit does work as a simple bypass, hence return here always the input
-            inline osg::Texture* getOrCreateOutputTexture(int mrt = 0) { return mInputTex[mrt].get(); }
+            inline osg::Texture* getOrCreateOutputTexture(int mrt = 0) { return getInputTexture(mrt); }
 
             //! Get text assigned with this unit
             osgText::Text& getText() { return *mText; }
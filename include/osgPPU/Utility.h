@@ -23,6 +23,19 @@
 
 #include <osgPPU/Export.h>
 
+// access modes of image bindings, usually provided by GL_ARB_vertex_buffer_object
+#ifndef GL_READ_ONLY_ARB
+    #define GL_READ_ONLY_ARB 0x88B8
+    #define GL_WRITE_ONLY_ARB 0x88B9
+    #define GL_READ_WRITE_ARB 0x88BA
+#endif
+
+// osg::Shader passes its type to glCreateShader, hence a compute shader can be
+// created by the value of the GL_ARB_compute_shader enum
+#ifndef GL_COMPUTE_SHADER
+    #define GL_COMPUTE_SHADER 0x91B9
+#endif
+
 /**
  * \namespace osgPPU
  * osgPPU module
@@ -45,6 +58,72 @@ namespace osgPPU
     **/
     OSGPPU_EXPORT unsigned int computeTextureSizeInBytes(osg::Texture* tex);
 
+    /**
+    * Insert a fence (GL_ARB_sync) into the command stream of the given context.
+    * The returned handle can be used to check when the GPU has executed all commands
+    * issued before the fence. If the extension is not supported, then NULL is returned.
+    **/
+    OSGPPU_EXPORT void* insertFenceSync(unsigned int contextID);
+
+    /**
+    * Wait until the given fence is signaled or the timeout (in nanoseconds) expires.
+    * Use a timeout of 0 to just check the state of the fence.
+    * @return true if the fence is signaled. NULL fences are always signaled.
+    **/
+    OSGPPU_EXPORT bool waitFenceSync(unsigned int contextID, void* fence, unsigned long long timeout = ~0ULL);
+
+    /**
+    * Delete a fence created by insertFenceSync(). NULL fences are ignored.
+    **/
+    OSGPPU_EXPORT void deleteFenceSync(unsigned int contextID, void* fence);
+
+    /**
+    * Delete a fence created by insertFenceSync() when no context is current. The fence
+    * is deleted on the next call of flushDeletedFenceSyncs() for the given context,
+    * which every unit does before it is drawn.
+    **/
+    OSGPPU_EXPORT void releaseFenceSync(unsigned int contextID, void* fence);
+
+    /**
+    * Delete all fences released by releaseFenceSync() for the given context.
+    * The context must be current.
+    **/
+    OSGPPU_EXPORT void flushDeletedFenceSyncs(unsigned int contextID);
+
+    /**
+    * Check if shaders can write to arbitrary texels of a texture (GL_ARB_shader_image_load_store).
+    **/
+    OSGPPU_EXPORT bool isImageLoadStoreSupported(unsigned int contextID);
+
+    /**
+    * Get the GLSL format layout qualifier of an image with the given internal format,
+    * i.e. "rgba16f" for GL_RGBA16F_ARB. Only float and normalized formats are supported,
+    * for other formats NULL is returned.
+    **/
+    OSGPPU_EXPORT const char* getImageFormatQualifier(GLenum internalFormat);
+
+    /**
+    * Bind the level of the texture to the image unit, so that shaders can write to it.
+    * The texture must be already applied once in the given context.
+    * @param access GL_WRITE_ONLY_ARB, GL_READ_ONLY_ARB or GL_READ_WRITE_ARB
+    **/
+    OSGPPU_EXPORT void bindImageTexture(unsigned int contextID, unsigned int unit, osg::Texture* texture, int level, GLenum access = GL_WRITE_ONLY_ARB);
+
+    /**
+    * Make sure that writes to images are visible to all following commands.
+    **/
+    OSGPPU_EXPORT void imageMemoryBarrier(unsigned int contextID);
+
+    /**
+    * Check if compute shaders can be dispatched (GL_ARB_compute_shader).
+    **/
+    OSGPPU_EXPORT bool isComputeShaderSupported(unsigned int contextID);
+
+    /**
+    * Dispatch the given number of work groups with the currently bound compute program.
+    **/
+    OSGPPU_EXPORT void dispatchCompute(unsigned int contextID, unsigned int numGroupsX, unsigned int numGroupsY, unsigned int numGroupsZ);
+
 };
 
 #endif
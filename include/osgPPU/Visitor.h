@@ -27,6 +27,8 @@
 #include <osgUtil/CullVisitor>
 #include <queue>
 #include <list>
+#include <set>
+#include <map>
 
 namespace osgPPU
 {
@@ -134,16 +136,13 @@ public:
     void apply (osg::Group &node)
     {
         // first check if we have already visited that node, if yes, it might be a loop in the graph, so don't go further
-        if (std::find(_visitedNodes.begin(), _visitedNodes.end(), &node) != _visitedNodes.end()) return;
+        if (_result || !_visitedNodes.insert(&node).second) return;
         
         Unit* unit = dynamic_cast<Unit*>(&node);
         if (unit && unit->getName() == _name)
             _result = unit;
         else
-        {
-            _visitedNodes.push_back(&node);
             node.traverse(*this);
-        }
     }
 
     Unit* getResult() { return _result; }
@@ -153,7 +152,7 @@ public:
 private:
     std::string _name;
     Unit* _result;
-    std::vector<osg::Group*> _visitedNodes;
+    std::set<osg::Group*> _visitedNodes;
 };
 
 //------------------------------------------------------------------------------
@@ -196,20 +195,40 @@ private:
 
 //------------------------------------------------------------------------------
 // Visitor to resolve all cycles in the unit graph
-// This will add BarrierNodes where they are needed
+// This will add BarrierNodes where they are needed. The graph is traversed
+// in one depth first pass, where every node is visited only once. A cycle
+// is found when an edge leads back to a node which is still on the current
+// node path (back edge). Only such edges are replaced by barrier nodes.
 //------------------------------------------------------------------------------
 class OSGPPU_EXPORT ResolveUnitsCyclesVisitor : public UnitVisitor
 {
 public:
 
-    ResolveUnitsCyclesVisitor() : UnitVisitor()
+    ResolveUnitsCyclesVisitor() : UnitVisitor(), _numResolvedCycles(0)
     {
     }
 
     void apply (osg::Group &node);
     void run (osg::Group* root);
 
+    //! Number of barrier nodes added by the last run
+    unsigned int getNumResolvedCycles() const { return _numResolvedCycles; }
+
     const char* className() { return "ResolveUnitsCyclesVisitor"; }
+
+private:
+    enum NodeState
+    {
+        // node is on the current node path, hence its subgraph is not done yet
+        IN_PROGRESS,
+
+        // node and its complete subgraph has been traversed
+        DONE
+    };
+    typedef std::map<osg::Node*, NodeState> NodeStateMap;
+
+    NodeStateMap _state;
+    unsigned int _numResolvedCycles;
 };
 
 //------------------------------------------------------------------------------
@@ -234,11 +253,20 @@ public:
     void setInitUnitsWhenFound(bool b) { _initUnits = b; }
     void setBinName(const std::string& name) { _binName = name; }
 
+    typedef std::list<Unit*> UnitSet;
+
+    //! All units found by the last run in the order of their execution
+    const UnitSet& getUnitSet() const { return mUnitSet; }
+
     const char* className() { return "SetupUnitRenderingVisitor"; }
 private:
-    typedef std::list<Unit*> UnitSet;
+    // compute dependency levels and the execution order of the found units
+    void scheduleUnits();
+
     Processor* _proc;
     UnitSet mUnitSet;
+    std::set<Unit*> mUnitLookup;
+    std::set<osg::Group*> mVisited;
     bool _initUnits;
     unsigned _startIndex;
     std::string _binName;
@@ -306,6 +334,46 @@ private:
     int _index;
 };
 
+//------------------------------------------------------------------------------
+// Mark units which are required to compute the output of an active sink as live.
+// Sinks are UnitOut's, UnitOutReadback's, pinned units and units placed as last.
+// Units rendering in place into the output of their parent, such as UnitText,
+// are live whenever their parent is live. Units which are not live are skipped
+// by update and cull traversals.
+//------------------------------------------------------------------------------
+class OSGPPU_EXPORT MarkUnitsLiveVisitor : public UnitVisitor
+{
+public:
+
+    MarkUnitsLiveVisitor(Processor* proc) : UnitVisitor(), _proc(proc)
+    {
+    }
+
+    void apply (osg::Group &node);
+    void run (osg::Group* root);
+
+    const char* className() { return "MarkUnitsLiveVisitor"; }
+
+    //! Check whether the output of the unit leaves the unit graph of the given processor
+    static bool isSink(Unit* unit, Processor* proc);
+
+    //! Check whether the unit renders into the output of its parent, it consumes the parent then
+    static bool rendersInPlace(Unit* unit);
+
+private:
+    typedef std::map<Unit*, std::vector<Unit*> > ProducerMap;
+
+    bool hasLiveConsumer(Unit* unit);
+    void addProducers(osg::Node* node, std::vector<Unit*>& queue);
+    void addInPlaceConsumers(Unit* unit, std::vector<Unit*>& queue);
+
+    Processor* _proc;
+    std::set<osg::Group*> _visited;
+    std::vector<Unit*> _units;
+    std::set<Unit*> _live;
+    ProducerMap _feedbackProducers;
+};
+
 }; // end namespace
 
 #endif
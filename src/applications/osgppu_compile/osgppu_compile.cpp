@@ -0,0 +1,621 @@
+/* osgPPU application, osgppu_compile.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/Notify>
+#include <osg/Texture2D>
+#include <osg/FrameStamp>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgUtil/UpdateVisitor>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/Unit.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitInHistoryOut.h>
+#include <osgPPU/UnitTemporalResolve.h>
+#include <osgPPU/BarrierNode.h>
+#include <osgPPU/Visitor.h>
+#include <osgPPU/Utility.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cstring>
+
+//
+// Offline compiler of .ppu pipelines. The pipeline is loaded and set up the
+// same way as the processor does it on the first frame, however against a
+// camera which is never rendered. Problems found on the way are reported, dead
+// units are removed and the result is written as a new .ppu file, so that
+// the application loads a pipeline which was already validated. A report
+// lists the passes in execution order, the memory used by the unit outputs,
+// a plan to share output textures between passes which are not alive at the same
+// time, passes which could be fused and the estimated bandwidth per frame.
+//
+// Shaders are not compiled, because this requires a graphics context.
+//
+
+//--------------------------------------------------------------------------
+// Collect warnings and errors of osgPPU and the osgDB plugin, these are
+// the validation messages of the pipeline.
+//--------------------------------------------------------------------------
+class CollectNotifyHandler : public osg::NotifyHandler
+{
+public:
+    CollectNotifyHandler() : numErrors(0), numWarnings(0) {}
+
+    void notify(osg::NotifySeverity severity, const char* message)
+    {
+        if (severity > osg::WARN) return;
+
+        if (severity == osg::WARN) numWarnings++;
+        else numErrors++;
+
+        std::string msg(message);
+        while (!msg.empty() && (msg[msg.size()-1] == '\n' || msg[msg.size()-1] == '\r'))
+            msg.erase(msg.size()-1);
+        messages.push_back((severity == osg::WARN ? std::string("warning: ") : std::string("error: ")) + msg);
+    }
+
+    void error(const std::string& msg)
+    {
+        numErrors++;
+        messages.push_back("error: " + msg);
+    }
+
+    void warning(const std::string& msg)
+    {
+        numWarnings++;
+        messages.push_back("warning: " + msg);
+    }
+
+    unsigned int numErrors;
+    unsigned int numWarnings;
+    std::vector<std::string> messages;
+};
+
+//--------------------------------------------------------------------------
+// Collect all units of the graph including the children blocked by barrier nodes
+//--------------------------------------------------------------------------
+class CollectUnitsVisitor : public osgPPU::UnitVisitor
+{
+public:
+    void apply(osg::Group& node)
+    {
+        if (!_visited.insert(&node).second) return;
+
+        osgPPU::Unit* unit = dynamic_cast<osgPPU::Unit*>(&node);
+        if (unit)
+        {
+            units.push_back(unit);
+            for (unsigned int i=0; i < unit->getNumChildren(); i++)
+            {
+                osgPPU::BarrierNode* br = dynamic_cast<osgPPU::BarrierNode*>(unit->getChild(i));
+                if (br && br->getBlockedChild()) br->getBlockedChild()->accept(*this);
+            }
+        }
+        node.traverse(*this);
+    }
+
+    void run(osg::Group* root)
+    {
+        _visited.clear();
+        units.clear();
+        root->traverse(*this);
+    }
+
+    std::vector<osgPPU::Unit*> units;
+
+private:
+    std::set<osg::Node*> _visited;
+};
+
+//--------------------------------------------------------------------------
+// Get units consuming the output of the given unit in the current frame
+//--------------------------------------------------------------------------
+static void getConsumers(osgPPU::Unit* unit, std::vector<osgPPU::Unit*>& consumers, bool& feedback)
+{
+    feedback = false;
+    for (unsigned int i=0; i < unit->getNumChildren(); i++)
+    {
+        osgPPU::Unit* child = dynamic_cast<osgPPU::Unit*>(unit->getChild(i));
+        if (child) consumers.push_back(child);
+        if (dynamic_cast<osgPPU::BarrierNode*>(unit->getChild(i))) feedback = true;
+    }
+}
+
+//--------------------------------------------------------------------------
+static std::string getTextureDescription(osg::Texture* tex)
+{
+    std::stringstream str;
+    str << tex->getTextureWidth() << "x" << tex->getTextureHeight();
+    if (tex->getTextureDepth() > 1) str << "x" << tex->getTextureDepth();
+    str << " 0x" << std::hex << tex->getInternalFormat() << std::dec << " " << tex->className();
+    return str.str();
+}
+
+//--------------------------------------------------------------------------
+static std::string formatBytes(double bytes)
+{
+    std::stringstream str;
+    str.precision(2);
+    str << std::fixed << bytes / (1024.0 * 1024.0) << " MB";
+    return str.str();
+}
+
+//--------------------------------------------------------------------------
+osgPPU::Processor* loadPipeline(const std::string& filename)
+{
+    osg::ref_ptr<osg::Object> object = osgDB::readObjectFile(filename);
+    osgPPU::Processor* processor = dynamic_cast<osgPPU::Processor*>(object.get());
+    if (processor) object.release();
+    return processor;
+}
+
+//--------------------------------------------------------------------------
+// Add the units whose output is consumed by the given node
+//--------------------------------------------------------------------------
+static void addProducers(osg::Node* node, osgPPU::Processor* processor, std::set<osgPPU::Unit*>& reached, std::vector<osgPPU::Unit*>& queue)
+{
+    for (unsigned int i=0; i < node->getNumParents(); i++)
+    {
+        osg::Group* parent = node->getParent(i);
+        osgPPU::Unit* unit = dynamic_cast<osgPPU::Unit*>(parent);
+
+        if (unit)
+        {
+            if (reached.insert(unit).second) queue.push_back(unit);
+        }
+
+        // units might be grouped by non-unit nodes, hence go further up to the processor
+        else if (parent != processor)
+            addProducers(parent, processor, reached, queue);
+    }
+}
+
+//--------------------------------------------------------------------------
+// Resolve cycles and remove units which do not contribute to the output of
+// any sink. The same rules as for the liveness of the units are used, however
+// inactive units are kept, since the application might activate them at
+// runtime. Returns the names of the removed units.
+//--------------------------------------------------------------------------
+std::vector<std::string> optimizePipeline(osgPPU::Processor* processor, bool removeDeadUnits, unsigned int& numCycles)
+{
+    osgPPU::ResolveUnitsCyclesVisitor rv;
+    rv.run(processor);
+    numCycles = rv.getNumResolvedCycles();
+
+    CollectUnitsVisitor cv;
+    cv.run(processor);
+
+    // a unit blocked by a barrier node consumes the output of the barrier's parent
+    std::map<osgPPU::Unit*, std::vector<osgPPU::Unit*> > feedbackProducers;
+    for (std::vector<osgPPU::Unit*>::iterator it = cv.units.begin(); it != cv.units.end(); it++)
+    {
+        for (unsigned int i=0; i < (*it)->getNumChildren(); i++)
+        {
+            osgPPU::BarrierNode* br = dynamic_cast<osgPPU::BarrierNode*>((*it)->getChild(i));
+            osgPPU::Unit* child = br ? dynamic_cast<osgPPU::Unit*>(br->getBlockedChild()) : NULL;
+            if (child) feedbackProducers[child].push_back(*it);
+        }
+    }
+
+    // go backwards from the sinks, regardless whether the units are active or not
+    std::set<osgPPU::Unit*> reached;
+    std::vector<osgPPU::Unit*> queue;
+    for (std::vector<osgPPU::Unit*>::iterator it = cv.units.begin(); it != cv.units.end(); it++)
+        if (osgPPU::MarkUnitsLiveVisitor::isSink(*it, processor) && reached.insert(*it).second) queue.push_back(*it);
+
+    while (!queue.empty())
+    {
+        osgPPU::Unit* unit = queue.back();
+        queue.pop_back();
+
+        addProducers(unit, processor, reached, queue);
+
+        // units rendering into the output of a reached unit, such as text overlays, are kept
+        for (unsigned int i=0; i < unit->getNumChildren(); i++)
+        {
+            osgPPU::Unit* child = dynamic_cast<osgPPU::Unit*>(unit->getChild(i));
+            if (child && osgPPU::MarkUnitsLiveVisitor::rendersInPlace(child) && reached.insert(child).second)
+                queue.push_back(child);
+        }
+
+        std::map<osgPPU::Unit*, std::vector<osgPPU::Unit*> >::iterator jt = feedbackProducers.find(unit);
+        if (jt == feedbackProducers.end()) continue;
+        for (std::vector<osgPPU::Unit*>::iterator kt = jt->second.begin(); kt != jt->second.end(); kt++)
+            if (reached.insert(*kt).second) queue.push_back(*kt);
+    }
+
+    // dead units do not contribute to any sink
+    std::vector<osg::ref_ptr<osgPPU::Unit> > dead;
+    for (std::vector<osgPPU::Unit*>::iterator it = cv.units.begin(); it != cv.units.end(); it++)
+        if (reached.find(*it) == reached.end()) dead.push_back(*it);
+
+    std::vector<std::string> names;
+    for (unsigned int i=0; i < dead.size(); i++)
+    {
+        names.push_back(dead[i]->getName());
+        if (!removeDeadUnits) continue;
+
+        osgPPU::RemoveUnitVisitor uv;
+        uv.run(dead[i].get());
+    }
+
+    processor->dirtyUnitSubgraph();
+    return names;
+}
+
+//--------------------------------------------------------------------------
+// Output texture of a unit with its lifetime in the execution order
+//--------------------------------------------------------------------------
+struct OutputTexture
+{
+    osgPPU::Unit* unit;
+    int mrt;
+    osg::Texture* texture;
+    unsigned int bytes;
+    unsigned int first;
+    unsigned int last;
+    std::string key;
+};
+
+struct OutputTextureOrder
+{
+    bool operator()(const OutputTexture& a, const OutputTexture& b) const { return a.first < b.first; }
+};
+
+//--------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    // use an ArgumentParser object to manage the program arguments.
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " validates and optimizes osgPPU pipelines offline");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options] input.ppu");
+    arguments.getApplicationUsage()->addCommandLineOption("-o <file>", "Write the optimized pipeline to the given .ppu file");
+    arguments.getApplicationUsage()->addCommandLineOption("--report <file>", "Write the report to the given file instead of the console");
+    arguments.getApplicationUsage()->addCommandLineOption("--size <width> <height>", "Size of the camera the pipeline is set up for (default 1024 768)");
+    arguments.getApplicationUsage()->addCommandLineOption("--hdr", "Use a floating point color texture of the camera");
+    arguments.getApplicationUsage()->addCommandLineOption("--fps <n>", "Frame rate used to estimate the bandwidth (default 60)");
+    arguments.getApplicationUsage()->addCommandLineOption("--keep-dead", "Do not remove units which do not contribute to any output");
+    arguments.getApplicationUsage()->addCommandLineOption("--strict", "Treat warnings as errors");
+
+    // if user request help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help") || arguments.argc() < 2)
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+
+    std::string outputFile, reportFile;
+    arguments.read("-o", outputFile);
+    arguments.read("--report", reportFile);
+
+    int width = 1024, height = 768;
+    arguments.read("--size", width, height);
+
+    double fps = 60.0;
+    arguments.read("--fps", fps);
+
+    bool hdr = arguments.read("--hdr");
+    bool keepDead = arguments.read("--keep-dead");
+    bool strict = arguments.read("--strict");
+
+    arguments.reportRemainingOptionsAsUnrecognized();
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    std::string inputFile;
+    for (int i=1; i < arguments.argc() && inputFile.empty(); i++)
+        if (!arguments.isOption(i)) inputFile = arguments[i];
+
+    // collect everything what is reported during the load and setup as validation messages
+    osg::ref_ptr<CollectNotifyHandler> notify = new CollectNotifyHandler();
+    osg::setNotifyHandler(notify.get());
+
+    // the pipeline is loaded twice, once to be written and once to be set up for the analysis,
+    // because the setup adds state to the units which shouldn't be part of the written file
+    osg::ref_ptr<osgPPU::Processor> pipeline = loadPipeline(inputFile);
+    osg::ref_ptr<osgPPU::Processor> processor = loadPipeline(inputFile);
+    if (!pipeline.valid() || !processor.valid())
+    {
+        osg::setNotifyHandler(new osg::StandardNotifyHandler());
+        std::cerr << arguments.getApplicationName() << ": " << inputFile << " is not a valid osgPPU pipeline" << std::endl;
+        return 1;
+    }
+
+    unsigned int numCycles = 0;
+    std::vector<std::string> deadUnits = optimizePipeline(pipeline.get(), !keepDead, numCycles);
+    optimizePipeline(processor.get(), !keepDead, numCycles);
+
+    // setup the pipeline as on the first frame, however with a camera which is never rendered
+    osg::ref_ptr<osg::Camera> camera = new osg::Camera();
+    camera->setViewport(0, 0, width, height);
+    camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+
+    osg::Texture2D* colorTexture = new osg::Texture2D();
+    colorTexture->setTextureSize(width, height);
+    colorTexture->setInternalFormat(hdr ? GL_RGBA16F_ARB : GL_RGBA8);
+    camera->attach(osg::Camera::COLOR_BUFFER, colorTexture);
+
+    osg::Texture2D* depthTexture = new osg::Texture2D();
+    depthTexture->setTextureSize(width, height);
+    depthTexture->setInternalFormat(GL_DEPTH_COMPONENT24);
+    camera->attach(osg::Camera::DEPTH_BUFFER, depthTexture);
+
+    processor->setCamera(camera.get());
+
+    osgUtil::UpdateVisitor uv;
+    osg::ref_ptr<osg::FrameStamp> frameStamp = new osg::FrameStamp();
+    uv.setFrameStamp(frameStamp.get());
+    processor->accept(uv);
+
+    // units in execution order
+    CollectUnitsVisitor cv;
+    cv.run(processor.get());
+    std::vector<osgPPU::Unit*> units;
+    for (std::vector<osgPPU::Unit*>::iterator it = cv.units.begin(); it != cv.units.end(); it++)
+        if ((*it)->isLive()) units.push_back(*it);
+    std::vector<osgPPU::Unit*> ordered(units.size(), (osgPPU::Unit*)NULL);
+    for (unsigned int i=0; i < units.size(); i++)
+    {
+        if (units[i]->getExecutionIndex() < ordered.size() && !ordered[units[i]->getExecutionIndex()])
+            ordered[units[i]->getExecutionIndex()] = units[i];
+        else
+            notify->error(units[i]->getName() + " is not scheduled");
+    }
+    ordered.erase(std::remove(ordered.begin(), ordered.end(), (osgPPU::Unit*)NULL), ordered.end());
+
+    // validate the setup units
+    std::map<std::string, unsigned int> names;
+    for (std::vector<osgPPU::Unit*>::iterator it = ordered.begin(); it != ordered.end(); it++)
+    {
+        osgPPU::Unit* unit = *it;
+        if (unit->getName().empty())
+            notify->warning(std::string("unnamed ") + unit->className() + ", it can not be found by osgPPU::Processor::findUnit()");
+        else if (names[unit->getName()]++ == 1)
+            notify->warning(unit->getName() + " is not a unique name, osgPPU::Processor::findUnit() returns the first unit only");
+
+        if (!unit->getViewport())
+            notify->error(unit->getName() + " has no viewport");
+
+        const osgPPU::Unit::TextureMap& input = unit->getInputTextureMap();
+        for (osgPPU::Unit::TextureMap::const_iterator jt = input.begin(); jt != input.end(); jt++)
+            if (!jt->second.valid())
+            {
+                std::stringstream str;
+                str << unit->getName() << " has no texture on input " << jt->first;
+                notify->error(str.str());
+            }
+
+        if (dynamic_cast<osgPPU::UnitInOut*>(unit) && !unit->getOutputTexture(0))
+            notify->error(unit->getName() + " has no output texture");
+    }
+
+    // output textures and their lifetime
+    std::map<osg::Texture*, unsigned int> producers;
+    std::vector<OutputTexture> outputs;
+    for (unsigned int i=0; i < ordered.size(); i++)
+    {
+        const osgPPU::Unit::TextureMap& output = ordered[i]->getOutputTextureMap();
+        for (osgPPU::Unit::TextureMap::const_iterator jt = output.begin(); jt != output.end(); jt++)
+        {
+            if (!jt->second.valid() || !dynamic_cast<osgPPU::UnitInOut*>(ordered[i])) continue;
+            producers[jt->second.get()]++;
+
+            OutputTexture out;
+            out.unit = ordered[i];
+            out.mrt = jt->first;
+            out.texture = jt->second.get();
+            out.bytes = osgPPU::computeTextureSizeInBytes(jt->second.get());
+            out.first = out.last = i;
+            out.key = getTextureDescription(jt->second.get());
+            outputs.push_back(out);
+        }
+    }
+
+    // textures consumed before they are produced are read from the previous frame
+    std::set<osg::Texture*> persistent;
+    for (unsigned int i=0; i < ordered.size(); i++)
+    {
+        const osgPPU::Unit::TextureMap& input = ordered[i]->getInputTextureMap();
+        for (osgPPU::Unit::TextureMap::const_iterator jt = input.begin(); jt != input.end(); jt++)
+        {
+            for (std::vector<OutputTexture>::iterator kt = outputs.begin(); kt != outputs.end(); kt++)
+            {
+                if (kt->texture != jt->second.get()) continue;
+                if (i <= kt->first) persistent.insert(kt->texture);
+                kt->last = osg::maximum(kt->last, i);
+            }
+        }
+    }
+
+    // passes with their estimated traffic, every input is read and every output is written once
+    std::stringstream passes;
+    double totalRead = 0, totalWritten = 0, totalMemory = 0;
+    for (unsigned int i=0; i < ordered.size(); i++)
+    {
+        osgPPU::Unit* unit = ordered[i];
+        osgPPU::UnitInOut* unitIO = dynamic_cast<osgPPU::UnitInOut*>(unit);
+
+        double read = 0, written = 0;
+        const osgPPU::Unit::TextureMap& input = unit->getInputTextureMap();
+        for (osgPPU::Unit::TextureMap::const_iterator jt = input.begin(); jt != input.end(); jt++)
+            read += osgPPU::computeTextureSizeInBytes(jt->second.get());
+
+        std::stringstream outputDesc;
+        for (std::vector<OutputTexture>::iterator jt = outputs.begin(); jt != outputs.end(); jt++)
+        {
+            if (jt->unit != unit) continue;
+            written += jt->bytes;
+            totalMemory += jt->bytes;
+            if (unitIO && unitIO->getDoubleBufferedOutput()) totalMemory += jt->bytes;
+            outputDesc << " [" << jt->mrt << "] " << jt->key;
+        }
+        totalRead += read;
+        totalWritten += written;
+
+        passes << "  " << i << "\t" << unit->getExecutionLevel() << "\t" << unit->className() << "\t" << unit->getName()
+               << "\tread " << formatBytes(read) << "\twrite " << formatBytes(written) << outputDesc.str() << std::endl;
+    }
+
+    // aliasing plan: outputs of the same layout which are not alive at the same time share one texture
+    std::vector<OutputTexture> candidates;
+    for (std::vector<OutputTexture>::iterator it = outputs.begin(); it != outputs.end(); it++)
+    {
+        osgPPU::UnitInOut* unitIO = dynamic_cast<osgPPU::UnitInOut*>(it->unit);
+        std::vector<osgPPU::Unit*> consumers;
+        bool feedback = false;
+        getConsumers(it->unit, consumers, feedback);
+
+        // outputs of sinks are used by the application, other are kept over several frames
+        if (consumers.empty() || feedback || it->unit->getPinned() || persistent.count(it->texture)) continue;
+        if (unitIO->getDoubleBufferedOutput() || producers[it->texture] > 1) continue;
+        if (dynamic_cast<osgPPU::UnitInHistoryOut*>(it->unit) || dynamic_cast<osgPPU::UnitTemporalResolve*>(it->unit)) continue;
+        candidates.push_back(*it);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), OutputTextureOrder());
+
+    std::vector<std::vector<OutputTexture> > slots;
+    for (std::vector<OutputTexture>::iterator it = candidates.begin(); it != candidates.end(); it++)
+    {
+        unsigned int s = 0;
+        for (; s < slots.size(); s++)
+            if (slots[s].back().key == it->key && slots[s].back().last < it->first) break;
+
+        if (s == slots.size()) slots.push_back(std::vector<OutputTexture>());
+        slots[s].push_back(*it);
+    }
+
+    double aliasedMemory = totalMemory;
+    std::stringstream aliasing;
+    for (unsigned int s=0; s < slots.size(); s++)
+    {
+        if (slots[s].size() < 2) continue;
+        aliasing << "  " << slots[s].front().key << ":";
+        for (unsigned int i=0; i < slots[s].size(); i++)
+        {
+            aliasing << " " << slots[s][i].unit->getName() << "[" << slots[s][i].mrt << "] (" << slots[s][i].first << "-" << slots[s][i].last << ")";
+            if (i > 0) aliasedMemory -= slots[s][i].bytes;
+        }
+        aliasing << std::endl;
+    }
+
+    // fusion candidates: a pass which output is consumed only by the next pass of the same size
+    std::stringstream fusion;
+    double fusionSaving = 0;
+    for (std::vector<osgPPU::Unit*>::iterator it = ordered.begin(); it != ordered.end(); it++)
+    {
+        osgPPU::Unit* unit = *it;
+        if (strcmp(unit->className(), "UnitInOut") != 0 || unit->getPinned()) continue;
+
+        std::vector<osgPPU::Unit*> consumers;
+        bool feedback = false;
+        getConsumers(unit, consumers, feedback);
+        if (feedback || consumers.size() != 1 || consumers[0]->getNumParents() != 1) continue;
+
+        osgPPU::UnitInOut* child = dynamic_cast<osgPPU::UnitInOut*>(consumers[0]);
+        if (!child || strcmp(child->className(), "UnitInOut") != 0) continue;
+        if (static_cast<osgPPU::UnitInOut*>(unit)->getOutputDepth() > 1 || static_cast<osgPPU::UnitInOut*>(unit)->getDoubleBufferedOutput()) continue;
+        if (!unit->getViewport() || !child->getViewport()) continue;
+        if (unit->getViewport()->width() != child->getViewport()->width() || unit->getViewport()->height() != child->getViewport()->height()) continue;
+
+        double bytes = 2.0 * osgPPU::computeTextureSizeInBytes(unit->getOutputTexture(0));
+        fusionSaving += bytes;
+        fusion << "  " << unit->getName() << " -> " << child->getName() << "\tsaves " << formatBytes(bytes) << " per frame" << std::endl;
+    }
+
+    // write the optimized pipeline and check that it can be read again
+    std::stringstream written;
+    bool failed = notify->numErrors > 0 || (strict && notify->numWarnings > 0);
+    if (!outputFile.empty() && !failed)
+    {
+        if (!osgDB::writeObjectFile(*pipeline, outputFile))
+            notify->error("unable to write " + outputFile);
+        else
+        {
+            osg::ref_ptr<osgPPU::Processor> reloaded = loadPipeline(outputFile);
+            CollectUnitsVisitor rv;
+            if (reloaded.valid()) rv.run(reloaded.get());
+
+            CollectUnitsVisitor pv;
+            pv.run(pipeline.get());
+
+            if (!reloaded.valid() || rv.units.size() != pv.units.size())
+                notify->error(outputFile + " does not contain the optimized pipeline");
+            else
+                written << "written " << outputFile << " (" << rv.units.size() << " units)" << std::endl;
+        }
+        failed = notify->numErrors > 0 || (strict && notify->numWarnings > 0);
+    }
+
+    osg::setNotifyHandler(new osg::StandardNotifyHandler());
+
+    // print out the report
+    std::ofstream reportStream;
+    if (!reportFile.empty()) reportStream.open(reportFile.c_str());
+    std::ostream& report = reportStream.is_open() ? reportStream : std::cout;
+
+    const osgPPU::Processor::Statistics& stats = processor->getStatistics();
+
+    report << "pipeline " << inputFile << " set up for " << width << "x" << height << (hdr ? " hdr" : "") << std::endl;
+    report << std::endl << "validation: " << notify->numErrors << " errors, " << notify->numWarnings << " warnings" << std::endl;
+    for (unsigned int i=0; i < notify->messages.size(); i++)
+        report << "  " << notify->messages[i] << std::endl;
+
+    report << std::endl << "optimization:" << std::endl;
+    report << "  resolved cycles\t" << numCycles << std::endl;
+    report << "  " << (keepDead ? "dead units (kept)" : "removed dead units") << "\t" << deadUnits.size() << std::endl;
+    for (unsigned int i=0; i < deadUnits.size(); i++)
+        report << "    " << deadUnits[i] << std::endl;
+    report << "  program changes\t" << stats.numProgramChangesUnsorted << " -> " << stats.numProgramChanges << std::endl;
+    report << "  fbo changes\t" << stats.numFrameBufferChangesUnsorted << " -> " << stats.numFrameBufferChanges << std::endl;
+    report << "  texture changes\t" << stats.numTextureChangesUnsorted << " -> " << stats.numTextureChanges << std::endl;
+
+    report << std::endl << "passes: " << ordered.size() << " on " << stats.numLevels << " levels" << std::endl;
+    report << "  index\tlevel\tclass\tname\tread\twrite\toutputs" << std::endl;
+    report << passes.str();
+
+    report << std::endl << "memory:" << std::endl;
+    report << "  unit outputs\t" << formatBytes(totalMemory) << std::endl;
+    report << "  with aliasing plan\t" << formatBytes(aliasedMemory) << std::endl;
+    if (!aliasing.str().empty()) report << "aliasing plan (shared texture: unit[mrt] (first-last use)):" << std::endl << aliasing.str();
+
+    report << std::endl << "bandwidth:" << std::endl;
+    report << "  per frame\t" << formatBytes(totalRead + totalWritten) << " (read " << formatBytes(totalRead) << ", write " << formatBytes(totalWritten) << ")" << std::endl;
+    report << "  at " << fps << " fps\t" << (totalRead + totalWritten) * fps / (1024.0 * 1024.0 * 1024.0) << " GB/s" << std::endl;
+    if (!fusion.str().empty())
+    {
+        report << "fusion candidates (valid if the consumer samples its input at the same texel):" << std::endl << fusion.str();
+        report << "  total\t" << formatBytes(fusionSaving) << " per frame" << std::endl;
+    }
+
+    if (!written.str().empty()) report << std::endl << written.str();
+    if (failed && !outputFile.empty()) report << std::endl << outputFile << " not written, pipeline is not valid" << std::endl;
+
+    return failed ? 1 : 0;
+}
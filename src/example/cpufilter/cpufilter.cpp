@@ -0,0 +1,248 @@
+/* osgPPU example, cpufilter.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/ClampColor>
+#include <osg/Texture2D>
+#include <osgDB/ReadFile>
+#include <osgViewer/Viewer>
+#include <OpenThreads/Thread>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitBypass.h>
+#include <osgPPU/UnitInOutModule.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/CPUModule.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+//
+// Filter the rendered scene on the cpu. A box blur is computed by a CPUModule
+// on a pool of worker threads, its results are shown some frames later. Use
+// --delay to simulate a slow filter, so that frames are dropped, and --latency
+// to give the workers more frames to finish.
+//
+
+//--------------------------------------------------------------------------
+// Box blur of the float input. Each tile reads the rows around its own rows,
+// hence the tiles can be computed independently by the workers.
+//--------------------------------------------------------------------------
+class BoxBlurModule : public osgPPU::CPUModule
+{
+public:
+    BoxBlurModule(osgPPU::UnitInOutModule* parent, int radius, unsigned int delay) :
+        osgPPU::CPUModule(parent),
+        _radius(radius),
+        _delay(delay)
+    {
+    }
+
+    void processTile(const Tile& tile)
+    {
+        ImageMap::const_iterator in = tile.inputs.find(0);
+        ImageMap::const_iterator out = tile.outputs.find(0);
+        if (in == tile.inputs.end() || out == tile.outputs.end()) return;
+
+        // input and output are float textures, i.e. four floats per pixel
+        const Image& src = in->second;
+        const Image& dst = out->second;
+        if (src.format != GL_RGBA || src.type != GL_FLOAT || dst.format != GL_RGBA || dst.type != GL_FLOAT) return;
+
+        int width = (int)osg::minimum(src.width, dst.width);
+        int height = (int)osg::minimum(src.height, dst.height);
+        std::vector<float> column(width * 4);
+
+        for (int y = (int)tile.firstRow; y < (int)(tile.firstRow + tile.numRows) && y < height; y++)
+        {
+            // sum up the rows of the window for each column
+            int y0 = osg::maximum(0, y - _radius);
+            int y1 = osg::minimum(height - 1, y + _radius);
+            std::fill(column.begin(), column.end(), 0.0f);
+            for (int r = y0; r <= y1; r++)
+            {
+                const float* row = (const float*)src.row(r);
+                for (int i=0; i < width * 4; i++) column[i] += row[i];
+            }
+
+            // average the columns of the window
+            float* result = (float*)dst.row(y);
+            for (int x=0; x < width; x++)
+            {
+                int x0 = osg::maximum(0, x - _radius);
+                int x1 = osg::minimum(width - 1, x + _radius);
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (int c = x0; c <= x1; c++)
+                    for (int i=0; i < 4; i++) sum[i] += column[c * 4 + i];
+
+                float scale = 1.0f / float((x1 - x0 + 1) * (y1 - y0 + 1));
+                for (int i=0; i < 4; i++) result[x * 4 + i] = sum[i] * scale;
+            }
+        }
+
+        // simulate a filter which needs more time
+        if (_delay) OpenThreads::Thread::microSleep(_delay * 1000);
+    }
+
+protected:
+    int _radius;
+    unsigned int _delay;
+};
+
+//--------------------------------------------------------------------------
+// Create camera resulting texture
+//--------------------------------------------------------------------------
+osg::Texture* createRenderTexture(int tex_width, int tex_height, bool depth)
+{
+    osg::Texture2D* texture2D = new osg::Texture2D;
+    texture2D->setTextureSize(tex_width, tex_height);
+    texture2D->setResizeNonPowerOfTwoHint(false);
+    texture2D->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::LINEAR);
+    texture2D->setFilter(osg::Texture2D::MAG_FILTER,osg::Texture2D::LINEAR);
+    texture2D->setWrap(osg::Texture2D::WRAP_S,osg::Texture2D::CLAMP_TO_EDGE);
+    texture2D->setWrap(osg::Texture2D::WRAP_T,osg::Texture2D::CLAMP_TO_EDGE);
+
+    // the module reads the texture back as floats
+    if (!depth)
+    {
+        texture2D->setInternalFormat(GL_RGBA32F_ARB);
+        texture2D->setSourceFormat(GL_RGBA);
+        texture2D->setSourceType(GL_FLOAT);
+    }else{
+        texture2D->setInternalFormat(GL_DEPTH_COMPONENT);
+    }
+
+    return texture2D;
+}
+
+//--------------------------------------------------------------------------
+// Setup the camera to do the render to texture
+//--------------------------------------------------------------------------
+void setupCamera(osg::Camera* camera)
+{
+    osg::Viewport* vp = camera->getViewport();
+
+    camera->setClearColor(osg::Vec4(0.0f,0.0f,0.0f,0.0f));
+    camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    camera->setViewport(vp);
+    camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    camera->attach(osg::Camera::COLOR_BUFFER, createRenderTexture((int)vp->width(), (int)vp->height(), false));
+    camera->attach(osg::Camera::DEPTH_BUFFER, createRenderTexture((int)vp->width(), (int)vp->height(), true));
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " example of filtering the scene on the cpu with osgPPU");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options] [model]");
+    arguments.getApplicationUsage()->addCommandLineOption("--radius <n>", "Radius of the box blur in pixels (default 4)");
+    arguments.getApplicationUsage()->addCommandLineOption("--threads <n>", "Number of worker threads (default number of processors)");
+    arguments.getApplicationUsage()->addCommandLineOption("--tile-rows <n>", "Number of rows processed at once by a worker (default 32)");
+    arguments.getApplicationUsage()->addCommandLineOption("--latency <n>", "Frames until the results of a frame are shown (default 2)");
+    arguments.getApplicationUsage()->addCommandLineOption("--delay <ms>", "Additional time spent by each tile (default 0)");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+
+    int radius = 4;
+    unsigned int threads = 0, tileRows = 32, latency = 2, delay = 0;
+    while (arguments.read("--radius", radius)) {}
+    while (arguments.read("--threads", threads)) {}
+    while (arguments.read("--tile-rows", tileRows)) {}
+    while (arguments.read("--latency", latency)) {}
+    while (arguments.read("--delay", delay)) {}
+
+    // construct the viewer
+    osgViewer::Viewer viewer;
+    unsigned int screenWidth, screenHeight;
+    unsigned int windowWidth = 640, windowHeight = 480;
+    osg::GraphicsContext::getWindowingSystemInterface()->getScreenResolution(osg::GraphicsContext::ScreenIdentifier(0), screenWidth, screenHeight);
+    viewer.setUpViewInWindow((screenWidth-windowWidth)/2, (screenHeight-windowHeight)/2, windowWidth, windowHeight);
+    osgViewer::GraphicsWindow* window = dynamic_cast<osgViewer::GraphicsWindow*>(viewer.getCamera()->getGraphicsContext());
+    if (window) window->setWindowName("Box blur on the cpu");
+
+    // setup scene
+    osg::Group* node = new osg::Group();
+    osg::ref_ptr<osg::Node> loadedModel = osgDB::readNodeFiles(arguments);
+    if (!loadedModel) loadedModel = osgDB::readNodeFile("Data/cow.osg");
+    if (!loadedModel)
+    {
+        std::cout << arguments.getApplicationName() << ": no model loaded" << std::endl;
+        return 1;
+    }
+    node->addChild(loadedModel.get());
+
+    // the filter works on unclamped values
+    osg::ClampColor* clamp = new osg::ClampColor();
+    clamp->setClampVertexColor(GL_FALSE);
+    clamp->setClampFragmentColor(GL_FALSE);
+    clamp->setClampReadColor(GL_FALSE);
+    node->getOrCreateStateSet()->setAttribute(clamp, osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE | osg::StateAttribute::PROTECTED);
+
+    // setup processor with the color output of the camera as input
+    osg::ref_ptr<osgPPU::Processor> processor = new osgPPU::Processor;
+    processor->setName("Processor");
+
+    osgPPU::UnitBypass* bypass = new osgPPU::UnitBypass();
+    bypass->setName("ColorBypass");
+    processor->addChild(bypass);
+
+    // unit running the module, the output has the same float format as the input
+    osgPPU::UnitInOutModule* unitCPU = new osgPPU::UnitInOutModule();
+    unitCPU->setName("CPUFilter");
+    unitCPU->setOutputInternalFormat(GL_RGBA32F_ARB);
+    bypass->addChild(unitCPU);
+
+    // the worker threads are started when the module is set
+    osg::ref_ptr<BoxBlurModule> module = new BoxBlurModule(unitCPU, radius, delay);
+    if (threads > 0) module->setNumThreads(threads);
+    module->setTileRows(tileRows);
+    module->setFrameLatency(latency);
+    unitCPU->setModule(module.get());
+
+    osgPPU::UnitOut* unitOut = new osgPPU::UnitOut();
+    unitOut->setName("Output");
+    unitCPU->addChild(unitOut);
+
+    setupCamera(viewer.getCamera());
+    processor->setCamera(viewer.getCamera());
+    node->addChild(processor.get());
+    viewer.setSceneData(node);
+
+    std::cout << "Box blur of radius " << radius << " on " << module->getNumThreads() << " threads, " << module->getFrameLatency() << " frames latency" << std::endl;
+
+    // report the frames dropped since the workers were too slow
+    unsigned int dropped = 0;
+    viewer.realize();
+    while (!viewer.done())
+    {
+        viewer.frame();
+        if (module->getNumDroppedFrames() != dropped)
+        {
+            dropped = module->getNumDroppedFrames();
+            std::cout << "Frame " << viewer.getFrameStamp()->getFrameNumber() << ": " << dropped << " frames dropped" << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -333,6 +333,9 @@ osg::Group* createShadowedScene(osg::Node* reflectedSubgraph, osg::NodePath refl
             // to prevent this we add the cubemap texture specified before as output texture
             unit->setOutputTexture(ppuTexture, 0);
 
+            // the cubemap is used by the scene only, hence keep the unit in the pipeline
+            unit->setPinned(true);
+
             // add shader to the unit
             unit->getOrCreateStateSet()->setAttributeAndModes(program);
 
@@ -29,7 +29,7 @@ extern void blurKernelWrapper(float4* in_data, float4* out_data, int width, int
 class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
 {
     public:
-        ProcessingModule(UnitInOutModule* parent) : UnitInOutModule::Module(parent)
+        ProcessingModule(UnitInOutModule* parent) : UnitInOutModule::Module(parent), _running(false)
         {
             // to get all thing properly we have to specify one input and one output pbo
             parent->setUsePBOForInputTexture(0, true);
@@ -42,6 +42,7 @@ class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
         {
             // force exit of CUDA
             cudaThreadSynchronize();
+            cudaEventDestroy(_done);
             cudaThreadExit();
             osg::notify(osg::INFO) << "osgPPU - Module - cudaKernel release" << std::endl;
         }
@@ -66,6 +67,7 @@ class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
                 exit(EXIT_FAILURE);                                                  
             }                                                                        
             CUDA_SAFE_CALL(cudaSetDevice(dev));
+            CUDA_SAFE_CALL(cudaEventCreate(&_done));
 
             // print some debug info
             printf("Cuda BlurKernel Module for osgPPU:\n");
@@ -82,9 +84,14 @@ class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
 
 
         //-----------------------------------------------------------------------------
-        // Register/Map textures into CUDA space and process them
+        // The kernel runs while the following frames are rendered
         //-----------------------------------------------------------------------------
-        bool beginAndProcess()
+        bool isAsynchronous() const { return true; }
+
+        //-----------------------------------------------------------------------------
+        // Register/Map textures into CUDA space and start processing them
+        //-----------------------------------------------------------------------------
+        bool submit(osg::RenderInfo&)
         {
             // get first input pbo
             const osg::PixelDataBufferObject* ipbo = _parent->getInputPBO(0);
@@ -113,20 +120,30 @@ class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
             // radius of how much sampling points around the current one        
             int radius = 4;
 
-            // run kernel with the specified parameters
+            // run kernel with the specified parameters, the launch does not block
             blurKernelWrapper(in_data, out_data, width, height, radius);
+            CUDA_SAFE_CALL(cudaEventRecord(_done, 0));
+            _running = true;
             //-----------------------------------------------------------------------------
 
-            // don't render anything afterwards
-            return false;
+            return true;
         }
 
+        //-----------------------------------------------------------------------------
+        // Check if the kernel is done without waiting for it
+        //-----------------------------------------------------------------------------
+        bool isComplete(osg::RenderInfo&)
+        {
+            return cudaEventQuery(_done) != cudaErrorNotReady;
+        }
 
         //-----------------------------------------------------------------------------
         // Unmap/Unregister data, so that results are copied back
         //-----------------------------------------------------------------------------
-        void end()
+        void complete(osg::RenderInfo&)
         {
+            _running = false;
+
             // get first input pbo
             const osg::PixelDataBufferObject* ipbo = _parent->getInputPBO(0);
             const osg::PixelDataBufferObject* opbo = _parent->getOutputPBO(0);
@@ -141,6 +158,24 @@ class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
             CUDA_SAFE_CALL(cudaGLUnregisterBufferObject(ipbo->getGLBufferObject(0)->getGLObjectID()));
         }
 
+        //-----------------------------------------------------------------------------
+        // Wait for a running kernel before the module is removed or reloaded
+        //-----------------------------------------------------------------------------
+        void shutdown()
+        {
+            if (!_running) return;
+
+            cudaEventSynchronize(_done);
+            osg::RenderInfo ri;
+            complete(ri);
+        }
+
+    protected:
+        //! Recorded after the kernel launch
+        cudaEvent_t _done;
+
+        //! Are the buffers mapped by a running kernel
+        bool _running;
 };
 
 
@@ -161,4 +196,9 @@ extern "C" bool OSGPPU_CUDAK_EXPORT OSGPPU_MODULE_ENTRY(UnitInOutModule* parent)
     return true;
 }
 
+//-----------------------------------------------------------------------------
+// The module runs asynchronously and can be reloaded while the viewer runs
+//-----------------------------------------------------------------------------
+OSGPPU_MODULE_DECLARE_ABI(OSGPPU_CUDAK_EXPORT, UnitInOutModule::MODULE_ASYNCHRONOUS | UnitInOutModule::MODULE_RELOADABLE)
+
 #endif // __PROCESSING_MODUL_H_
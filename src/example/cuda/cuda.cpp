@@ -127,6 +127,9 @@ int main(int argc, char **argv)
     unitCuda->loadModule("../lib/osgppu_cudakernel.so");
 #endif
 
+    // rebuilding the module while the example runs swaps it between two frames
+    unitCuda->setReloadOnChange(true);
+
     // setup output unit 
     osg::ref_ptr<osgPPU::UnitOut> unitOut = new osgPPU::UnitOut;
     unitOut->setName("Output");
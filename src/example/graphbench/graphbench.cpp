@@ -0,0 +1,329 @@
+/* osgPPU example, graphbench.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Notify>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/Unit.h>
+#include <osgPPU/Visitor.h>
+#include <osgPPU/BarrierNode.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <new>
+#include <cstdlib>
+
+//
+// Benchmark of the unit graph setup passes. The example does not render
+// anything, it just generates unit graphs of different size and measures the
+// memory used per unit and the time spent in the visitors which are run by
+// the processor whenever the unit graph becomes dirty. On small graphs the
+// passes are compared against the implementation used before.
+//
+
+//--------------------------------------------------------------------------
+// Count the bytes allocated on the heap, so that the memory used by the
+// units can be measured. Every block carries a header in front of it with
+// the counted size and the start of the allocated block. Bytes are counted
+// only while the graphs are created on the main thread, hence the counter is
+// not shared with any other thread.
+//--------------------------------------------------------------------------
+static size_t g_allocatedBytes = 0;
+static bool g_countAllocations = false;
+static const size_t g_headerSize = 16;
+
+struct AllocationHeader
+{
+    size_t countedSize;
+    void* block;
+};
+
+static void* allocate(size_t size, size_t alignment)
+{
+    if (alignment < g_headerSize) alignment = g_headerSize;
+
+    char* block = static_cast<char*>(malloc(size + alignment + g_headerSize));
+    if (block == NULL) return NULL;
+
+    // place the header right in front of the aligned pointer
+    size_t offset = g_headerSize + alignment - (reinterpret_cast<size_t>(block) + g_headerSize) % alignment;
+    if (offset - g_headerSize == alignment) offset = g_headerSize;
+    char* ptr = block + offset;
+
+    AllocationHeader* header = reinterpret_cast<AllocationHeader*>(ptr) - 1;
+    header->block = block;
+    header->countedSize = g_countAllocations ? size : 0;
+    g_allocatedBytes += header->countedSize;
+
+    return ptr;
+}
+
+static void deallocate(void* ptr)
+{
+    if (ptr == NULL) return;
+
+    AllocationHeader* header = reinterpret_cast<AllocationHeader*>(ptr) - 1;
+    if (g_countAllocations) g_allocatedBytes -= header->countedSize;
+    free(header->block);
+}
+
+void* operator new(size_t size)
+{
+    void* ptr = allocate(size, g_headerSize);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() { return allocate(size, g_headerSize); }
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, const std::nothrow_t&) throw() { return allocate(size, g_headerSize); }
+
+void operator delete(void* ptr) throw() { deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) throw() { deallocate(ptr); }
+void operator delete[](void* ptr) throw() { deallocate(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) throw() { deallocate(ptr); }
+
+// aligned allocations are part of the language since C++17
+#if __cplusplus >= 201703L
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    void* ptr = allocate(size, static_cast<size_t>(alignment));
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<size_t>(alignment)); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(ptr); }
+#endif
+
+//--------------------------------------------------------------------------
+// Generate a graph of diamonds, as used by multi-branch effects like bloom.
+// Every layer contains two units, each connected to both units of the next
+// layer. Every 8th layer feeds back into a unit four layers above, which gives
+// cycles that have to be resolved.
+//--------------------------------------------------------------------------
+osgPPU::Processor* createDiamondGraph(unsigned int numUnits)
+{
+    osgPPU::Processor* processor = new osgPPU::Processor();
+
+    std::vector<std::vector<osgPPU::Unit*> > layers;
+
+    for (unsigned int i=0; i < numUnits; i+=2)
+    {
+        std::vector<osgPPU::Unit*> current;
+        for (unsigned int j=0; j < 2; j++)
+        {
+            std::stringstream name;
+            name << "Unit" << i+j;
+
+            osgPPU::Unit* unit = new osgPPU::Unit();
+            unit->setName(name.str());
+            current.push_back(unit);
+
+            if (layers.empty())
+                processor->addChild(unit);
+            else
+                for (unsigned int k=0; k < layers.back().size(); k++)
+                    layers.back()[k]->addChild(unit);
+        }
+
+        // add a feedback edge
+        if (layers.size() >= 4 && layers.size() % 8 == 0)
+            current[0]->addChild(layers[layers.size()-4][1]);
+
+        layers.push_back(current);
+    }
+
+    return processor;
+}
+
+//--------------------------------------------------------------------------
+// Cycle resolution as done by osgPPU before the depth first pass was used.
+// Every path through the graph is traversed and the whole node path is searched
+// for the current node, hence it is exponential in the number of diamonds.
+// It is kept here to compare the new visitor against it.
+//--------------------------------------------------------------------------
+class LegacyResolveUnitsCyclesVisitor : public osgPPU::UnitVisitor
+{
+public:
+    LegacyResolveUnitsCyclesVisitor() : osgPPU::UnitVisitor(), numResolvedCycles(0) {}
+
+    void apply(osg::Group& node)
+    {
+        bool foundCycle = false;
+
+        osg::NodePath::reverse_iterator it = getNodePath().rbegin(); it++;
+        for (; it != getNodePath().rend(); it++)
+        {
+            if (*it == &node)
+            {
+                osgPPU::BarrierNode* br = new osgPPU::BarrierNode();
+                foundCycle = true;
+                numResolvedCycles++;
+
+                it--;
+                (dynamic_cast<osg::Group*>(*it))->replaceChild(&node, br);
+                br->setBlockedChild(&node);
+                br->setBlockedParent(dynamic_cast<osg::Group*>(*it));
+                it++;
+            }
+        }
+
+        if (!foundCycle) node.traverse(*this);
+    }
+
+    unsigned int numResolvedCycles;
+};
+
+//--------------------------------------------------------------------------
+// Execution order setup as done by osgPPU before units were indexed. Every
+// path through the graph is traversed and units are deduplicated by a linear
+// search in a list.
+//--------------------------------------------------------------------------
+class LegacySetupUnitRenderingVisitor : public osgPPU::UnitVisitor
+{
+public:
+    void apply(osg::Group& node)
+    {
+        for (int i = (int)node.getNumChildren()-1; i >= 0; i--)
+            node.getChild(i)->accept(*this);
+
+        osgPPU::Unit* unit = dynamic_cast<osgPPU::Unit*>(&node);
+        if (unit != NULL)
+        {
+            bool found = false;
+            for (std::list<osgPPU::Unit*>::iterator it = units.begin(); it != units.end(); it++)
+                if (*it == unit) found = true;
+            if (!found) units.push_front(unit);
+        }
+    }
+
+    std::list<osgPPU::Unit*> units;
+};
+
+//--------------------------------------------------------------------------
+// Compare the old and the new setup passes. The old ones do not scale beyond
+// a few dozens of units in diamond graphs, hence only small graphs are used.
+//--------------------------------------------------------------------------
+void runBaseline(unsigned int maxUnits)
+{
+    osg::Timer* timer = osg::Timer::instance();
+
+    std::cout << "units\tcycles old (new)\tresolve cycles old [ms]\tresolve cycles new [ms]\tsetup order old [ms]\tsetup order new [ms]" << std::endl;
+    for (unsigned int numUnits = 8; numUnits <= maxUnits; numUnits += 8)
+    {
+        osg::ref_ptr<osgPPU::Processor> legacy = createDiamondGraph(numUnits);
+        osg::ref_ptr<osgPPU::Processor> processor = createDiamondGraph(numUnits);
+
+        osg::Timer_t start = timer->tick();
+        LegacyResolveUnitsCyclesVisitor lrv;
+        lrv.run(legacy.get());
+        double legacyResolveTime = timer->delta_m(start, timer->tick());
+
+        start = timer->tick();
+        osgPPU::ResolveUnitsCyclesVisitor rv;
+        rv.run(processor.get());
+        double resolveTime = timer->delta_m(start, timer->tick());
+
+        start = timer->tick();
+        LegacySetupUnitRenderingVisitor lsv;
+        lsv.run(legacy.get());
+        double legacySetupTime = timer->delta_m(start, timer->tick());
+
+        start = timer->tick();
+        osgPPU::SetupUnitRenderingVisitor sv(processor.get());
+        sv.setInitUnitsWhenFound(false);
+        sv.run(processor.get());
+        double setupTime = timer->delta_m(start, timer->tick());
+
+        std::cout << numUnits << "\t" << lrv.numResolvedCycles << " (" << rv.getNumResolvedCycles() << ")\t" << legacyResolveTime << "\t" << resolveTime << "\t" << legacySetupTime << "\t" << setupTime << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    // use an ArgumentParser object to manage the program arguments.
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " measures the setup time of osgPPU unit graphs");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [--units <max>] [--baseline <max>]");
+    arguments.getApplicationUsage()->addCommandLineOption("--units <max>", "Maximal number of units in the generated graphs (default 10000)");
+    arguments.getApplicationUsage()->addCommandLineOption("--baseline <max>", "Maximal number of units in the graphs used to compare against the old setup passes (default 40, 0 to disable)");
+
+    // if user request help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+
+    unsigned int maxUnits = 10000;
+    arguments.read("--units", maxUnits);
+
+    unsigned int maxBaselineUnits = 40;
+    arguments.read("--baseline", maxBaselineUnits);
+    if (maxBaselineUnits > 0) runBaseline(maxBaselineUnits);
+
+    osg::Timer* timer = osg::Timer::instance();
+
+    std::cout << "units\tbytes/unit\tcycles\tresolve cycles [ms]\tsetup order [ms]\t1000x findUnit [ms]" << std::endl;
+    for (unsigned int numUnits = 100; numUnits <= maxUnits; numUnits *= 10)
+    {
+        g_allocatedBytes = 0;
+        g_countAllocations = true;
+        osg::ref_ptr<osgPPU::Processor> processor = createDiamondGraph(numUnits);
+        g_countAllocations = false;
+        size_t bytesPerUnit = g_allocatedBytes / numUnits;
+
+        osg::Timer_t start = timer->tick();
+        osgPPU::ResolveUnitsCyclesVisitor rv;
+        rv.run(processor.get());
+        double resolveTime = timer->delta_m(start, timer->tick());
+
+        // compute execution order only, units can not be initialized without a camera
+        start = timer->tick();
+        osgPPU::SetupUnitRenderingVisitor sv(processor.get());
+        sv.setInitUnitsWhenFound(false);
+        sv.run(processor.get());
+        double setupTime = timer->delta_m(start, timer->tick());
+
+        // search the last unit, as it might be done per frame to change parameters
+        std::stringstream name;
+        name << "Unit" << numUnits - 1;
+        start = timer->tick();
+        for (unsigned int i=0; i < 1000; i++)
+            processor->findUnit(name.str());
+        double findTime = timer->delta_m(start, timer->tick());
+
+        std::cout << numUnits << "\t" << bytesPerUnit << "\t" << rv.getNumResolvedCycles() << "\t" << resolveTime << "\t" << setupTime << "\t" << findTime << std::endl;
+    }
+
+    return 0;
+}
@@ -278,20 +278,12 @@ class HDRRendering
             sceneLuminance->addChild(adaptedlum);
 
 
-            // The adapted luminance ppu do compute it. However if you
-            // can follow me for now, you maybe encounter, that this ppu do
-            // have to write into the same texture as it also read from.
-            // To prevent this, we just generate an inout ppu which do
-            // nothing than render the copy of input to the output.
-            // We will use the output of this ppu as input for the
-            // adapted luminance ppu. In this way we do not write to the
-            // same texture as we have readed from.
-            osgPPU::UnitInOut* adaptedlumCopy = new osgPPU::UnitInOut();
-            adaptedlumCopy->setName("AdaptedLuminanceCopy");
-            adaptedlumCopy->addChild(adaptedlum);
+            // The adapted luminance ppu does need its own result of the previous
+            // frame as second input. The output becomes double buffered, so that
+            // the ppu does not write into the same texture as it reads from.
+            osgPPU::Unit::connectPreviousFrame(adaptedlum, adaptedlum, 1);
 
             // now connect the output of the adaptedlum with the rest where it is needed
-            adaptedlum->addChild(adaptedlumCopy);
 
             adaptedlum->addChild(brightpass);
             brightpass->setInputToUniform(adaptedlum, "texAdaptedLuminance");
@@ -311,7 +311,8 @@ public:
                     textppu->setText("Gauss Blur on Brightpass");
                 }else if (ea.getKey() == osgGA::GUIEventAdapter::KEY_F5)
                 {
-                    ppu->setTexture(viewer->getProcessor()->findUnit("AdaptedLuminanceCopy")->getOrCreateOutputTexture(0));
+                    // the output is double buffered, the texture shows the adapted luminance of the last even frame
+                    ppu->setTexture(viewer->getProcessor()->findUnit("AdaptedLuminance")->getOrCreateOutputTexture(0));
                     textppu->setText("Adapted Luminance");
                 }
                 #if 1
@@ -179,6 +179,9 @@ osg::StateSet* createState(osgPPU::Processor* processor)
     mainUnit->setOutputTexture(texture3D, 0);
     mainUnit->getOrCreateStateSet()->setAttributeAndModes(program);
 
+    // the 3D texture is used by the scene only, hence keep the unit in the pipeline
+    mainUnit->setPinned(true);
+
     // the unit should work only on the 2nd texture
     mainUnit->setOutputZSlice(1);
 
@@ -187,6 +187,9 @@ int main(int , char **)
     unitInOut->setName("Video processing");
     gUnitTexture = unitInOut->getOrCreateOutputTexture(0);
 
+    // the output is used by the scene only, hence keep the unit in the pipeline
+    unitInOut->setPinned(true);
+
     // setup appropriate pipeline to perform video processing
     node->addChild(processor);
     processor->addChild(unitTexture);
@@ -0,0 +1,352 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/CPUModule.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/Image>
+#include <OpenThreads/ScopedLock>
+
+#include <string.h>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    // Memory block whose data is 16 byte aligned
+    //------------------------------------------------------------------------------
+    struct AlignedBuffer
+    {
+        AlignedBuffer() : data(NULL), size(0) {}
+
+        void resize(unsigned int s)
+        {
+            if (s > size || data == NULL)
+            {
+                storage.resize(s + 15);
+                data = &storage[0] + ((16 - ((size_t)&storage[0] & 15)) & 15);
+            }
+            size = s;
+        }
+
+        std::vector<unsigned char> storage;
+        unsigned char* data;
+        unsigned int size;
+    };
+
+    //------------------------------------------------------------------------------
+    // Describe the data of the texture given in the layout of the unit's PBOs
+    //------------------------------------------------------------------------------
+    static CPUModule::Image createImage(const osg::Texture* texture, unsigned char* data, unsigned int size)
+    {
+        CPUModule::Image image;
+        image.data = data;
+        image.format = osg::Image::computePixelFormat(texture->getInternalFormat());
+        image.type = osg::Image::computeFormatDataType(texture->getInternalFormat());
+        image.width = osg::maximum(1, texture->getTextureWidth());
+        image.rowSize = osg::Image::computeRowWidthInBytes(image.width, image.format, image.type, 4);
+        image.height = image.rowSize ? size / image.rowSize : 0;
+        return image;
+    }
+
+    //------------------------------------------------------------------------------
+    // Input and output data of one frame
+    //------------------------------------------------------------------------------
+    struct CPUModule::Job : public osg::Referenced
+    {
+        Job() : sequence(0), numRows(0), tileRows(1), pendingTiles(0), finished(false) {}
+
+        unsigned int sequence;
+        unsigned int numRows;
+        unsigned int tileRows;
+        unsigned int pendingTiles;
+        bool finished;
+
+        std::map<int, AlignedBuffer> inputs;
+        std::map<int, AlignedBuffer> outputs;
+        ImageMap inputImages;
+        ImageMap outputImages;
+    };
+
+    //------------------------------------------------------------------------------
+    // Worker thread processing the tiles of the queue
+    //------------------------------------------------------------------------------
+    class CPUModule::Worker : public OpenThreads::Thread
+    {
+        public:
+            Worker(CPUModule* module) : _module(module) {}
+
+            virtual void run()
+            {
+                Job* job = NULL;
+                unsigned int tile = 0;
+                while (_module->nextTask(job, tile))
+                {
+                    Tile t;
+                    t.firstRow = tile * job->tileRows;
+                    t.numRows = osg::minimum(job->tileRows, job->numRows - t.firstRow);
+                    t.inputs = job->inputImages;
+                    t.outputs = job->outputImages;
+                    t.frame = job->sequence;
+
+                    _module->processTile(t);
+                    _module->finishTask(job);
+                }
+            }
+
+        protected:
+            CPUModule* _module;
+    };
+
+    //------------------------------------------------------------------------------
+    // Forward the mapped PBOs of the unit to the module
+    //------------------------------------------------------------------------------
+    class CPUModule::Callback : public Unit::PBOCallback
+    {
+        public:
+            META_Object(osgPPU, Callback);
+
+            Callback() : _module(NULL) {}
+            Callback(CPUModule* module) : _module(module) {}
+            Callback(const Callback& cb, const osg::CopyOp& copyop) : Unit::PBOCallback(cb, copyop), _module(cb._module) {}
+
+            void readInput(osg::RenderInfo&, const Unit*, int index, const void* data, unsigned int size) const
+            {
+                if (_module) _module->readInput(index, data, size);
+            }
+
+            void writeOutput(osg::RenderInfo&, const Unit*, int mrt, void* data, unsigned int size) const
+            {
+                if (_module) _module->writeOutput(mrt, data, size);
+            }
+
+            CPUModule* _module;
+    };
+
+    //------------------------------------------------------------------------------
+    CPUModule::CPUModule(UnitInOutModule* parent, unsigned int numInputs, unsigned int numOutputs) :
+        UnitInOutModule::Module(parent),
+        _numInputs(numInputs),
+        _numOutputs(numOutputs),
+        _numThreads(osg::maximum(1, OpenThreads::GetNumberOfProcessors())),
+        _tileRows(32),
+        _frameLatency(2),
+        _numDroppedFrames(0),
+        _numSubmitted(0),
+        _resultSelected(false),
+        _quit(false)
+    {
+        // input is read back and output uploaded by the unit's PBOs
+        for (unsigned int i=0; i < _numInputs; i++)
+            parent->setUsePBOForInputTexture(i, true);
+        for (unsigned int i=0; i < _numOutputs; i++)
+            parent->setUsePBOForOutputTexture(i, true);
+        parent->setNumPBOBuffers(1);
+
+        _callback = new Callback(this);
+        parent->setPBOCallback(_callback.get());
+    }
+
+    //------------------------------------------------------------------------------
+    CPUModule::~CPUModule()
+    {
+        stopThreads();
+
+        _callback->_module = NULL;
+        if (_parent->getPBOCallback() == _callback.get())
+            _parent->setPBOCallback(NULL);
+    }
+
+    //------------------------------------------------------------------------------
+    bool CPUModule::init()
+    {
+        stopThreads();
+        startThreads();
+        return true;
+    }
+
+    //------------------------------------------------------------------------------
+    void CPUModule::startThreads()
+    {
+        for (unsigned int i=0; i < _numThreads; i++)
+        {
+            Worker* worker = new Worker(this);
+            worker->start();
+            _workers.push_back(worker);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void CPUModule::stopThreads()
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _quit = true;
+            _tasks.clear();
+            _taskCondition.broadcast();
+        }
+
+        for (unsigned int i=0; i < _workers.size(); i++)
+        {
+            _workers[i]->join();
+            delete _workers[i];
+        }
+        _workers.clear();
+
+        // unfinished jobs are dropped
+        _inFlight.clear();
+        _filling = NULL;
+        _quit = false;
+    }
+
+    //------------------------------------------------------------------------------
+    bool CPUModule::nextTask(Job*& job, unsigned int& tile)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        while (_tasks.empty() && !_quit)
+            _taskCondition.wait(&_mutex);
+        if (_quit) return false;
+
+        job = _tasks.front().first;
+        tile = _tasks.front().second;
+        _tasks.pop_front();
+        return true;
+    }
+
+    //------------------------------------------------------------------------------
+    void CPUModule::finishTask(Job* job)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (--job->pendingTiles == 0)
+        {
+            job->finished = true;
+            _doneCondition.broadcast();
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void CPUModule::readInput(int index, const void* data, unsigned int size)
+    {
+        const osg::Texture* texture = _parent->getInputTexture(index);
+        if (texture == NULL) return;
+
+        if (!_filling.valid())
+        {
+            if (_freeJobs.empty())
+                _filling = new Job();
+            else
+            {
+                _filling = _freeJobs.back();
+                _freeJobs.pop_back();
+            }
+            _filling->inputImages.clear();
+            _filling->outputImages.clear();
+        }
+
+        AlignedBuffer& buffer = _filling->inputs[index];
+        buffer.resize(size);
+        memcpy(buffer.data, data, size);
+        _filling->inputImages[index] = createImage(texture, buffer.data, size);
+    }
+
+    //------------------------------------------------------------------------------
+    bool CPUModule::beginAndProcess()
+    {
+        _resultSelected = false;
+        if (!_filling.valid() || _workers.empty()) return false;
+
+        osg::ref_ptr<Job> job = _filling;
+        _filling = NULL;
+
+        // workers are too slow, hence drop the input instead of queuing it
+        if (_inFlight.size() > _frameLatency)
+        {
+            _freeJobs.push_back(job);
+            _numDroppedFrames++;
+            return false;
+        }
+
+        // allocate the outputs, the tiles are rows of the highest output
+        job->numRows = 0;
+        for (unsigned int i=0; i < _numOutputs; i++)
+        {
+            osg::Texture* texture = _parent->getOutputTexture(i);
+            if (texture == NULL) continue;
+
+            unsigned int size = computeTextureSizeInBytes(texture);
+            AlignedBuffer& buffer = job->outputs[i];
+            buffer.resize(size);
+            job->outputImages[i] = createImage(texture, buffer.data, size);
+            job->numRows = osg::maximum(job->numRows, job->outputImages[i].height);
+        }
+        if (job->numRows == 0)
+        {
+            _freeJobs.push_back(job);
+            return false;
+        }
+
+        job->tileRows = _tileRows;
+        job->sequence = _numSubmitted++;
+        job->finished = false;
+        unsigned int numTiles = (job->numRows + job->tileRows - 1) / job->tileRows;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        job->pendingTiles = numTiles;
+        for (unsigned int i=0; i < numTiles; i++)
+            _tasks.push_back(std::make_pair(job.get(), i));
+        _inFlight.push_back(job);
+        _taskCondition.broadcast();
+
+        // the quad is not rendered, output comes from the pbos
+        return false;
+    }
+
+    //------------------------------------------------------------------------------
+    void CPUModule::writeOutput(int mrt, void* data, unsigned int size)
+    {
+        // select once per frame the latest finished job which is due
+        if (!_resultSelected)
+        {
+            _resultSelected = true;
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            while (!_inFlight.empty())
+            {
+                Job* job = _inFlight.front().get();
+                if (job->sequence + _frameLatency > _numSubmitted) break;
+
+                // only without latency the draw thread waits for the workers
+                if (!job->finished)
+                {
+                    if (_frameLatency > 1) break;
+                    while (!job->finished) _doneCondition.wait(&_mutex);
+                }
+
+                if (_result.valid()) _freeJobs.push_back(_result);
+                _result = job;
+                _inFlight.pop_front();
+            }
+        }
+
+        // upload the last results again if nothing new is finished
+        std::map<int, AlignedBuffer>::const_iterator it;
+        if (_result.valid() && (it = _result->outputs.find(mrt)) != _result->outputs.end())
+            memcpy(data, it->second.data, osg::minimum(size, it->second.size));
+        else
+            memset(data, 0, size);
+    }
+
+}; // end namespace
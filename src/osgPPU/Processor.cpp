@@ -26,6 +26,8 @@
 #include <osg/Material>
 
 #include <assert.h>
+#include <algorithm>
+#include <set>
 
 #include <osgUtil/RenderBin>
 
@@ -52,6 +54,9 @@ class CollectLastUnitsCallback : public osg::NodeCallback
 
 //------------------------------------------------------------------------------
 // Helper class used as render bin
+// Units are collected in the traversal order, which respects their dependencies.
+// The bin reorders them according to the execution order computed by the processor,
+// so that units which do not depend on each other are rendered with less state changes.
 //------------------------------------------------------------------------------
 class PPUProcessingBin : public osgUtil::RenderBin
 {
@@ -61,6 +66,56 @@ class PPUProcessingBin : public osgUtil::RenderBin
             setName(name);
             setSortMode(osgUtil::RenderBin::TRAVERSAL_ORDER);
         }
+
+        PPUProcessingBin(const PPUProcessingBin& bin, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY) :
+            osgUtil::RenderBin(bin, copyop)
+        {
+        }
+
+        virtual osg::Object* cloneType() const { return new PPUProcessingBin(getName()); }
+        virtual osg::Object* clone(const osg::CopyOp& copyop) const { return new PPUProcessingBin(*this, copyop); }
+
+        virtual void sortImplementation()
+        {
+            sortTraversalOrder();
+
+            // units can be traversed several times per frame (i.e. UnitInOutRepeat), hence
+            // reorder only runs of leaves in which every unit appears once
+            RenderLeafList::iterator begin = _renderLeafList.begin();
+            std::set<const Unit*> units;
+            const Unit* lastUnit = NULL;
+            for (RenderLeafList::iterator it = _renderLeafList.begin(); it != _renderLeafList.end(); it++)
+            {
+                const Unit* unit = getUnit(*it);
+                if (unit == NULL || (unit != lastUnit && units.find(unit) != units.end()))
+                {
+                    std::stable_sort(begin, it, ExecutionOrder());
+                    units.clear();
+                    begin = unit ? it : it + 1;
+                }
+                if (unit) units.insert(unit);
+                lastUnit = unit;
+            }
+            std::stable_sort(begin, _renderLeafList.end(), ExecutionOrder());
+        }
+
+    protected:
+
+        // get unit to which the drawable of the leaf belongs to
+        static const Unit* getUnit(const osgUtil::RenderLeaf* leaf)
+        {
+            const osg::Drawable* dr = leaf->_drawable;
+            if (dr == NULL || dr->getNumParents() == 0 || dr->getParent(0)->getNumParents() == 0) return NULL;
+            return dynamic_cast<const Unit*>(dr->getParent(0)->getParent(0));
+        }
+
+        struct ExecutionOrder
+        {
+            bool operator()(const osgUtil::RenderLeaf* a, const osgUtil::RenderLeaf* b) const
+            {
+                return getUnit(a)->getExecutionIndex() < getUnit(b)->getExecutionIndex();
+            }
+        };
 };
 
 // This is a default rendering bin which all units are usign
@@ -72,7 +127,9 @@ Processor::Processor()
     // set some variables
     mbDirty = true;
     mbDirtyUnitGraph = true;
+    mbDirtyUnitLiveness = true;
     mUseColorClamp = true;
+    mUseStateSorting = true;
     mCollectLastUnitsCallback = new CollectLastUnitsCallback(this);
 
     // first we have to create a render bin which will hold the units
@@ -96,7 +153,9 @@ Processor::Processor(const Processor& pp, const osg::CopyOp& copyop) :
     //mVisitor(pp.mVisitor),
     mbDirty(pp.mbDirty),
     mbDirtyUnitGraph(pp.mbDirtyUnitGraph),
-    mUseColorClamp(pp.mUseColorClamp)
+    mbDirtyUnitLiveness(pp.mbDirtyUnitLiveness),
+    mUseColorClamp(pp.mUseColorClamp),
+    mUseStateSorting(pp.mUseStateSorting)
 {
 }
 
@@ -167,11 +226,67 @@ void Processor::setCamera(osg::Camera* camera)
 //------------------------------------------------------------------------------
 Unit* Processor::findUnit(const std::string& name)
 {
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitIndexMutex);
+
+    // first check the index, it is valid as soon as the subgraph is set up, however units
+    // might be detached from the graph since then, hence check them once after the subgraph got dirty
+    UnitIndex::iterator it = mUnitIndex.find(name);
+    if (it != mUnitIndex.end())
+    {
+        UnitIndexEntry& entry = it->second;
+        if (entry.unit.valid() && entry.unit->getName() == name)
+        {
+            if (!entry.attached) entry.attached = isUnitAttached(entry.unit.get());
+            if (entry.attached) return entry.unit.get();
+        }
+        mUnitIndex.erase(it);
+    }
+
+    // names which weren't found are not searched again until the subgraph changes
+    if (mMissingUnitNames.find(name) != mMissingUnitNames.end()) return NULL;
+
+    // unit might be added after the subgraph was set up, hence search for it
     FindUnitVisitor uv(name);
     uv.run(this);
+    if (uv.getResult()) mUnitIndex[name] = UnitIndexEntry(uv.getResult());
+    else mMissingUnitNames.insert(name);
     return uv.getResult();
 }
 
+//------------------------------------------------------------------------------
+bool Processor::isUnitAttached(Unit* unit)
+{
+    // go upwards until the processor is found, the first path found is enough
+    std::set<osg::Group*> visited;
+    std::vector<osg::Group*> stack(1, unit);
+    while (!stack.empty())
+    {
+        osg::Group* node = stack.back();
+        stack.pop_back();
+        if (node == this) return true;
+        if (!visited.insert(node).second) continue;
+
+        const osg::Node::ParentList& parents = node->getParents();
+        for (osg::Node::ParentList::const_reverse_iterator jt = parents.rbegin(); jt != parents.rend(); jt++)
+            stack.push_back(*jt);
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void Processor::updateUnitIndex(Unit* unit, const std::string& oldName)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitIndexMutex);
+
+    UnitIndex::iterator it = mUnitIndex.find(oldName);
+    if (it != mUnitIndex.end() && it->second.unit == unit) mUnitIndex.erase(it);
+
+    // the unit was found by going upwards to the processor, hence it is attached
+    if (mUnitIndex.find(unit->getName()) == mUnitIndex.end())
+        mUnitIndex[unit->getName()] = UnitIndexEntry(unit);
+    mMissingUnitNames.erase(unit->getName());
+}
+
 //------------------------------------------------------------------------------
 bool Processor::removeUnit(Unit* unit)
 {
@@ -184,6 +299,11 @@ bool Processor::removeUnit(Unit* unit)
     RemoveUnitVisitor uv;
     uv.run(unit);
 
+    // unit is not part of the subgraph anymore
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitIndexMutex);
+    UnitIndex::iterator it = mUnitIndex.find(unit->getName());
+    if (it != mUnitIndex.end() && it->second.unit == unit) mUnitIndex.erase(it);
+
     return true;
 }
 
@@ -201,6 +321,12 @@ void Processor::onViewportChange()
 void Processor::dirtyUnitSubgraph()
 {
     mbDirtyUnitGraph = true;
+
+    // units might be added or removed, hence check the indexed ones again on the next lookup
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitIndexMutex);
+    for (UnitIndex::iterator it = mUnitIndex.begin(); it != mUnitIndex.end(); it++)
+        it->second.attached = false;
+    mMissingUnitNames.clear();
 }
 
 //------------------------------------------------------------------------------
@@ -212,6 +338,9 @@ void Processor::placeUnitAsLast(Unit* unit, bool enable)
         unit->removeCullCallback(mCollectLastUnitsCallback);
     else
         unit->setCullCallback(mCollectLastUnitsCallback);    
+
+    // units placed as last are sinks of the pipeline
+    dirtyUnitLiveness();
 }
 
 //------------------------------------------------------------------------------
@@ -244,12 +373,44 @@ void Processor::traverse(osg::NodeVisitor& nv)
         SetupUnitRenderingVisitor sv(this);
         sv.run(this);
 
+        // rebuild the name index of all units, the first unit of the same name wins
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitIndexMutex);
+            mUnitIndex.clear();
+            mMissingUnitNames.clear();
+            const SetupUnitRenderingVisitor::UnitSet& units = sv.getUnitSet();
+            for (SetupUnitRenderingVisitor::UnitSet::const_iterator it = units.begin(); it != units.end(); it++)
+            {
+                if (mUnitIndex.find((*it)->getName()) == mUnitIndex.end())
+                    mUnitIndex[(*it)->getName()] = UnitIndexEntry(*it);
+            }
+        }
+
         osg::notify(osg::INFO) << "END " << getName() << std::endl;
         osg::notify(osg::INFO) << "--------------------------------------------------------------------" << std::endl;
 
         // optimize subgraph
         OptimizeUnitsVisitor ov;
         ov.run(this);
+
+        // graph has changed, hence sinks and producers might have too
+        dirtyUnitLiveness();
+    }
+
+    // find out which units are required to compute the output of the active sinks,
+    // the flag is set by units from the update and by the processor from the cull traversal
+    bool dirtyLiveness = false;
+    if (!mbDirtyUnitGraph)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mLivenessMutex);
+        dirtyLiveness = mbDirtyUnitLiveness;
+        mbDirtyUnitLiveness = false;
+    }
+
+    if (dirtyLiveness)
+    {
+        MarkUnitsLiveVisitor lv(this);
+        lv.run(this);
     }
 
     // make sure we render only our own camera
@@ -290,9 +451,9 @@ void Processor::traverse(osg::NodeVisitor& nv)
     {
         for (std::list<Unit*>::iterator it = mLastUnits.begin(); it != mLastUnits.end(); it++)
         {
-            placeUnitAsLast(*it, false);
+            (*it)->removeCullCallback(mCollectLastUnitsCallback);
             (*it)->accept(nv);
-            placeUnitAsLast(*it, true);
+            (*it)->setCullCallback(mCollectLastUnitsCallback);
         }
         mLastUnits.clear();
     }
@@ -362,6 +362,12 @@ void ShaderAttribute::apply(osg::State& state) const
     // first apply the program as it is
     osg::Program::apply(state);
 
+    applyUniforms(state);
+}
+
+//--------------------------------------------------------------------------
+void ShaderAttribute::applyUniforms(osg::State& state) const
+{
     // this have to be our object
     const Program::PerContextProgram* lastAppliedProgram = state.getLastAppliedProgramObject();
     if (lastAppliedProgram == NULL) return;
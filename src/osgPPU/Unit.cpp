@@ -23,22 +23,52 @@
 
 #include <osg/Texture2D>
 #include <osg/TextureRectangle>
+#include <osg/TextureCubeMap>
+#include <osg/Texture3D>
+#include <osg/Texture2DArray>
 #include <osgDB/WriteFile>
 #include <osgDB/Registry>
 #include <osg/Image>
 #include <osg/Program>
 #include <osg/FrameBufferObject>
 #include <osg/Geometry>
+#include <osg/FrameStamp>
+#include <osgUtil/CullVisitor>
 #include <math.h>
 
 namespace osgPPU
 {
 
+// Default attributes shared by all units. They are never changed, a unit does
+// replace them by its own ones, hence there is no need to allocate them per unit.
+static osg::ref_ptr<osg::Program> EmptyProgram = new osg::Program();
+static osg::ref_ptr<osg::Texture2D> EmptyTexture = new osg::Texture2D();
+static osg::ref_ptr<osg::RefMatrix> DefaultProjectionMatrix = new osg::RefMatrix(osg::Matrix::ortho(0,1,0,1,0,1));
+static osg::ref_ptr<osg::RefMatrix> DefaultModelviewMatrix = new osg::RefMatrix(osg::Matrixf::identity());
+
+//------------------------------------------------------------------------------
+const osg::RefMatrix* Unit::getDefaultProjectionMatrix()
+{
+    return DefaultProjectionMatrix.get();
+}
+
+//------------------------------------------------------------------------------
+const osg::RefMatrix* Unit::getDefaultModelviewMatrix()
+{
+    return DefaultModelviewMatrix.get();
+}
+
 //------------------------------------------------------------------------------
 Unit::Unit() : osg::Group(),
+    mNumPBOBuffers(1),
     mbDirty(true),
     mInputTexIndexForViewportReference(0),
     mbActive(true),
+    mbPinned(false),
+    mbLive(true),
+    mbOutputReleased(false),
+    mExecutionLevel(0),
+    mExecutionIndex(0),
     mbUpdateTraversed(false),
     mbCullTraversed(false)
 {
@@ -56,14 +86,14 @@ Unit::Unit() : osg::Group(),
     mGeode->addDrawable(drawable);
 
     // initialze projection matrix
-    sProjectionMatrix = new osg::RefMatrix(osg::Matrix::ortho(0,1,0,1,0,1));
+    sProjectionMatrix = DefaultProjectionMatrix;
 
     // setup default modelview matrix
-    sModelviewMatrix = new osg::RefMatrix(osg::Matrixf::identity());
+    sModelviewMatrix = DefaultModelviewMatrix;
 
     // setup default empty fbo and empty program, so that in default mode
     // we do not use any fbo or program
-    getOrCreateStateSet()->setAttribute(new osg::Program(), osg::StateAttribute::ON);
+    getOrCreateStateSet()->setAttribute(EmptyProgram.get(), osg::StateAttribute::ON);
     //getOrCreateStateSet()->setAttribute(new osg::FrameBufferObject(), osg::StateAttribute::ON);
     //mPushedFBO = NULL;
 
@@ -71,7 +101,7 @@ Unit::Unit() : osg::Group(),
     // as long as one is not defined
     for (unsigned int i=0; i < 16; i++)
     {
-        getOrCreateStateSet()->setTextureAttribute(i, new osg::Texture2D());
+        getOrCreateStateSet()->setTextureAttribute(i, EmptyTexture.get());
     }
 
     // no culling, because we do not need it
@@ -88,8 +118,13 @@ Unit::Unit(const Unit& ppu, const osg::CopyOp& copyop) :
     mOutputTex(ppu.mOutputTex),
     mInputPBO(ppu.mInputPBO),
     mOutputPBO(ppu.mOutputPBO),
+    mInputPBORing(ppu.mInputPBORing),
+    mOutputPBORing(ppu.mOutputPBORing),
+    mNumPBOBuffers(ppu.mNumPBOBuffers),
+    mPBOCallback(ppu.mPBOCallback),
     mIgnoreList(ppu.mIgnoreList),
     mInputToUniformMap(ppu.mInputToUniformMap),
+    mPreviousFrameInput(ppu.mPreviousFrameInput),
     mDrawable(ppu.mDrawable),
     sProjectionMatrix(ppu.sProjectionMatrix),
     sModelviewMatrix(ppu.sModelviewMatrix),
@@ -99,16 +134,95 @@ Unit::Unit(const Unit& ppu, const osg::CopyOp& copyop) :
     mbDirty(ppu.mbDirty),
     mInputTexIndexForViewportReference(ppu.mInputTexIndexForViewportReference),
     mbActive(ppu.mbActive),
+    mbPinned(ppu.mbPinned),
+    mbLive(ppu.mbLive),
+    mbOutputReleased(ppu.mbOutputReleased),
+    mExecutionLevel(ppu.mExecutionLevel),
+    mExecutionIndex(ppu.mExecutionIndex),
     mbUpdateTraversed(ppu.mbUpdateTraversed),
     mbCullTraversed(ppu.mbCullTraversed),
     mPushedFBO(ppu.mPushedFBO)
 {
-
+    // pending transfers belong to the other unit
+    for (PixelDataBufferRingMap::iterator it = mInputPBORing.begin(); it != mInputPBORing.end(); it++)
+        it->second.fences = std::vector<osg::buffered_value<void*> >(it->second.buffers.size());
+    for (PixelDataBufferRingMap::iterator it = mOutputPBORing.begin(); it != mOutputPBORing.end(); it++)
+        it->second.fences = std::vector<osg::buffered_value<void*> >(it->second.buffers.size());
 }
 
 //------------------------------------------------------------------------------
 Unit::~Unit()
 {
+    // fences of pending transfers can only be deleted with a current context
+    for (PixelDataBufferRingMap::iterator it = mInputPBORing.begin(); it != mInputPBORing.end(); it++)
+        releasePBORingFences(it->second);
+    for (PixelDataBufferRingMap::iterator it = mOutputPBORing.begin(); it != mOutputPBORing.end(); it++)
+        releasePBORingFences(it->second);
+}
+
+//------------------------------------------------------------------------------
+void Unit::releaseGLObjects(osg::State* state) const
+{
+    osg::Group::releaseGLObjects(state);
+
+    Unit* unit = const_cast<Unit*>(this);
+    for (PixelDataBufferRingMap::iterator it = unit->mInputPBORing.begin(); it != unit->mInputPBORing.end(); it++)
+    {
+        unit->releasePBORingFences(it->second);
+        for (unsigned int i=0; i < it->second.buffers.size(); i++) it->second.buffers[i]->releaseGLObjects(state);
+    }
+    for (PixelDataBufferRingMap::iterator it = unit->mOutputPBORing.begin(); it != unit->mOutputPBORing.end(); it++)
+    {
+        unit->releasePBORingFences(it->second);
+        for (unsigned int i=0; i < it->second.buffers.size(); i++) it->second.buffers[i]->releaseGLObjects(state);
+    }
+}
+
+//------------------------------------------------------------------------------
+void Unit::releasePBORingFences(PixelDataBufferRing& ring)
+{
+    for (unsigned int i=0; i < ring.fences.size(); i++)
+        for (unsigned int contextID=0; contextID < ring.fences[i].size(); contextID++)
+        {
+            releaseFenceSync(contextID, ring.fences[i][contextID]);
+            ring.fences[i][contextID] = NULL;
+        }
+}
+
+//------------------------------------------------------------------------------
+void Unit::setName(const std::string& name)
+{
+    if (name == getName()) return;
+    std::string oldName = getName();
+    osg::Group::setName(name);
+
+    // update the processor's unit index
+    FindProcessorVisitor fp;
+    this->accept(fp);
+    if (fp._processor) fp._processor->updateUnitIndex(this, oldName);
+}
+
+//------------------------------------------------------------------------------
+void Unit::setActive(bool b)
+{
+    if (mbActive == b) return;
+    mbActive = b;
+
+    // set of live units might have changed, so let the processor know about it
+    FindProcessorVisitor fp;
+    this->accept(fp);
+    if (fp._processor) fp._processor->dirtyUnitLiveness();
+}
+
+//------------------------------------------------------------------------------
+void Unit::setPinned(bool b)
+{
+    if (mbPinned == b) return;
+    mbPinned = b;
+
+    FindProcessorVisitor fp;
+    this->accept(fp);
+    if (fp._processor) fp._processor->dirtyUnitLiveness();
 }
 
 //------------------------------------------------------------------------------
@@ -117,10 +231,12 @@ void Unit::setUsePBOForInputTexture(int index, bool use)
     if (use)
     {
         if (getUsePBOForInputTexture(index)) return;
-        mInputPBO[index] = new osg::PixelDataBufferObject;
+        setupPBORing(mInputPBORing[index], mInputPBO[index]);
     }else
     {
-        mInputPBO[index] = NULL;
+        mInputPBO.erase(index);
+        if (mInputPBORing.find(index) != mInputPBORing.end()) releasePBORingFences(mInputPBORing[index]);
+        mInputPBORing.erase(index);
     }
 }
 
@@ -130,13 +246,45 @@ void Unit::setUsePBOForOutputTexture(int mrt, bool use)
     if (use)
     {
         if (getUsePBOForOutputTexture(mrt)) return;
-        mOutputPBO[mrt] = new osg::PixelDataBufferObject;
+        setupPBORing(mOutputPBORing[mrt], mOutputPBO[mrt]);
     }else
     {
-        mOutputPBO[mrt] = NULL;
+        mOutputPBO.erase(mrt);
+        if (mOutputPBORing.find(mrt) != mOutputPBORing.end()) releasePBORingFences(mOutputPBORing[mrt]);
+        mOutputPBORing.erase(mrt);
     }
 }
 
+//------------------------------------------------------------------------------
+void Unit::setNumPBOBuffers(unsigned int num)
+{
+    if (num < 1) num = 1;
+    if (num == mNumPBOBuffers) return;
+    mNumPBOBuffers = num;
+
+    // recreate the rings, the new buffers get their size on the next init
+    for (PixelDataBufferRingMap::iterator it = mInputPBORing.begin(); it != mInputPBORing.end(); it++)
+        setupPBORing(it->second, mInputPBO[it->first]);
+    for (PixelDataBufferRingMap::iterator it = mOutputPBORing.begin(); it != mOutputPBORing.end(); it++)
+        setupPBORing(it->second, mOutputPBO[it->first]);
+
+    dirty();
+}
+
+//------------------------------------------------------------------------------
+void Unit::setupPBORing(PixelDataBufferRing& ring, osg::ref_ptr<osg::PixelDataBufferObject>& current)
+{
+    // pending transfers of the old ring are not consumed anymore
+    releasePBORingFences(ring);
+
+    ring.buffers.resize(mNumPBOBuffers);
+    ring.fences.resize(mNumPBOBuffers);
+    for (unsigned int i=0; i < mNumPBOBuffers; i++)
+        if (!ring.buffers[i].valid()) ring.buffers[i] = new osg::PixelDataBufferObject;
+
+    current = ring.buffers[0];
+}
+
 //------------------------------------------------------------------------------
 void Unit::setColorAttribute(ColorAttribute* ca)
 {
@@ -169,8 +317,8 @@ osg::Drawable* Unit::createTexturedQuadDrawable(const osg::Vec3& corner,const os
 
     // Add texture coordinates for every input texture
     // \todo Determine if use supplied coordinates might be required
-    TextureMap input_map = getInputTextureMap();
-    TextureMap::iterator it = input_map.begin();
+    const TextureMap& input_map = getInputTextureMap();
+    TextureMap::const_iterator it = input_map.begin();
     for (; it != input_map.end(); it++)
     {
         int unit = it->first;
@@ -337,12 +485,11 @@ void Unit::assignInputTexture()
 void Unit::assignInputPBO()
 {
     // for each input texture do
-    PixelDataBufferObjectMap::iterator it = mInputPBO.begin();
-    for (; it != mInputPBO.end(); it++)
+    PixelDataBufferRingMap::iterator it = mInputPBORing.begin();
+    for (; it != mInputPBORing.end(); it++)
     {
         // get output texture
-        osg::Texture* texture = mInputTex[it->first].get();
-        osg::PixelDataBufferObject* pbo = it->second.get();
+        osg::Texture* texture = getInputTexture(it->first);
 
         // if the output texture is NULL, hence ERROR
         if (texture == NULL)
@@ -351,8 +498,10 @@ void Unit::assignInputPBO()
             continue;
         }
 
-        // compute size of the texture which has to be allocated for the pbo
-        pbo->setDataSize(computeTextureSizeInBytes(texture));
+        // compute size of the texture which has to be allocated for the pbos
+        unsigned int size = computeTextureSizeInBytes(texture);
+        for (unsigned int i=0; i < it->second.buffers.size(); i++)
+            it->second.buffers[i]->setDataSize(size);
     }
 }
 
@@ -479,6 +628,14 @@ void Unit::traverse(osg::NodeVisitor& nv)
 
         mbUpdateTraversed = true;
 
+        // units which are not part of the pipeline are not updated, however
+        // their children might be, hence traverse them further
+        if (!mbLive)
+        {
+            traverseChildUnits(nv);
+            return;
+        }
+
         update();
         getStateSet()->runUpdateCallbacks(&nv);
 
@@ -495,12 +652,39 @@ void Unit::traverse(osg::NodeVisitor& nv)
 
         // mark this unit as has been traversed and traverse
         mbCullTraversed = true;        
+
+        // do not cull the drawables of units which are not part of the pipeline
+        if (!mbLive)
+        {
+            traverseChildUnits(nv);
+            return;
+        }
+
+        // inputs which change every frame are applied on top of the unit's state
+        osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(&nv);
+        if (cv && mFrameParityStateSet[0].valid() && nv.getFrameStamp())
+        {
+            cv->pushStateSet(mFrameParityStateSet[nv.getFrameStamp()->getFrameNumber() % 2].get());
+            osg::Group::traverse(nv);
+            cv->popStateSet();
+            return;
+        }
     }
 
     // default traversion
     osg::Group::traverse(nv);
 }
 
+//------------------------------------------------------------------------------
+void Unit::traverseChildUnits(osg::NodeVisitor& nv)
+{
+    for (unsigned int i=0; i < getNumChildren(); i++)
+    {
+        Unit* unit = dynamic_cast<Unit*>(getChild(i));
+        if (unit) unit->accept(nv);
+    }
+}
+
 //------------------------------------------------------------------------------
 void Unit::init()
 {
@@ -523,6 +707,7 @@ void Unit::init()
     }
 
     // reassign input and shaders
+    setupFrameParityInputs();
     assignInputTexture();
     assignViewport();
     assignInputPBO();
@@ -657,6 +842,86 @@ void Unit::setupBlockedChildren()
     }
 }
 
+//--------------------------------------------------------------------------
+void Unit::connectPreviousFrame(UnitInOut* producer, Unit* consumer, unsigned int slot)
+{
+    if (producer == NULL || consumer == NULL) return;
+
+    producer->setDoubleBufferedOutput(true);
+    consumer->mPreviousFrameInput[slot] = producer;
+    consumer->dirty();
+}
+
+//--------------------------------------------------------------------------
+void Unit::removePreviousFrameInput(unsigned int slot)
+{
+    mPreviousFrameInput.erase(slot);
+    dirty();
+}
+
+//--------------------------------------------------------------------------
+void Unit::setupFrameParityInputs()
+{
+    // texture of each slot on even and odd frames
+    std::map<unsigned int, std::pair<osg::Texture*, osg::Texture*> > inputs;
+
+    // outputs of double buffered parents alternate with the frames
+    for (TextureMap::iterator it = mInputTex.begin(); it != mInputTex.end(); it++)
+    {
+        for (unsigned int i=0; i < getNumParents() && it->second.valid(); i++)
+        {
+            Unit* parent = dynamic_cast<Unit*>(getParent(i));
+            osg::Texture* buffered = parent ? parent->getOrCreateBufferedOutputTexture(it->second.get()) : NULL;
+            if (buffered)
+            {
+                inputs[it->first] = std::make_pair(it->second.get(), buffered);
+                break;
+            }
+        }
+    }
+
+    // previous frame inputs get the texture which is not written in the current frame
+    for (PreviousFrameInputMap::iterator it = mPreviousFrameInput.begin(); it != mPreviousFrameInput.end(); it++)
+    {
+        Unit* producer = it->second.get();
+        osg::Texture* output = producer ? producer->getOrCreateOutputTexture(0) : NULL;
+        osg::Texture* buffered = producer ? producer->getOrCreateBufferedOutputTexture(output) : NULL;
+        if (buffered == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::Unit::setupFrameParityInputs() - " << getName() << " producer of previous frame input " << it->first << " is not valid" << std::endl;
+            continue;
+        }
+        mInputTex[it->first] = buffered;
+        inputs[it->first] = std::make_pair(buffered, output);
+    }
+
+    mFrameParityStateSet[0] = mFrameParityStateSet[1] = NULL;
+    if (inputs.empty()) return;
+
+    mFrameParityStateSet[0] = new osg::StateSet();
+    mFrameParityStateSet[1] = new osg::StateSet();
+    for (std::map<unsigned int, std::pair<osg::Texture*, osg::Texture*> >::iterator it = inputs.begin(); it != inputs.end(); it++)
+    {
+        mFrameParityStateSet[0]->setTextureAttributeAndModes(it->first, it->second.first, osg::StateAttribute::ON);
+        mFrameParityStateSet[1]->setTextureAttributeAndModes(it->first, it->second.second, osg::StateAttribute::ON);
+    }
+}
+
+//--------------------------------------------------------------------------
+osg::Texture* Unit::getFrameParityInputTexture(osg::Texture* input, unsigned int frameNumber) const
+{
+    if (input == NULL || !mFrameParityStateSet[0].valid()) return input;
+
+    // stateset of even frames contains the textures as they are bound per default
+    osg::StateSet* even = mFrameParityStateSet[0].get();
+    for (unsigned int i=0; i < even->getTextureAttributeList().size(); i++)
+    {
+        if (even->getTextureAttribute(i, osg::StateAttribute::TEXTURE) == input)
+            return static_cast<osg::Texture*>(mFrameParityStateSet[frameNumber % 2]->getTextureAttribute(i, osg::StateAttribute::TEXTURE));
+    }
+    return input;
+}
+
 //--------------------------------------------------------------------------
 void Unit::dirty()
 {
@@ -687,6 +952,61 @@ void Unit::EmptyDrawCallback::drawImplementation (osg::RenderInfo& ri, const osg
     }
 }
 
+//--------------------------------------------------------------------------
+// Copy content of the texture into the currently bound pixel pack buffer.
+// Faces of a cubemap are stored one after another.
+//--------------------------------------------------------------------------
+static void readTextureIntoBuffer(osg::State& state, unsigned int unit, osg::Texture* texture)
+{
+    if (texture == NULL) return;
+
+    GLenum format = osg::Image::computePixelFormat(texture->getInternalFormat());
+    GLenum type = osg::Image::computeFormatDataType(texture->getInternalFormat());
+
+    state.applyTextureAttribute(unit, texture);
+    if (dynamic_cast<osg::TextureCubeMap*>(texture))
+    {
+        unsigned int faceSize = computeTextureSizeInBytes(texture) / 6;
+        for (unsigned int face=0; face < 6; face++)
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, format, type, (GLvoid*)(size_t)(face * faceSize));
+    }else
+        glGetTexImage(texture->getTextureTarget(), 0, format, type, NULL);
+}
+
+//--------------------------------------------------------------------------
+// Upload content of the currently bound pixel unpack buffer into the texture.
+// Layout of the buffer is the same as written by readTextureIntoBuffer().
+//--------------------------------------------------------------------------
+static void writeBufferIntoTexture(osg::State& state, unsigned int unit, osg::Texture* texture)
+{
+    if (texture == NULL) return;
+
+    GLenum format = osg::Image::computePixelFormat(texture->getInternalFormat());
+    GLenum type = osg::Image::computeFormatDataType(texture->getInternalFormat());
+    int width = texture->getTextureWidth();
+    int height = texture->getTextureHeight();
+    int depth = texture->getTextureDepth();
+
+    state.applyTextureAttribute(unit, texture);
+    if (dynamic_cast<osg::TextureCubeMap*>(texture))
+    {
+        unsigned int faceSize = computeTextureSizeInBytes(texture) / 6;
+        for (unsigned int face=0; face < 6; face++)
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, width, height, format, type, (GLvoid*)(size_t)(face * faceSize));
+    }else if (dynamic_cast<osg::Texture3D*>(texture))
+    {
+        const osg::Texture3D::Extensions* ext = osg::Texture3D::getExtensions(state.getContextID(), true);
+        ext->glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, format, type, NULL);
+    }else if (dynamic_cast<osg::Texture2DArray*>(texture))
+    {
+        const osg::Texture2DArray::Extensions* ext = osg::Texture2DArray::getExtensions(state.getContextID(), true);
+        ext->glTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, 0, 0, 0, width, height, depth, format, type, NULL);
+    }else if (dynamic_cast<osg::Texture2D*>(texture) || dynamic_cast<osg::TextureRectangle*>(texture))
+    {
+        glTexSubImage2D(texture->getTextureTarget(), 0, 0, 0, width, height, format, type, NULL);
+    }
+}
+
 //--------------------------------------------------------------------------
 void Unit::DrawCallback::drawImplementation (osg::RenderInfo& ri, const osg::Drawable* dr) const
 {
@@ -696,25 +1016,81 @@ void Unit::DrawCallback::drawImplementation (osg::RenderInfo& ri, const osg::Dra
     {   
         _parent->printDebugInfo(dr);
 
-        // precompile input and output pbos, so that they are valid for hte next execution
-        for (PixelDataBufferObjectMap::iterator it = _parent->mInputPBO.begin(); it != _parent->mInputPBO.end(); it++)
-            if (it->second && it->second->getOrCreateGLBufferObject(ri.getContextID())->isDirty()) it->second->compileBuffer(*ri.getState());
-        for (PixelDataBufferObjectMap::iterator it = _parent->mOutputPBO.begin(); it != _parent->mOutputPBO.end(); it++)
-            if (it->second && it->second->getOrCreateGLBufferObject(ri.getContextID())->isDirty()) it->second->compileBuffer(*ri.getState());
+        unsigned int contextID = ri.getContextID();
+        flushDeletedFenceSyncs(contextID);
+
+        // the pbo transfers are done once per frame, even if the unit is drawn several times
+        const osg::FrameStamp* fs = ri.getState()->getFrameStamp();
+        bool transferPBOs = true;
+        if (fs)
+        {
+            unsigned int frameNumber = fs->getFrameNumber() + 1;
+            transferPBOs = _parent->mPBOFrameNumber[contextID] != frameNumber;
+            _parent->mPBOFrameNumber[contextID] = frameNumber;
+        }
+
+        unsigned int frame = _parent->mPBOFrame[contextID];
+        unsigned int frameNumber = fs ? fs->getFrameNumber() : 0;
+        const PBOCallback* pboCallback = _parent->getPBOCallback();
+        bool useFences = pboCallback || _parent->mNumPBOBuffers > 1;
+        osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
 
-        // copy content of the input textures into pbo, if such are specified
-        for (PixelDataBufferObjectMap::iterator it = _parent->mInputPBO.begin(); it != _parent->mInputPBO.end(); it++)
+        // precompile input and output pbos, so that they are valid for hte next execution
+        for (PixelDataBufferRingMap::iterator it = _parent->mInputPBORing.begin(); it != _parent->mInputPBORing.end(); it++)
+            for (unsigned int i=0; i < it->second.buffers.size(); i++)
+                if (it->second.buffers[i]->getOrCreateGLBufferObject(contextID)->isDirty()) it->second.buffers[i]->compileBuffer(*ri.getState());
+        for (PixelDataBufferRingMap::iterator it = _parent->mOutputPBORing.begin(); it != _parent->mOutputPBORing.end(); it++)
+            for (unsigned int i=0; i < it->second.buffers.size(); i++)
+                if (it->second.buffers[i]->getOrCreateGLBufferObject(contextID)->isDirty()) it->second.buffers[i]->compileBuffer(*ri.getState());
+
+        // copy content of the input textures into pbo, if such are specified and the unit wants new input
+        bool readInputs = transferPBOs && !_parent->mInputPBORing.empty() && _parent->noticeReadInputPBOs(ri);
+        for (PixelDataBufferRingMap::iterator it = _parent->mInputPBORing.begin(); readInputs && it != _parent->mInputPBORing.end(); it++)
         {
-            if (!it->second) continue;
-            osg::Texture* texture = _parent->mInputTex[it->first].get();
+            PixelDataBufferRing& ring = it->second;
+            unsigned int current = frame % ring.buffers.size();
+            osg::PixelDataBufferObject* pbo = ring.buffers[current].get();
+            void*& fence = ring.fences[current][contextID];
+
+            // the buffer holds the transfer started N frames ago, give it to the callback before it is overwritten
+            if (pboCallback && frame >= ring.buffers.size())
+            {
+                waitFenceSync(contextID, fence);
+                pbo->bindBufferInWriteMode(*ri.getState());
+                const void* data = ext->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+                if (data)
+                {
+                    pboCallback->readInput(ri, _parent, it->first, data, pbo->getDataSize());
+                    ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+                }
+                pbo->unbindBuffer(contextID);
+            }
+            deleteFenceSync(contextID, fence);
+            fence = NULL;
 
             // bind buffer in write mode and copy texture content into the buffer
-            it->second->bindBufferInWriteMode(*ri.getState());
-            ri.getState()->applyTextureAttribute(it->first, texture);
-            glGetTexImage(texture->getTextureTarget(), 0, 
-                osg::Image::computePixelFormat(texture->getInternalFormat()), 
-                osg::Image::computeFormatDataType(texture->getInternalFormat()), NULL);
-            it->second->unbindBuffer(ri.getContextID());
+            pbo->bindBufferInWriteMode(*ri.getState());
+            // inputs alternating with the frames are not bound by the state at this point
+            osg::Texture* input = _parent->getFrameParityInputTexture(_parent->getInputTexture(it->first), frameNumber);
+            readTextureIntoBuffer(*ri.getState(), it->first, input);
+            pbo->unbindBuffer(contextID);
+            if (useFences) fence = insertFenceSync(contextID);
+
+            _parent->mInputPBO[it->first] = pbo;
+        }
+
+        // select output pbos of this frame, wait until their last upload is done so that they can be written
+        for (PixelDataBufferRingMap::iterator it = _parent->mOutputPBORing.begin(); transferPBOs && it != _parent->mOutputPBORing.end(); it++)
+        {
+            PixelDataBufferRing& ring = it->second;
+            unsigned int current = frame % ring.buffers.size();
+            void*& fence = ring.fences[current][contextID];
+
+            if (pboCallback) waitFenceSync(contextID, fence);
+            deleteFenceSync(contextID, fence);
+            fence = NULL;
+
+            _parent->mOutputPBO[it->first] = ring.buffers[current];
         }
 
         // unit should know that we are about to render it and let us know if we should render 
@@ -737,28 +1113,42 @@ void Unit::DrawCallback::drawImplementation (osg::RenderInfo& ri, const osg::Dra
         // ok rendering is done, unit can do other stuff.
         _parent->noticeFinishRendering(ri, dr);
 
-        // copy content of the output textures into output pbos
-        for (PixelDataBufferObjectMap::iterator it = _parent->mOutputPBO.begin(); it != _parent->mOutputPBO.end(); it++)
+        // fill the output pbos of this frame and upload the ones filled N-1 frames before into the
+        // output textures, hence the buffer written by the CPU is never the one the GPU reads from
+        bool writeOutputs = transferPBOs && !_parent->mOutputPBORing.empty() && _parent->noticeWriteOutputPBOs(ri);
+        for (PixelDataBufferRingMap::iterator it = _parent->mOutputPBORing.begin(); writeOutputs && it != _parent->mOutputPBORing.end(); it++)
         {
-            if (!it->second) continue;
-
-            // bind buffer in read mode and copy texture content into the buffer
-            it->second->bindBufferInReadMode(*ri.getState());
+            PixelDataBufferRing& ring = it->second;
+            unsigned int current = frame % ring.buffers.size();
+            osg::PixelDataBufferObject* pbo = ring.buffers[current].get();
 
-            // upload buffer content into the texture
-            osg::Texture2D* tex = dynamic_cast<osg::Texture2D*>(_parent->mOutputTex[it->first].get());
-            if (tex)
+            // bind buffer in read mode and let the callback fill it
+            if (pboCallback)
             {
-                ri.getState()->applyTextureAttribute(it->first, tex);
-                glTexSubImage2D(tex->getTextureTarget(), 0, 0, 0, 
-                    tex->getTextureWidth(), tex->getTextureHeight(), 
-                    osg::Image::computePixelFormat(tex->getInternalFormat()), 
-                    osg::Image::computeFormatDataType(tex->getInternalFormat()), NULL);
+                pbo->bindBufferInReadMode(*ri.getState());
+                void* data = ext->glMapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+                if (data)
+                {
+                    pboCallback->writeOutput(ri, _parent, it->first, data, pbo->getDataSize());
+                    ext->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB);
+                }
+                pbo->unbindBuffer(contextID);
             }
 
-            it->second->unbindBuffer(ri.getContextID());
+            // upload the oldest filled buffer into the texture, with one buffer it is the current one
+            unsigned int upload = (frame + 1) % ring.buffers.size();
+            if (frame + 1 < ring.buffers.size()) continue;
+
+            pbo = ring.buffers[upload].get();
+            pbo->bindBufferInReadMode(*ri.getState());
+            writeBufferIntoTexture(*ri.getState(), it->first, _parent->getOutputTexture(it->first));
+            pbo->unbindBuffer(contextID);
+            if (useFences) ring.fences[upload][contextID] = insertFenceSync(contextID);
         }
 
+        // advance the pbo rings
+        if (readInputs || writeOutputs)
+            _parent->mPBOFrame[contextID] = frame + 1;
     }
 }
 
@@ -0,0 +1,298 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitInConvolveOut.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/TextureRectangle>
+#include <osg/Math>
+
+#include <sstream>
+#include <iomanip>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    UnitInConvolveOut::UnitInConvolveOut(const UnitInConvolveOut& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mKernel(unit.mKernel),
+        mSigma(unit.mSigma),
+        mMaxRadius(unit.mMaxRadius)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInConvolveOut::UnitInConvolveOut() : UnitInOut()
+    {
+        mMaxRadius = 16;
+        mRenderPasses = true;
+        setGaussianKernel(2.0f);
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInConvolveOut::~UnitInConvolveOut()
+    {
+
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInConvolveOut::setGaussianKernel(float sigma)
+    {
+        if (sigma < 0.1f) sigma = 0.1f;
+        mSigma = sigma;
+
+        int radius = osg::maximum(1, (int)ceilf(3.0f * sigma));
+        mKernel.resize(radius + 1);
+        for (int i=0; i <= radius; i++)
+            mKernel[i] = expf(-float(i*i) / (2.0f * sigma * sigma));
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInConvolveOut::setKernel(const std::vector<float>& weights)
+    {
+        if (weights.empty())
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInConvolveOut::setKernel() - " << getName() << " empty kernel is ignored" << std::endl;
+            return;
+        }
+        mSigma = 0.0f;
+        mKernel = weights;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInConvolveOut::setMaxRadius(unsigned int radius)
+    {
+        if (radius < 1) radius = 1;
+        mMaxRadius = radius;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    unsigned int UnitInConvolveOut::getDownsampleFactor() const
+    {
+        unsigned int radius = mKernel.size() - 1;
+        unsigned int factor = 1;
+        while (radius > mMaxRadius * factor) factor *= 2;
+        return factor;
+    }
+
+    //------------------------------------------------------------------------------
+    std::vector<UnitInConvolveOut::Tap> UnitInConvolveOut::computeTaps(unsigned int factor) const
+    {
+        // kernel at the downsampled resolution
+        std::vector<float> weights;
+        if (mSigma > 0.0f)
+        {
+            float sigma = mSigma / float(factor);
+            int radius = osg::maximum(1, (int)ceilf(3.0f * sigma));
+            for (int i=0; i <= radius; i++)
+                weights.push_back(expf(-float(i*i) / (2.0f * sigma * sigma)));
+        }else
+        {
+            for (unsigned int i=0; i < mKernel.size(); i++)
+            {
+                unsigned int j = (i + factor / 2) / factor;
+                if (weights.size() <= j) weights.resize(j + 1, 0.0f);
+                weights[j] += mKernel[i];
+            }
+        }
+
+        // normalize, the weights except of the center are applied twice
+        float total = weights[0];
+        for (unsigned int i=1; i < weights.size(); i++) total += 2.0f * weights[i];
+        if (total <= 0.0f) total = 1.0f;
+
+        // merge the taps i and i+1 into one bilinear fetch
+        std::vector<Tap> taps;
+        Tap center = {0.0f, weights[0] / total};
+        taps.push_back(center);
+        for (unsigned int i=1; i < weights.size(); i+=2)
+        {
+            float a = weights[i];
+            float b = (i + 1 < weights.size()) ? weights[i+1] : 0.0f;
+            if (a + b <= 0.0f) continue;
+
+            Tap tap = {(float(i) * a + float(i+1) * b) / (a + b), (a + b) / total};
+            taps.push_back(tap);
+        }
+        return taps;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInConvolveOut::addPass(osg::Texture* input, osg::Texture* output, osg::Program* program, bool rectangle)
+    {
+        FrameBufferObject* fbo = createPassFBO(output);
+        if (fbo == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInConvolveOut::addPass() - " << getName() << " output texture type is not supported" << std::endl;
+            return;
+        }
+
+        int width = osg::maximum(1, output->getTextureWidth());
+        int height = osg::maximum(1, output->getTextureHeight());
+
+        osg::Drawable* draw = createTexturedQuadDrawable();
+        osg::StateSet* ss = draw->getOrCreateStateSet();
+        ss->setAttribute(new osg::Viewport(0, 0, width, height), osg::StateAttribute::ON);
+        ss->setAttribute(program, osg::StateAttribute::ON);
+        ss->setTextureAttributeAndModes(0, input, osg::StateAttribute::ON);
+        ss->getOrCreateUniform(OSGPPU_CONVOLVE_INPUT_UNIFORM, rectangle ? osg::Uniform::SAMPLER_2D_RECT : osg::Uniform::SAMPLER_2D)->set(0);
+        ss->getOrCreateUniform(OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2((float)osg::maximum(1, input->getTextureWidth()), (float)osg::maximum(1, input->getTextureHeight())));
+        ss->getOrCreateUniform(OSGPPU_CONVOLVE_OUTPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2((float)width, (float)height));
+        appendPass(fbo, draw);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInConvolveOut::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        clearPasses();
+
+        osg::Texture* input = getInputTexture(0);
+        osg::Texture* output = getOutputTexture(0);
+        if (input == NULL || output == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInConvolveOut::init() - " << getName() << " has no input or output texture" << std::endl;
+            return;
+        }
+
+        bool rectangle = dynamic_cast<osg::TextureRectangle*>(input) != NULL;
+        unsigned int factor = getDownsampleFactor();
+        std::vector<Tap> taps = computeTaps(factor);
+
+        // convolve at full resolution
+        if (factor == 1)
+        {
+            osg::Texture2D* tmp = acquirePassTexture(osg::maximum(1, output->getTextureWidth()), osg::maximum(1, output->getTextureHeight()));
+
+            addPass(input, tmp, createConvolveProgram(taps, true, rectangle), rectangle);
+            addPass(tmp, output, createConvolveProgram(taps, false, false), false);
+
+        // large kernels are convolved on a downsampled copy
+        }else
+        {
+            int width = (osg::maximum(1, input->getTextureWidth()) + factor - 1) / factor;
+            int height = (osg::maximum(1, input->getTextureHeight()) + factor - 1) / factor;
+            osg::Texture2D* a = acquirePassTexture(width, height);
+            osg::Texture2D* b = acquirePassTexture(width, height);
+
+            addPass(input, a, createDownsampleProgram(factor, rectangle), rectangle);
+            addPass(a, b, createConvolveProgram(taps, true, false), false);
+            addPass(b, a, createConvolveProgram(taps, false, false), false);
+            addPass(a, output, createUpsampleProgram(), false);
+        }
+
+        // release textures which were not reused
+        releasePassTexturePool();
+    }
+
+    //------------------------------------------------------------------------------
+    static void writeSampleFunction(std::stringstream& src, bool rectangle)
+    {
+        if (rectangle)
+            src << "#extension GL_ARB_texture_rectangle : enable" << std::endl
+                << "uniform sampler2DRect " << OSGPPU_CONVOLVE_INPUT_UNIFORM << ";" << std::endl;
+        else
+            src << "uniform sampler2D " << OSGPPU_CONVOLVE_INPUT_UNIFORM << ";" << std::endl;
+        src << "uniform vec2 " << OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_CONVOLVE_OUTPUT_SIZE_UNIFORM << ";" << std::endl;
+
+        // sample at normalized texture coordinates
+        src << "vec4 sampleInput(vec2 tc)" << std::endl << "{" << std::endl;
+        if (rectangle)
+            src << "    return texture2DRect(" << OSGPPU_CONVOLVE_INPUT_UNIFORM << ", tc * " << OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM << ");" << std::endl;
+        else
+            src << "    return texture2D(" << OSGPPU_CONVOLVE_INPUT_UNIFORM << ", tc);" << std::endl;
+        src << "}" << std::endl;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInConvolveOut::createConvolveProgram(const std::vector<Tap>& taps, bool horizontal, bool rectangle) const
+    {
+        std::stringstream src;
+
+        src << "#define NUM_TAPS " << taps.size() << std::endl;
+
+        // offsets and weights must be float literals, GLSL 1.10 does not convert int to float
+        src << std::showpoint << std::setprecision(9);
+        for (unsigned int i=0; i < taps.size(); i++)
+            src << "#define OFFSET" << i << " " << taps[i].offset << std::endl
+                << "#define WEIGHT" << i << " " << taps[i].weight << std::endl;
+        writeSampleFunction(src, rectangle);
+
+        src << "void main(void)" << std::endl << "{" << std::endl
+            << "    vec2 tc = gl_FragCoord.xy / " << OSGPPU_CONVOLVE_OUTPUT_SIZE_UNIFORM << ";" << std::endl;
+        if (horizontal)
+            src << "    vec2 dir = vec2(1.0 / " << OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM << ".x, 0.0);" << std::endl;
+        else
+            src << "    vec2 dir = vec2(0.0, 1.0 / " << OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM << ".y);" << std::endl;
+
+        // kernel is unrolled, each tap except of the center samples both sides
+        src << "    vec4 sum = WEIGHT0 * sampleInput(tc);" << std::endl;
+        for (unsigned int i=1; i < taps.size(); i++)
+            src << "    sum += WEIGHT" << i << " * (sampleInput(tc + OFFSET" << i << " * dir) + sampleInput(tc - OFFSET" << i << " * dir));" << std::endl;
+        src << "    gl_FragColor = sum;" << std::endl << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInConvolveOut::createDownsampleProgram(unsigned int factor, bool rectangle) const
+    {
+        std::stringstream src;
+
+        // each bilinear fetch averages a block of 2x2 texels
+        src << "#define FACTOR " << factor << std::endl
+            << "#define HALF_FACTOR " << osg::maximum(1u, factor / 2) << std::endl;
+        writeSampleFunction(src, rectangle);
+
+        src << "void main(void)" << std::endl << "{" << std::endl
+            << "    vec2 origin = floor(gl_FragCoord.xy) * float(FACTOR);" << std::endl
+            << "    vec4 sum = vec4(0.0);" << std::endl
+            << "    for (int y=0; y < HALF_FACTOR; y++)" << std::endl
+            << "    for (int x=0; x < HALF_FACTOR; x++)" << std::endl
+            << "        sum += sampleInput((origin + vec2(float(2*x+1), float(2*y+1))) / " << OSGPPU_CONVOLVE_INPUT_SIZE_UNIFORM << ");" << std::endl
+            << "    gl_FragColor = sum / float(HALF_FACTOR * HALF_FACTOR);" << std::endl
+            << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInConvolveOut::createUpsampleProgram() const
+    {
+        std::stringstream src;
+
+        writeSampleFunction(src, false);
+        src << "void main(void)" << std::endl << "{" << std::endl
+            << "    gl_FragColor = sampleInput(gl_FragCoord.xy / " << OSGPPU_CONVOLVE_OUTPUT_SIZE_UNIFORM << ");" << std::endl
+            << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+}; // end namespace
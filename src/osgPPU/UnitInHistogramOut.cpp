@@ -0,0 +1,240 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitInHistogramOut.h>
+
+#include <osg/TextureRectangle>
+#include <osg/BlendFunc>
+#include <osg/ClampColor>
+#include <osg/Math>
+
+#include <sstream>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    UnitInHistogramOut::UnitInHistogramOut(const UnitInHistogramOut& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mChannel(unit.mChannel),
+        mNumBins(unit.mNumBins),
+        mRangeMin(unit.mRangeMin),
+        mRangeMax(unit.mRangeMax),
+        mSampleStep(unit.mSampleStep),
+        mNormalize(unit.mNormalize),
+        mNumSamples(0)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInHistogramOut::UnitInHistogramOut() : UnitInOut()
+    {
+        mChannel = LUMINANCE;
+        mNumBins = 64;
+        mRangeMin = 0.0f;
+        mRangeMax = 1.0f;
+        mSampleStep = 1;
+        mNormalize = false;
+        mNumSamples = 0;
+
+        // counts are accumulated by blending
+        setOutputInternalFormat(GL_RGBA32F_ARB);
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInHistogramOut::~UnitInHistogramOut()
+    {
+
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInHistogramOut::setNumBins(unsigned int num)
+    {
+        if (num < 1) num = 1;
+        mNumBins = num;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInHistogramOut::setRange(float minValue, float maxValue)
+    {
+        mRangeMin = minValue;
+        mRangeMax = maxValue > minValue ? maxValue : minValue + 1.0f;
+        if (mScatterGeometry.valid())
+            mScatterGeometry->getOrCreateStateSet()->getOrCreateUniform(OSGPPU_HISTOGRAM_RANGE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(mRangeMin, mRangeMax));
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInHistogramOut::setSampleStep(unsigned int step)
+    {
+        if (step < 1) step = 1;
+        mSampleStep = step;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInHistogramOut::setNormalize(bool normalize)
+    {
+        mNormalize = normalize;
+        updateWeight();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInHistogramOut::updateWeight()
+    {
+        if (!mScatterGeometry.valid()) return;
+
+        float weight = (mNormalize && mNumSamples > 0) ? 1.0f / (float)mNumSamples : 1.0f;
+        mScatterGeometry->getOrCreateStateSet()->getOrCreateUniform(OSGPPU_HISTOGRAM_WEIGHT_UNIFORM, osg::Uniform::FLOAT)->set(weight);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInHistogramOut::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        // values accumulated in the bins must not be clamped
+        osg::ClampColor* clamp = new osg::ClampColor();
+        clamp->setClampVertexColor(GL_FALSE);
+        clamp->setClampFragmentColor(GL_FALSE);
+        clamp->setClampReadColor(GL_FALSE);
+        getOrCreateStateSet()->setAttribute(clamp, osg::StateAttribute::ON);
+
+        mScatterGeometry = NULL;
+        mNumSamples = 0;
+
+        osg::Texture* input = getInputTexture(0);
+        if (input == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInHistogramOut::init() - " << getName() << " has no input texture" << std::endl;
+            return;
+        }
+
+        // one texel per bin, force new viewport to be used
+        osg::ref_ptr<osg::Viewport> oldVp = mViewport;
+        osg::ref_ptr<osg::Viewport> newVp = new osg::Viewport(0, 0, mNumBins, 1);
+        mViewport = newVp;
+        assignViewport();
+        mViewport = oldVp;
+        noticeChangeViewport(newVp.get());
+
+        // one point per sampled column, the rows are drawn as instances
+        int columns = (osg::maximum(1, input->getTextureWidth()) + mSampleStep - 1) / mSampleStep;
+        int rows = (osg::maximum(1, input->getTextureHeight()) + mSampleStep - 1) / mSampleStep;
+        mNumSamples = columns * rows;
+
+        osg::Vec3Array* coords = new osg::Vec3Array(columns);
+        for (int i=0; i < columns; i++)
+            (*coords)[i].set((float)i, 0.0f, 0.0f);
+
+        mScatterGeometry = new osg::Geometry();
+        mScatterGeometry->setVertexArray(coords);
+        mScatterGeometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, columns, rows));
+        mScatterGeometry->setUseDisplayList(false);
+        mScatterGeometry->setUseVertexBufferObjects(true);
+        mScatterGeometry->setComputeBoundingBoxCallback(new osg::Drawable::ComputeBoundingBoxCallback());
+
+        bool rectangle = dynamic_cast<osg::TextureRectangle*>(input) != NULL;
+
+        osg::StateSet* ss = mScatterGeometry->getOrCreateStateSet();
+        ss->setAttribute(newVp.get(), osg::StateAttribute::ON);
+        ss->setAttribute(createHistogramProgram(rectangle), osg::StateAttribute::ON);
+        ss->setAttributeAndModes(new osg::BlendFunc(GL_ONE, GL_ONE), osg::StateAttribute::ON);
+        ss->setTextureAttributeAndModes(0, input, osg::StateAttribute::ON);
+        ss->getOrCreateUniform(OSGPPU_HISTOGRAM_INPUT_UNIFORM, rectangle ? osg::Uniform::SAMPLER_2D_RECT : osg::Uniform::SAMPLER_2D)->set(0);
+        ss->getOrCreateUniform(OSGPPU_HISTOGRAM_NUM_BINS_UNIFORM, osg::Uniform::FLOAT)->set((float)mNumBins);
+        ss->getOrCreateUniform(OSGPPU_HISTOGRAM_STEP_UNIFORM, osg::Uniform::INT)->set((int)mSampleStep);
+
+        setRange(mRangeMin, mRangeMax);
+        updateWeight();
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInHistogramOut::createHistogramProgram(bool rectangle) const
+    {
+        // the texel is fetched in the vertex shader, which moves the point into its bin
+        std::stringstream vsrc;
+        vsrc << "#version 150 compatibility" << std::endl;
+        if (rectangle)
+            vsrc << "uniform sampler2DRect " << OSGPPU_HISTOGRAM_INPUT_UNIFORM << ";" << std::endl;
+        else
+            vsrc << "uniform sampler2D " << OSGPPU_HISTOGRAM_INPUT_UNIFORM << ";" << std::endl;
+        vsrc << "uniform vec2 " << OSGPPU_HISTOGRAM_RANGE_UNIFORM << ";" << std::endl
+             << "uniform float " << OSGPPU_HISTOGRAM_NUM_BINS_UNIFORM << ";" << std::endl
+             << "uniform int " << OSGPPU_HISTOGRAM_STEP_UNIFORM << ";" << std::endl
+             << "out float osgppu_HistogramValue;" << std::endl
+             << "void main(void)" << std::endl
+             << "{" << std::endl
+             << "    ivec2 texel = ivec2(int(gl_Vertex.x), gl_InstanceID) * " << OSGPPU_HISTOGRAM_STEP_UNIFORM << ";" << std::endl;
+        if (rectangle)
+            vsrc << "    vec4 color = texelFetch(" << OSGPPU_HISTOGRAM_INPUT_UNIFORM << ", texel);" << std::endl;
+        else
+            vsrc << "    vec4 color = texelFetch(" << OSGPPU_HISTOGRAM_INPUT_UNIFORM << ", texel, 0);" << std::endl;
+
+        switch (mChannel)
+        {
+            case RED: vsrc << "    float value = color.r;" << std::endl; break;
+            case GREEN: vsrc << "    float value = color.g;" << std::endl; break;
+            case BLUE: vsrc << "    float value = color.b;" << std::endl; break;
+            case ALPHA: vsrc << "    float value = color.a;" << std::endl; break;
+            case LUMINANCE: vsrc << "    float value = dot(color.rgb, vec3(0.2125, 0.7154, 0.0721));" << std::endl; break;
+            case LOG_LUMINANCE: vsrc << "    float value = log2(max(dot(color.rgb, vec3(0.2125, 0.7154, 0.0721)), 0.0001));" << std::endl; break;
+        }
+
+        vsrc << "    vec2 range = " << OSGPPU_HISTOGRAM_RANGE_UNIFORM << ";" << std::endl
+             << "    float bin = clamp(floor((value - range.x) / (range.y - range.x) * " << OSGPPU_HISTOGRAM_NUM_BINS_UNIFORM << "), 0.0, " << OSGPPU_HISTOGRAM_NUM_BINS_UNIFORM << " - 1.0);" << std::endl
+             << "    gl_Position = vec4((bin + 0.5) / " << OSGPPU_HISTOGRAM_NUM_BINS_UNIFORM << " * 2.0 - 1.0, 0.0, 0.0, 1.0);" << std::endl
+             << "    osgppu_HistogramValue = value;" << std::endl
+             << "}" << std::endl;
+
+        std::stringstream fsrc;
+        fsrc << "#version 150 compatibility" << std::endl
+             << "uniform float " << OSGPPU_HISTOGRAM_WEIGHT_UNIFORM << ";" << std::endl
+             << "in float osgppu_HistogramValue;" << std::endl
+             << "void main(void)" << std::endl
+             << "{" << std::endl
+             << "    gl_FragColor = vec4(1.0, osgppu_HistogramValue, 0.0, 0.0) * " << OSGPPU_HISTOGRAM_WEIGHT_UNIFORM << ";" << std::endl
+             << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::VERTEX, vsrc.str()));
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, fsrc.str()));
+        return program;
+    }
+
+    //--------------------------------------------------------------------------
+    bool UnitInHistogramOut::noticeBeginRendering (osg::RenderInfo& info, const osg::Drawable* drawable)
+    {
+        // bind the output fbo, it is restored in noticeFinishRendering()
+        UnitInOut::noticeBeginRendering(info, drawable);
+        if (!mScatterGeometry.valid()) return false;
+
+        // bins are accumulated from zero every frame
+        info.getState()->apply(mScatterGeometry->getStateSet());
+        GLfloat clearColor[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+        mScatterGeometry->drawImplementation(info);
+
+        // return false, so that parent drawable will not be rendered
+        return false;
+    }
+
+}; // end namespace
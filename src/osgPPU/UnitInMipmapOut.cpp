@@ -16,9 +16,14 @@
 
 #include <osgPPU/UnitInMipmapOut.h>
 #include <osgPPU/Processor.h>
+#include <osgPPU/Utility.h>
 
 #include <osg/Texture2D>
+#include <osg/Texture2DArray>
+#include <osg/TextureCubeMap>
+#include <osg/Image>
 #include <algorithm>
+#include <sstream>
 
 namespace osgPPU
 {
@@ -28,7 +33,11 @@ namespace osgPPU
         mMipmapFBO(unit.mMipmapFBO),
         mMipmapViewport(unit.mMipmapViewport),
         mMipmapDrawable(unit.mMipmapDrawable),
+        mMultiLevelPass(unit.mMultiLevelPass),
+        mNumLevelsPerPass(unit.mNumLevelsPerPass),
         mNumLevels(unit.mNumLevels),
+        mFirstLevel(unit.mFirstLevel),
+        mLastLevel(unit.mLastLevel),
         mGenerateMipmapInputIndex(unit.mGenerateMipmapInputIndex),
         mUseShader(unit.mUseShader),
         mOutputWidth(unit.mOutputWidth),
@@ -40,8 +49,11 @@ namespace osgPPU
     UnitInMipmapOut::UnitInMipmapOut() : UnitInOut()
     {
         mNumLevels = 0;
+        mFirstLevel = 0;
+        mLastLevel = -1;
         mGenerateMipmapInputIndex = -1;
         mUseShader = true;
+        mNumLevelsPerPass = 1;
         mOutputWidth = 0;
         mOutputHeight = 0;
         mProjectionMatrix = new osg::RefMatrix(osg::Matrix::ortho(0,1,0,1,0,1));
@@ -81,10 +93,11 @@ namespace osgPPU
             // if the output texture is the same as input texture, then
             // we do not need to recompute the level 0, because it should 
             // stay the same.
-            int baseLevel = (mGenerateMipmapInputIndex < 0 ? 0 : 1);
+            int baseLevel = getFirstRenderedLevel();
 
-            // attach a drawable for each mipmap level
-            for (int i = baseLevel; i < mNumLevels; i++)
+            // attach a drawable for each mipmap level, level 0 might be rendered
+            // as source of the first level
+            for (int i = 0; i < mNumLevels; i++)
             {
                 // setup the drawable
                 osg::Drawable* draw = mMipmapDrawable[i];
@@ -104,10 +117,143 @@ namespace osgPPU
                 osg::Uniform* ln = ss->getOrCreateUniform(OSGPPU_MIPMAP_LEVEL_NUM_UNIFORM, osg::Uniform::FLOAT);
                 ln->set((float)mNumLevels);
 
+                osg::Uniform* lf = ss->getOrCreateUniform(OSGPPU_MIPMAP_LEVEL_FIRST_UNIFORM, osg::Uniform::FLOAT);
+                osg::Uniform* ll = ss->getOrCreateUniform(OSGPPU_MIPMAP_LEVEL_LAST_UNIFORM, osg::Uniform::FLOAT);
+                lf->set((float)baseLevel);
+                ll->set((float)(mNumLevels - 1));
+
                 osg::Uniform* le = ss->getOrCreateUniform(OSGPPU_MIPMAP_LEVEL_UNIFORM, osg::Uniform::FLOAT);
                 le->set((float)i);
             }
+
+            setupMultiLevelPasses();
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInMipmapOut::setNumLevelsPerPass(unsigned int num)
+    {
+        if (num < 1) num = 1;
+        if (mNumLevelsPerPass != num) dirty();
+        mNumLevelsPerPass = num;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInMipmapOut::setMipmapLevelRange(int first, int last)
+    {
+        if (first < 0) first = 0;
+        if (last >= 0 && last < first) last = first;
+        if (mFirstLevel != first || mLastLevel != last) dirty();
+        mFirstLevel = first;
+        mLastLevel = last;
+    }
+
+    //------------------------------------------------------------------------------
+    int UnitInMipmapOut::getFirstRenderedLevel() const
+    {
+        // level 0 is never rendered if the mipmaps are generated for the input texture
+        return std::max(mFirstLevel, (mGenerateMipmapInputIndex < 0 ? 0 : 1));
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInMipmapOut::setupMultiLevelPasses()
+    {
+        mMultiLevelPass.clear();
+        if (mNumLevelsPerPass < 2 || mOutputTex.size() != 1 || !mOutputTex.begin()->second.valid()) return;
+
+        // the built-in filter works on 2D textures only
+        osg::Texture* output = mOutputTex.begin()->second.get();
+        if (dynamic_cast<osg::Texture2D*>(output) == NULL) return;
+
+        const char* format = getImageFormatQualifier(output->getInternalFormat());
+        if (format == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInMipmapOut::setupMultiLevelPasses() - " << getName() << " output format is not supported, use one pass per level" << std::endl;
+            return;
+        }
+
+        // the first and the last level are rendered by the unit's shader, the levels
+        // inbetween are computed by the built-in filter
+        int firstLevel = getFirstRenderedLevel() + 1;
+        int lastLevel = mNumLevels - 2;
+
+        // a work group reduces a block of at least 2^(n-1)x2^(n-1) texels of the first level of the pass
+        int numLevelsPerPass = std::min((int)mNumLevelsPerPass, 6);
+        for (int level = firstLevel; level <= lastLevel; level += numLevelsPerPass)
+        {
+            MultiLevelPass pass;
+            pass.firstLevel = level;
+            pass.numLevels = std::min(numLevelsPerPass, lastLevel - level + 1);
+            pass.groupSize = std::max(1u << (pass.numLevels - 1), 8u);
+
+            // the pass reads the previous level of the output texture
+            pass.program = createMultiLevelProgram(pass.numLevels, pass.groupSize, format);
+            pass.sourceLevel = new osg::Uniform("osgppu_MipmapSourceLevel", level - 1);
+
+            mMultiLevelPass.push_back(pass);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInMipmapOut::createMultiLevelProgram(unsigned int numLevels, unsigned int groupSize, const char* format) const
+    {
+        std::stringstream src;
+
+        src << "#version 430" << std::endl;
+        src << "layout(local_size_x = " << groupSize << ", local_size_y = " << groupSize << ") in;" << std::endl;
+        src << "uniform sampler2D osgppu_MipmapSource;" << std::endl;
+        src << "uniform int osgppu_MipmapSourceLevel;" << std::endl;
+        for (unsigned int i=0; i < numLevels; i++)
+            src << "layout(" << format << ", binding = " << i << ") writeonly uniform image2D osgppu_MipmapImage" << i << ";" << std::endl;
+        src << "shared vec4 texels[" << groupSize << "][" << groupSize << "];" << std::endl;
+
+        // size of the given level of the pass
+        src << "ivec2 levelSize(int level)" << std::endl
+            << "{" << std::endl
+            << "    return max(textureSize(osgppu_MipmapSource, osgppu_MipmapSourceLevel) >> (level + 1), ivec2(1));" << std::endl
+            << "}" << std::endl;
+
+        // the first level of the pass is computed from the source level, every following
+        // level is reduced from the previous one in shared memory, where the texel of a level
+        // is kept at the position of the first texel of its block. Texels outside of a level
+        // are not needed by the texels of the following levels, hence they are skipped
+        src << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    ivec2 local = ivec2(gl_LocalInvocationID.xy);" << std::endl
+            << "    ivec2 origin = ivec2(gl_WorkGroupID.xy) * " << groupSize << ";" << std::endl
+            << "    ivec2 texel = origin + local;" << std::endl
+            << "    ivec2 pos;" << std::endl
+            << "    ivec2 maxTexel = textureSize(osgppu_MipmapSource, osgppu_MipmapSourceLevel) - ivec2(1);" << std::endl
+            << "    vec4 value = 0.25 * (texelFetch(osgppu_MipmapSource, min(texel * 2, maxTexel), osgppu_MipmapSourceLevel)" << std::endl
+            << "        + texelFetch(osgppu_MipmapSource, min(texel * 2 + ivec2(1,0), maxTexel), osgppu_MipmapSourceLevel)" << std::endl
+            << "        + texelFetch(osgppu_MipmapSource, min(texel * 2 + ivec2(0,1), maxTexel), osgppu_MipmapSourceLevel)" << std::endl
+            << "        + texelFetch(osgppu_MipmapSource, min(texel * 2 + ivec2(1,1), maxTexel), osgppu_MipmapSourceLevel));" << std::endl
+            << "    texels[local.y][local.x] = value;" << std::endl
+            << "    if (all(lessThan(texel, levelSize(0)))) imageStore(osgppu_MipmapImage0, texel, value);" << std::endl;
+        for (unsigned int i=1; i < numLevels; i++)
+        {
+            int block = 1 << i;
+            int child = block / 2;
+            src << "    memoryBarrierShared();" << std::endl
+                << "    barrier();" << std::endl
+                << "    pos = texel / " << block << ";" << std::endl
+                << "    if (local.x % " << block << " == 0 && local.y % " << block << " == 0 && all(lessThan(pos, levelSize(" << i << "))))" << std::endl
+                << "    {" << std::endl
+                << "        ivec2 maxChild = levelSize(" << i - 1 << ") - ivec2(1);" << std::endl
+                << "        ivec2 childOrigin = origin / " << child << ";" << std::endl
+                << "        ivec2 c0 = (min(pos * 2, maxChild) - childOrigin) * " << child << ";" << std::endl
+                << "        ivec2 c1 = (min(pos * 2 + ivec2(1), maxChild) - childOrigin) * " << child << ";" << std::endl
+                << "        value = 0.25 * (texels[c0.y][c0.x] + texels[c0.y][c1.x] + texels[c1.y][c0.x] + texels[c1.y][c1.x]);" << std::endl
+                << "        texels[local.y][local.x] = value;" << std::endl
+                << "        imageStore(osgppu_MipmapImage" << i << ", pos, value);" << std::endl
+                << "    }" << std::endl;
         }
+        src << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->setName(getName() + "MipmapProgram");
+        program->addShader(new osg::Shader((osg::Shader::Type)GL_COMPUTE_SHADER, src.str()));
+        return program;
     }
     
     //--------------------------------------------------------------------------
@@ -131,7 +277,9 @@ namespace osgPPU
                 else
                     it->second->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::NEAREST_MIPMAP_NEAREST);
 
-                it->second->allocateMipmapLevels();
+                // with a partial chain only the used levels are allocated later on
+                if (mLastLevel < 0)
+                    it->second->allocateMipmapLevels();
                 createAndAttachFBOs(it->second.get(), it->first);
             }
         }
@@ -141,10 +289,11 @@ namespace osgPPU
     //--------------------------------------------------------------------------
     void UnitInMipmapOut::createAndAttachFBOs(osg::Texture* output, int mrt)
     {
-        // check if the texture is 2D texture
-        if (dynamic_cast<osg::Texture2D*>(output) == NULL)
+        // check if the texture is 2D, 2D array or cubemap texture
+        unsigned int numLayers = getNumOutputLayers(output);
+        if (numLayers == 0)
         {
-            osg::notify(osg::WARN) << "osgPPU::UnitInMipmapOut::createAndAttachFBOs() - currently only 2D textures are supported" << std::endl;
+            osg::notify(osg::WARN) << "osgPPU::UnitInMipmapOut::createAndAttachFBOs() - only 2D, 2D array and cubemap textures are supported" << std::endl;
             return;
         }
 
@@ -153,6 +302,7 @@ namespace osgPPU
         int height = output->getTextureHeight();
         int mwh = std::max(width, height);
         int numLevel = 1 + static_cast<int>(floor(logf(mwh)/logf(2.0f)));
+        if (mLastLevel >= 0) numLevel = std::min(numLevel, mLastLevel + 1);
 
         // set new sizes
         mOutputWidth = width;
@@ -162,6 +312,12 @@ namespace osgPPU
         // if we do not use shader, then return
         if (mUseShader == false) return;
 
+        // all layers/faces of a level are rendered at once
+        if (numLayers > 1 && !setupLayeredProgram(dynamic_cast<osg::TextureCubeMap*>(output) != NULL))
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInMipmapOut::createAndAttachFBOs() - " << getName() << " layered textures require a shader program" << std::endl;
+        }
+
         // generate fbo and viewport for each mipmap level if not done before
         if ((int)mMipmapFBO.size() != numLevel)
         {
@@ -180,11 +336,13 @@ namespace osgPPU
                 
                 // generate fbo and assign a mipmap level to it
 				osg::ref_ptr<FrameBufferObject> fbo = new FrameBufferObject();
-                fbo->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + mrt), osg::FrameBufferAttachment(dynamic_cast<osg::Texture2D*>(output), i));
+                osg::FrameBufferAttachment attachment;
+                createLevelAttachment(output, i, attachment);
+                fbo->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + mrt), attachment);
                 mMipmapFBO.push_back(fbo);
 
                 // generate drawable which is responsible for this level
-                osg::Drawable* draw = createTexturedQuadDrawable();
+                osg::Drawable* draw = numLayers > 1 ? createLayeredQuadDrawable(numLayers) : createTexturedQuadDrawable();
                 osg::StateSet* ss = draw->getOrCreateStateSet();
                 ss->setAttribute(vp, osg::StateAttribute::ON);
                 //ss->setAttribute(fbo, osg::StateAttribute::ON);
@@ -206,13 +364,71 @@ namespace osgPPU
 
         pushFrameBufferObject(*info.getState());
 
+        unsigned int contextID = info.getContextID();
+        unsigned baseLevel = getFirstRenderedLevel();
+
+        // allocate the levels of a partial mipmap chain
+        std::map<int, osg::ref_ptr<osg::Texture> >::iterator it = mOutputTex.begin();
+        for (; it != mOutputTex.end(); it++)
+            if (it->second.valid()) applyLevelRange(*info.getState(), it->second.get());
+
+        // nothing to render if the range starts below the smallest level
+        if (baseLevel >= mMipmapDrawable.size())
+        {
+            popFrameBufferObject(*info.getState());
+            return false;
+        }
+
+        // the levels above the first one are the source of it
+        generateSourceLevels(info);
+
         // perform manual rendering of all drawables of this unit
         // the drawables are used for every mipmap level 
-        for (unsigned i=(mGenerateMipmapInputIndex < 0 ? 0 : 1); i < mMipmapDrawable.size(); i++)
+        if (mMultiLevelPass.empty() || !isComputeShaderSupported(contextID))
+        {
+            for (unsigned i=baseLevel; i < mMipmapDrawable.size(); i++)
+            {
+                info.getState()->apply(mMipmapDrawable[i]->getStateSet());
+                mMipmapFBO[i]->apply(*info.getState());
+                mMipmapDrawable[i]->drawImplementation(info);
+            }
+
+        // first and last level are rendered by the unit's shader, the rest by the built-in filter
+        }else
         {
-            info.getState()->apply(mMipmapDrawable[i]->getStateSet());
-            mMipmapFBO[i]->apply(*info.getState());
-            mMipmapDrawable[i]->drawImplementation(info);
+            info.getState()->apply(mMipmapDrawable[baseLevel]->getStateSet());
+            mMipmapFBO[baseLevel]->apply(*info.getState());
+            mMipmapDrawable[baseLevel]->drawImplementation(info);
+
+            osg::Texture* output = mOutputTex.begin()->second.get();
+            osg::ref_ptr<osg::Uniform> sampler = new osg::Uniform("osgppu_MipmapSource", 0);
+            for (unsigned i=0; i < mMultiLevelPass.size(); i++)
+            {
+                const MultiLevelPass& pass = mMultiLevelPass[i];
+                info.getState()->applyTextureAttribute(0, output);
+                info.getState()->applyAttribute(pass.program.get());
+                const osg::Program::PerContextProgram* program = info.getState()->getLastAppliedProgramObject();
+                if (program == NULL) break;
+                program->apply(*sampler);
+                program->apply(*pass.sourceLevel);
+
+                for (int j=0; j < pass.numLevels; j++)
+                    bindImageTexture(contextID, j, output, pass.firstLevel + j);
+
+                // the written levels are read by the next pass
+                unsigned int numGroupsX = ((unsigned int)mMipmapViewport[pass.firstLevel]->width() + pass.groupSize - 1) / pass.groupSize;
+                unsigned int numGroupsY = ((unsigned int)mMipmapViewport[pass.firstLevel]->height() + pass.groupSize - 1) / pass.groupSize;
+                dispatchCompute(contextID, numGroupsX, numGroupsY, 1);
+                imageMemoryBarrier(contextID);
+            }
+
+            unsigned lastLevel = mMipmapDrawable.size() - 1;
+            if (lastLevel > baseLevel)
+            {
+                info.getState()->apply(mMipmapDrawable[lastLevel]->getStateSet());
+                mMipmapFBO[lastLevel]->apply(*info.getState());
+                mMipmapDrawable[lastLevel]->drawImplementation(info);
+            }
         }
 
         popFrameBufferObject(*info.getState());
@@ -222,6 +438,49 @@ namespace osgPPU
         return false;
     }
 
+    //--------------------------------------------------------------------------
+    void UnitInMipmapOut::generateSourceLevels(osg::RenderInfo& info)
+    {
+        int baseLevel = getFirstRenderedLevel();
+        if (baseLevel == 0) return;
+
+        // level 0 of a separate output is rendered from the input as usual
+        if (mGenerateMipmapInputIndex < 0)
+        {
+            info.getState()->apply(mMipmapDrawable[0]->getStateSet());
+            mMipmapFBO[0]->apply(*info.getState());
+            mMipmapDrawable[0]->drawImplementation(info);
+        }
+        if (baseLevel < 2) return;
+
+        // the levels inbetween are generated by the hardware, restrict the
+        // generation to these levels by the max level of the texture
+        osg::FBOExtensions* fbo_ext = osg::FBOExtensions::instance(info.getContextID(),true);
+        std::map<int, osg::ref_ptr<osg::Texture> >::iterator it = mOutputTex.begin();
+        for (; it != mOutputTex.end(); it++)
+        {
+            if (!it->second.valid()) continue;
+
+            GLenum target = it->second->getTextureTarget();
+            GLint maxLevel = 1000;
+            info.getState()->applyTextureAttribute(0, it->second.get());
+            glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+            glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, baseLevel - 1);
+            fbo_ext->glGenerateMipmap(target);
+            glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    void UnitInMipmapOut::noticeChangeLive(bool live)
+    {
+        UnitInOut::noticeChangeLive(live);
+
+        // mipmap levels must be reattached too
+        for (unsigned i=0; i < mMipmapFBO.size(); i++)
+            mMipmapFBO[i]->dirty();
+    }
+
     //--------------------------------------------------------------------------
     void UnitInMipmapOut::noticeFinishRendering(osg::RenderInfo &renderInfo, const osg::Drawable* drawable)
     {
@@ -239,9 +498,61 @@ namespace osgPPU
         std::map<int, osg::ref_ptr<osg::Texture> >::iterator it = mOutputTex.begin();
         for (; it != mOutputTex.end(); it++)
         {
+            applyLevelRange(*renderInfo.getState(), it->second.get());
             renderInfo.getState()->applyTextureAttribute(0, it->second.get());
             fbo_ext->glGenerateMipmap(it->second->getTextureTarget());
         }
     }
+
+    //--------------------------------------------------------------------------
+    void UnitInMipmapOut::applyLevelRange(osg::State& state, osg::Texture* output)
+    {
+        // full chain is allocated by osg::Texture
+        if (mLastLevel < 0 || output == NULL) return;
+
+        unsigned int contextID = state.getContextID();
+        osg::Texture::TextureObject* to = output->getTextureObject(contextID);
+        if (to == NULL)
+        {
+            state.applyTextureAttribute(0, output);
+            to = output->getTextureObject(contextID);
+            if (to == NULL) return;
+        }
+
+        // setup only once per texture object
+        if (mLevelRangeTextureID[contextID] == to->id()) return;
+        mLevelRangeTextureID[contextID] = to->id();
+
+        GLenum target = output->getTextureTarget();
+        int lastLevel = mNumLevels - 1;
+        state.applyTextureAttribute(0, output);
+        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, lastLevel);
+
+        // hardware mipmap generation allocates the levels by itself
+        if (mUseShader == false) return;
+
+        // allocate storage for the levels [1, last] only, the levels above the first
+        // rendered level are needed as its source
+        GLenum format = output->getSourceFormat() ? output->getSourceFormat() : createSourceTextureFormat(output->getInternalFormat());
+        GLenum type = output->getSourceType() ? output->getSourceType() : osg::Image::computeFormatDataType(output->getInternalFormat());
+        if (type == 0) type = GL_UNSIGNED_BYTE;
+        for (int i=1; i <= lastLevel; i++)
+        {
+            int w = std::max(1, mOutputWidth >> i);
+            int h = std::max(1, mOutputHeight >> i);
+            if (target == GL_TEXTURE_CUBE_MAP)
+            {
+                for (unsigned int face=0; face < 6; face++)
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, i, output->getInternalFormat(), w, h, 0, format, type, NULL);
+            }else if (target == GL_TEXTURE_2D_ARRAY_EXT)
+            {
+                osg::Texture2DArray::Extensions* ext = osg::Texture2DArray::getExtensions(contextID, true);
+                if (ext && ext->isTexture2DArraySupported())
+                    ext->glTexImage3D(target, i, output->getInternalFormat(), w, h, getNumOutputLayers(output), 0, format, type, NULL);
+            }else
+                glTexImage2D(target, i, output->getInternalFormat(), w, h, 0, format, type, NULL);
+        }
+    }
     
 }; // end namespace
@@ -22,6 +22,7 @@
 #include <osgPPU/UnitInOut.h>
 #include <osgPPU/Processor.h>
 #include <osgPPU/Utility.h>
+#include <osgPPU/ShaderAttribute.h>
 
 #include <osg/TextureCubeMap>
 #include <osg/Texture2D>
@@ -29,6 +30,11 @@
 #include <osg/Texture2DArray>
 #include <osg/TextureRectangle>
 #include <osg/GL2Extensions>
+#include <osg/Geometry>
+#include <osg/FrameStamp>
+
+#include <algorithm>
+#include <sstream>
 
 namespace osgPPU
 {
@@ -236,26 +242,71 @@ namespace osgPPU
             }
     };
 
+    //------------------------------------------------------------------------------
+    // Helper class for layered rendering, program build out of the unit's shaders
+    //------------------------------------------------------------------------------
+    class LayeredProgram : public osg::Program
+    {
+        public:
+            LayeredProgram() {}
+
+            // uniforms of a shader attribute are set by the attribute itself
+            void apply (osg::State &state) const
+            {
+                osg::Program::apply(state);
+
+                const ShaderAttribute* shader = dynamic_cast<const ShaderAttribute*>(_source.get());
+                if (shader) shader->applyUniforms(state);
+            }
+
+            // take over the shaders and bindings of the given program
+            void setSource(osg::Program* source)
+            {
+                _source = source;
+
+                while (getNumShaders()) removeShader(getShader(0));
+                for (unsigned int i=0; i < source->getNumShaders(); i++)
+                    addShader(source->getShader(i));
+
+                const AttribBindingList& attribs = source->getAttribBindingList();
+                for (AttribBindingList::const_iterator it = attribs.begin(); it != attribs.end(); it++)
+                    addBindAttribLocation(it->first, it->second);
+
+                const FragDataBindingList& frags = source->getFragDataBindingList();
+                for (FragDataBindingList::const_iterator it = frags.begin(); it != frags.end(); it++)
+                    addBindFragDataLocation(it->first, it->second);
+            }
+
+        private:
+            osg::ref_ptr<osg::Program> _source;
+    };
+
     //------------------------------------------------------------------------------
     UnitInOut::UnitInOut(const UnitInOut& unit, const osg::CopyOp& copyop) :
         Unit(unit, copyop),
         mFBO(unit.mFBO),
+        mBufferedFBO(unit.mBufferedFBO),
+        mBufferedOutputTex(unit.mBufferedOutputTex),
+        mDoubleBufferedOutput(unit.mDoubleBufferedOutput),
         mBypassedInput(unit.mBypassedInput),
         mOutputCubemapFace(unit.mOutputCubemapFace),
         mOutputZSlice(unit.mOutputZSlice),
         mOutputDepth(unit.mOutputDepth),
         mOutputType(unit.mOutputType),
-        mOutputInternalFormat(unit.mOutputInternalFormat)
+        mOutputInternalFormat(unit.mOutputInternalFormat),
+        mRenderPasses(unit.mRenderPasses)
     {
     }
 
     //------------------------------------------------------------------------------
     UnitInOut::UnitInOut() : Unit(),
+        mDoubleBufferedOutput(false),
         mBypassedInput(-1),
         mOutputCubemapFace(0),
         mOutputDepth(1),
         mOutputType(TEXTURE_2D),
-        mOutputInternalFormat(GL_RGBA16F_ARB)
+        mOutputInternalFormat(GL_RGBA16F_ARB),
+        mRenderPasses(false)
     {
         mFBO = new FrameBufferObject();
 
@@ -524,18 +575,67 @@ namespace osgPPU
             // if we are here, then output texture type is not supported, hence give some warning
             osg::notify(osg::FATAL) << "osgPPU::UnitInOut::assignOutputTexture() - " << getName() << " cannot attach output texture to FBO because output texture type is not supported" << std::endl;
         }
+
+        // second fbo writes to the buffered textures on odd frames
+        mBufferedFBO = NULL;
+        if (!mDoubleBufferedOutput)
+        {
+            mBufferedOutputTex.clear();
+            return;
+        }
+        if (!supportsDoubleBufferedOutput())
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOut::assignOutputTexture() - " << getName() << " does not write its output through the unit's fbo, hence it cannot be double buffered" << std::endl;
+            mBufferedOutputTex.clear();
+            return;
+        }
+        mBufferedFBO = new FrameBufferObject();
+        for (it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+        {
+            osg::Texture* buffered = getOrCreateBufferedOutputTexture(it->second.get());
+            osg::Texture2D* tex2D = dynamic_cast<osg::Texture2D*>(buffered);
+            osg::TextureRectangle* texRect = dynamic_cast<osg::TextureRectangle*>(buffered);
+            if (tex2D != NULL)
+                mBufferedFBO->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + it->first), osg::FrameBufferAttachment(tex2D));
+            else if (texRect != NULL)
+                mBufferedFBO->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + it->first), osg::FrameBufferAttachment(texRect));
+            else
+            {
+                osg::notify(osg::WARN) << "osgPPU::UnitInOut::assignOutputTexture() - " << getName() << " only 2D outputs can be double buffered" << std::endl;
+                mBufferedFBO = NULL;
+                return;
+            }
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Texture* UnitInOut::getOrCreateBufferedOutputTexture(const osg::Texture* output)
+    {
+        if (!mDoubleBufferedOutput || !supportsDoubleBufferedOutput() || output == NULL) return NULL;
+
+        for (TextureMap::iterator it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+        {
+            if (it->second.get() != output) continue;
+            if (dynamic_cast<const osg::Texture2D*>(output) == NULL && dynamic_cast<const osg::TextureRectangle*>(output) == NULL) return NULL;
+
+            // the buffered texture is a copy of the output, reallocated when the output is resized
+            osg::ref_ptr<osg::Texture>& buffered = mBufferedOutputTex[it->first];
+            if (!buffered.valid() || buffered->getTextureWidth() != output->getTextureWidth() || buffered->getTextureHeight() != output->getTextureHeight())
+                buffered = static_cast<osg::Texture*>(output->clone(osg::CopyOp::SHALLOW_COPY));
+            return buffered.get();
+        }
+        return NULL;
     }
 
     //------------------------------------------------------------------------------
     void UnitInOut::assignOutputPBO()
     {
         // for each input texture do
-        PixelDataBufferObjectMap::iterator it = mOutputPBO.begin();
-        for (; it != mOutputPBO.end(); it++)
+        PixelDataBufferRingMap::iterator it = mOutputPBORing.begin();
+        for (; it != mOutputPBORing.end(); it++)
         {
             // get output texture
-            osg::Texture* texture = mOutputTex[it->first].get();
-            osg::PixelDataBufferObject* pbo = it->second.get();
+            osg::Texture* texture = getOutputTexture(it->first);
     
             // if the output texture is NULL, hence ERROR
             if (texture == NULL)
@@ -546,14 +646,19 @@ namespace osgPPU
     
             // check the type of the output texture. It must be a supported type
             if ((dynamic_cast<osg::Texture2D*>(texture) == NULL) &&
-                (dynamic_cast<osg::TextureRectangle*>(texture) == NULL))
+                (dynamic_cast<osg::TextureRectangle*>(texture) == NULL) &&
+                (dynamic_cast<osg::Texture2DArray*>(texture) == NULL) &&
+                (dynamic_cast<osg::Texture3D*>(texture) == NULL) &&
+                (dynamic_cast<osg::TextureCubeMap*>(texture) == NULL))
             {
                 osg::notify(osg::FATAL) << "osgPPU::Unit::assignOutputPBOs() - " << getName() << " output texture " << it->first << " has an unsupported format." << std::endl;
                 continue;
             }
 
-            // compute size of the texture which has to be allocated for the pbo
-            pbo->setDataSize(computeTextureSizeInBytes(texture));
+            // compute size of the texture which has to be allocated for the pbos
+            unsigned int size = computeTextureSizeInBytes(texture);
+            for (unsigned int i=0; i < it->second.buffers.size(); i++)
+                it->second.buffers[i]->setDataSize(size);
         }
     }
 
@@ -619,14 +724,64 @@ namespace osgPPU
 
     }
 
+    //------------------------------------------------------------------------------
+    void UnitInOut::noticeChangeLive(bool live)
+    {
+        // attachments has to be reapplied, because texture objects are recreated
+        mFBO->dirty();
+        if (mBufferedFBO.valid()) mBufferedFBO->dirty();
+        for (unsigned i=0; i < mPassFBO.size(); i++)
+            mPassFBO[i]->dirty();
+        if (live) return;
+
+        // release texture objects of the output textures, they are reallocated on the next apply
+        TextureMap::iterator it = mOutputTex.begin();
+        for (; it != mOutputTex.end(); it++)
+        {
+            if (!it->second.valid()) continue;
+
+            // do not release bypassed input textures, they are not owned by this unit
+            bool isInput = false;
+            for (TextureMap::const_iterator jt = mInputTex.begin(); jt != mInputTex.end(); jt++)
+                if (jt->second == it->second) isInput = true;
+
+            if (!isInput) it->second->dirtyTextureObject();
+        }
+        for (it = mBufferedOutputTex.begin(); it != mBufferedOutputTex.end(); it++)
+            if (it->second.valid()) it->second->dirtyTextureObject();
+    }
+
     //------------------------------------------------------------------------------
     bool UnitInOut::noticeBeginRendering (osg::RenderInfo& info, const osg::Drawable* )
     {
         //if (mBypassedInput >= 0 && mBypassedInput < (int)getNumParents()) return true;
 
+        // units rendering passes draw them on their own
+        if (mRenderPasses)
+        {
+            if (mPassFBO.empty()) return false;
+
+            // setup matricies, they must be setted up correctly in order
+            // to have correct rendering of the passes
+            info.getState()->applyProjectionMatrix(getDefaultProjectionMatrix());
+            info.getState()->applyModelViewMatrix(getDefaultModelviewMatrix());
+
+            pushFrameBufferObject(*info.getState());
+            renderPasses(info);
+            popFrameBufferObject(*info.getState());
+
+            // return false, so that parent drawable will not be rendered
+            return false;
+        }
+
         pushFrameBufferObject(*info.getState());
 
-        mFBO->apply(*info.getState());
+        // double buffered outputs are written alternately
+        const osg::FrameStamp* fs = info.getState()->getFrameStamp();
+        if (mBufferedFBO.valid() && fs && fs->getFrameNumber() % 2)
+            mBufferedFBO->apply(*info.getState());
+        else
+            mFBO->apply(*info.getState());
 
         return true;
     }
@@ -636,8 +791,264 @@ namespace osgPPU
     {
         //if (mBypassedInput >= 0 && mBypassedInput < (int)getNumParents()) return;
 
+        // fbo is already restored after rendering the passes
+        if (mRenderPasses) return;
+
         // restore the FBO to its previous state
         popFrameBufferObject(*info.getState());
     }
 
+    //------------------------------------------------------------------------------
+    void UnitInOut::renderPasses(osg::RenderInfo& info)
+    {
+        for (unsigned i=0; i < mPassFBO.size(); i++)
+            renderPass(info, i);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOut::renderPass(osg::RenderInfo& info, unsigned int index)
+    {
+        osg::State& state = *info.getState();
+        osg::Drawable* draw = mPassDrawable[index].get();
+        if (draw)
+        {
+            state.apply(draw->getStateSet());
+
+            // pass statesets replace the state of the unit, hence inputs alternating with the frames are swapped here
+            const osg::FrameStamp* fs = state.getFrameStamp();
+            osg::StateSet* ss = draw->getStateSet();
+            if (fs && ss && getFrameParityStateSet(fs->getFrameNumber()))
+            {
+                for (unsigned int i=0; i < ss->getTextureAttributeList().size(); i++)
+                {
+                    osg::Texture* texture = dynamic_cast<osg::Texture*>(ss->getTextureAttribute(i, osg::StateAttribute::TEXTURE));
+                    osg::Texture* current = getFrameParityInputTexture(texture, fs->getFrameNumber());
+                    if (current != texture) state.applyTextureAttribute(i, current);
+                }
+            }
+
+            mPassFBO[index]->apply(state);
+            draw->drawImplementation(info);
+        }else
+        {
+            // clear color of the application is kept
+            GLfloat clearColor[4];
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+            mPassFBO[index]->apply(state);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOut::clearPasses()
+    {
+        mPassTexturePool.insert(mPassTexturePool.end(), mPassTexture.begin(), mPassTexture.end());
+        mPassTexture.clear();
+        mPassFBO.clear();
+        mPassDrawable.clear();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOut::appendPass(FrameBufferObject* fbo, osg::Drawable* drawable)
+    {
+        if (fbo == NULL) return;
+        mPassFBO.push_back(fbo);
+        mPassDrawable.push_back(drawable);
+    }
+
+    //------------------------------------------------------------------------------
+    FrameBufferObject* UnitInOut::createPassFBO(osg::Texture* output) const
+    {
+        osg::FrameBufferAttachment attachment;
+        osg::TextureRectangle* outputRect = dynamic_cast<osg::TextureRectangle*>(output);
+        if (outputRect != NULL)
+            attachment = osg::FrameBufferAttachment(outputRect);
+        else if (!createLevelAttachment(output, 0, attachment))
+            return NULL;
+
+        FrameBufferObject* fbo = new FrameBufferObject();
+        fbo->setAttachment(osg::Camera::COLOR_BUFFER0, attachment);
+        return fbo;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Texture2D* UnitInOut::acquirePassTexture(int width, int height, GLenum internalFormat, osg::Texture::FilterMode filter)
+    {
+        if (internalFormat == 0) internalFormat = getOutputInternalFormat();
+        osg::ref_ptr<osg::Texture2D> texture;
+
+        // reuse texture of the previous initialization
+        for (PassTextureList::iterator it = mPassTexturePool.begin(); it != mPassTexturePool.end(); it++)
+        {
+            if ((*it)->getTextureWidth() == width && (*it)->getTextureHeight() == height &&
+                (*it)->getInternalFormat() == internalFormat && (*it)->getFilter(osg::Texture::MIN_FILTER) == filter)
+            {
+                texture = *it;
+                mPassTexturePool.erase(it);
+                break;
+            }
+        }
+
+        if (!texture.valid())
+        {
+            texture = new osg::Texture2D();
+            texture->setTextureSize(width, height);
+            texture->setInternalFormat(internalFormat);
+            texture->setSourceFormat(createSourceTextureFormat(internalFormat));
+            texture->setSourceType(GL_FLOAT);
+            texture->setFilter(osg::Texture::MIN_FILTER, filter);
+            texture->setFilter(osg::Texture::MAG_FILTER, filter);
+            texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+            texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        }
+
+        mPassTexture.push_back(texture);
+        return texture.get();
+    }
+
+
+    //------------------------------------------------------------------------------
+    unsigned int UnitInOut::getNumOutputLayers(const osg::Texture* texture)
+    {
+        if (dynamic_cast<const osg::Texture2D*>(texture) != NULL) return 1;
+        if (dynamic_cast<const osg::TextureCubeMap*>(texture) != NULL) return 6;
+
+        const osg::Texture2DArray* tex2DArray = dynamic_cast<const osg::Texture2DArray*>(texture);
+        if (tex2DArray != NULL) return std::max(1, tex2DArray->getTextureDepth());
+
+        return 0;
+    }
+
+    //------------------------------------------------------------------------------
+    bool UnitInOut::createLevelAttachment(osg::Texture* texture, unsigned int level, osg::FrameBufferAttachment& attachment)
+    {
+        osg::Texture2D* tex2D = dynamic_cast<osg::Texture2D*>(texture);
+        if (tex2D != NULL)
+        {
+            attachment = osg::FrameBufferAttachment(tex2D, level);
+            return true;
+        }
+
+        // layer is selected by the geometry shader
+        osg::TextureCubeMap* cubemapTex = dynamic_cast<osg::TextureCubeMap*>(texture);
+        if (cubemapTex != NULL)
+        {
+            attachment = osg::FrameBufferAttachment(cubemapTex, osg::Camera::FACE_CONTROLLED_BY_GEOMETRY_SHADER, level);
+            return true;
+        }
+
+        osg::Texture2DArray* tex2DArray = dynamic_cast<osg::Texture2DArray*>(texture);
+        if (tex2DArray != NULL)
+        {
+            attachment = osg::FrameBufferAttachment(tex2DArray, osg::Camera::FACE_CONTROLLED_BY_GEOMETRY_SHADER, level);
+            return true;
+        }
+
+        return false;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Drawable* UnitInOut::createLayeredQuadDrawable(unsigned int numLayers)
+    {
+        osg::Geometry* geom = dynamic_cast<osg::Geometry*>(createTexturedQuadDrawable());
+        if (geom == NULL || numLayers <= 1) return geom;
+
+        // two triangles per layer, the geometry shader derives the layer from the primitive id
+        static const float quad[6][2] = {{0,0}, {1,0}, {1,1}, {0,0}, {1,1}, {0,1}};
+        osg::Vec3Array* coords = new osg::Vec3Array(6 * numLayers);
+        osg::Vec2Array* tcoords = new osg::Vec2Array(6 * numLayers);
+        for (unsigned int i=0; i < 6 * numLayers; i++)
+        {
+            (*coords)[i].set(quad[i % 6][0], quad[i % 6][1], 0.0f);
+            (*tcoords)[i].set(quad[i % 6][0], quad[i % 6][1]);
+        }
+        geom->setVertexArray(coords);
+        for (unsigned int i=0; i < geom->getNumTexCoordArrays(); i++)
+            geom->setTexCoordArray(i, NULL);
+        geom->setTexCoordArray(0, tcoords);
+
+        geom->removePrimitiveSet(0, geom->getNumPrimitiveSets());
+        geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, 6 * numLayers));
+
+        // layered program is used instead of the unit's one
+        if (mLayeredProgram.valid())
+            geom->getOrCreateStateSet()->setAttribute(mLayeredProgram.get(), osg::StateAttribute::ON);
+
+        return geom;
+    }
+
+    //------------------------------------------------------------------------------
+    bool UnitInOut::setupLayeredProgram(bool cubemap)
+    {
+        osg::Program* program = dynamic_cast<osg::Program*>(getOrCreateStateSet()->getAttribute(osg::StateAttribute::PROGRAM));
+        if (program == NULL || program->getNumShaders() == 0) return false;
+
+        // the drawables share one program, so that it can be rebuild in place
+        if (!mLayeredProgram.valid()) mLayeredProgram = new LayeredProgram();
+        LayeredProgram* layered = static_cast<LayeredProgram*>(mLayeredProgram.get());
+        layered->setSource(program);
+
+        // check if the user does the layering by himself
+        bool hasVertexShader = false;
+        for (unsigned int i=0; i < program->getNumShaders(); i++)
+        {
+            const osg::Shader* shader = program->getShader(i);
+            if (shader->getType() == osg::Shader::GEOMETRY) return true;
+            if (shader->getType() == osg::Shader::VERTEX) hasVertexShader = true;
+        }
+
+        if (!hasVertexShader)
+        {
+            std::stringstream src;
+            src << "#version 150 compatibility" << std::endl
+                << "void main(void)" << std::endl
+                << "{" << std::endl
+                << "    gl_Position = ftransform();" << std::endl
+                << "    gl_FrontColor = gl_Color;" << std::endl;
+            for (unsigned int i=0; i < 4; i++)
+                src << "    gl_TexCoord[" << i << "] = gl_MultiTexCoord" << i << ";" << std::endl;
+            src << "}" << std::endl;
+            layered->addShader(new osg::Shader(osg::Shader::VERTEX, src.str()));
+        }
+
+        // two triangles are emitted per layer
+        std::stringstream src;
+        src << "#version 150 compatibility" << std::endl
+            << "layout(triangles) in;" << std::endl
+            << "layout(triangle_strip, max_vertices = 3) out;" << std::endl
+            << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    int layer = gl_PrimitiveIDIn / 2;" << std::endl
+            << "    for (int i=0; i < 3; i++)" << std::endl
+            << "    {" << std::endl
+            << "        gl_Layer = layer;" << std::endl
+            << "        gl_Position = gl_in[i].gl_Position;" << std::endl
+            << "        gl_FrontColor = gl_in[i].gl_FrontColor;" << std::endl
+            << "        gl_TexCoord[0] = vec4(gl_in[i].gl_TexCoord[0].xy, float(layer), 1.0);" << std::endl;
+        for (unsigned int i=(cubemap ? 2 : 1); i < 4; i++)
+            src << "        gl_TexCoord[" << i << "] = gl_in[i].gl_TexCoord[" << i << "];" << std::endl;
+        if (cubemap)
+        {
+            // direction of the texel, as defined by the cubemap face selection rules
+            src << "        vec2 st = gl_in[i].gl_TexCoord[0].xy * 2.0 - 1.0;" << std::endl
+                << "        vec3 dir;" << std::endl
+                << "        if (layer == 0) dir = vec3( 1.0, -st.y, -st.x);" << std::endl
+                << "        else if (layer == 1) dir = vec3(-1.0, -st.y,  st.x);" << std::endl
+                << "        else if (layer == 2) dir = vec3( st.x,  1.0,  st.y);" << std::endl
+                << "        else if (layer == 3) dir = vec3( st.x, -1.0, -st.y);" << std::endl
+                << "        else if (layer == 4) dir = vec3( st.x, -st.y,  1.0);" << std::endl
+                << "        else dir = vec3(-st.x, -st.y, -1.0);" << std::endl
+                << "        gl_TexCoord[1] = vec4(normalize(dir), 0.0);" << std::endl;
+        }
+        src << "        EmitVertex();" << std::endl
+            << "    }" << std::endl
+            << "    EndPrimitive();" << std::endl
+            << "}" << std::endl;
+        layered->addShader(new osg::Shader(osg::Shader::GEOMETRY, src.str()));
+
+        return true;
+    }
+
 }; // end namespace
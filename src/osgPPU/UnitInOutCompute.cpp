@@ -0,0 +1,236 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitInOutCompute.h>
+#include <osgPPU/ShaderAttribute.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/Texture3D>
+#include <osg/Texture2DArray>
+
+#include <sstream>
+#include <algorithm>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    UnitInOutCompute::UnitInOutCompute(const UnitInOutCompute& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mComputeShaderSource(unit.mComputeShaderSource),
+        mInputImageUnit(unit.mInputImageUnit),
+        mComputeProgram(unit.mComputeProgram)
+    {
+        for (unsigned int i=0; i < 3; i++) mLocalSize[i] = unit.mLocalSize[i];
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInOutCompute::UnitInOutCompute() : UnitInOut()
+    {
+        mLocalSize[0] = 16;
+        mLocalSize[1] = 16;
+        mLocalSize[2] = 1;
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInOutCompute::~UnitInOutCompute()
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutCompute::setLocalSize(unsigned int x, unsigned int y, unsigned int z)
+    {
+        mLocalSize[0] = osg::maximum(1u, x);
+        mLocalSize[1] = osg::maximum(1u, y);
+        mLocalSize[2] = osg::maximum(1u, z);
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutCompute::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        mComputeProgram = NULL;
+        if (getOutputTextureType() == TEXTURE_CUBEMAP)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutCompute::init() - " << getName() << " cubemap outputs are not supported" << std::endl;
+            return;
+        }
+        if (mComputeShaderSource.empty())
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutCompute::init() - " << getName() << " has no compute shader" << std::endl;
+            return;
+        }
+
+        mComputeProgram = createComputeProgram();
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInOutCompute::createComputeProgram() const
+    {
+        std::stringstream header;
+        header << "layout(local_size_x = " << mLocalSize[0] << ", local_size_y = " << mLocalSize[1] << ", local_size_z = " << mLocalSize[2] << ") in;" << std::endl;
+        for (TextureMap::const_iterator it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+        {
+            const char* format = it->second.valid() ? getImageFormatQualifier(it->second->getInternalFormat()) : NULL;
+            if (format) header << "#define OSGPPU_OUTPUT_FORMAT" << it->first << " " << format << std::endl;
+        }
+
+        // the header must follow the version and the extension directives at the beginning
+        const std::string& src = mComputeShaderSource;
+        std::string::size_type insert = 0, pos = 0;
+        bool hasVersion = false;
+        while (pos < src.size())
+        {
+            std::string::size_type end = src.find('\n', pos);
+            if (end == std::string::npos) end = src.size();
+            std::string::size_type first = src.find_first_not_of(" \t\r", pos);
+
+            // empty and comment lines between the directives are skipped
+            if (first == std::string::npos || first >= end || src.compare(first, 2, "//") == 0)
+            {
+                pos = end + 1;
+                continue;
+            }
+            if (src.compare(first, 8, "#version") == 0)
+                hasVersion = true;
+            else if (src.compare(first, 10, "#extension") != 0)
+                break;
+
+            pos = end + 1;
+            insert = std::min(pos, src.size());
+        }
+
+        std::stringstream source;
+        if (!hasVersion) source << "#version 430" << std::endl;
+        source << src.substr(0, insert);
+        if (insert > 0 && src[insert - 1] != '\n') source << std::endl;
+        source << header.str();
+        source << src.substr(insert);
+
+        osg::Program* program = new osg::Program();
+        program->setName(getName() + "ComputeProgram");
+        program->addShader(new osg::Shader((osg::Shader::Type)GL_COMPUTE_SHADER, source.str()));
+        return program;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutCompute::getNumWorkGroups(unsigned int& x, unsigned int& y, unsigned int& z) const
+    {
+        x = y = z = 0;
+        if (!getViewport()) return;
+
+        unsigned int width = (unsigned int)getViewport()->width();
+        unsigned int height = (unsigned int)getViewport()->height();
+
+        // layered outputs are processed at once
+        unsigned int depth = 1;
+        TextureMap::const_iterator it = mOutputTex.begin();
+        if (it != mOutputTex.end() && it->second.valid())
+        {
+            if (dynamic_cast<const osg::Texture3D*>(it->second.get()) || dynamic_cast<const osg::Texture2DArray*>(it->second.get()))
+                depth = osg::maximum(1, it->second->getTextureDepth());
+        }
+
+        x = (width + mLocalSize[0] - 1) / mLocalSize[0];
+        y = (height + mLocalSize[1] - 1) / mLocalSize[1];
+        z = (depth + mLocalSize[2] - 1) / mLocalSize[2];
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutCompute::applyUniforms(const osg::Program::PerContextProgram* program, const osg::StateSet* ss)
+    {
+        if (ss == NULL) return;
+
+        const osg::StateSet::UniformList& list = ss->getUniformList();
+        for (osg::StateSet::UniformList::const_iterator it = list.begin(); it != list.end(); it++)
+        {
+            if ((it->second.second & osg::StateAttribute::ON) == osg::StateAttribute::ON)
+                program->apply(*(it->second.first));
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    bool UnitInOutCompute::noticeBeginRendering (osg::RenderInfo& info, const osg::Drawable* )
+    {
+        osg::State& state = *info.getState();
+        unsigned int contextID = info.getContextID();
+
+        if (!mComputeProgram.valid()) return false;
+        if (!isComputeShaderSupported(contextID))
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutCompute::noticeBeginRendering() - " << getName() << " compute shaders are not supported" << std::endl;
+            return false;
+        }
+
+        // outputs are not attached to a fbo, hence allocate them on a unit not used by the inputs
+        unsigned int freeUnit = mInputTex.empty() ? 0 : mInputTex.rbegin()->first + 1;
+        for (TextureMap::iterator it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+        {
+            if (it->second.valid() && it->second->getTextureObject(contextID) == NULL)
+                state.applyTextureAttribute(freeUnit, it->second.get());
+        }
+
+        // bind the program and apply the uniforms the unit would apply to its shader
+        state.applyAttribute(mComputeProgram.get());
+        const osg::Program::PerContextProgram* program = state.getLastAppliedProgramObject();
+        if (program == NULL) return false;
+
+        applyUniforms(program, getStateSet());
+        applyUniforms(program, mGeode->getStateSet());
+        applyUniforms(program, mDrawable.valid() ? mDrawable->getStateSet() : NULL);
+
+        const ShaderAttribute* shader = getStateSet() ? dynamic_cast<const ShaderAttribute*>(getStateSet()->getAttribute(osg::StateAttribute::PROGRAM)) : NULL;
+        if (shader)
+        {
+            for (osg::StateSet::UniformList::const_iterator it = shader->getUniformList().begin(); it != shader->getUniformList().end(); it++)
+            {
+                if ((it->second.second & osg::StateAttribute::ON) == osg::StateAttribute::ON)
+                    program->apply(*(it->second.first));
+            }
+        }
+
+        // bind images
+        for (TextureMap::iterator it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+        {
+            if (it->second.valid()) bindImageTexture(contextID, it->first, it->second.get(), 0);
+        }
+        unsigned int frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0;
+        for (InputImageUnitMap::const_iterator it = mInputImageUnit.begin(); it != mInputImageUnit.end(); it++)
+        {
+            osg::Texture* input = getFrameParityInputTexture(getInputTexture(it->first), frameNumber);
+            if (input) bindImageTexture(contextID, it->second, input, 0, GL_READ_ONLY_ARB);
+        }
+
+        unsigned int x, y, z;
+        getNumWorkGroups(x, y, z);
+        dispatchCompute(contextID, x, y, z);
+
+        // following units read the results by samplers, images or as attachments
+        imageMemoryBarrier(contextID);
+
+        // return false, so that the quad of the unit is not rendered
+        return false;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutCompute::noticeFinishRendering(osg::RenderInfo&, const osg::Drawable* )
+    {
+    }
+
+}; // end namespace
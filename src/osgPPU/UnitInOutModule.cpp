@@ -15,23 +15,55 @@
  ***************************************************************************/
 
 #include <osgPPU/UnitInOutModule.h>
+#include <osgPPU/Utility.h>
 
 #include <osg/Texture2D>
 #include <osg/TextureCubeMap>
+#include <osgDB/FileNameUtils>
+#include <OpenThreads/ScopedLock>
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 namespace osgPPU
 {
 
     //-------------------------------------------------------------------------
     UnitInOutModule::UnitInOutModule() : UnitInOut(),
-        _moduleDirty(false)
+        _asyncState(ASYNC_IDLE),
+        _asyncFence(NULL),
+        _asyncContextID(0),
+        _moduleVersion(0),
+        _moduleCapabilities(0),
+        _reloadOnChange(false),
+        _reloadCheckInterval(1.0),
+        _lastReloadCheck(0),
+        _moduleFileTime(0),
+        _lastLoadTime(0.0),
+        _lastInitTime(0.0),
+        _moduleDirty(false),
+        _moduleCopyCount(0)
     {
     }
 
     //-------------------------------------------------------------------------
     UnitInOutModule::UnitInOutModule(const UnitInOutModule& unit, const osg::CopyOp& copyop) : 
         UnitInOut(unit, copyop),
+        _asyncState(ASYNC_IDLE),
+        _asyncFence(NULL),
+        _asyncContextID(0),
+        _moduleVersion(unit._moduleVersion),
+        _moduleCapabilities(unit._moduleCapabilities),
+        _reloadOnChange(unit._reloadOnChange),
+        _reloadCheckInterval(unit._reloadCheckInterval),
+        _lastReloadCheck(0),
+        _moduleFileTime(unit._moduleFileTime),
+        _lastLoadTime(unit._lastLoadTime),
+        _lastInitTime(unit._lastInitTime),
         _moduleDirty(unit._moduleDirty),
+        _moduleCopyCount(0),
         _module(unit._module),
         _moduleLib(unit._moduleLib)
     {
@@ -44,30 +76,226 @@ namespace osgPPU
         // first remove the module and then close the dynamic library
         removeModule();
         _moduleLib = NULL;
+
+        // a changed library was loaded from a copy, which is not needed anymore
+        if (!_moduleLibFile.empty() && _moduleLibFile != _moduleFile) remove(_moduleLibFile.c_str());
     }
 
     //-------------------------------------------------------------------------
     bool UnitInOutModule::loadModule(const std::string& moduleFile)
     {
-        _moduleLib = osgDB::DynamicLibrary::loadLibrary(moduleFile);
+        return loadModuleLibrary(moduleFile, moduleFile);
+    }
 
-        if (!_moduleLib.valid())
+    //-------------------------------------------------------------------------
+    bool UnitInOutModule::loadModuleLibrary(const std::string& moduleFile, const std::string& libraryFile)
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        // the current module is kept until the new library could be loaded
+        osg::ref_ptr<osgDB::DynamicLibrary> lib = osgDB::DynamicLibrary::loadLibrary(libraryFile);
+        if (!lib.valid())
         {
             osg::notify(osg::FATAL) << "osgPPU::UnitInOutModule - cannot load module from " << moduleFile << std::endl;
             return false;
         }
 
+        // libraries without version are built against the first interface
+        osgppuModuleVersion version = (osgppuModuleVersion)lib->getProcAddress(OSGPPU_MODULE_VERSION_STR);
+        unsigned int moduleVersion = version ? version() : 1;
+        if (moduleVersion > OSGPPU_MODULE_ABI_VERSION)
+        {
+            osg::notify(osg::FATAL) << "osgPPU::UnitInOutModule - module " << moduleFile << " requires interface version " << moduleVersion << ", but only " << OSGPPU_MODULE_ABI_VERSION << " is supported" << std::endl;
+            return false;
+        }
+
+        osgppuModuleCapabilities capabilities = (osgppuModuleCapabilities)lib->getProcAddress(OSGPPU_MODULE_CAPABILITIES_STR);
+        unsigned int moduleCapabilities = capabilities ? capabilities() : 0;
+
         // try to find the main process
-        osgppuInitModule entry = (osgppuInitModule)_moduleLib->getProcAddress(OSGPPU_MODULE_ENTRY_STR);
+        osgppuInitModule entry = (osgppuInitModule)lib->getProcAddress(OSGPPU_MODULE_ENTRY_STR);
         if (entry == NULL)
         {
             osg::notify(osg::FATAL) << "osgPPU::UnitInOutModule - no entry point " << OSGPPU_MODULE_ENTRY_STR << " in the module " << moduleFile << " was found" << std::endl;
             return false;
         }
-        _moduleFile = moduleFile;
+
+        // keep the old module and its library, until the new module is initialized
+        osg::ref_ptr<osgDB::DynamicLibrary> oldLib = _moduleLib;
+        osg::ref_ptr<Module> oldModule = _module;
+        std::string oldLibFile = _moduleLibFile;
+        std::string oldModuleFile = _moduleFile;
+        unsigned int oldVersion = _moduleVersion;
+        unsigned int oldCapabilities = _moduleCapabilities;
+        long oldFileTime = _moduleFileTime;
+
+        _moduleLib = lib;
+        _moduleLibFile = libraryFile;
+        _moduleVersion = moduleVersion;
+        _lastInitTime = 0.0;
+        setModuleFile(moduleFile, getModificationTime(moduleFile), moduleCapabilities);
 
         // call the entry point, so that the module register himself by this unit
-        return entry(this);
+        bool result = entry(this) && _module.valid() && _module != oldModule;
+
+        if (!result)
+        {
+            // the old module is set again, the new one must be released before its library is closed
+            _moduleLib = oldLib;
+            _moduleLibFile = oldLibFile;
+            _moduleVersion = oldVersion;
+            setModuleFile(oldModuleFile, oldFileTime, oldCapabilities);
+            if (oldModule.valid()) setModule(oldModule.get()); else removeModule();
+            lib = NULL;
+
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutModule - " << getName() << " cannot initialize module " << moduleFile << std::endl;
+            return false;
+        }
+
+        // the old module must be released before its library is closed
+        oldModule = NULL;
+        oldLib = NULL;
+        if (!oldLibFile.empty() && oldLibFile != oldModuleFile) remove(oldLibFile.c_str());
+
+        _lastLoadTime = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick()) - _lastInitTime;
+        osg::notify(osg::INFO) << "osgPPU::UnitInOutModule - " << getName() << " loaded module " << moduleFile << " (interface " << _moduleVersion << ") in " << _lastLoadTime << " ms, initialized in " << _lastInitTime << " ms" << std::endl;
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    bool UnitInOutModule::copyModuleFile(const std::string& src, const std::string& dst)
+    {
+        std::ifstream in(src.c_str(), std::ios::in | std::ios::binary);
+        std::ofstream out(dst.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!in || !out) return false;
+
+        out << in.rdbuf();
+        return !out.fail();
+    }
+
+    //-------------------------------------------------------------------------
+    long UnitInOutModule::getModificationTime(const std::string& file)
+    {
+        struct stat info;
+        if (stat(file.c_str(), &info) != 0) return 0;
+        return (long)info.st_mtime;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::setReloadOnChange(bool reload, double checkInterval)
+    {
+        _reloadOnChange = reload;
+        _reloadCheckInterval = checkInterval;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
+        _moduleFileTime = getModificationTime(_moduleFile);
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::setModuleFile(const std::string& file, long fileTime, unsigned int capabilities)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
+        _moduleFile = file;
+        _moduleFileTime = fileTime;
+        _moduleCapabilities = capabilities;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::update()
+    {
+        UnitInOut::update();
+
+        if (!_reloadOnChange) return;
+
+        osg::Timer_t now = osg::Timer::instance()->tick();
+        if (osg::Timer::instance()->delta_s(_lastReloadCheck, now) < _reloadCheckInterval) return;
+        _lastReloadCheck = now;
+
+        // the module file is changed by the draw thread on a reload, hence work on a copy
+        std::string file;
+        long fileTime;
+        unsigned int capabilities;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
+            if (_moduleFile.empty() || _moduleDirty) return;
+            file = _moduleFile;
+            fileTime = _moduleFileTime;
+            capabilities = _moduleCapabilities;
+        }
+
+        long time = getModificationTime(file);
+        if (time == 0 || time == fileTime) return;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
+        if (_moduleFile != file) return;
+        _moduleFileTime = time;
+
+        if ((capabilities & MODULE_RELOADABLE) == 0)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutModule::update() - " << getName() << " module " << file << " changed, but is not reloadable" << std::endl;
+            return;
+        }
+
+        // the module is swapped in the draw thread, before the unit is rendered next time
+        _moduleDirty = true;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::requestReload()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
+        _moduleDirty = true;
+    }
+
+    //-------------------------------------------------------------------------
+    bool UnitInOutModule::takeReloadRequest()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
+        bool dirty = _moduleDirty;
+        _moduleDirty = false;
+        return dirty;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::reloadModule(osg::RenderInfo& ri)
+    {
+        // running work of the old module is not needed anymore
+        deleteFenceSync(ri.getContextID(), _asyncFence);
+        _asyncFence = NULL;
+        resetAsyncState();
+
+        if (_moduleFile.empty())
+        {
+            if (!_module.valid()) return;
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            _module->shutdown();
+            if (_module->init() == false) _module = NULL;
+            _lastInitTime = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+
+            osg::notify(osg::NOTICE) << "osgPPU::UnitInOutModule - " << getName() << " reinitialized module in " << _lastInitTime << " ms" << std::endl;
+            return;
+        }
+
+        // libraries are shared by their file name, hence the changed library is loaded from a copy
+        std::stringstream libraryFile;
+        libraryFile << osgDB::getNameLessExtension(_moduleFile) << "_reload" << ++_moduleCopyCount << "." << osgDB::getFileExtension(_moduleFile);
+        if (!copyModuleFile(_moduleFile, libraryFile.str()))
+        {
+            remove(libraryFile.str().c_str());
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutModule - " << getName() << " cannot copy module " << _moduleFile << " to " << libraryFile.str() << std::endl;
+            return;
+        }
+
+        // the current module is kept running if the new one cannot be loaded
+        if (!loadModuleLibrary(_moduleFile, libraryFile.str()))
+        {
+            remove(libraryFile.str().c_str());
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutModule - " << getName() << " cannot reload module " << _moduleFile << ", keep the current one" << std::endl;
+            return;
+        }
+        osg::notify(osg::NOTICE) << "osgPPU::UnitInOutModule - " << getName() << " reloaded module " << _moduleFile << " in " << _lastLoadTime << " ms, initialized in " << _lastInitTime << " ms" << std::endl;
     }
 
     //-------------------------------------------------------------------------
@@ -76,32 +304,116 @@ namespace osgPPU
         if (module == NULL) return;
         if (module == _module.get()) return;
 
+        if (_module.valid()) _module->shutdown();
+        resetAsyncState();
         _module = module;
-        if (_module->init() == false)
-            removeModule();
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        bool initialized = _module->init();
+        _lastInitTime = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+
+        if (initialized == false)
+            _module = NULL;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_moduleMutex);
         _moduleDirty = false;
     }
 
     //-------------------------------------------------------------------------
     void UnitInOutModule::removeModule()
     {
+        if (_module.valid()) _module->shutdown();
+        resetAsyncState();
         _module = NULL;
     }
 
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::resetAsyncState()
+    {
+        // the fence can only be deleted with a current context, hence it is deleted on the next draw
+        releaseFenceSync(_asyncContextID, _asyncFence);
+        _asyncState = ASYNC_IDLE;
+        _asyncFence = NULL;
+    }
+
     //-------------------------------------------------------------------------
     bool UnitInOutModule::noticeBeginRendering(osg::RenderInfo& ri, const osg::Drawable*)
     {
+        if (takeReloadRequest()) reloadModule(ri);
         if (!_module.get()) return false;
-        if (_moduleDirty) setModule(_module.get());
 
-        return _module->beginAndProcess();
+        if (!_module->isAsynchronous())
+            return _module->beginAndProcess();
+
+        unsigned int contextID = ri.getContextID();
+        _asyncContextID = contextID;
+        switch (_asyncState)
+        {
+            // input was read back in this frame, submit as soon as the transfer is done
+            case ASYNC_IDLE:
+                _asyncFence = insertFenceSync(contextID);
+                _asyncState = ASYNC_WAIT_INPUT;
+                break;
+
+            case ASYNC_WAIT_INPUT:
+                if (waitFenceSync(contextID, _asyncFence, 0))
+                {
+                    deleteFenceSync(contextID, _asyncFence);
+                    _asyncFence = NULL;
+                    _asyncState = ASYNC_IDLE;
+
+                    // GL commands issued by the module are tracked by a fence too
+                    if (_module->submit(ri))
+                    {
+                        _asyncFence = insertFenceSync(contextID);
+                        _asyncState = ASYNC_RUNNING;
+                    }
+                }
+                break;
+
+            case ASYNC_RUNNING:
+                if (waitFenceSync(contextID, _asyncFence, 0) && _module->isComplete(ri))
+                {
+                    deleteFenceSync(contextID, _asyncFence);
+                    _asyncFence = NULL;
+                    _module->complete(ri);
+                    _asyncState = ASYNC_COMPLETED;
+                }
+                break;
+
+            case ASYNC_COMPLETED:
+                break;
+        }
+
+        // the output textures are written by the pbos only
+        return false;
     }
 
     //-------------------------------------------------------------------------
     void UnitInOutModule::noticeFinishRendering(osg::RenderInfo& ri, const osg::Drawable*)
     {
         if (!_module.get()) return;
-        _module->end();
+        if (!_module->isAsynchronous()) _module->end();
+    }
+
+    //-------------------------------------------------------------------------
+    bool UnitInOutModule::noticeReadInputPBOs(osg::RenderInfo&)
+    {
+        if (!_module.get() || !_module->isAsynchronous()) return true;
+
+        // the module might still use the input pbos
+        return _asyncState == ASYNC_IDLE;
+    }
+
+    //-------------------------------------------------------------------------
+    bool UnitInOutModule::noticeWriteOutputPBOs(osg::RenderInfo&)
+    {
+        if (!_module.get() || !_module->isAsynchronous()) return true;
+
+        // output textures keep the last completed results until the next one is complete
+        if (_asyncState != ASYNC_COMPLETED) return false;
+        _asyncState = ASYNC_IDLE;
+        return true;
     }
 
  
@@ -19,53 +19,52 @@
 #include <osgPPU/BarrierNode.h>
 #include <osgPPU/Visitor.h>
 #include <osgPPU/UnitInOut.h>
+#include <osg/ColorMask>
+#include <osg/Drawable>
+#include <osg/Texture2D>
+#include <osg/Math>
+
+#include <algorithm>
+#include <sstream>
+
+#define OSGPPU_REPEAT_CURRENT_UNIFORM "osgppu_RepeatCurrent"
+#define OSGPPU_REPEAT_PREVIOUS_UNIFORM "osgppu_RepeatPrevious"
+#define OSGPPU_REPEAT_EPSILON_UNIFORM "osgppu_RepeatEpsilon"
 
 namespace osgPPU
 {
     //------------------------------------------------------------------------------
-    // Notify callback, which will enable specified texture on a certain iteration.
+    // Sort units by the order in which they are executed by the processor
     //------------------------------------------------------------------------------
-    struct ChangeInputsCallback : public Unit::NotifyCallback
+    static bool executedBefore(const osg::ref_ptr<Unit>& a, const osg::ref_ptr<Unit>& b)
     {
-        ChangeInputsCallback(osg::Texture* texture, unsigned unit, unsigned changeOn, unsigned numIterations) : 
-            _iteration(0),
-            _unit(unit),
-            _changeOnIteration(changeOn),
-            _numIterations(numIterations),
-            _texture(texture)
-        {}
-
-        void operator()(osg::RenderInfo& ri, const Unit* unit) const
-        {
-            if (_iteration >= _changeOnIteration)
-            {
-                //glAccum(GL_ADD, 1.0);
-                ri.getState()->applyTextureAttribute(_unit, _texture);
-            }
-            _iteration = (_iteration + 1) % _numIterations;
-        }
-
-        mutable unsigned _iteration;
-        unsigned _unit;
-        unsigned _changeOnIteration;
-        unsigned _numIterations;
-        osg::ref_ptr<osg::Texture> _texture;
-    };
+        return a->getExecutionIndex() < b->getExecutionIndex();
+    }
 
     //------------------------------------------------------------------------------
     UnitInOutRepeat::UnitInOutRepeat() : UnitInOut()
     {
         _numIterations = 0;
         _lastNode = NULL;
-        _lastNodeOutputIndex = 0;
+        _feedback[0] = 0;
+        _replaying = false;
+        _convergenceInterval = 0;
+        _convergenceEpsilon = 0.0f;
+        _convergenceThreshold = 0;
+        _numIterationsUsed = 0;
     }
 
     //------------------------------------------------------------------------------
     UnitInOutRepeat::UnitInOutRepeat(const UnitInOutRepeat& u, const osg::CopyOp& copyop) : 
         UnitInOut(u, copyop),
         _numIterations(u._numIterations),
-        _lastNodeOutputIndex(u._lastNodeOutputIndex),
-        _lastNode(u._lastNode)
+        _feedback(u._feedback),
+        _lastNode(u._lastNode),
+        _replaying(false),
+        _convergenceInterval(u._convergenceInterval),
+        _convergenceEpsilon(u._convergenceEpsilon),
+        _convergenceThreshold(u._convergenceThreshold),
+        _numIterationsUsed(0)
     {
 
     }
@@ -83,93 +82,333 @@ namespace osgPPU
         dirty();        
     }
 
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::setConvergenceCheck(unsigned interval, float epsilon, unsigned threshold)
+    {
+        _convergenceInterval = interval;
+        _convergenceEpsilon = epsilon;
+        _convergenceThreshold = threshold;
+        dirty();
+    }
+
     //------------------------------------------------------------------------------
     void UnitInOutRepeat::traverse(osg::NodeVisitor& nv)
     {
         // the repeatable traversion is only interesting for cull visitors
-        if (nv.getVisitorType() != osg::NodeVisitor::CULL_VISITOR || _lastNode == NULL || _numIterations <= 1)
+        if (nv.getVisitorType() != osg::NodeVisitor::CULL_VISITOR || _lastNode == NULL || _numIterations <= 1 || _region.empty() || !isLive())
         {
             UnitInOut::traverse(nv);
             return;
         }
 
-        // disable access to all child units
-		std::vector<unsigned> nodeMasks(_lastNode->getNumChildren(), 0);
-        for (unsigned i=0; i < _lastNode->getNumChildren(); i++)
+        // same checks as done by the unit, so that the region is only culled once
+        if (mbCullTraversed) return;
+        for (unsigned i=0; i < getNumParents(); i++)
         {
-            Unit* unit = dynamic_cast<Unit*>(_lastNode->getChild(i));
-            if (unit)
-			{
-				nodeMasks[i] = unit->getNodeMask();
-				unit->setNodeMask(0x0);
-			}
+            Unit* unit = dynamic_cast<Unit*>(getParent(i));
+            if (unit && !unit->mbCullTraversed) return;
         }
 
-        // for every iteration we do
-        for (int i=0; i < _numIterations; i++)
+        // units of the region are rendered by this unit, hence do not cull them
+        for (unsigned i=0; i < _region.size(); i++)
+            _region[i]->mbCullTraversed = true;
+
+        // the execution order might change whenever the graph is setup again
+        std::sort(_region.begin(), _region.end(), executedBefore);
+
+        UnitInOut::traverse(nv);
+
+        // continue traversing with the units outside of the region (i.e. children of the last unit)
+        for (unsigned i=0; i < _region.size(); i++)
         {
-            // mark every unit as not being culled before
-            CleanCullTraversedVisitor::sVisitor->run(this);
+            for (unsigned j=0; j < _region[i]->getNumChildren(); j++)
+            {
+                Unit* unit = dynamic_cast<Unit*>(_region[i]->getChild(j));
+                if (unit && unit != this && !unit->mbCullTraversed) unit->accept(nv);
+            }
+        }
+    }
 
-            // run cull visitor which will stop after the last unit
-            UnitInOut::traverse(nv);
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::drawUnit(osg::RenderInfo& ri, Unit* unit, osg::StateSet* extra)
+    {
+        osg::State& state = *ri.getState();
+        osg::Geode* geode = unit->getGeode();
+        if (geode == NULL) return;
+
+        // inputs alternating with the frames are applied on top of the unit's state, as done by the cull traversal
+        osg::StateSet* parity = state.getFrameStamp() ? unit->getFrameParityStateSet(state.getFrameStamp()->getFrameNumber()) : NULL;
+
+        state.pushStateSet(unit->getStateSet());
+        if (parity) state.pushStateSet(parity);
+        if (geode->getStateSet()) state.pushStateSet(geode->getStateSet());
+        if (extra) state.pushStateSet(extra);
+
+        for (unsigned i=0; i < geode->getNumDrawables(); i++)
+        {
+            osg::Drawable* drawable = geode->getDrawable(i);
+            if (drawable->getStateSet()) state.pushStateSet(drawable->getStateSet());
+
+            state.apply();
+            drawable->draw(ri);
+
+            if (drawable->getStateSet()) state.popStateSet();
         }
 
-        // continue traversing after last unit (start traversion on every child unit)
-        for (unsigned i=0; i < _lastNode->getNumChildren(); i++)
+        if (extra) state.popStateSet();
+        if (geode->getStateSet()) state.popStateSet();
+        if (parity) state.popStateSet();
+        state.popStateSet();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::noticeFinishRendering(osg::RenderInfo& ri, const osg::Drawable* drawable)
+    {
+        UnitInOut::noticeFinishRendering(ri, drawable);
+
+        // first iteration of this unit was just rendered by the processor, hence replay the rest
+        if (_replaying || _region.empty()) return;
+        _replaying = true;
+
+        unsigned int contextID = ri.getState()->getContextID();
+        unsigned int frameNumber = ri.getState()->getFrameStamp() ? ri.getState()->getFrameStamp()->getFrameNumber() : 0;
+        osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(contextID, true);
+        bool check = _convergenceInterval > 0 && _checkDrawable.valid() && ext->isARBOcclusionQuerySupported();
+
+        // results of the previous frames limit the number of iterations
+        ConvergenceState& cs = _convergence[contextID];
+        if (check) updateConvergenceLimit(ri, cs);
+        unsigned numIterations = std::max(_numIterations, 0);
+        unsigned limit = (check && cs.limit > 0) ? std::min(cs.limit, numIterations) : numIterations;
+
+        unsigned used = 0;
+        for (unsigned k=0; k < limit; k++)
         {
-            Unit* unit = dynamic_cast<Unit*>(_lastNode->getChild(i));
-            if (unit)
+            // from the second iteration on this unit gets the outputs of the last unit
+            if (k > 0) drawUnit(ri, this, _feedbackStateSet[frameNumber % 2].get());
+
+            for (unsigned i=0; i < _region.size(); i++)
+                if (_region[i]->isLive() && _region[i]->getActive()) drawUnit(ri, _region[i].get());
+            used = k + 1;
+
+            if (!check) continue;
+
+            // count the changing pixels, the limit is checked too so that it can be raised again,
+            // there is no need to check after the last iteration
+            if (((k + 1) % _convergenceInterval == 0 || k + 1 == limit) && k + 1 < numIterations)
             {
-                unit->setNodeMask(nodeMasks[i]);
-                unit->accept(nv);
+                PendingQuery pending;
+                pending.iteration = k + 1;
+                if (cs.free.empty())
+                {
+                    ext->glGenQueries(1, &pending.query);
+                }else
+                {
+                    pending.query = cs.free.back();
+                    cs.free.pop_back();
+                }
+                beginConvergenceCheck(ri, pending.query);
+                cs.pending.push_back(pending);
             }
+
+            // results of earlier checks are used as soon as they are available
+            updateConvergenceLimit(ri, cs);
+            if (cs.limit > 0 && cs.limit <= k + 1) break;
         }
+        _numIterationsUsed = used;
+
+        // restore the state as it was before the replay
+        ri.getState()->apply();
+
+        _replaying = false;
     }
 
     //------------------------------------------------------------------------------
-    void UnitInOutRepeat::init()
+    void UnitInOutRepeat::beginConvergenceCheck(osg::RenderInfo& ri, GLuint query)
+    {
+        osg::State& state = *ri.getState();
+        osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(state.getContextID(), true);
+
+        ext->glBeginQuery(GL_SAMPLES_PASSED_ARB, query);
+
+        state.pushStateSet(_checkDrawable->getStateSet());
+        state.apply();
+        state.applyProjectionMatrix(getDefaultProjectionMatrix());
+        state.applyModelViewMatrix(getDefaultModelviewMatrix());
+
+        pushFrameBufferObject(state);
+        _checkFBO->apply(state);
+        _checkDrawable->drawImplementation(ri);
+        popFrameBufferObject(state);
+
+        state.popStateSet();
+
+        ext->glEndQuery(GL_SAMPLES_PASSED_ARB);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::updateConvergenceLimit(osg::RenderInfo& ri, ConvergenceState& cs)
     {
-        // currently only one input per repeat unit is supported, hence force it
-        if (getNumParents() > 1)
+        osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(ri.getState()->getContextID(), true);
+        unsigned numIterations = std::max(_numIterations, 0);
+
+        // queries finish in the order they were issued, so stop at the first one not done
+        while (!cs.pending.empty())
         {
-            osg::notify(osg::FATAL) << "osgPPU::UnitBypassRepeat - does support only 1 unit as parent (you specified " << getNumParents() << " ). Behaviour is undefined" << std::endl;
+            PendingQuery pending = cs.pending.front();
+            GLint available = 0;
+            ext->glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE_ARB, &available);
+            if (!available) return;
+
+            GLuint changing = 0;
+            ext->glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT_ARB, &changing);
+            cs.pending.pop_front();
+            cs.free.push_back(pending.query);
+
+            // converged results lower the limit, a failed check at the limit raises it
+            unsigned current = cs.limit > 0 ? cs.limit : numIterations;
+            if (changing <= _convergenceThreshold)
+                cs.limit = std::min(current, pending.iteration);
+            else if (pending.iteration >= current)
+                cs.limit = std::min(numIterations, current + _convergenceInterval);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::releaseGLObjects(osg::State* state) const
+    {
+        UnitInOut::releaseGLObjects(state);
+
+        // queries can only be deleted with the context of the given state
+        if (state == NULL) return;
+        unsigned int contextID = state->getContextID();
+        ConvergenceState& cs = _convergence[contextID];
+        osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(contextID, true);
+
+        for (std::list<PendingQuery>::const_iterator it = cs.pending.begin(); it != cs.pending.end(); it++)
+            cs.free.push_back(it->query);
+        if (!cs.free.empty() && ext->isARBOcclusionQuerySupported())
+            ext->glDeleteQueries(cs.free.size(), &cs.free[0]);
+
+        cs.free.clear();
+        cs.pending.clear();
+        cs.limit = 0;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::setupConvergenceCheck()
+    {
+        if (_convergenceInterval == 0) return;
+
+        osg::Texture2D* current = dynamic_cast<osg::Texture2D*>(_lastNode->getOrCreateOutputTexture(getLastNodeOutputIndex()));
+        osg::Texture2D* previous = dynamic_cast<osg::Texture2D*>(getOrCreateOutputTexture(0));
+        if (current == NULL || previous == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutRepeat::setupConvergenceCheck() - " << getName() << " convergence check requires 2D outputs of this and the last unit" << std::endl;
             return;
         }
 
+        int width = osg::maximum(1, current->getTextureWidth());
+        int height = osg::maximum(1, current->getTextureHeight());
+
+        // only the number of samples is of interest, hence render into a renderbuffer without writing it
+        _checkFBO = new FrameBufferObject();
+        _checkFBO->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(new osg::RenderBuffer(width, height, GL_RGBA8)));
+
+        // fragments of pixels which did not change are discarded and hence not counted
+        std::stringstream src;
+        src << "uniform sampler2D " << OSGPPU_REPEAT_CURRENT_UNIFORM << ";" << std::endl;
+        src << "uniform sampler2D " << OSGPPU_REPEAT_PREVIOUS_UNIFORM << ";" << std::endl;
+        src << "uniform float " << OSGPPU_REPEAT_EPSILON_UNIFORM << ";" << std::endl;
+        src << "void main(void)" << std::endl << "{" << std::endl;
+        src << "    vec4 d = abs(texture2D(" << OSGPPU_REPEAT_CURRENT_UNIFORM << ", gl_TexCoord[0].st) - texture2D(" << OSGPPU_REPEAT_PREVIOUS_UNIFORM << ", gl_TexCoord[0].st));" << std::endl;
+        src << "    if (max(max(d.r, d.g), max(d.b, d.a)) <= " << OSGPPU_REPEAT_EPSILON_UNIFORM << ") discard;" << std::endl;
+        src << "    gl_FragColor = vec4(1.0);" << std::endl;
+        src << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+
+        _checkDrawable = createTexturedQuadDrawable();
+        osg::StateSet* ss = _checkDrawable->getOrCreateStateSet();
+        ss->setAttribute(new osg::Viewport(0, 0, width, height), osg::StateAttribute::ON);
+        ss->setAttribute(new osg::ColorMask(false, false, false, false), osg::StateAttribute::ON);
+        ss->setAttribute(program, osg::StateAttribute::ON);
+        ss->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
+        ss->setMode(GL_BLEND, osg::StateAttribute::OFF);
+        ss->setTextureAttributeAndModes(0, current, osg::StateAttribute::ON);
+        ss->setTextureAttributeAndModes(1, previous, osg::StateAttribute::ON);
+        ss->getOrCreateUniform(OSGPPU_REPEAT_CURRENT_UNIFORM, osg::Uniform::SAMPLER_2D)->set(0);
+        ss->getOrCreateUniform(OSGPPU_REPEAT_PREVIOUS_UNIFORM, osg::Uniform::SAMPLER_2D)->set(1);
+        ss->getOrCreateUniform(OSGPPU_REPEAT_EPSILON_UNIFORM, osg::Uniform::FLOAT)->set(_convergenceEpsilon);
+    }
+
+    //------------------------------------------------------------------------------
+    bool UnitInOutRepeat::collectRegion(Unit* unit, std::map<Unit*, bool>& visited)
+    {
+        std::map<Unit*, bool>::iterator it = visited.find(unit);
+        if (it != visited.end()) return it->second;
+
+        // mark as visited before descending, so that cycles terminate
+        visited[unit] = false;
+
+        // do not descend behind the last unit
+        bool reaches = (unit == _lastNode.get());
+        for (unsigned i=0; unit != _lastNode.get() && i < unit->getNumChildren(); i++)
+        {
+            Unit* child = dynamic_cast<Unit*>(unit->getChild(i));
+            if (child && child != this && collectRegion(child, visited)) reaches = true;
+        }
+
+        visited[unit] = reaches;
+        if (reaches && unit != this) _region.push_back(unit);
+
+        return reaches;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOutRepeat::init()
+    {
         UnitInOut::init();
 
+        _region.clear();
+        _feedbackStateSet[0] = _feedbackStateSet[1] = NULL;
+        _checkDrawable = NULL;
+        _checkFBO = NULL;
+
+        // the limit found by the convergence check is not valid anymore
+        for (unsigned i=0; i < _convergence.size(); i++)
+            _convergence[i].limit = 0;
+
         if (_lastNode == NULL || _numIterations <= 1) return;
 
-        // warning that we use only one output from the last unit
-        if (_lastNode->getOutputTextureMap().size() > _lastNodeOutputIndex + 1)
+        // collect units which are rendered on each iteration
+        std::map<Unit*, bool> visited;
+        if (!collectRegion(this, visited))
         {
-            osg::notify(osg::WARN) << "osgPPU::UnitBypassRepeat - last node has " << _lastNode->getOutputTextureMap().size() << " outputs, however you specified to use " << _lastNodeOutputIndex << " output. Output 0 will be forced!" << std::endl;
-            _lastNodeOutputIndex = 0;
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutRepeat::init() - " << getName() << " last node " << _lastNode->getName() << " is not a child of the repeat unit, no iterations are done" << std::endl;
+            _region.clear();
+            return;
         }
 
-		// setup a change in the input on my self, so get on the second iteration the output of the last unit
-		setBeginDrawCallback(new ChangeInputsCallback(_lastNode->getOrCreateOutputTexture(_lastNodeOutputIndex), 0, 1, _numIterations));
-
-        // input of each child should be changed on the second iteration
-        /*for (unsigned i=0; i < getNumChildren(); i++)
+        // setup the inputs of this unit used from the second iteration on
+        // a double buffered last unit writes its second textures on odd frames
+        _feedbackStateSet[0] = new osg::StateSet();
+        _feedbackStateSet[1] = new osg::StateSet();
+        for (FeedbackMap::const_iterator it = _feedback.begin(); it != _feedback.end(); it++)
         {
-            Unit* unit = dynamic_cast<Unit*>(getChild(i));
-            if (unit)
+            osg::Texture* texture = _lastNode->getOrCreateOutputTexture(it->second);
+            if (texture == NULL)
             {
-                // determine which input from this unit goes to its children and add a callback there
-                for (unsigned j=0, index=0; j < unit->getNumParents(); j++)
-                {
-                    if (unit->getParent(j) == this)
-                        unit->setBeginDrawCallback(new ChangeInputsCallback(_lastNode->getOrCreateOutputTexture(_lastNodeOutputIndex), index, 1, _numIterations));
-
-                    // if parent is a io unit, then skip also MRTs
-                    UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit->getParent(j));
-                    if (unitIO) index += unitIO->getOutputDepth();
-                    else index ++;
-                }
+                osg::notify(osg::WARN) << "osgPPU::UnitInOutRepeat::init() - " << getName() << " last node has no output " << it->second << " to be fed back to input " << it->first << std::endl;
+                continue;
             }
-        }*/
+            osg::Texture* buffered = _lastNode->getOrCreateBufferedOutputTexture(texture);
+            _feedbackStateSet[0]->setTextureAttributeAndModes(it->first, texture, osg::StateAttribute::ON);
+            _feedbackStateSet[1]->setTextureAttributeAndModes(it->first, buffered ? buffered : texture, osg::StateAttribute::ON);
+        }
+
+        setupConvergenceCheck();
     }
 
 
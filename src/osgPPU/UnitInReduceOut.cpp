@@ -0,0 +1,285 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitInReduceOut.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/TextureRectangle>
+#include <osg/Math>
+#include <osg/FrameStamp>
+#include <OpenThreads/ScopedLock>
+
+#include <sstream>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    UnitInReduceOut::UnitInReduceOut(const UnitInReduceOut& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mOperator(unit.mOperator),
+        mFactor(unit.mFactor),
+        mCurrentBuffer(0),
+        mResultFrameNumber(0),
+        mHasResult(false)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInReduceOut::UnitInReduceOut() : UnitInOut()
+    {
+        mOperator = MEAN;
+        mFactor = 4;
+        mCurrentBuffer = 0;
+        mResultFrameNumber = 0;
+        mHasResult = false;
+        mRenderPasses = true;
+
+        // sums of large textures require full float precision
+        setOutputInternalFormat(GL_RGBA32F_ARB);
+
+        // result of frame k is fetched in frame k+2
+        setNumPBOBuffers(3);
+    }
+
+    //------------------------------------------------------------------------------
+    UnitInReduceOut::~UnitInReduceOut()
+    {
+
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInReduceOut::setReductionFactor(unsigned int factor)
+    {
+        if (factor < 2) factor = 2;
+        mFactor = factor;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    bool UnitInReduceOut::hasResult() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mResultMutex);
+        return mHasResult;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Vec4 UnitInReduceOut::getResult() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mResultMutex);
+        return mResult;
+    }
+
+    //------------------------------------------------------------------------------
+    unsigned int UnitInReduceOut::getResultFrameNumber() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mResultMutex);
+        return mResultFrameNumber;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInReduceOut::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        clearPasses();
+
+        osg::Texture* input = getInputTexture(0);
+        if (input == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInReduceOut::init() - " << getName() << " has no input texture" << std::endl;
+            return;
+        }
+
+        // the result is a single texel, force new viewport to be used
+        osg::ref_ptr<osg::Viewport> oldVp = mViewport;
+        osg::ref_ptr<osg::Viewport> newVp = new osg::Viewport(0, 0, 1, 1);
+        mViewport = newVp;
+        assignViewport();
+        mViewport = oldVp;
+        noticeChangeViewport(newVp.get());
+
+        int width = osg::maximum(1, input->getTextureWidth());
+        int height = osg::maximum(1, input->getTextureHeight());
+        float numPixels = (float)width * (float)height;
+        bool rectangle = dynamic_cast<osg::TextureRectangle*>(input) != NULL;
+
+        // generate passes until the input is reduced to one texel
+        osg::Texture* passInput = input;
+        do
+        {
+            int w = (width + mFactor - 1) / mFactor;
+            int h = (height + mFactor - 1) / mFactor;
+            bool first = mPassDrawable.empty();
+            bool last = (w == 1 && h == 1);
+
+            // last pass renders into the output texture, the others into intermediate ones
+            osg::Texture2D* output = dynamic_cast<osg::Texture2D*>(getOutputTexture(0));
+            if (!last || output == NULL)
+                output = acquirePassTexture(w, h, GL_RGBA32F_ARB, osg::Texture::NEAREST);
+
+            // setup drawable, which combines the texels of the previous pass
+            osg::Drawable* draw = createTexturedQuadDrawable();
+            osg::StateSet* ss = draw->getOrCreateStateSet();
+            ss->setAttribute(new osg::Viewport(0, 0, w, h), osg::StateAttribute::ON);
+            ss->setAttribute(createReduceProgram(first, last, first && rectangle), osg::StateAttribute::ON);
+            ss->setTextureAttributeAndModes(0, passInput, osg::StateAttribute::ON);
+            ss->getOrCreateUniform(OSGPPU_REDUCE_INPUT_UNIFORM, first && rectangle ? osg::Uniform::SAMPLER_2D_RECT : osg::Uniform::SAMPLER_2D)->set(0);
+            ss->getOrCreateUniform(OSGPPU_REDUCE_INPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2((float)width, (float)height));
+            ss->getOrCreateUniform(OSGPPU_REDUCE_NUM_PIXELS_UNIFORM, osg::Uniform::FLOAT)->set(numPixels);
+            appendPass(createPassFBO(output), draw);
+
+            passInput = output;
+            width = w;
+            height = h;
+        }while (width > 1 || height > 1);
+
+        // release textures which were not reused
+        releasePassTexturePool();
+
+        // ring of small buffers to read the result
+        if (mBuffers.size() != getNumPBOBuffers())
+        {
+            mBuffers.clear();
+            mBuffers.resize(getNumPBOBuffers());
+            for (unsigned int i=0; i < mBuffers.size(); i++)
+            {
+                mBuffers[i].pbo = new osg::PixelDataBufferObject();
+                mBuffers[i].pbo->setDataSize(4 * sizeof(GLfloat));
+            }
+            mCurrentBuffer = 0;
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInReduceOut::createReduceProgram(bool first, bool last, bool rectangle) const
+    {
+        std::stringstream src;
+
+        src << "#define FACTOR " << mFactor << std::endl;
+        if (rectangle)
+            src << "#extension GL_ARB_texture_rectangle : enable" << std::endl
+                << "uniform sampler2DRect " << OSGPPU_REDUCE_INPUT_UNIFORM << ";" << std::endl;
+        else
+            src << "uniform sampler2D " << OSGPPU_REDUCE_INPUT_UNIFORM << ";" << std::endl;
+        src << "uniform vec2 " << OSGPPU_REDUCE_INPUT_SIZE_UNIFORM << ";" << std::endl;
+        src << "uniform float " << OSGPPU_REDUCE_NUM_PIXELS_UNIFORM << ";" << std::endl;
+
+        src << "void main(void)" << std::endl << "{" << std::endl;
+        src << "    vec2 base = floor(gl_FragCoord.xy) * float(FACTOR);" << std::endl;
+
+        // initial value of the operator
+        if (mOperator == MIN) src << "    vec4 result = vec4(3.0e38);" << std::endl;
+        else if (mOperator == MAX) src << "    vec4 result = vec4(-3.0e38);" << std::endl;
+        else src << "    vec4 result = vec4(0.0);" << std::endl;
+
+        // combine the block of texels, texels outside of the input are skipped
+        src << "    for (int y=0; y < FACTOR; y++)" << std::endl
+            << "    for (int x=0; x < FACTOR; x++)" << std::endl
+            << "    {" << std::endl
+            << "        vec2 texel = base + vec2(float(x), float(y));" << std::endl
+            << "        if (texel.x >= " << OSGPPU_REDUCE_INPUT_SIZE_UNIFORM << ".x || texel.y >= " << OSGPPU_REDUCE_INPUT_SIZE_UNIFORM << ".y) continue;" << std::endl;
+        if (rectangle)
+            src << "        vec4 value = texture2DRect(" << OSGPPU_REDUCE_INPUT_UNIFORM << ", texel + 0.5);" << std::endl;
+        else
+            src << "        vec4 value = texture2D(" << OSGPPU_REDUCE_INPUT_UNIFORM << ", (texel + 0.5) / " << OSGPPU_REDUCE_INPUT_SIZE_UNIFORM << ");" << std::endl;
+        if (first && mOperator == LOG_AVERAGE)
+            src << "        value = log(max(value, vec4(0.0)) + vec4(0.0001));" << std::endl;
+
+        if (mOperator == MIN) src << "        result = min(result, value);" << std::endl;
+        else if (mOperator == MAX) src << "        result = max(result, value);" << std::endl;
+        else src << "        result += value;" << std::endl;
+        src << "    }" << std::endl;
+
+        // the sums are normalized in the last pass
+        if (last && mOperator == MEAN)
+            src << "    result /= " << OSGPPU_REDUCE_NUM_PIXELS_UNIFORM << ";" << std::endl;
+        else if (last && mOperator == LOG_AVERAGE)
+            src << "    result = exp(result / " << OSGPPU_REDUCE_NUM_PIXELS_UNIFORM << ");" << std::endl;
+
+        src << "    gl_FragColor = result;" << std::endl << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+    //--------------------------------------------------------------------------
+    void UnitInReduceOut::renderPasses(osg::RenderInfo& info)
+    {
+        // render the passes, each one reads the output of the previous one
+        UnitInOut::renderPasses(info);
+
+        // last fbo is still bound, so read the result
+        readResult(info);
+    }
+
+    //--------------------------------------------------------------------------
+    void UnitInReduceOut::readResult(osg::RenderInfo& ri)
+    {
+        if (mBuffers.empty()) return;
+
+        osg::State& state = *ri.getState();
+        unsigned int contextID = state.getContextID();
+        osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+
+        // fetch all finished transfers, oldest first, without waiting for the gpu
+        for (unsigned int i=0; i < mBuffers.size(); i++)
+        {
+            Buffer& buffer = mBuffers[(mCurrentBuffer + i) % mBuffers.size()];
+            if (!buffer.pending) continue;
+
+            // if the oldest transfer is not done yet, then the newer ones are not done either
+            if (buffer.fence && !waitFenceSync(contextID, buffer.fence, 0)) break;
+
+            // without fences the transfer is fetched only when the buffer is reused
+            if (buffer.fence == NULL && i > 0) continue;
+
+            buffer.pbo->bindBufferInWriteMode(state);
+            const GLfloat* data = (const GLfloat*)ext->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+            if (data)
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mResultMutex);
+                mResult.set(data[0], data[1], data[2], data[3]);
+                mResultFrameNumber = buffer.frameNumber;
+                mHasResult = true;
+                ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+            }
+            buffer.pbo->unbindBuffer(contextID);
+
+            deleteFenceSync(contextID, buffer.fence);
+            buffer.fence = NULL;
+            buffer.pending = false;
+        }
+
+        // start reading the result of this frame into the current buffer
+        Buffer& current = mBuffers[mCurrentBuffer];
+        if (current.pbo->getOrCreateGLBufferObject(contextID)->isDirty()) current.pbo->compileBuffer(state);
+        current.pbo->bindBufferInWriteMode(state);
+        glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+        glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, NULL);
+        current.pbo->unbindBuffer(contextID);
+
+        deleteFenceSync(contextID, current.fence);
+        current.fence = insertFenceSync(contextID);
+        current.pending = true;
+        current.frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0;
+
+        mCurrentBuffer = (mCurrentBuffer + 1) % mBuffers.size();
+    }
+
+}; // end namespace
@@ -17,11 +17,18 @@
 #include <osgPPU/UnitInResampleOut.h>
 #include <osgPPU/Processor.h>
 
+#include <osg/TextureRectangle>
+#include <osg/Math>
+
+#include <sstream>
+
 namespace osgPPU
 {
     //------------------------------------------------------------------------------
     UnitInResampleOut::UnitInResampleOut(const UnitInResampleOut& unit, const osg::CopyOp& copyop) :
         UnitInOut(unit, copyop),
+        mFilter(unit.mFilter),
+        mFusedShader(unit.mFusedShader),
         mWidthFactor(unit.mWidthFactor),
         mHeightFactor(unit.mHeightFactor),
         mDirtyFactor(unit.mDirtyFactor)
@@ -35,6 +42,7 @@ namespace osgPPU
         mWidthFactor = 1.0;
         mHeightFactor = 1.0;
         mDirtyFactor = true;
+        mFilter = DEFAULT;
     }
     
     //------------------------------------------------------------------------------
@@ -57,6 +65,20 @@ namespace osgPPU
         mDirtyFactor = true;
     }
 
+    //------------------------------------------------------------------------------
+    void UnitInResampleOut::setFilter(Filter filter)
+    {
+        mFilter = filter;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInResampleOut::setFusedShader(osg::Shader* shader)
+    {
+        mFusedShader = shader;
+        dirty();
+    }
+
     //------------------------------------------------------------------------------
     void UnitInResampleOut::dirty()
     {
@@ -87,6 +109,145 @@ namespace osgPPU
 
             noticeChangeViewport(newVp);
         }    
+
+        // setup the generated shader, which replaces the unit's one
+        osg::StateSet* ss = mDrawable->getOrCreateStateSet();
+        osg::Texture* input = getInputTexture(0);
+        if ((mFilter == DEFAULT && !mFusedShader.valid()) || input == NULL)
+        {
+            ss->removeAttribute(osg::StateAttribute::PROGRAM);
+            return;
+        }
+
+        osg::Texture* output = getOutputTexture(0);
+        float inWidth = (float)osg::maximum(1, input->getTextureWidth());
+        float inHeight = (float)osg::maximum(1, input->getTextureHeight());
+        float outWidth = output ? (float)osg::maximum(1, output->getTextureWidth()) : inWidth * mWidthFactor;
+        float outHeight = output ? (float)osg::maximum(1, output->getTextureHeight()) : inHeight * mHeightFactor;
+        bool rectangle = dynamic_cast<osg::TextureRectangle*>(input) != NULL;
+
+        ss->setAttribute(createResampleProgram(inWidth / outWidth, inHeight / outHeight, rectangle), osg::StateAttribute::ON);
+        ss->getOrCreateUniform(OSGPPU_RESAMPLE_INPUT_UNIFORM, rectangle ? osg::Uniform::SAMPLER_2D_RECT : osg::Uniform::SAMPLER_2D)->set(0);
+        ss->getOrCreateUniform(OSGPPU_RESAMPLE_INPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(inWidth, inHeight));
+        ss->getOrCreateUniform(OSGPPU_RESAMPLE_OUTPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(outWidth, outHeight));
+
+        // the viewport keeps the origin of the input's one, gl_FragCoord is shifted by it
+        osg::Viewport* vp = dynamic_cast<osg::Viewport*>(getOrCreateStateSet()->getAttribute(osg::StateAttribute::VIEWPORT));
+        osg::Vec2 origin = vp ? osg::Vec2(vp->x(), vp->y()) : osg::Vec2(0.0f, 0.0f);
+        ss->getOrCreateUniform(OSGPPU_RESAMPLE_OUTPUT_ORIGIN_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(origin);
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitInResampleOut::createResampleProgram(float ratioX, float ratioY, bool rectangle) const
+    {
+        std::stringstream src;
+
+        // loops over the footprint are unrolled by the compiler
+        if (mFilter == BOX || mFilter == MIN || mFilter == MAX)
+        {
+            src << "#define FOOTPRINT_X " << osg::maximum(1, (int)ceilf(ratioX)) << std::endl
+                << "#define FOOTPRINT_Y " << osg::maximum(1, (int)ceilf(ratioY)) << std::endl;
+        }else if (mFilter == BICUBIC || mFilter == LANCZOS)
+        {
+            src << "#define RADIUS_X " << (int)ceilf(2.0f * osg::maximum(1.0f, ratioX)) << std::endl
+                << "#define RADIUS_Y " << (int)ceilf(2.0f * osg::maximum(1.0f, ratioY)) << std::endl;
+        }
+
+        if (rectangle)
+            src << "#extension GL_ARB_texture_rectangle : enable" << std::endl
+                << "uniform sampler2DRect " << OSGPPU_RESAMPLE_INPUT_UNIFORM << ";" << std::endl;
+        else
+            src << "uniform sampler2D " << OSGPPU_RESAMPLE_INPUT_UNIFORM << ";" << std::endl;
+        src << "uniform vec2 " << OSGPPU_RESAMPLE_INPUT_SIZE_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_RESAMPLE_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_RESAMPLE_OUTPUT_ORIGIN_UNIFORM << ";" << std::endl;
+        if (mFusedShader.valid())
+            src << "vec4 osgppu_ResampleProcess(vec4 color, vec2 texCoord);" << std::endl;
+
+        // sample at the given position in texel coordinates
+        src << "vec4 sampleTexel(vec2 texel)" << std::endl << "{" << std::endl;
+        if (rectangle)
+            src << "    return texture2DRect(" << OSGPPU_RESAMPLE_INPUT_UNIFORM << ", texel);" << std::endl;
+        else
+            src << "    return texture2D(" << OSGPPU_RESAMPLE_INPUT_UNIFORM << ", texel / " << OSGPPU_RESAMPLE_INPUT_SIZE_UNIFORM << ");" << std::endl;
+        src << "}" << std::endl;
+
+        // filter kernels, both have a support of 2
+        if (mFilter == BICUBIC)
+            src << "float kernel(float x)" << std::endl << "{" << std::endl
+                << "    x = abs(x);" << std::endl
+                << "    if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;" << std::endl
+                << "    if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;" << std::endl
+                << "    return 0.0;" << std::endl
+                << "}" << std::endl;
+        else if (mFilter == LANCZOS)
+            src << "float kernel(float x)" << std::endl << "{" << std::endl
+                << "    x = abs(x);" << std::endl
+                << "    if (x < 0.0001) return 1.0;" << std::endl
+                << "    if (x >= 2.0) return 0.0;" << std::endl
+                << "    float px = 3.14159265 * x;" << std::endl
+                << "    return 2.0 * sin(px) * sin(px * 0.5) / (px * px);" << std::endl
+                << "}" << std::endl;
+
+        src << "void main(void)" << std::endl << "{" << std::endl
+            << "    vec2 ratio = " << OSGPPU_RESAMPLE_INPUT_SIZE_UNIFORM << " / " << OSGPPU_RESAMPLE_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "    vec2 fragCoord = gl_FragCoord.xy - " << OSGPPU_RESAMPLE_OUTPUT_ORIGIN_UNIFORM << ";" << std::endl
+            << "    vec2 center = (floor(fragCoord) + 0.5) * ratio;" << std::endl;
+
+        switch (mFilter)
+        {
+            // hardware filtering at the pixel center
+            case DEFAULT:
+                src << "    vec4 color = sampleTexel(center);" << std::endl;
+                break;
+
+            // texel centers distributed over the footprint
+            case BOX:
+            case MIN:
+            case MAX:
+                src << "    vec2 origin = floor(fragCoord) * ratio;" << std::endl
+                    << "    vec2 step = ratio / vec2(float(FOOTPRINT_X), float(FOOTPRINT_Y));" << std::endl;
+                if (mFilter == BOX) src << "    vec4 color = vec4(0.0);" << std::endl;
+                else src << "    vec4 color = sampleTexel(floor(origin) + 0.5);" << std::endl;
+                src << "    for (int y=0; y < FOOTPRINT_Y; y++)" << std::endl
+                    << "    for (int x=0; x < FOOTPRINT_X; x++)" << std::endl
+                    << "    {" << std::endl
+                    << "        vec4 value = sampleTexel(floor(origin + (vec2(float(x), float(y)) + 0.5) * step) + 0.5);" << std::endl;
+                if (mFilter == BOX) src << "        color += value;" << std::endl;
+                else if (mFilter == MIN) src << "        color = min(color, value);" << std::endl;
+                else src << "        color = max(color, value);" << std::endl;
+                src << "    }" << std::endl;
+                if (mFilter == BOX) src << "    color /= float(FOOTPRINT_X * FOOTPRINT_Y);" << std::endl;
+                break;
+
+            // kernel is stretched by the ratio when downsampling
+            case BICUBIC:
+            case LANCZOS:
+                src << "    vec2 scale = max(ratio, vec2(1.0));" << std::endl
+                    << "    vec2 base = floor(center - 0.5);" << std::endl
+                    << "    vec4 color = vec4(0.0);" << std::endl
+                    << "    float total = 0.0;" << std::endl
+                    << "    for (int y=1-RADIUS_Y; y <= RADIUS_Y; y++)" << std::endl
+                    << "    for (int x=1-RADIUS_X; x <= RADIUS_X; x++)" << std::endl
+                    << "    {" << std::endl
+                    << "        vec2 texel = base + vec2(float(x), float(y)) + 0.5;" << std::endl
+                    << "        vec2 d = (texel - center) / scale;" << std::endl
+                    << "        float w = kernel(d.x) * kernel(d.y);" << std::endl
+                    << "        color += sampleTexel(texel) * w;" << std::endl
+                    << "        total += w;" << std::endl
+                    << "    }" << std::endl
+                    << "    color /= total;" << std::endl;
+                break;
+        }
+
+        if (mFusedShader.valid())
+            src << "    color = osgppu_ResampleProcess(color, fragCoord / " << OSGPPU_RESAMPLE_OUTPUT_SIZE_UNIFORM << ");" << std::endl;
+        src << "    gl_FragColor = color;" << std::endl << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        if (mFusedShader.valid()) program->addShader(mFusedShader.get());
+        return program;
     }
 
 }; // end namespace
@@ -18,6 +18,7 @@
 #include <osgPPU/Processor.h>
 
 #include <osg/Texture2D>
+#include <osg/TextureCubeMap>
 #include <algorithm>
 
 namespace osgPPU
@@ -93,6 +94,19 @@ namespace osgPPU
             int height = (mOutputTex.begin()->second)->getTextureHeight();
             int mwh = std::max(width, height);
             int numLevels = 1 + static_cast<int>(floor(logf(mwh)/logf(2.0f)));
+
+            // 2D arrays and cubemaps are rendered layered, all outputs must be of the same type
+            osg::Texture* first = mOutputTex.begin()->second.get();
+            unsigned int numLayers = getNumOutputLayers(first);
+            if (numLayers == 0)
+            {
+                osg::notify(osg::WARN) << "osgPPU::UnitMipmapInMipmapOut::checkIOMipmappedData() - " << getName() << ": only 2D, 2D array and cubemap textures are supported" << std::endl;
+                return;
+            }
+            if (numLayers > 1 && !setupLayeredProgram(dynamic_cast<osg::TextureCubeMap*>(first) != NULL))
+            {
+                osg::notify(osg::WARN) << "osgPPU::UnitMipmapInMipmapOut::checkIOMipmappedData() - " << getName() << ": layered textures require a shader program" << std::endl;
+            }
     
             // generate fbo for each mipmap level 
             for (int level=0; level < numLevels; level++)
@@ -112,7 +126,13 @@ namespace osgPPU
                 for (int mrt = 0; it != mOutputTex.end(); it++, mrt++)
                 {   
                     // output texture 
-                    osg::ref_ptr<osg::Texture2D> output = dynamic_cast<osg::Texture2D*>(it->second.get());
+                    osg::Texture* output = it->second.get();
+                    osg::FrameBufferAttachment attachment;
+                    if (output == NULL || getNumOutputLayers(output) != numLayers || !createLevelAttachment(output, level, attachment))
+                    {
+                        osg::notify(osg::FATAL) << "osgPPU::UnitMipmapInMipmapOut::checkIOMipmappedData() - " << getName() << ": output textures are not of the same supported type" << std::endl;
+                        return;
+                    }
         
                     // check if we have generated all the fbo's for each mipmap level
                     int _width = output->getTextureWidth();
@@ -126,14 +146,14 @@ namespace osgPPU
                     }
         
                     // set fbo of current level with to this output         
-                    fbo->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + mrt), osg::FrameBufferAttachment(output.get(), level));
+                    fbo->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + mrt), attachment);
                 }
     
                 // store fbo
                 mIOMipmapFBO.push_back(fbo);
 
                 // generate mipmap drawables
-                osg::Drawable* draw = createTexturedQuadDrawable();
+                osg::Drawable* draw = numLayers > 1 ? createLayeredQuadDrawable(numLayers) : createTexturedQuadDrawable();
                 osg::StateSet* ss = draw->getOrCreateStateSet();
                 ss->setAttribute(vp, osg::StateAttribute::ON);
                 //ss->setAttribute(fbo, osg::StateAttribute::ON);
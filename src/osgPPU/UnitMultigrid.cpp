@@ -0,0 +1,284 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitMultigrid.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/TextureRectangle>
+#include <osg/ClampColor>
+#include <osg/Math>
+
+#include <sstream>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    UnitMultigrid::UnitMultigrid(const UnitMultigrid& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mNumLevels(unit.mNumLevels),
+        mNumCycles(unit.mNumCycles),
+        mNumPreSmooth(unit.mNumPreSmooth),
+        mNumPostSmooth(unit.mNumPostSmooth),
+        mNumCoarseSmooth(unit.mNumCoarseSmooth),
+        mNumFullResolutionPasses(0),
+        mSmoother(unit.mSmoother),
+        mResidual(unit.mResidual)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitMultigrid::UnitMultigrid() : UnitInOut()
+    {
+        mNumLevels = 4;
+        mNumCycles = 1;
+        mNumPreSmooth = 2;
+        mNumPostSmooth = 2;
+        mNumCoarseSmooth = 8;
+        mNumFullResolutionPasses = 0;
+        mRenderPasses = true;
+    }
+
+    //------------------------------------------------------------------------------
+    UnitMultigrid::~UnitMultigrid()
+    {
+
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitMultigrid::setNumLevels(unsigned int num)
+    {
+        mNumLevels = num;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitMultigrid::setNumCycles(unsigned int num)
+    {
+        if (num < 1) num = 1;
+        mNumCycles = num;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitMultigrid::addClearPass(osg::Texture* output)
+    {
+        appendPass(createPassFBO(output), NULL);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitMultigrid::addPass(osg::Texture* input, const char* inputName, osg::Texture* secondInput, const char* secondName, osg::Texture* output, osg::Program* program, unsigned int level)
+    {
+        FrameBufferObject* fbo = createPassFBO(output);
+        if (fbo == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitMultigrid::addPass() - " << getName() << " output texture type is not supported" << std::endl;
+            return;
+        }
+
+        int width = osg::maximum(1, output->getTextureWidth());
+        int height = osg::maximum(1, output->getTextureHeight());
+
+        osg::Drawable* draw = createTexturedQuadDrawable();
+        osg::StateSet* ss = draw->getOrCreateStateSet();
+        ss->setAttribute(new osg::Viewport(0, 0, width, height), osg::StateAttribute::ON);
+        ss->setAttribute(program, osg::StateAttribute::ON);
+        ss->setTextureAttributeAndModes(0, input, osg::StateAttribute::ON);
+        ss->getOrCreateUniform(inputName, osg::Uniform::SAMPLER_2D)->set(0);
+        if (secondInput)
+        {
+            ss->setTextureAttributeAndModes(1, secondInput, osg::StateAttribute::ON);
+            ss->getOrCreateUniform(secondName, osg::Uniform::SAMPLER_2D)->set(1);
+        }
+        ss->getOrCreateUniform(OSGPPU_MULTIGRID_TEXEL_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(1.0f / (float)width, 1.0f / (float)height));
+        ss->getOrCreateUniform(OSGPPU_MULTIGRID_OUTPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2((float)width, (float)height));
+        ss->getOrCreateUniform(OSGPPU_MULTIGRID_GRID_SPACING_UNIFORM, osg::Uniform::FLOAT)->set((float)(1 << level));
+        ss->getOrCreateUniform(OSGPPU_MULTIGRID_LEVEL_UNIFORM, osg::Uniform::INT)->set((int)level);
+        ss->getOrCreateUniform(OSGPPU_VIEWPORT_WIDTH_UNIFORM, osg::Uniform::FLOAT)->set((float)width);
+        ss->getOrCreateUniform(OSGPPU_VIEWPORT_HEIGHT_UNIFORM, osg::Uniform::FLOAT)->set((float)height);
+        appendPass(fbo, draw);
+
+        if (level == 0) mNumFullResolutionPasses++;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Texture* UnitMultigrid::addSmoothPasses(unsigned int level, unsigned int num, osg::Texture* current, osg::Texture* first, osg::Texture* second, osg::Texture* rhs)
+    {
+        // each step reads the solution of the previous one, the first write goes into the first texture
+        for (unsigned int i=0; i < num; i++)
+        {
+            osg::Texture* next = current == first ? second : first;
+            addPass(current, OSGPPU_MULTIGRID_SOLUTION_UNIFORM, rhs, OSGPPU_MULTIGRID_RHS_UNIFORM, next, mSmoother.get(), level);
+            current = next;
+        }
+        return current;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitMultigrid::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        // values of the corrections and residuals are signed, they must not be clamped
+        osg::ClampColor* clamp = new osg::ClampColor();
+        clamp->setClampVertexColor(GL_FALSE);
+        clamp->setClampFragmentColor(GL_FALSE);
+        clamp->setClampReadColor(GL_FALSE);
+        getOrCreateStateSet()->setAttribute(clamp, osg::StateAttribute::ON);
+
+        // textures of the previous setup can be reused
+        clearPasses();
+        mNumFullResolutionPasses = 0;
+
+        osg::Texture* rhs = getInputTexture(0);
+        osg::Texture* initial = getInputTexture(1);
+        osg::Texture* output = getOutputTexture(0);
+        if (rhs == NULL || output == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitMultigrid::init() - " << getName() << " has no input or output texture" << std::endl;
+            return;
+        }
+        if (!mSmoother.valid() || !mResidual.valid())
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitMultigrid::init() - " << getName() << " requires a smoother and a residual program" << std::endl;
+            return;
+        }
+        osg::FrameBufferAttachment attachment;
+        if (dynamic_cast<osg::TextureRectangle*>(rhs) != NULL || dynamic_cast<osg::TextureRectangle*>(initial) != NULL || !createLevelAttachment(output, 0, attachment))
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitMultigrid::init() - " << getName() << " supports 2D textures only" << std::endl;
+            return;
+        }
+
+        unsigned int numLevels = mNumLevels;
+        unsigned int numCoarseSmooth = osg::maximum(1u, mNumCoarseSmooth);
+
+        // the solution of a level alternates between two textures, choose them so that
+        // the last write on the finest level goes into the output texture
+        unsigned int numWrites = mNumCycles * (numLevels > 0 ? mNumPreSmooth + 1 + mNumPostSmooth : numCoarseSmooth);
+        std::vector<osg::Texture*> solution[2];
+        std::vector<osg::Texture*> rhsLevel(numLevels + 1), residual(numLevels + 1), current(numLevels + 1);
+        solution[0].resize(numLevels + 1);
+        solution[1].resize(numLevels + 1);
+
+        int width = osg::maximum(1, output->getTextureWidth());
+        int height = osg::maximum(1, output->getTextureHeight());
+        solution[(numWrites - 1) % 2][0] = output;
+        solution[numWrites % 2][0] = acquirePassTexture(width, height);
+        rhsLevel[0] = rhs;
+        for (unsigned int level=0; level <= numLevels; level++)
+        {
+            if (level > 0)
+            {
+                width = osg::maximum(1, width / 2);
+                height = osg::maximum(1, height / 2);
+                solution[0][level] = acquirePassTexture(width, height);
+                solution[1][level] = acquirePassTexture(width, height);
+                rhsLevel[level] = acquirePassTexture(width, height);
+            }
+            if (level < numLevels)
+                residual[level] = acquirePassTexture(width, height);
+        }
+
+        osg::ref_ptr<osg::Program> restrictProgram = createRestrictProgram();
+        osg::ref_ptr<osg::Program> correctProgram = createCorrectProgram();
+
+        // start with the initial guess or with 0
+        current[0] = initial;
+        if (current[0] == NULL)
+        {
+            addClearPass(solution[1][0]);
+            current[0] = solution[1][0];
+        }
+
+        for (unsigned int cycle=0; cycle < mNumCycles; cycle++)
+        {
+            // smooth and restrict the residual down to the coarsest level,
+            // where the correction starts with 0
+            for (unsigned int level=0; level < numLevels; level++)
+            {
+                if (level > 0)
+                {
+                    addClearPass(solution[1][level]);
+                    current[level] = solution[1][level];
+                }
+                current[level] = addSmoothPasses(level, mNumPreSmooth, current[level], solution[0][level], solution[1][level], rhsLevel[level]);
+
+                addPass(current[level], OSGPPU_MULTIGRID_SOLUTION_UNIFORM, rhsLevel[level], OSGPPU_MULTIGRID_RHS_UNIFORM, residual[level], mResidual.get(), level);
+                addPass(residual[level], OSGPPU_MULTIGRID_RESIDUAL_UNIFORM, NULL, NULL, rhsLevel[level + 1], restrictProgram.get(), level + 1);
+            }
+
+            // solve approximately on the coarsest level
+            if (numLevels > 0)
+            {
+                addClearPass(solution[1][numLevels]);
+                current[numLevels] = solution[1][numLevels];
+            }
+            current[numLevels] = addSmoothPasses(numLevels, numCoarseSmooth, current[numLevels], solution[0][numLevels], solution[1][numLevels], rhsLevel[numLevels]);
+
+            // add the corrections up to the finest level
+            for (int level = (int)numLevels - 1; level >= 0; level--)
+            {
+                osg::Texture* next = current[level] == solution[0][level] ? solution[1][level] : solution[0][level];
+                addPass(current[level], OSGPPU_MULTIGRID_SOLUTION_UNIFORM, current[level + 1], OSGPPU_MULTIGRID_CORRECTION_UNIFORM, next, correctProgram.get(), level);
+                current[level] = addSmoothPasses(level, mNumPostSmooth, next, solution[0][level], solution[1][level], rhsLevel[level]);
+            }
+        }
+
+        // release textures which were not reused
+        releasePassTexturePool();
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitMultigrid::createRestrictProgram() const
+    {
+        std::stringstream src;
+
+        // one fetch in the middle of 2x2 texels of the finer level
+        src << "uniform sampler2D " << OSGPPU_MULTIGRID_RESIDUAL_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_MULTIGRID_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    gl_FragColor = texture2D(" << OSGPPU_MULTIGRID_RESIDUAL_UNIFORM << ", gl_FragCoord.xy / " << OSGPPU_MULTIGRID_OUTPUT_SIZE_UNIFORM << ");" << std::endl
+            << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitMultigrid::createCorrectProgram() const
+    {
+        std::stringstream src;
+
+        // correction is interpolated bilinear from the coarser level
+        src << "uniform sampler2D " << OSGPPU_MULTIGRID_SOLUTION_UNIFORM << ";" << std::endl
+            << "uniform sampler2D " << OSGPPU_MULTIGRID_CORRECTION_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_MULTIGRID_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    vec2 tc = gl_FragCoord.xy / " << OSGPPU_MULTIGRID_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "    gl_FragColor = texture2D(" << OSGPPU_MULTIGRID_SOLUTION_UNIFORM << ", tc) + texture2D(" << OSGPPU_MULTIGRID_CORRECTION_UNIFORM << ", tc);" << std::endl
+            << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+}; // end namespace
@@ -0,0 +1,372 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitOutReadback.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/TextureRectangle>
+#include <osg/Math>
+#include <osg/FrameStamp>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <list>
+#include <set>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    // Worker thread executing the callback on the mapped buffers
+    //------------------------------------------------------------------------------
+    class UnitOutReadback::Worker : public OpenThreads::Thread
+    {
+    public:
+        Worker(UnitOutReadback* parent) : _parent(parent), _done(false) {}
+
+        ~Worker() { stop(); }
+
+        //! Pass mapped buffer to the worker
+        void submit(unsigned int buffer, const Frame& frame, Callback* callback)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _busy.insert(buffer);
+            _jobs.push_back(Job(buffer, frame, callback));
+            _condition.broadcast();
+        }
+
+        //! Block until the worker does not use the buffer anymore
+        void waitForBuffer(unsigned int buffer)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            while (_busy.find(buffer) != _busy.end()) _condition.wait(&_mutex);
+        }
+
+        //! Check whether the callback is still executed on the buffer or waits for it
+        bool isBusy(unsigned int buffer)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            return _busy.find(buffer) != _busy.end();
+        }
+
+        //! Block until all buffers are released
+        void waitForAll()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            while (!_busy.empty()) _condition.wait(&_mutex);
+        }
+
+        //! Finish the thread, jobs which are not started yet are dropped
+        void stop()
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                _done = true;
+                _condition.broadcast();
+            }
+            if (isRunning()) join();
+        }
+
+        virtual void run()
+        {
+            while (true)
+            {
+                Job job;
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                    while (_jobs.empty() && !_done) _condition.wait(&_mutex);
+                    if (_done) return;
+                    job = _jobs.front();
+                    _jobs.pop_front();
+                }
+
+                if (job.callback.valid()) (*job.callback)(_parent, job.frame);
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                _busy.erase(job.buffer);
+                _condition.broadcast();
+            }
+        }
+
+    private:
+        struct Job
+        {
+            Job() : buffer(0) {}
+            Job(unsigned int b, const Frame& f, Callback* cb) : buffer(b), frame(f), callback(cb) {}
+
+            unsigned int buffer;
+            Frame frame;
+            osg::ref_ptr<Callback> callback;
+        };
+
+        UnitOutReadback* _parent;
+        bool _done;
+        std::list<Job> _jobs;
+        std::set<unsigned int> _busy;
+        OpenThreads::Mutex _mutex;
+        OpenThreads::Condition _condition;
+    };
+
+    //------------------------------------------------------------------------------
+    UnitOutReadback::UnitOutReadback(const UnitOutReadback& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mCurrentBuffer(0),
+        mContextID(0),
+        mWorker(NULL),
+        mCallback(unit.mCallback),
+        mRegionX(unit.mRegionX),
+        mRegionY(unit.mRegionY),
+        mRegionWidth(unit.mRegionWidth),
+        mRegionHeight(unit.mRegionHeight)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitOutReadback::UnitOutReadback() : UnitInOut(),
+        mCurrentBuffer(0),
+        mContextID(0),
+        mWorker(NULL),
+        mRegionX(0),
+        mRegionY(0),
+        mRegionWidth(0),
+        mRegionHeight(0)
+    {
+        // data of frame k is available in frame k+2, so the worker has two frames time
+        setNumPBOBuffers(3);
+    }
+
+    //------------------------------------------------------------------------------
+    UnitOutReadback::~UnitOutReadback()
+    {
+        // no context here, deleting the buffer objects later on unmaps them implicitly
+        releaseBuffers(NULL);
+        delete mWorker;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutReadback::releaseGLObjects(osg::State* state) const
+    {
+        UnitInOut::releaseGLObjects(state);
+
+        UnitOutReadback* unit = const_cast<UnitOutReadback*>(this);
+        unit->releaseBuffers(state);
+        for (unsigned int i=0; i < mBuffers.size(); i++) mBuffers[i].pbo->releaseGLObjects(state);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutReadback::releaseBuffers(osg::State* state)
+    {
+        // the callback must not access the memory anymore
+        if (mWorker) mWorker->waitForAll();
+
+        bool canUnmap = state != NULL && state->getContextID() == mContextID;
+        osg::GLBufferObject::Extensions* ext = canUnmap ? osg::GLBufferObject::getExtensions(mContextID, true) : NULL;
+
+        for (unsigned int i=0; i < mBuffers.size(); i++)
+        {
+            Buffer& buffer = mBuffers[i];
+            if (buffer.mapped && ext)
+            {
+                buffer.pbo->bindBufferInWriteMode(*state);
+                ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+                buffer.pbo->unbindBuffer(mContextID);
+            }
+            buffer.mapped = false;
+            buffer.pending = false;
+            buffer.frame.data = NULL;
+
+            releaseFenceSync(mContextID, buffer.fence);
+            buffer.fence = NULL;
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutReadback::setRegionOfInterest(int x, int y, int width, int height)
+    {
+        mRegionX = x;
+        mRegionY = y;
+        mRegionWidth = width;
+        mRegionHeight = height;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutReadback::init()
+    {
+        // do initialize as usual
+        UnitInOut::init();
+
+        osg::Texture* input = getInputTexture(0);
+        if (input == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitOutReadback::init() - " << getName() << " has no input texture" << std::endl;
+            return;
+        }
+
+        // clamp the region of interest to the input
+        int inputWidth = input->getTextureWidth();
+        int inputHeight = input->getTextureHeight();
+        int x = osg::clampBetween(mRegionX, 0, inputWidth);
+        int y = osg::clampBetween(mRegionY, 0, inputHeight);
+        int width = mRegionWidth > 0 ? osg::minimum(mRegionWidth, inputWidth - x) : inputWidth - x;
+        int height = mRegionHeight > 0 ? osg::minimum(mRegionHeight, inputHeight - y) : inputHeight - y;
+        if (width <= 0 || height <= 0)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitOutReadback::init() - " << getName() << " region of interest is outside of the input texture" << std::endl;
+            return;
+        }
+
+        // output is of the region size, force new viewport to be used
+        osg::ref_ptr<osg::Viewport> oldVp = mViewport;
+        osg::ref_ptr<osg::Viewport> newVp = new osg::Viewport(0, 0, width, height);
+        mViewport = newVp;
+        assignViewport();
+        mViewport = oldVp;
+        noticeChangeViewport(newVp.get());
+
+        // map the region of the input onto the quad
+        osg::Geometry* geom = dynamic_cast<osg::Geometry*>(mDrawable.get());
+        if (geom)
+        {
+            float l = (float)x, b = (float)y, r = (float)(x + width), t = (float)(y + height);
+            if (dynamic_cast<osg::TextureRectangle*>(input) == NULL)
+            {
+                l /= (float)inputWidth; r /= (float)inputWidth;
+                b /= (float)inputHeight; t /= (float)inputHeight;
+            }
+            osg::Vec2Array* tcoords = new osg::Vec2Array(4);
+            (*tcoords)[0].set(l,t);
+            (*tcoords)[1].set(l,b);
+            (*tcoords)[2].set(r,b);
+            (*tcoords)[3].set(r,t);
+            geom->setTexCoordArray(0, tcoords);
+        }
+
+        // layout of the read back data, rows are tightly packed
+        Frame frame;
+        frame.data = NULL;
+        frame.width = width;
+        frame.height = height;
+        frame.pixelFormat = createSourceTextureFormat(getOutputInternalFormat());
+        frame.dataType = osg::Image::computeFormatDataType(getOutputInternalFormat());
+        if (frame.dataType == 0) frame.dataType = GL_UNSIGNED_BYTE;
+        frame.stride = osg::Image::computeRowWidthInBytes(width, frame.pixelFormat, frame.dataType, 1);
+        frame.frameNumber = 0;
+
+        // nothing to do if the buffers fit already
+        if (mBuffers.size() == getNumPBOBuffers() && !mBuffers.empty() &&
+            mBuffers[0].frame.stride == frame.stride && mBuffers[0].frame.height == frame.height &&
+            mBuffers[0].frame.pixelFormat == frame.pixelFormat && mBuffers[0].frame.dataType == frame.dataType)
+            return;
+
+        // the worker must not read from the buffers which are going to be released
+        releaseBuffers(NULL);
+
+        mBuffers.clear();
+        mBuffers.resize(getNumPBOBuffers());
+        for (unsigned int i=0; i < mBuffers.size(); i++)
+        {
+            mBuffers[i].pbo = new osg::PixelDataBufferObject();
+            mBuffers[i].pbo->setDataSize(frame.stride * frame.height);
+            mBuffers[i].frame = frame;
+        }
+        mCurrentBuffer = 0;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutReadback::noticeFinishRendering(osg::RenderInfo& ri, const osg::Drawable* dr)
+    {
+        if (mCallback.valid() && !mBuffers.empty())
+        {
+            osg::State& state = *ri.getState();
+            unsigned int contextID = state.getContextID();
+            osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+            mContextID = contextID;
+
+            if (mWorker == NULL)
+            {
+                mWorker = new Worker(this);
+                mWorker->start();
+            }
+
+            // unmap the buffers whose callback has returned since the last frame
+            for (unsigned int i=0; i < mBuffers.size(); i++)
+            {
+                if (!mBuffers[i].mapped || mWorker->isBusy(i)) continue;
+                mBuffers[i].pbo->bindBufferInWriteMode(state);
+                ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+                mBuffers[i].pbo->unbindBuffer(contextID);
+                mBuffers[i].mapped = false;
+                mBuffers[i].frame.data = NULL;
+            }
+
+            // buffer must be released by the worker before it can be reused
+            Buffer& current = mBuffers[mCurrentBuffer];
+            mWorker->waitForBuffer(mCurrentBuffer);
+            if (current.pbo->getOrCreateGLBufferObject(contextID)->isDirty()) current.pbo->compileBuffer(state);
+            current.pbo->bindBufferInWriteMode(state);
+            if (current.mapped)
+            {
+                ext->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+                current.mapped = false;
+                current.frame.data = NULL;
+            }
+
+            // start reading the rendered output, fbo is still bound
+            GLint alignment = 4, readBuffer = GL_COLOR_ATTACHMENT0_EXT;
+            glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+            glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+            glReadPixels(0, 0, current.frame.width, current.frame.height, current.frame.pixelFormat, current.frame.dataType, NULL);
+            glReadBuffer((GLenum)readBuffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+            current.pbo->unbindBuffer(contextID);
+
+            deleteFenceSync(contextID, current.fence);
+            current.fence = insertFenceSync(contextID);
+            current.pending = true;
+            current.frame.frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0;
+
+            // the next buffer in the ring holds the oldest transfer, pass it to the worker
+            mCurrentBuffer = (mCurrentBuffer + 1) % mBuffers.size();
+            Buffer& oldest = mBuffers[mCurrentBuffer];
+            if (oldest.pending)
+            {
+                waitFenceSync(contextID, oldest.fence);
+                deleteFenceSync(contextID, oldest.fence);
+                oldest.fence = NULL;
+                oldest.pending = false;
+
+                oldest.pbo->bindBufferInWriteMode(state);
+                oldest.frame.data = ext->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+                oldest.pbo->unbindBuffer(contextID);
+
+                if (oldest.frame.data)
+                {
+                    oldest.mapped = true;
+                    mWorker->submit(mCurrentBuffer, oldest.frame, mCallback.get());
+                }
+            }
+        }
+
+        // restore the fbo
+        UnitInOut::noticeFinishRendering(ri, dr);
+    }
+
+}; // end namespace
@@ -0,0 +1,253 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitPyramid.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/TextureRectangle>
+#include <osg/Math>
+
+#include <sstream>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    UnitPyramid::UnitPyramid(const UnitPyramid& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mNumLevels(unit.mNumLevels),
+        mFilter(unit.mFilter),
+        mLevelProgram(unit.mLevelProgram),
+        mWeights(unit.mWeights)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitPyramid::UnitPyramid() : UnitInOut()
+    {
+        mNumLevels = 4;
+        mFilter = DUAL_KAWASE;
+        mRenderPasses = true;
+    }
+
+    //------------------------------------------------------------------------------
+    UnitPyramid::~UnitPyramid()
+    {
+
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitPyramid::setNumLevels(unsigned int num)
+    {
+        if (num < 1) num = 1;
+        mNumLevels = num;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitPyramid::setLevelWeight(unsigned int level, float weight)
+    {
+        mWeights[level] = weight;
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    float UnitPyramid::getLevelWeight(unsigned int level) const
+    {
+        std::map<unsigned int, float>::const_iterator it = mWeights.find(level);
+        if (it != mWeights.end()) return it->second;
+
+        // per default only the smallest level is used
+        return level == mNumLevels ? 1.0f : 0.0f;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::StateSet* UnitPyramid::addPass(osg::Texture* input, osg::Texture* levelInput, osg::Texture* output, osg::Program* program, unsigned int level)
+    {
+        FrameBufferObject* fbo = createPassFBO(output);
+        if (fbo == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitPyramid::addPass() - " << getName() << " output texture type is not supported" << std::endl;
+            return NULL;
+        }
+
+        int width = osg::maximum(1, output->getTextureWidth());
+        int height = osg::maximum(1, output->getTextureHeight());
+
+        osg::Drawable* draw = createTexturedQuadDrawable();
+        osg::StateSet* ss = draw->getOrCreateStateSet();
+        ss->setAttribute(new osg::Viewport(0, 0, width, height), osg::StateAttribute::ON);
+        ss->setAttribute(program, osg::StateAttribute::ON);
+        ss->setTextureAttributeAndModes(0, input, osg::StateAttribute::ON);
+        ss->getOrCreateUniform(OSGPPU_PYRAMID_INPUT_UNIFORM, osg::Uniform::SAMPLER_2D)->set(0);
+        if (levelInput)
+        {
+            ss->setTextureAttributeAndModes(1, levelInput, osg::StateAttribute::ON);
+            ss->getOrCreateUniform(OSGPPU_PYRAMID_LEVEL_INPUT_UNIFORM, osg::Uniform::SAMPLER_2D)->set(1);
+        }
+        ss->getOrCreateUniform(OSGPPU_PYRAMID_TEXEL_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(1.0f / (float)osg::maximum(1, input->getTextureWidth()), 1.0f / (float)osg::maximum(1, input->getTextureHeight())));
+        ss->getOrCreateUniform(OSGPPU_PYRAMID_OUTPUT_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2((float)width, (float)height));
+        ss->getOrCreateUniform(OSGPPU_PYRAMID_LEVEL_UNIFORM, osg::Uniform::INT)->set((int)level);
+        ss->getOrCreateUniform(OSGPPU_VIEWPORT_WIDTH_UNIFORM, osg::Uniform::FLOAT)->set((float)width);
+        ss->getOrCreateUniform(OSGPPU_VIEWPORT_HEIGHT_UNIFORM, osg::Uniform::FLOAT)->set((float)height);
+        appendPass(fbo, draw);
+
+        return ss;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitPyramid::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        // textures of the previous setup can be reused
+        clearPasses();
+
+        osg::Texture* input = getInputTexture(0);
+        osg::Texture* output = getOutputTexture(0);
+        if (input == NULL || output == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitPyramid::init() - " << getName() << " has no input or output texture" << std::endl;
+            return;
+        }
+        if (dynamic_cast<osg::TextureRectangle*>(input) != NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitPyramid::init() - " << getName() << " rectangle input textures are not supported" << std::endl;
+            return;
+        }
+
+        // downsample chain, the processed levels are used for the recombination only
+        std::vector<osg::Texture*> processed(mNumLevels + 1);
+        processed[0] = input;
+
+        osg::ref_ptr<osg::Program> downsample = createDownsampleProgram();
+        osg::Texture* source = input;
+        int width = osg::maximum(1, input->getTextureWidth());
+        int height = osg::maximum(1, input->getTextureHeight());
+        for (unsigned int level=1; level <= mNumLevels; level++)
+        {
+            width = osg::maximum(1, width / 2);
+            height = osg::maximum(1, height / 2);
+
+            osg::Texture* down = acquirePassTexture(width, height);
+            addPass(source, NULL, down, downsample.get(), level);
+            processed[level] = down;
+
+            if (mLevelProgram.valid())
+            {
+                processed[level] = acquirePassTexture(width, height);
+                addPass(down, NULL, processed[level], mLevelProgram.get(), level);
+            }
+            source = down;
+        }
+
+        // recombine upwards, the last pass writes into the output
+        osg::ref_ptr<osg::Program> upsample = createUpsampleProgram();
+        osg::Texture* upper = processed[mNumLevels];
+        float upperWeight = getLevelWeight(mNumLevels);
+        for (int level = mNumLevels - 1; level >= 0; level--)
+        {
+            osg::Texture* target = output;
+            if (level > 0)
+                target = acquirePassTexture(processed[level]->getTextureWidth(), processed[level]->getTextureHeight());
+
+            osg::StateSet* ss = addPass(upper, processed[level], target, upsample.get(), level);
+            if (ss == NULL) return;
+            ss->getOrCreateUniform(OSGPPU_PYRAMID_WEIGHT_UNIFORM, osg::Uniform::FLOAT)->set(getLevelWeight(level));
+            ss->getOrCreateUniform(OSGPPU_PYRAMID_UPPER_WEIGHT_UNIFORM, osg::Uniform::FLOAT)->set(upperWeight);
+
+            upper = target;
+            upperWeight = 1.0f;
+        }
+
+        // release textures which were not reused
+        releasePassTexturePool();
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitPyramid::createDownsampleProgram() const
+    {
+        std::stringstream src;
+
+        src << "uniform sampler2D " << OSGPPU_PYRAMID_INPUT_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_PYRAMID_TEXEL_SIZE_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_PYRAMID_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    vec2 tc = gl_FragCoord.xy / " << OSGPPU_PYRAMID_OUTPUT_SIZE_UNIFORM << ";" << std::endl;
+
+        // one fetch in the middle of 2x2 texels
+        if (mFilter == BOX)
+            src << "    gl_FragColor = texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc);" << std::endl;
+
+        // center and four diagonal fetches, each averaging 2x2 texels
+        else
+            src << "    vec2 hp = " << OSGPPU_PYRAMID_TEXEL_SIZE_UNIFORM << ";" << std::endl
+                << "    vec4 sum = texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc) * 4.0;" << std::endl
+                << "    sum += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc - hp);" << std::endl
+                << "    sum += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + hp);" << std::endl
+                << "    sum += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(hp.x, -hp.y));" << std::endl
+                << "    sum += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc - vec2(hp.x, -hp.y));" << std::endl
+                << "    gl_FragColor = sum / 8.0;" << std::endl;
+        src << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitPyramid::createUpsampleProgram() const
+    {
+        std::stringstream src;
+
+        src << "uniform sampler2D " << OSGPPU_PYRAMID_INPUT_UNIFORM << ";" << std::endl
+            << "uniform sampler2D " << OSGPPU_PYRAMID_LEVEL_INPUT_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_PYRAMID_TEXEL_SIZE_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_PYRAMID_OUTPUT_SIZE_UNIFORM << ";" << std::endl
+            << "uniform float " << OSGPPU_PYRAMID_WEIGHT_UNIFORM << ";" << std::endl
+            << "uniform float " << OSGPPU_PYRAMID_UPPER_WEIGHT_UNIFORM << ";" << std::endl
+            << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    vec2 tc = gl_FragCoord.xy / " << OSGPPU_PYRAMID_OUTPUT_SIZE_UNIFORM << ";" << std::endl;
+
+        if (mFilter == BOX)
+            src << "    vec4 upper = texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc);" << std::endl;
+
+        // tent of four edge and four diagonal fetches of the upper level
+        else
+            src << "    vec2 hp = " << OSGPPU_PYRAMID_TEXEL_SIZE_UNIFORM << " * 0.5;" << std::endl
+                << "    vec4 upper = texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(-hp.x * 2.0, 0.0));" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(-hp.x, hp.y)) * 2.0;" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(0.0, hp.y * 2.0));" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(hp.x, hp.y)) * 2.0;" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(hp.x * 2.0, 0.0));" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(hp.x, -hp.y)) * 2.0;" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(0.0, -hp.y * 2.0));" << std::endl
+                << "    upper += texture2D(" << OSGPPU_PYRAMID_INPUT_UNIFORM << ", tc + vec2(-hp.x, -hp.y)) * 2.0;" << std::endl
+                << "    upper /= 12.0;" << std::endl;
+
+        src << "    gl_FragColor = upper * " << OSGPPU_PYRAMID_UPPER_WEIGHT_UNIFORM
+            << " + texture2D(" << OSGPPU_PYRAMID_LEVEL_INPUT_UNIFORM << ", tc) * " << OSGPPU_PYRAMID_WEIGHT_UNIFORM << ";" << std::endl
+            << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+}; // end namespace
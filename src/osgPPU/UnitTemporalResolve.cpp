@@ -0,0 +1,273 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+
+#include <osgPPU/UnitTemporalResolve.h>
+#include <osgPPU/Processor.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/FrameStamp>
+#include <osg/Math>
+
+#include <sstream>
+
+namespace osgPPU
+{
+    //------------------------------------------------------------------------------
+    // Element of the Halton low discrepancy sequence of the given base
+    //------------------------------------------------------------------------------
+    static float halton(unsigned int index, unsigned int base)
+    {
+        float f = 1.0f, result = 0.0f;
+        while (index > 0)
+        {
+            f /= (float)base;
+            result += f * (float)(index % base);
+            index /= base;
+        }
+        return result;
+    }
+
+    //------------------------------------------------------------------------------
+    UnitTemporalResolve::UnitTemporalResolve(const UnitTemporalResolve& unit, const osg::CopyOp& copyop) :
+        UnitInOut(unit, copyop),
+        mJitterIndex(0),
+        mLastCullFrame(0),
+        mHistoryValid(false),
+        mHistoryWeight(unit.mHistoryWeight),
+        mNumJitterSamples(unit.mNumJitterSamples)
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    UnitTemporalResolve::UnitTemporalResolve() : UnitInOut()
+    {
+        mJitterIndex = 0;
+        mLastCullFrame = 0;
+        mHistoryValid = false;
+        mHistoryWeight = 0.9f;
+        mNumJitterSamples = 8;
+        mRenderPasses = true;
+    }
+
+    //------------------------------------------------------------------------------
+    UnitTemporalResolve::~UnitTemporalResolve()
+    {
+        removeJitter();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTemporalResolve::setNumJitterSamples(unsigned int num)
+    {
+        mNumJitterSamples = num;
+        if (num == 0) removeJitter();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTemporalResolve::removeJitter()
+    {
+        mJitter.set(0.0f, 0.0f);
+
+        // only restore the projection if it was not changed by someone else
+        osg::Camera* camera = mCamera.get();
+        if (camera && camera->getProjectionMatrix() == mJitteredProjection)
+            camera->setProjectionMatrix(mBaseProjection);
+        mJitteredProjection = mBaseProjection;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTemporalResolve::init()
+    {
+        // default initialization
+        UnitInOut::init();
+
+        clearPasses();
+        mHistoryValid = false;
+
+        // camera is taken from the processor this unit is a part of
+        osg::Camera* camera = NULL;
+        osg::NodePathList paths = getParentalNodePaths();
+        for (unsigned int i=0; i < paths.size() && camera == NULL; i++)
+            for (unsigned int j=0; j < paths[i].size() && camera == NULL; j++)
+            {
+                Processor* proc = dynamic_cast<Processor*>(paths[i][j]);
+                if (proc) camera = proc->getCamera();
+            }
+        if (camera != mCamera.get())
+        {
+            removeJitter();
+            mCamera = camera;
+            if (camera) mBaseProjection = mJitteredProjection = camera->getProjectionMatrix();
+        }
+
+        osg::Texture* color = getInputTexture(0);
+        osg::Texture* depth = getInputTexture(1);
+        osg::Texture2D* output = dynamic_cast<osg::Texture2D*>(getOutputTexture(0));
+        if (camera == NULL || color == NULL || depth == NULL || output == NULL)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitTemporalResolve::init() - " << getName() << " requires a processor camera, color and depth input and a 2D output texture" << std::endl;
+            return;
+        }
+
+        int width = osg::maximum(1, output->getTextureWidth());
+        int height = osg::maximum(1, output->getTextureHeight());
+
+        osg::ref_ptr<osg::Program> program = createResolveProgram();
+        for (unsigned int i=0; i < 2; i++)
+        {
+            if (!mHistory[i].valid() || mHistory[i]->getTextureWidth() != width || mHistory[i]->getTextureHeight() != height || mHistory[i]->getInternalFormat() != getOutputInternalFormat())
+            {
+                mHistory[i] = new osg::Texture2D();
+                mHistory[i]->setTextureSize(width, height);
+                mHistory[i]->setInternalFormat(getOutputInternalFormat());
+                mHistory[i]->setSourceFormat(createSourceTextureFormat(getOutputInternalFormat()));
+                mHistory[i]->setSourceType(GL_FLOAT);
+                mHistory[i]->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+                mHistory[i]->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+                mHistory[i]->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+                mHistory[i]->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+            }
+        }
+
+        // the resolved color is written to the output and to the history of the frame,
+        // pass i is used on frames of parity i and reads the history written by the other one
+        for (unsigned int i=0; i < 2; i++)
+        {
+            FrameBufferObject* fbo = new FrameBufferObject();
+            fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(output));
+            fbo->setAttachment(osg::Camera::COLOR_BUFFER1, osg::FrameBufferAttachment(mHistory[i].get()));
+
+            osg::Drawable* draw = createTexturedQuadDrawable();
+            osg::StateSet* ss = draw->getOrCreateStateSet();
+            ss->setAttribute(new osg::Viewport(0, 0, width, height), osg::StateAttribute::ON);
+            ss->setAttribute(program.get(), osg::StateAttribute::ON);
+            ss->setTextureAttributeAndModes(2, mHistory[1 - i].get(), osg::StateAttribute::ON);
+            ss->getOrCreateUniform(OSGPPU_TEMPORAL_COLOR_UNIFORM, osg::Uniform::SAMPLER_2D)->set(0);
+            ss->getOrCreateUniform(OSGPPU_TEMPORAL_DEPTH_UNIFORM, osg::Uniform::SAMPLER_2D)->set(1);
+            ss->getOrCreateUniform(OSGPPU_TEMPORAL_HISTORY_UNIFORM, osg::Uniform::SAMPLER_2D)->set(2);
+            ss->getOrCreateUniform(OSGPPU_TEMPORAL_TEXEL_SIZE_UNIFORM, osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(1.0f / (float)osg::maximum(1, color->getTextureWidth()), 1.0f / (float)osg::maximum(1, color->getTextureHeight())));
+            ss->getOrCreateUniform(OSGPPU_TEMPORAL_HISTORY_WEIGHT_UNIFORM, osg::Uniform::FLOAT)->set(0.0f);
+            ss->getOrCreateUniform(OSGPPU_TEMPORAL_REPROJECTION_UNIFORM, osg::Uniform::FLOAT_MAT4)->set(osg::Matrixf::identity());
+            appendPass(fbo, draw);
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTemporalResolve::update()
+    {
+        UnitInOut::update();
+
+        osg::Camera* camera = mCamera.get();
+        if (camera == NULL || camera->getViewport() == NULL || mNumJitterSamples == 0) return;
+
+        // the application might have changed the projection since the last frame
+        if (camera->getProjectionMatrix() != mJitteredProjection)
+            mBaseProjection = camera->getProjectionMatrix();
+
+        // offset in pixels from the pixel center, applied as translation in clip space
+        unsigned int index = mJitterIndex++ % mNumJitterSamples;
+        mJitter.set(halton(index + 1, 2) - 0.5f, halton(index + 1, 3) - 0.5f);
+
+        double width = osg::maximum(1.0, (double)camera->getViewport()->width());
+        double height = osg::maximum(1.0, (double)camera->getViewport()->height());
+        mJitteredProjection = mBaseProjection * osg::Matrixd::translate(2.0 * mJitter.x() / width, 2.0 * mJitter.y() / height, 0.0);
+        camera->setProjectionMatrix(mJitteredProjection);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTemporalResolve::traverse(osg::NodeVisitor& nv)
+    {
+        // the view of the frame is known when the processor is culled
+        if (nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR && nv.getFrameStamp() && nv.getFrameStamp()->getFrameNumber() != mLastCullFrame)
+            updateReprojection(nv.getFrameStamp()->getFrameNumber());
+
+        UnitInOut::traverse(nv);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTemporalResolve::updateReprojection(unsigned int frameNumber)
+    {
+        mLastCullFrame = frameNumber;
+
+        osg::Camera* camera = mCamera.get();
+        if (camera == NULL || mPassDrawable.size() != 2) return;
+        osg::Drawable* draw = mPassDrawable[frameNumber % 2].get();
+
+        // the reprojection is done without the jitter, so that a static image does not move
+        osg::Matrixd viewProjection = camera->getViewMatrix() * mBaseProjection;
+        osg::Matrixd reprojection = osg::Matrixd::inverse(viewProjection) * (mHistoryValid ? mPreviousViewProjection : viewProjection);
+
+        // frames use alternating passes, so the pass drawn by the previous frame is not touched
+        osg::StateSet* ss = draw->getStateSet();
+        ss->getOrCreateUniform(OSGPPU_TEMPORAL_REPROJECTION_UNIFORM, osg::Uniform::FLOAT_MAT4)->set(osg::Matrixf(reprojection));
+        ss->getOrCreateUniform(OSGPPU_TEMPORAL_HISTORY_WEIGHT_UNIFORM, osg::Uniform::FLOAT)->set(mHistoryValid ? mHistoryWeight : 0.0f);
+
+        mPreviousViewProjection = viewProjection;
+        mHistoryValid = true;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Program* UnitTemporalResolve::createResolveProgram() const
+    {
+        std::stringstream src;
+
+        src << "uniform sampler2D " << OSGPPU_TEMPORAL_COLOR_UNIFORM << ";" << std::endl
+            << "uniform sampler2D " << OSGPPU_TEMPORAL_DEPTH_UNIFORM << ";" << std::endl
+            << "uniform sampler2D " << OSGPPU_TEMPORAL_HISTORY_UNIFORM << ";" << std::endl
+            << "uniform mat4 " << OSGPPU_TEMPORAL_REPROJECTION_UNIFORM << ";" << std::endl
+            << "uniform vec2 " << OSGPPU_TEMPORAL_TEXEL_SIZE_UNIFORM << ";" << std::endl
+            << "uniform float " << OSGPPU_TEMPORAL_HISTORY_WEIGHT_UNIFORM << ";" << std::endl
+            << "void main(void)" << std::endl
+            << "{" << std::endl
+            << "    vec2 tc = gl_TexCoord[0].st;" << std::endl
+            << "    vec4 color = texture2D(" << OSGPPU_TEMPORAL_COLOR_UNIFORM << ", tc);" << std::endl;
+
+        // bounding box of the colors in the neighbourhood
+        src << "    vec4 minColor = color, maxColor = color;" << std::endl
+            << "    for (int y=-1; y <= 1; y++)" << std::endl
+            << "        for (int x=-1; x <= 1; x++)" << std::endl
+            << "        {" << std::endl
+            << "            vec4 c = texture2D(" << OSGPPU_TEMPORAL_COLOR_UNIFORM << ", tc + vec2(float(x), float(y)) * " << OSGPPU_TEMPORAL_TEXEL_SIZE_UNIFORM << ");" << std::endl
+            << "            minColor = min(minColor, c);" << std::endl
+            << "            maxColor = max(maxColor, c);" << std::endl
+            << "        }" << std::endl;
+
+        // position of the pixel in the previous frame
+        src << "    float depth = texture2D(" << OSGPPU_TEMPORAL_DEPTH_UNIFORM << ", tc).r;" << std::endl
+            << "    vec4 prev = " << OSGPPU_TEMPORAL_REPROJECTION_UNIFORM << " * vec4(tc * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);" << std::endl
+            << "    vec2 prevTc = prev.xy / prev.w * 0.5 + 0.5;" << std::endl
+            << "    float weight = " << OSGPPU_TEMPORAL_HISTORY_WEIGHT_UNIFORM << ";" << std::endl
+            << "    if (any(lessThan(prevTc, vec2(0.0))) || any(greaterThan(prevTc, vec2(1.0)))) weight = 0.0;" << std::endl
+            << "    vec4 history = clamp(texture2D(" << OSGPPU_TEMPORAL_HISTORY_UNIFORM << ", prevTc), minColor, maxColor);" << std::endl
+            << "    vec4 result = mix(color, history, weight);" << std::endl
+            << "    gl_FragData[0] = result;" << std::endl
+            << "    gl_FragData[1] = result;" << std::endl
+            << "}" << std::endl;
+
+        osg::Program* program = new osg::Program();
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, src.str()));
+        return program;
+    }
+
+    //--------------------------------------------------------------------------
+    void UnitTemporalResolve::renderPasses(osg::RenderInfo& info)
+    {
+        // only the pass of the current frame is rendered
+        unsigned int frame = info.getState()->getFrameStamp() ? info.getState()->getFrameStamp()->getFrameNumber() : 0;
+        if (mPassFBO.size() == 2) renderPass(info, frame % 2);
+    }
+
+}; // end namespace
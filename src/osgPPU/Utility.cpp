@@ -22,6 +22,28 @@
 #include <osg/TextureCubeMap>
 #include <osg/TextureRectangle>
 #include <osg/Texture2DArray>
+#include <osg/GLExtensions>
+#include <osg/buffered_value>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <map>
+#include <vector>
+
+// GL_ARB_sync is not wrapped by osg, hence we define what we need by ourself
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+    #define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+    #define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+    #define GL_ALREADY_SIGNALED 0x911A
+    #define GL_TIMEOUT_EXPIRED 0x911B
+    #define GL_CONDITION_SATISFIED 0x911C
+    #define GL_WAIT_FAILED 0x911D
+#endif
+
+// same for GL_ARB_shader_image_load_store
+#ifndef GL_ALL_BARRIER_BITS
+    #define GL_ALL_BARRIER_BITS 0xFFFFFFFF
+#endif
 
 namespace osgPPU
 {
@@ -42,6 +64,11 @@ GLenum createSourceTextureFormat(GLenum internalFormat)
         case GL_RGBA32F_ARB:
         case GL_RGBA16F_ARB: return GL_RGBA;
 
+        case GL_LUMINANCE8: return GL_LUMINANCE;
+        case GL_LUMINANCE8_ALPHA8: return GL_LUMINANCE_ALPHA;
+        case GL_RGB8: return GL_RGB;
+        case GL_RGBA8: return GL_RGBA;
+
         case GL_LUMINANCE32UI_EXT:
         case GL_LUMINANCE32I_EXT:
         case GL_LUMINANCE16UI_EXT:
@@ -104,9 +131,215 @@ unsigned int computeTextureSizeInBytes(osg::Texture* tex)
     GLenum type = osg::Image::computeFormatDataType(intFormat);
     unsigned int rowWidth = osg::Image::computeRowWidthInBytes(w, intFormat, type, 1);
 
+    // cubemaps store six faces of the same size
+    if (dynamic_cast<osg::TextureCubeMap*>(tex)) d = 6;
+
     return rowWidth*h*d;
 }
 
+//--------------------------------------------------------------------------
+// Per context function pointers of the GL_ARB_sync extension
+//--------------------------------------------------------------------------
+struct SyncExtensions
+{
+    typedef void* (APIENTRY * FenceSyncProc) (GLenum condition, GLbitfield flags);
+    typedef GLenum (APIENTRY * ClientWaitSyncProc) (void* sync, GLbitfield flags, unsigned long long timeout);
+    typedef void (APIENTRY * DeleteSyncProc) (void* sync);
+
+    SyncExtensions() : initialized(false), glFenceSync(NULL), glClientWaitSync(NULL), glDeleteSync(NULL) {}
+
+    void setup(unsigned int contextID)
+    {
+        if (initialized) return;
+        initialized = true;
+
+        if (!osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_sync", 3.2f)) return;
+
+        osg::setGLExtensionFuncPtr(glFenceSync, "glFenceSync");
+        osg::setGLExtensionFuncPtr(glClientWaitSync, "glClientWaitSync");
+        osg::setGLExtensionFuncPtr(glDeleteSync, "glDeleteSync");
+    }
+
+    inline bool isSupported() const { return glFenceSync && glClientWaitSync && glDeleteSync; }
+
+    bool initialized;
+    FenceSyncProc glFenceSync;
+    ClientWaitSyncProc glClientWaitSync;
+    DeleteSyncProc glDeleteSync;
+};
+static osg::buffered_object<SyncExtensions> s_syncExtensions;
+
+//--------------------------------------------------------------------------
+void* insertFenceSync(unsigned int contextID)
+{
+    SyncExtensions& ext = s_syncExtensions[contextID];
+    ext.setup(contextID);
+    if (!ext.isSupported()) return NULL;
+
+    return ext.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+//--------------------------------------------------------------------------
+bool waitFenceSync(unsigned int contextID, void* fence, unsigned long long timeout)
+{
+    if (fence == NULL) return true;
+
+    SyncExtensions& ext = s_syncExtensions[contextID];
+    if (!ext.isSupported()) return true;
+
+    GLenum result = ext.glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+//--------------------------------------------------------------------------
+void deleteFenceSync(unsigned int contextID, void* fence)
+{
+    if (fence == NULL) return;
+
+    SyncExtensions& ext = s_syncExtensions[contextID];
+    if (ext.isSupported()) ext.glDeleteSync(fence);
+}
+
+//--------------------------------------------------------------------------
+// Fences released without a current context, deleted on the next draw
+//--------------------------------------------------------------------------
+typedef std::map<unsigned int, std::vector<void*> > DeletedFenceMap;
+static DeletedFenceMap s_deletedFences;
+static OpenThreads::Mutex s_deletedFencesMutex;
+
+//--------------------------------------------------------------------------
+void releaseFenceSync(unsigned int contextID, void* fence)
+{
+    if (fence == NULL) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_deletedFencesMutex);
+    s_deletedFences[contextID].push_back(fence);
+}
+
+//--------------------------------------------------------------------------
+void flushDeletedFenceSyncs(unsigned int contextID)
+{
+    std::vector<void*> fences;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_deletedFencesMutex);
+        DeletedFenceMap::iterator it = s_deletedFences.find(contextID);
+        if (it == s_deletedFences.end()) return;
+        fences.swap(it->second);
+    }
+
+    for (std::vector<void*>::iterator it = fences.begin(); it != fences.end(); it++)
+        deleteFenceSync(contextID, *it);
+}
+
+
+//--------------------------------------------------------------------------
+// Per context function pointers of the GL_ARB_shader_image_load_store extension
+//--------------------------------------------------------------------------
+struct ImageExtensions
+{
+    typedef void (APIENTRY * BindImageTextureProc) (GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+    typedef void (APIENTRY * MemoryBarrierProc) (GLbitfield barriers);
+
+    ImageExtensions() : initialized(false), glBindImageTexture(NULL), glMemoryBarrier(NULL) {}
+
+    void setup(unsigned int contextID)
+    {
+        if (initialized) return;
+        initialized = true;
+
+        if (!osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_shader_image_load_store", 4.2f)) return;
+
+        osg::setGLExtensionFuncPtr(glBindImageTexture, "glBindImageTexture");
+        osg::setGLExtensionFuncPtr(glMemoryBarrier, "glMemoryBarrier");
+    }
+
+    inline bool isSupported() const { return glBindImageTexture && glMemoryBarrier; }
+
+    bool initialized;
+    BindImageTextureProc glBindImageTexture;
+    MemoryBarrierProc glMemoryBarrier;
+};
+static osg::buffered_object<ImageExtensions> s_imageExtensions;
+
+//--------------------------------------------------------------------------
+bool isImageLoadStoreSupported(unsigned int contextID)
+{
+    ImageExtensions& ext = s_imageExtensions[contextID];
+    ext.setup(contextID);
+    return ext.isSupported();
+}
+
+//--------------------------------------------------------------------------
+const char* getImageFormatQualifier(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_RGBA32F_ARB: return "rgba32f";
+        case GL_RGBA16F_ARB: return "rgba16f";
+        case GL_RGBA8:
+        case GL_RGBA: return "rgba8";
+        default: return NULL;
+    }
+}
+
+//--------------------------------------------------------------------------
+void bindImageTexture(unsigned int contextID, unsigned int unit, osg::Texture* texture, int level, GLenum access)
+{
+    ImageExtensions& ext = s_imageExtensions[contextID];
+    osg::Texture::TextureObject* to = texture ? texture->getTextureObject(contextID) : NULL;
+    if (!ext.isSupported() || to == NULL) return;
+
+    GLenum format = texture->getInternalFormat() == GL_RGBA ? GL_RGBA8 : texture->getInternalFormat();
+    ext.glBindImageTexture(unit, to->id(), level, GL_TRUE, 0, access, format);
+}
+
+//--------------------------------------------------------------------------
+void imageMemoryBarrier(unsigned int contextID)
+{
+    ImageExtensions& ext = s_imageExtensions[contextID];
+    if (ext.isSupported()) ext.glMemoryBarrier(GL_ALL_BARRIER_BITS);
+}
+
+//--------------------------------------------------------------------------
+// Per context function pointers of the GL_ARB_compute_shader extension
+//--------------------------------------------------------------------------
+struct ComputeExtensions
+{
+    typedef void (APIENTRY * DispatchComputeProc) (GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+
+    ComputeExtensions() : initialized(false), glDispatchCompute(NULL) {}
+
+    void setup(unsigned int contextID)
+    {
+        if (initialized) return;
+        initialized = true;
+
+        if (!osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_compute_shader", 4.3f)) return;
+
+        osg::setGLExtensionFuncPtr(glDispatchCompute, "glDispatchCompute");
+    }
+
+    inline bool isSupported() const { return glDispatchCompute != NULL; }
+
+    bool initialized;
+    DispatchComputeProc glDispatchCompute;
+};
+static osg::buffered_object<ComputeExtensions> s_computeExtensions;
+
+//--------------------------------------------------------------------------
+bool isComputeShaderSupported(unsigned int contextID)
+{
+    ComputeExtensions& ext = s_computeExtensions[contextID];
+    ext.setup(contextID);
+    return ext.isSupported() && isImageLoadStoreSupported(contextID);
+}
+
+//--------------------------------------------------------------------------
+void dispatchCompute(unsigned int contextID, unsigned int numGroupsX, unsigned int numGroupsY, unsigned int numGroupsZ)
+{
+    ComputeExtensions& ext = s_computeExtensions[contextID];
+    if (ext.isSupported()) ext.glDispatchCompute(numGroupsX, numGroupsY, numGroupsZ);
+}
 
 }; //end namespace
 
@@ -16,13 +16,22 @@
 
 #include <osgPPU/Visitor.h>
 #include <osgPPU/UnitBypass.h>
+#include <osgPPU/UnitCamera.h>
+#include <osgPPU/UnitCameraAttachmentBypass.h>
+#include <osgPPU/UnitTexture.h>
+#include <osgPPU/UnitText.h>
 #include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/UnitOutReadback.h>
 #include <osgPPU/BarrierNode.h>
 #include <osgUtil/CullVisitor>
 
 #include <OpenThreads/ScopedLock>
 #include <OpenThreads/Mutex>
 
+#include <algorithm>
+#include <functional>
+
 namespace osgPPU
 {
 // Mutex used to let threads only change data values of Units in serialized manner
@@ -165,41 +174,44 @@ void OptimizeUnitsVisitor::run (osg::Group* root)
 //------------------------------------------------------------------------------
 void ResolveUnitsCyclesVisitor::apply (osg::Group &node)
 {
-    bool foundCycle = false;
+    NodeStateMap::iterator it = _state.find(&node);
 
-    // traverse the node path and check, whenever this node was already added
-    osg::NodePath::reverse_iterator it = getNodePath().rbegin(); it++;
-    for (; it!=getNodePath().rend(); it++)
+    // node was reached over a back edge, hence there is a cycle
+    if (it != _state.end() && it->second == IN_PROGRESS)
     {
-        // if we are able to find this node again, so there is a cycle
-        if (*it == dynamic_cast<osg::Node*>(&node))
+        // the node from which we came here shouldn't contain this node as a child anymore
+        const osg::NodePath& path = getNodePath();
+        osg::Group* parent = path.size() > 1 ? path[path.size()-2]->asGroup() : NULL;
+        if (parent == NULL)
         {
-            // create new node, which will be used to block the traversion
-            BarrierNode* br = new BarrierNode();
-            foundCycle = true;
-
-            // the previous node in the list, shouldn't contain this node as a child anymore
-            it --;
-            (dynamic_cast<osg::Group*>(*it))->replaceChild(dynamic_cast<osg::Node*>(&node), br);
+            osg::notify(osg::FATAL) << "osgPPU::ResolveUnitsCyclesVisitor::apply() - cannot resolve cycle at " << node.getName() << ", because no parent found" << std::endl;
+            return;
+        }
 
-            // debug info
-            osg::notify(osg::INFO) << "osgPPU::ResolveUnitsCyclesVisitor::apply():" << std::endl << "\t";
-            for (osg::NodePath::iterator kt = getNodePath().begin(); kt!=getNodePath().end(); kt++) osg::notify(osg::INFO) << (*kt)->getName() << " -> ";
-            osg::notify(osg::INFO) << std::endl << "\tReplace child " << node.getName() << " of node " << (*it)->getName() << " with a barrier node to resolve cycles!" <<std::endl;
+        // create new node, which will be used to block the traversion
+        BarrierNode* br = new BarrierNode();
+        parent->replaceChild(&node, br);
+        _numResolvedCycles++;
 
-            // now the child of the barrier node would be the current node
-            br->setBlockedChild(&node);
-            br->setBlockedParent(dynamic_cast<osg::Group*>(*it));
-            br->setName((*it)->getName() + std::string("-") + node.getName());
+        // debug info
+        osg::notify(osg::INFO) << "osgPPU::ResolveUnitsCyclesVisitor::apply():" << std::endl << "\t";
+        for (osg::NodePath::const_iterator kt = path.begin(); kt!=path.end(); kt++) osg::notify(osg::INFO) << (*kt)->getName() << " -> ";
+        osg::notify(osg::INFO) << std::endl << "\tReplace child " << node.getName() << " of node " << parent->getName() << " with a barrier node to resolve cycles!" <<std::endl;
 
-            it ++;
-        }
+        // now the child of the barrier node would be the current node
+        br->setBlockedChild(&node);
+        br->setBlockedParent(parent);
+        br->setName(parent->getName() + std::string("-") + node.getName());
+        return;
     }
 
-    // traverse the unit as if it where a group node
-    if (!foundCycle)
-        node.traverse(*this);
+    // subgraph of the node was already checked over another path
+    if (it != _state.end()) return;
 
+    // traverse the unit as if it where a group node
+    _state[&node] = IN_PROGRESS;
+    node.traverse(*this);
+    _state[&node] = DONE;
 }
 
 //------------------------------------------------------------------------------
@@ -207,7 +219,10 @@ void ResolveUnitsCyclesVisitor::run (osg::Group* root)
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
 
+    _state.clear();
+    _numResolvedCycles = 0;
     root->traverse(*this);
+    _state.clear();
 }
 
 
@@ -218,6 +233,8 @@ void SetupUnitRenderingVisitor::run (osg::Group* root)
 
     // setup unit list
     mUnitSet.clear();
+    mUnitLookup.clear();
+    mVisited.clear();
     root->traverse(*this);
 
     // setup the indices of the units, so that they got sorted correctly in the pipeline
@@ -236,12 +253,152 @@ void SetupUnitRenderingVisitor::run (osg::Group* root)
         if (_initUnits) (*it)->update();
     }
 
+    // compute execution order of the units
+    if (_proc) scheduleUnits();
+}
+
+//------------------------------------------------------------------------------
+// Helper functor to sort units of the same level by their state
+//------------------------------------------------------------------------------
+struct UnitStateOrder
+{
+    //! Sort key of a unit, states are identified by the first unit using them in topological order
+    struct Key
+    {
+        bool last;
+        unsigned int program;
+        unsigned int texture;
+        unsigned int fbo;
+        unsigned int index;
+    };
+    typedef std::map<Unit*, Key> KeyMap;
+
+    UnitStateOrder(const KeyMap& keys, bool sortByState) :
+        _keys(keys), _sortByState(sortByState) {}
+
+    static const osg::StateAttribute* getProgram(const Unit* unit)
+    {
+        return unit->getStateSet() ? unit->getStateSet()->getAttribute(osg::StateAttribute::PROGRAM) : NULL;
+    }
+
+    static const osg::FrameBufferObject* getFrameBufferObject(Unit* unit)
+    {
+        UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+        return unitIO ? unitIO->getFrameBufferObject() : NULL;
+    }
+
+    bool operator()(Unit* a, Unit* b) const
+    {
+        const Key& ka = _keys.find(a)->second;
+        const Key& kb = _keys.find(b)->second;
+
+        // units placed as last and units depending on them are executed at the end of the pipeline
+        if (ka.last != kb.last) return kb.last;
+
+        if (a->getExecutionLevel() != b->getExecutionLevel()) return a->getExecutionLevel() < b->getExecutionLevel();
+
+        if (_sortByState)
+        {
+            if (ka.program != kb.program) return ka.program < kb.program;
+            if (ka.texture != kb.texture) return ka.texture < kb.texture;
+            if (ka.fbo != kb.fbo) return ka.fbo < kb.fbo;
+        }
+        return ka.index < kb.index;
+    }
+
+    const KeyMap& _keys;
+    bool _sortByState;
+};
+
+//------------------------------------------------------------------------------
+static void countStateChanges(const std::vector<Unit*>& units, unsigned int& numProgramChanges, unsigned int& numFrameBufferChanges, unsigned int& numTextureChanges)
+{
+    numProgramChanges = numFrameBufferChanges = numTextureChanges = 0;
+
+    const osg::StateAttribute* program = NULL;
+    const osg::FrameBufferObject* fbo = NULL;
+    std::map<int, osg::Texture*> textures;
+
+    for (std::vector<Unit*>::const_iterator it = units.begin(); it != units.end(); it++)
+    {
+        if (UnitStateOrder::getProgram(*it) != program) numProgramChanges++;
+        if (UnitStateOrder::getFrameBufferObject(*it) != fbo) numFrameBufferChanges++;
+        program = UnitStateOrder::getProgram(*it);
+        fbo = UnitStateOrder::getFrameBufferObject(*it);
+
+        const Unit::TextureMap& input = (*it)->getInputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = input.begin(); jt != input.end(); jt++)
+        {
+            if (!jt->second.valid()) continue;
+            osg::Texture*& bound = textures[jt->first];
+            if (bound != jt->second.get()) numTextureChanges++;
+            bound = jt->second.get();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void SetupUnitRenderingVisitor::scheduleUnits()
+{
+    // the unit set is in topological order, hence parents are handled before their children
+    std::vector<Unit*> units(mUnitSet.begin(), mUnitSet.end());
+    UnitStateOrder::KeyMap keys;
+    std::map<const void*, unsigned int> stateIds;
+    unsigned int numLevels = 0;
+    for (unsigned int k=0; k < units.size(); k++)
+    {
+        Unit* unit = units[k];
+        UnitStateOrder::Key& key = keys[unit];
+        key.last = unit->getCullCallback() == _proc->mCollectLastUnitsCallback.get();
+        key.index = k;
+
+        unit->mExecutionLevel = 0;
+        for (unsigned int i=0; i < unit->getNumParents(); i++)
+        {
+            Unit* parent = dynamic_cast<Unit*>(unit->getParent(i));
+            if (parent && mUnitLookup.find(parent) != mUnitLookup.end())
+            {
+                unit->mExecutionLevel = osg::maximum(unit->mExecutionLevel, parent->mExecutionLevel + 1);
+
+                // children of units placed as last have to be executed after them
+                if (keys[parent].last) key.last = true;
+            }
+        }
+        numLevels = osg::maximum(numLevels, unit->mExecutionLevel + 1);
+
+        // states get the topological index of the first unit using them, so that the order does not depend on pointers
+        key.program = stateIds.insert(std::make_pair((const void*)UnitStateOrder::getProgram(unit), k)).first->second;
+        key.texture = stateIds.insert(std::make_pair((const void*)unit->getInputTexture(0), k)).first->second;
+        key.fbo = stateIds.insert(std::make_pair((const void*)UnitStateOrder::getFrameBufferObject(unit), k)).first->second;
+    }
+
+    // statistics of the order as found in the graph
+    Processor::Statistics& stats = _proc->mStatistics;
+    stats = Processor::Statistics();
+    stats.numUnits = units.size();
+    stats.numLevels = numLevels;
+    countStateChanges(units, stats.numProgramChangesUnsorted, stats.numFrameBufferChangesUnsorted, stats.numTextureChangesUnsorted);
+
+    // sort by levels and units of the same level by their state
+    std::sort(units.begin(), units.end(), UnitStateOrder(keys, _proc->getUseStateSorting()));
+    for (unsigned int i=0; i < units.size(); i++)
+        units[i]->mExecutionIndex = i;
+
+    countStateChanges(units, stats.numProgramChanges, stats.numFrameBufferChanges, stats.numTextureChanges);
+
+    osg::notify(osg::INFO) << "osgPPU::SetupUnitRenderingVisitor::scheduleUnits() - " << stats.numUnits << " units on " << numLevels << " levels, "
+        << "program changes " << stats.numProgramChangesUnsorted << " -> " << stats.numProgramChanges << ", "
+        << "fbo changes " << stats.numFrameBufferChangesUnsorted << " -> " << stats.numFrameBufferChanges << ", "
+        << "texture changes " << stats.numTextureChangesUnsorted << " -> " << stats.numTextureChanges << std::endl;
 }
 
 
 //------------------------------------------------------------------------------
 void SetupUnitRenderingVisitor::apply (osg::Group &node)
 {
+    // subgraph of the node was already visited over another path
+    if (!mVisited.insert(&node).second) return;
+
     Unit* unit = dynamic_cast<Unit*>(&node);
 
     // we do here a manuall children accept method calling.
@@ -261,12 +418,7 @@ void SetupUnitRenderingVisitor::apply (osg::Group &node)
     if (unit != NULL)
     {
         // add the new unit only if it wasn't added before
-        bool found = false;
-        for (UnitSet::iterator it=mUnitSet.begin(); it!=mUnitSet.end(); it++)
-            if (*it == unit) found = true;
-
-        // add the unit to the unit set
-        if (found == false)
+        if (mUnitLookup.insert(unit).second)
             mUnitSet.push_front(unit);
     }
 }
@@ -305,6 +457,158 @@ void RemoveUnitsViewportsVisitor::run (osg::Group* root)
     root->accept(*this);
 }
 
+//------------------------------------------------------------------------------
+void MarkUnitsLiveVisitor::apply (osg::Group &node)
+{
+    // every node is visited only once
+    if (!_visited.insert(&node).second) return;
+
+    Unit* unit = dynamic_cast<Unit*>(&node);
+    if (unit)
+    {
+        _units.push_back(unit);
+
+        // a unit blocked by a barrier node consumes the output of the barrier's parent
+        for (unsigned int i=0; i < unit->getNumChildren(); i++)
+        {
+            BarrierNode* br = dynamic_cast<BarrierNode*>(unit->getChild(i));
+            Unit* child = br ? dynamic_cast<Unit*>(br->getBlockedChild()) : NULL;
+            if (child) _feedbackProducers[child].push_back(unit);
+        }
+    }
+
+    node.traverse(*this);
+}
+
+//------------------------------------------------------------------------------
+bool MarkUnitsLiveVisitor::isSink(Unit* unit, Processor* proc)
+{
+    // only units which output leaves the unit graph are sinks, dangling chains are not
+    if (dynamic_cast<UnitOut*>(unit) || dynamic_cast<UnitOutReadback*>(unit) || unit->getPinned()) return true;
+    if (proc && unit->getCullCallback() && unit->getCullCallback() == proc->mCollectLastUnitsCallback.get()) return true;
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+bool MarkUnitsLiveVisitor::rendersInPlace(Unit* unit)
+{
+    // text is drawn onto the input, bypasses just forward the input
+    if (dynamic_cast<UnitText*>(unit)) return true;
+    if (!dynamic_cast<UnitBypass*>(unit)) return false;
+
+    // these bypasses bring their own texture into the graph
+    return !dynamic_cast<UnitCamera*>(unit) && !dynamic_cast<UnitCameraAttachmentBypass*>(unit) && !dynamic_cast<UnitTexture*>(unit);
+}
+
+//------------------------------------------------------------------------------
+bool MarkUnitsLiveVisitor::hasLiveConsumer(Unit* unit)
+{
+    for (unsigned int i=0; i < unit->getNumChildren(); i++)
+    {
+        Unit* child = dynamic_cast<Unit*>(unit->getChild(i));
+
+        BarrierNode* br = dynamic_cast<BarrierNode*>(unit->getChild(i));
+        if (br) child = dynamic_cast<Unit*>(br->getBlockedChild());
+
+        if (child && _live.find(child) != _live.end()) return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void MarkUnitsLiveVisitor::addProducers(osg::Node* node, std::vector<Unit*>& queue)
+{
+    for (unsigned int i=0; i < node->getNumParents(); i++)
+    {
+        osg::Group* parent = node->getParent(i);
+        Unit* unit = dynamic_cast<Unit*>(parent);
+
+        // inactive units do not propagate the liveness to their producers
+        if (unit)
+        {
+            if (unit->getActive() && _live.insert(unit).second)
+                queue.push_back(unit);
+        }
+
+        // units might be grouped by non-unit nodes, hence go further up to the processor
+        else if (parent != _proc)
+            addProducers(parent, queue);
+    }
+}
+
+//------------------------------------------------------------------------------
+void MarkUnitsLiveVisitor::addInPlaceConsumers(Unit* unit, std::vector<Unit*>& queue)
+{
+    for (unsigned int i=0; i < unit->getNumChildren(); i++)
+    {
+        Unit* child = dynamic_cast<Unit*>(unit->getChild(i));
+        if (child && child->getActive() && rendersInPlace(child) && _live.insert(child).second)
+            queue.push_back(child);
+    }
+}
+
+//------------------------------------------------------------------------------
+void MarkUnitsLiveVisitor::run (osg::Group* root)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
+
+    // collect all units and feedback connections of the graph
+    _visited.clear();
+    _units.clear();
+    _live.clear();
+    _feedbackProducers.clear();
+    root->traverse(*this);
+
+    // start with all active sinks
+    std::vector<Unit*> queue;
+    for (std::vector<Unit*>::iterator it = _units.begin(); it != _units.end(); it++)
+    {
+        if ((*it)->getActive() && isSink(*it, _proc))
+        {
+            _live.insert(*it);
+            queue.push_back(*it);
+        }
+    }
+
+    // go backwards from the sinks and mark every producer as live, units
+    // rendering into the output of a live unit are live as well
+    while (!queue.empty())
+    {
+        Unit* unit = queue.back();
+        queue.pop_back();
+
+        addProducers(unit, queue);
+        addInPlaceConsumers(unit, queue);
+
+        ProducerMap::iterator jt = _feedbackProducers.find(unit);
+        if (jt == _feedbackProducers.end()) continue;
+        for (std::vector<Unit*>::iterator kt = jt->second.begin(); kt != jt->second.end(); kt++)
+        {
+            if ((*kt)->getActive() && _live.insert(*kt).second)
+                queue.push_back(*kt);
+        }
+    }
+
+    // apply the result on the units
+    for (std::vector<Unit*>::iterator it = _units.begin(); it != _units.end(); it++)
+    {
+        Unit* unit = *it;
+        unit->mbLive = _live.find(unit) != _live.end();
+
+        if (!unit->mbLive)
+            osg::notify(osg::INFO) << "osgPPU::MarkUnitsLiveVisitor::run() - " << unit->getName() << " is not part of the pipeline" << std::endl;
+
+        // inactive units might still be consumed by live units, hence keep their output then
+        bool release = !unit->mbLive && !hasLiveConsumer(unit);
+        if (release != unit->mbOutputReleased)
+        {
+            unit->mbOutputReleased = release;
+            unit->noticeChangeLive(!release);
+        }
+    }
+}
+
 }; //end namespace
 
 
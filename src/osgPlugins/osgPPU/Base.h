@@ -33,6 +33,7 @@ class ListReadOptions : public osgDB::ReaderWriter::Options
 public:
     typedef std::map<osgPPU::Unit*, std::list<std::string> > List;
     typedef std::map<osgPPU::Unit*, std::map<std::string,std::string> > UniformInputMap;
+    typedef std::map<osgPPU::Unit*, std::map<unsigned int,std::string> > PreviousFrameInputMap;
 
     void setList(const List& l) { mList = l;}
     List& getList() { return mList; }
@@ -40,6 +41,8 @@ public:
     void setUniformInputMap(const UniformInputMap& l) { mUniformInputMap = l;}
     UniformInputMap& getUniformInputMap() { return mUniformInputMap; }
 
+    PreviousFrameInputMap& getPreviousFrameInputMap() { return mPreviousFrameInputMap; }
+
     ListReadOptions() : osgDB::ReaderWriter::Options()
     {}
 
@@ -50,6 +53,7 @@ private:
 
     List mList;
     UniformInputMap mUniformInputMap;
+    PreviousFrameInputMap mPreviousFrameInputMap;
 };
 
 
@@ -20,7 +20,15 @@
 #include <osgPPU/UnitMipmapInMipmapOut.h>
 #include <osgPPU/UnitOut.h>
 #include <osgPPU/UnitOutCapture.h>
+#include <osgPPU/UnitOutReadback.h>
 #include <osgPPU/UnitInResampleOut.h>
+#include <osgPPU/UnitInReduceOut.h>
+#include <osgPPU/UnitInHistogramOut.h>
+#include <osgPPU/UnitInConvolveOut.h>
+#include <osgPPU/UnitPyramid.h>
+#include <osgPPU/UnitMultigrid.h>
+#include <osgPPU/UnitTemporalResolve.h>
+#include <osgPPU/UnitInOutCompute.h>
 #include <osgPPU/UnitText.h>
 #include <osgPPU/UnitBypass.h>
 #include <osgPPU/UnitDepthbufferBypass.h>
@@ -33,6 +41,7 @@
 
 #include <osg/Notify>
 #include <osg/io_utils>
+#include <sstream>
 
 #include "Base.h"
 
@@ -250,6 +259,321 @@ bool readUnitInResampleOut(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    if (fr[0].matchWord("filter"))
+    {
+        if (fr[1].matchWord("DEFAULT")) unit.setFilter(osgPPU::UnitInResampleOut::DEFAULT);
+        else if (fr[1].matchWord("BOX")) unit.setFilter(osgPPU::UnitInResampleOut::BOX);
+        else if (fr[1].matchWord("BICUBIC")) unit.setFilter(osgPPU::UnitInResampleOut::BICUBIC);
+        else if (fr[1].matchWord("LANCZOS")) unit.setFilter(osgPPU::UnitInResampleOut::LANCZOS);
+        else if (fr[1].matchWord("MIN")) unit.setFilter(osgPPU::UnitInResampleOut::MIN);
+        else if (fr[1].matchWord("MAX")) unit.setFilter(osgPPU::UnitInResampleOut::MAX);
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Shader* shader = static_cast<osg::Shader*>(fr.readObjectOfType(osgDB::type_wrapper<osg::Shader>()));
+    if (shader)
+    {
+        unit.setFusedShader(shader);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitInReduceOut(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitInReduceOut& unit = static_cast<osgPPU::UnitInReduceOut&>(obj);
+
+    bool itAdvanced = false;
+
+    if (fr[0].matchWord("operator"))
+    {
+        if (fr[1].matchWord("SUM")) unit.setOperator(osgPPU::UnitInReduceOut::SUM);
+        else if (fr[1].matchWord("MIN")) unit.setOperator(osgPPU::UnitInReduceOut::MIN);
+        else if (fr[1].matchWord("MAX")) unit.setOperator(osgPPU::UnitInReduceOut::MAX);
+        else if (fr[1].matchWord("MEAN")) unit.setOperator(osgPPU::UnitInReduceOut::MEAN);
+        else if (fr[1].matchWord("LOG_AVERAGE")) unit.setOperator(osgPPU::UnitInReduceOut::LOG_AVERAGE);
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int factor = 0;
+    if (fr.readSequence("reductionFactor", factor))
+    {
+        unit.setReductionFactor(factor);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitInHistogramOut(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitInHistogramOut& unit = static_cast<osgPPU::UnitInHistogramOut&>(obj);
+
+    bool itAdvanced = false;
+
+    unsigned int numBins = 0;
+    if (fr.readSequence("numBins", numBins))
+    {
+        unit.setNumBins(numBins);
+        itAdvanced = true;
+    }
+
+    if (fr[0].matchWord("channel"))
+    {
+        if (fr[1].matchWord("RED")) unit.setChannel(osgPPU::UnitInHistogramOut::RED);
+        else if (fr[1].matchWord("GREEN")) unit.setChannel(osgPPU::UnitInHistogramOut::GREEN);
+        else if (fr[1].matchWord("BLUE")) unit.setChannel(osgPPU::UnitInHistogramOut::BLUE);
+        else if (fr[1].matchWord("ALPHA")) unit.setChannel(osgPPU::UnitInHistogramOut::ALPHA);
+        else if (fr[1].matchWord("LUMINANCE")) unit.setChannel(osgPPU::UnitInHistogramOut::LUMINANCE);
+        else if (fr[1].matchWord("LOG_LUMINANCE")) unit.setChannel(osgPPU::UnitInHistogramOut::LOG_LUMINANCE);
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    float minValue = 0.0f, maxValue = 1.0f;
+    if (fr[0].matchWord("range") && fr[1].getFloat(minValue) && fr[2].getFloat(maxValue))
+    {
+        unit.setRange(minValue, maxValue);
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    unsigned int step = 1;
+    if (fr.readSequence("sampleStep", step))
+    {
+        unit.setSampleStep(step);
+        itAdvanced = true;
+    }
+
+    int normalize = 0;
+    if (fr.readSequence("normalize", normalize))
+    {
+        unit.setNormalize(normalize ? true : false);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitInConvolveOut(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitInConvolveOut& unit = static_cast<osgPPU::UnitInConvolveOut&>(obj);
+
+    bool itAdvanced = false;
+
+    float sigma = 0.0f;
+    if (fr.readSequence("sigma", sigma))
+    {
+        unit.setGaussianKernel(sigma);
+        itAdvanced = true;
+    }
+
+    unsigned int numWeights = 0;
+    if (fr[0].matchWord("kernel") && fr[1].getUInt(numWeights))
+    {
+        fr += 2;
+        std::vector<float> weights;
+        float weight = 0.0f;
+        for (unsigned int i=0; i < numWeights && fr[0].getFloat(weight); i++, ++fr)
+            weights.push_back(weight);
+        unit.setKernel(weights);
+        itAdvanced = true;
+    }
+
+    unsigned int maxRadius = 0;
+    if (fr.readSequence("maxRadius", maxRadius))
+    {
+        unit.setMaxRadius(maxRadius);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitPyramid(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitPyramid& unit = static_cast<osgPPU::UnitPyramid&>(obj);
+
+    bool itAdvanced = false;
+
+    unsigned int numLevels = 0;
+    if (fr.readSequence("numLevels", numLevels))
+    {
+        unit.setNumLevels(numLevels);
+        itAdvanced = true;
+    }
+
+    if (fr[0].matchWord("filter"))
+    {
+        if (fr[1].matchWord("BOX")) unit.setFilter(osgPPU::UnitPyramid::BOX);
+        else if (fr[1].matchWord("DUAL_KAWASE")) unit.setFilter(osgPPU::UnitPyramid::DUAL_KAWASE);
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int level = 0;
+    float weight = 0.0f;
+    if (fr[0].matchWord("levelWeight") && fr[1].getUInt(level) && fr[2].getFloat(weight))
+    {
+        unit.setLevelWeight(level, weight);
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    osg::Program* program = static_cast<osg::Program*>(fr.readObjectOfType(osgDB::type_wrapper<osg::Program>()));
+    if (program)
+    {
+        unit.setLevelProgram(program);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitMultigrid(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitMultigrid& unit = static_cast<osgPPU::UnitMultigrid&>(obj);
+
+    bool itAdvanced = false;
+
+    unsigned int num = 0;
+    if (fr.readSequence("numLevels", num))
+    {
+        unit.setNumLevels(num);
+        itAdvanced = true;
+    }
+
+    if (fr.readSequence("numCycles", num))
+    {
+        unit.setNumCycles(num);
+        itAdvanced = true;
+    }
+
+    unsigned int pre = 0, post = 0;
+    if (fr[0].matchWord("smoothingSteps") && fr[1].getUInt(pre) && fr[2].getUInt(post))
+    {
+        unit.setNumSmoothingSteps(pre, post);
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    if (fr.readSequence("coarseSmoothingSteps", num))
+    {
+        unit.setNumCoarseSmoothingSteps(num);
+        itAdvanced = true;
+    }
+
+    if (fr[0].matchWord("smoother"))
+    {
+        ++fr;
+        osg::Program* program = static_cast<osg::Program*>(fr.readObjectOfType(osgDB::type_wrapper<osg::Program>()));
+        if (program) unit.setSmootherProgram(program);
+        itAdvanced = true;
+    }
+
+    if (fr[0].matchWord("residual"))
+    {
+        ++fr;
+        osg::Program* program = static_cast<osg::Program*>(fr.readObjectOfType(osgDB::type_wrapper<osg::Program>()));
+        if (program) unit.setResidualProgram(program);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitTemporalResolve(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitTemporalResolve& unit = static_cast<osgPPU::UnitTemporalResolve&>(obj);
+
+    bool itAdvanced = false;
+
+    float weight = 0.0f;
+    if (fr.readSequence("historyWeight", weight))
+    {
+        unit.setHistoryWeight(weight);
+        itAdvanced = true;
+    }
+
+    unsigned int num = 0;
+    if (fr.readSequence("jitterSamples", num))
+    {
+        unit.setNumJitterSamples(num);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
+//--------------------------------------------------------------------------
+bool readUnitInOutCompute(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitInOutCompute& unit = static_cast<osgPPU::UnitInOutCompute&>(obj);
+
+    bool itAdvanced = false;
+
+    if (fr.matchSequence("localSize %i %i %i"))
+    {
+        unsigned int x = 16, y = 16, z = 1;
+        fr[1].getUInt(x);
+        fr[2].getUInt(y);
+        fr[3].getUInt(z);
+        unit.setLocalSize(x, y, z);
+        fr += 4;
+        itAdvanced = true;
+    }
+
+    if (fr.matchSequence("inputImageUnit %i %i"))
+    {
+        unsigned int input = 0, imageUnit = 0;
+        fr[1].getUInt(input);
+        fr[2].getUInt(imageUnit);
+        unit.setInputImageUnit(input, imageUnit);
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    // source is stored line by line
+    if (fr.matchSequence("computeShader {"))
+    {
+        int entry = fr[0].getNoNestedBrackets();
+
+        fr += 2;
+
+        std::string source;
+        while (!fr.eof() && fr[0].getNoNestedBrackets()>entry)
+        {
+            if (fr[0].getStr())
+            {
+                source += fr[0].getStr();
+                source += "\n";
+            }
+            ++fr;
+        }
+        unit.setComputeShaderSource(source);
+
+        // skip trailing '}'
+        ++fr;
+
+        itAdvanced = true;
+    }
+
     return itAdvanced;
 }
 
@@ -275,6 +599,21 @@ bool readUnitInMipmapOut(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    unsigned int levelsPerPass = 1;
+    if (fr.readSequence("levelsPerPass", levelsPerPass))
+    {
+        unit.setNumLevelsPerPass(levelsPerPass);
+        itAdvanced = true;
+    }
+
+    int first = 0, last = -1;
+    if (fr[0].matchWord("levelRange") && fr[1].getInt(first) && fr[2].getInt(last))
+    {
+        unit.setMipmapLevelRange(first, last);
+        fr += 3;
+        itAdvanced = true;
+    }
+
     return itAdvanced;
 }
 
@@ -292,6 +631,13 @@ bool readUnitInOutModule(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    int reload = 0;
+    if (fr.readSequence("reloadOnChange", reload))
+    {
+        unit.setReloadOnChange(reload != 0);
+        itAdvanced = true;
+    }
+
     return itAdvanced;
 }
 
@@ -331,6 +677,23 @@ bool readUnitInOutRepeat(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    int input = 0, mrt = 0;
+    if (fr[0].matchWord("feedback") && fr[1].getInt(input) && fr[2].getInt(mrt))
+    {
+        unit.setFeedback(input, mrt);
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    int interval = 0, threshold = 0;
+    float epsilon = 0.0f;
+    if (fr[0].matchWord("convergenceCheck") && fr[1].getInt(interval) && fr[2].getFloat(epsilon) && fr[3].getInt(threshold))
+    {
+        unit.setConvergenceCheck(interval, epsilon, threshold);
+        fr += 4;
+        itAdvanced = true;
+    }
+
     return itAdvanced;
 }
 
@@ -359,6 +722,25 @@ bool readUnitText(osg::Object& obj, osgDB::Input& fr)
     return itAdvanced;
 }
 
+//--------------------------------------------------------------------------
+bool readUnitOutReadback(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitOutReadback& unit = static_cast<osgPPU::UnitOutReadback&>(obj);
+
+    bool itAdvanced = false;
+
+    int x, y, width, height;
+    if (fr[0].matchWord("regionOfInterest") && fr[1].getInt(x) && fr[2].getInt(y) && fr[3].getInt(width) && fr[4].getInt(height))
+    {
+        unit.setRegionOfInterest(x, y, width, height);
+        fr += 5;
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
 //--------------------------------------------------------------------------
 bool readUnitOutCapture(osg::Object& obj, osgDB::Input& fr)
 {
@@ -406,6 +788,13 @@ bool readUnit(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    int isPinned = 0;
+    if (fr.readSequence("isPinned", isPinned))
+    {
+        unit.setPinned(isPinned?true:false);
+        itAdvanced = true;
+    }
+
     int inputTextureIndexForViewportReference = 0;
     if (fr.readSequence("inputTextureIndexForViewportReference", inputTextureIndexForViewportReference))
     {
@@ -523,6 +912,42 @@ bool readUnit(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    // inputs connected to the previous frame output of other units
+    if (fr.matchSequence("PreviousFrameInput {"))
+    {
+        int entry = fr[0].getNoNestedBrackets();
+
+        fr += 2;
+
+        std::map<unsigned int, std::string> inputMap;
+
+        while (!fr.eof() && fr[0].getNoNestedBrackets()>entry)
+        {
+            unsigned int slot = 0;
+            if (!fr[0].getUInt(slot))
+            {
+                osg::notify(osg::FATAL) << "osgPPU::ReaderWriter::readUnit() - syntax error in PreviousFrameInput field" << std::endl;
+                break;
+            }
+            inputMap[slot] = fr[1].getStr();
+            fr += 2;
+        }
+
+        // resolved when all units are read
+        ListReadOptions* opt = dynamic_cast<ListReadOptions*>(const_cast<osgDB::ReaderWriter::Options*>(fr.getOptions()));
+        if (opt)
+        {
+            opt->getPreviousFrameInputMap()[&unit] = inputMap;
+        }else{
+            osg::notify(osg::WARN)<<"osgPPU::readObject - Something bad happens!" << std::endl;
+        }
+
+        // skip trailing '}'
+        ++fr;
+
+        itAdvanced = true;
+    }
+
     // read shader attribute
     osgPPU::ShaderAttribute* sh = static_cast<osgPPU::ShaderAttribute*>(fr.readObjectOfType(osgDB::type_wrapper<osgPPU::ShaderAttribute>()));
     if (sh)
@@ -596,6 +1021,7 @@ bool writeUnit(const osg::Object& obj, osgDB::Output& fout)
     // retrieve default parameters and sotre them
     fout.indent() << "name " <<  fout.wrapString(unit.getName()) << std::endl;
     fout.indent() << "isActive " <<  unit.getActive() << std::endl;
+    if (unit.getPinned()) fout.indent() << "isPinned " <<  unit.getPinned() << std::endl;
     fout.indent() << "inputTextureIndexForViewportReference " <<  unit.getInputTextureIndexForViewportReference() << std::endl;
 
     // write ignore input indices
@@ -643,6 +1069,33 @@ bool writeUnit(const osg::Object& obj, osgDB::Output& fout)
         }
     }
 
+    // write inputs connected to the previous frame
+    {
+        const osgPPU::Unit::PreviousFrameInputMap& map = unit.getPreviousFrameInputMap();
+        if (map.size())
+        {
+            fout << std::endl;
+            fout.writeBeginObject("PreviousFrameInput");
+            fout.moveIn();
+
+            for (osgPPU::Unit::PreviousFrameInputMap::const_iterator it = map.begin(); it != map.end(); it++)
+            {
+                if (!it->second.valid()) continue;
+
+                std::string uid;
+                if (!fout.getUniqueIDForObject(it->second.get(), uid))
+                {
+                    fout.createUniqueIDForObject(it->second.get(), uid);
+                    fout.registerUniqueIDForObject(it->second.get(), uid);
+                }
+                fout.indent() << it->first << " " << uid << std::endl;
+            }
+
+            fout.moveOut();
+            fout.writeEndObject();
+        }
+    }
+
     // for non bypass ppus do specify inputs
     fout << std::endl;
     fout.writeBeginObject("PPUOutput");
@@ -732,6 +1185,19 @@ bool writeUnitOutCapture(const osg::Object& obj, osgDB::Output& fout)
     return true;
 }
 
+//--------------------------------------------------------------------------
+bool writeUnitOutReadback(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitOutReadback& unit = static_cast<const osgPPU::UnitOutReadback&>(obj);
+
+    int x, y, width, height;
+    unit.getRegionOfInterest(x, y, width, height);
+    fout.indent() << "regionOfInterest " << x << " " << y << " " << width << " " << height << std::endl;
+
+    return true;
+}
+
 //--------------------------------------------------------------------------
 bool writeUnitInOut(const osg::Object& obj, osgDB::Output& fout)
 {
@@ -793,6 +1259,10 @@ bool writeUnitInMipmapOut(const osg::Object& obj, osgDB::Output& fout)
 
     fout.indent() << "inputIndex " <<  unit.getGenerateMipmapForInputTextureIndex() << std::endl;
     fout.indent() << "useShader " << unit.getUseShader() << std::endl;
+    if (unit.getNumLevelsPerPass() > 1)
+        fout.indent() << "levelsPerPass " << unit.getNumLevelsPerPass() << std::endl;
+    if (unit.getMipmapLevelFirst() != 0 || unit.getMipmapLevelLast() >= 0)
+        fout.indent() << "levelRange " << unit.getMipmapLevelFirst() << " " << unit.getMipmapLevelLast() << std::endl;
 
     return true;
 }
@@ -807,6 +1277,165 @@ bool writeUnitInResampleOut(const osg::Object& obj, osgDB::Output& fout)
     fout.indent() << "factorX " <<  unit.getFactorX() << std::endl;
     fout.indent() << "factorY " <<  unit.getFactorY() << std::endl;
 
+    const char* filter = "DEFAULT";
+    switch (unit.getFilter())
+    {
+        case osgPPU::UnitInResampleOut::DEFAULT: filter = "DEFAULT"; break;
+        case osgPPU::UnitInResampleOut::BOX: filter = "BOX"; break;
+        case osgPPU::UnitInResampleOut::BICUBIC: filter = "BICUBIC"; break;
+        case osgPPU::UnitInResampleOut::LANCZOS: filter = "LANCZOS"; break;
+        case osgPPU::UnitInResampleOut::MIN: filter = "MIN"; break;
+        case osgPPU::UnitInResampleOut::MAX: filter = "MAX"; break;
+    }
+    fout.indent() << "filter " << filter << std::endl;
+    if (unit.getFusedShader())
+        fout.writeObject(*unit.getFusedShader());
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitInHistogramOut(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitInHistogramOut& unit = static_cast<const osgPPU::UnitInHistogramOut&>(obj);
+
+    const char* channel = "LUMINANCE";
+    switch (unit.getChannel())
+    {
+        case osgPPU::UnitInHistogramOut::RED: channel = "RED"; break;
+        case osgPPU::UnitInHistogramOut::GREEN: channel = "GREEN"; break;
+        case osgPPU::UnitInHistogramOut::BLUE: channel = "BLUE"; break;
+        case osgPPU::UnitInHistogramOut::ALPHA: channel = "ALPHA"; break;
+        case osgPPU::UnitInHistogramOut::LUMINANCE: channel = "LUMINANCE"; break;
+        case osgPPU::UnitInHistogramOut::LOG_LUMINANCE: channel = "LOG_LUMINANCE"; break;
+    }
+    fout.indent() << "numBins " << unit.getNumBins() << std::endl;
+    fout.indent() << "channel " << channel << std::endl;
+    fout.indent() << "range " << unit.getRangeMin() << " " << unit.getRangeMax() << std::endl;
+    fout.indent() << "sampleStep " << unit.getSampleStep() << std::endl;
+    fout.indent() << "normalize " << unit.getNormalize() << std::endl;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitInConvolveOut(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitInConvolveOut& unit = static_cast<const osgPPU::UnitInConvolveOut&>(obj);
+
+    if (unit.getSigma() > 0.0f)
+        fout.indent() << "sigma " << unit.getSigma() << std::endl;
+    else
+    {
+        const std::vector<float>& weights = unit.getKernel();
+        fout.indent() << "kernel " << weights.size();
+        for (unsigned int i=0; i < weights.size(); i++)
+            fout << " " << weights[i];
+        fout << std::endl;
+    }
+    fout.indent() << "maxRadius " << unit.getMaxRadius() << std::endl;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitPyramid(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitPyramid& unit = static_cast<const osgPPU::UnitPyramid&>(obj);
+
+    fout.indent() << "numLevels " << unit.getNumLevels() << std::endl;
+    fout.indent() << "filter " << (unit.getFilter() == osgPPU::UnitPyramid::BOX ? "BOX" : "DUAL_KAWASE") << std::endl;
+    for (unsigned int i=0; i <= unit.getNumLevels(); i++)
+        fout.indent() << "levelWeight " << i << " " << unit.getLevelWeight(i) << std::endl;
+    if (unit.getLevelProgram())
+        fout.writeObject(*unit.getLevelProgram());
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitMultigrid(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitMultigrid& unit = static_cast<const osgPPU::UnitMultigrid&>(obj);
+
+    fout.indent() << "numLevels " << unit.getNumLevels() << std::endl;
+    fout.indent() << "numCycles " << unit.getNumCycles() << std::endl;
+    fout.indent() << "smoothingSteps " << unit.getNumPreSmoothingSteps() << " " << unit.getNumPostSmoothingSteps() << std::endl;
+    fout.indent() << "coarseSmoothingSteps " << unit.getNumCoarseSmoothingSteps() << std::endl;
+    if (unit.getSmootherProgram())
+    {
+        fout.indent() << "smoother" << std::endl;
+        fout.writeObject(*unit.getSmootherProgram());
+    }
+    if (unit.getResidualProgram())
+    {
+        fout.indent() << "residual" << std::endl;
+        fout.writeObject(*unit.getResidualProgram());
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitTemporalResolve(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitTemporalResolve& unit = static_cast<const osgPPU::UnitTemporalResolve&>(obj);
+
+    fout.indent() << "historyWeight " << unit.getHistoryWeight() << std::endl;
+    fout.indent() << "jitterSamples " << unit.getNumJitterSamples() << std::endl;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitInOutCompute(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitInOutCompute& unit = static_cast<const osgPPU::UnitInOutCompute&>(obj);
+
+    fout.indent() << "localSize " << unit.getLocalSizeX() << " " << unit.getLocalSizeY() << " " << unit.getLocalSizeZ() << std::endl;
+
+    const osgPPU::UnitInOutCompute::InputImageUnitMap& images = unit.getInputImageUnitMap();
+    for (osgPPU::UnitInOutCompute::InputImageUnitMap::const_iterator it = images.begin(); it != images.end(); it++)
+        fout.indent() << "inputImageUnit " << it->first << " " << it->second << std::endl;
+
+    fout.writeBeginObject("computeShader");
+    fout.moveIn();
+
+        std::istringstream source(unit.getComputeShaderSource());
+        std::string line;
+        while (std::getline(source, line))
+            fout.indent() << fout.wrapString(line) << std::endl;
+
+    fout.moveOut();
+    fout.writeEndObject();
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+bool writeUnitInReduceOut(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitInReduceOut& unit = static_cast<const osgPPU::UnitInReduceOut&>(obj);
+
+    const char* op = "MEAN";
+    switch (unit.getOperator())
+    {
+        case osgPPU::UnitInReduceOut::SUM: op = "SUM"; break;
+        case osgPPU::UnitInReduceOut::MIN: op = "MIN"; break;
+        case osgPPU::UnitInReduceOut::MAX: op = "MAX"; break;
+        case osgPPU::UnitInReduceOut::MEAN: op = "MEAN"; break;
+        case osgPPU::UnitInReduceOut::LOG_AVERAGE: op = "LOG_AVERAGE"; break;
+    }
+    fout.indent() << "operator " << op << std::endl;
+    fout.indent() << "reductionFactor " << unit.getReductionFactor() << std::endl;
+
     return true;
 }
 
@@ -817,6 +1446,7 @@ bool writeUnitInOutModule(const osg::Object& obj, osgDB::Output& fout)
     const osgPPU::UnitInOutModule& unit = static_cast<const osgPPU::UnitInOutModule&>(obj);
 
     fout.indent() << "module " <<  fout.wrapString(unit.getModuleFile()) << std::endl;
+    if (unit.getReloadOnChange()) fout.indent() << "reloadOnChange 1" << std::endl;
 
     return true;
 }
@@ -839,6 +1469,14 @@ bool writeUnitInOutRepeat(const osg::Object& obj, osgDB::Output& fout)
     fout.indent() << "lastNode " << uid << std::endl;
     fout.indent() << "lastNodeOutputIndex " << unit.getLastNodeOutputIndex() << std::endl;
 
+    const osgPPU::UnitInOutRepeat::FeedbackMap& feedback = unit.getFeedbackMap();
+    for (osgPPU::UnitInOutRepeat::FeedbackMap::const_iterator it = feedback.begin(); it != feedback.end(); it++)
+        if (it->first != 0)
+            fout.indent() << "feedback " << it->first << " " << it->second << std::endl;
+
+    if (unit.getConvergenceInterval() > 0)
+        fout.indent() << "convergenceCheck " << unit.getConvergenceInterval() << " " << unit.getConvergenceEpsilon() << " " << unit.getConvergenceThreshold() << std::endl;
+
     return true;
 }
 
@@ -936,6 +1574,16 @@ osgDB::RegisterDotOsgWrapperProxy g_UnitOutCaptureProxy
     &writeUnitOutCapture
 );
 
+// register the read and write functions with the osgDB::Registry.
+osgDB::RegisterDotOsgWrapperProxy g_UnitOutReadbackProxy
+(
+    new osgPPU::UnitOutReadback,
+    "UnitOutReadback",
+    "Unit UnitInOut UnitOutReadback",
+    &readUnitOutReadback,
+    &writeUnitOutReadback
+);
+
 // register the read and write functions with the osgDB::Registry.
 osgDB::RegisterDotOsgWrapperProxy g_UnitInOutProxy
 (
@@ -966,6 +1614,70 @@ osgDB::RegisterDotOsgWrapperProxy g_UnitInResampleOutProxy
     &writeUnitInResampleOut
 );
 
+// register the read and write functions with the osgDB::Registry.
+osgDB::RegisterDotOsgWrapperProxy g_UnitInReduceOutProxy
+(
+    new osgPPU::UnitInReduceOut,
+    "UnitInReduceOut",
+    "Unit UnitInOut UnitInReduceOut",
+    &readUnitInReduceOut,
+    &writeUnitInReduceOut
+);
+
+osgDB::RegisterDotOsgWrapperProxy g_UnitInHistogramOutProxy
+(
+    new osgPPU::UnitInHistogramOut,
+    "UnitInHistogramOut",
+    "Unit UnitInOut UnitInHistogramOut",
+    &readUnitInHistogramOut,
+    &writeUnitInHistogramOut
+);
+
+osgDB::RegisterDotOsgWrapperProxy g_UnitInConvolveOutProxy
+(
+    new osgPPU::UnitInConvolveOut,
+    "UnitInConvolveOut",
+    "Unit UnitInOut UnitInConvolveOut",
+    &readUnitInConvolveOut,
+    &writeUnitInConvolveOut
+);
+
+osgDB::RegisterDotOsgWrapperProxy g_UnitPyramidProxy
+(
+    new osgPPU::UnitPyramid,
+    "UnitPyramid",
+    "Unit UnitInOut UnitPyramid",
+    &readUnitPyramid,
+    &writeUnitPyramid
+);
+
+osgDB::RegisterDotOsgWrapperProxy g_UnitMultigridProxy
+(
+    new osgPPU::UnitMultigrid,
+    "UnitMultigrid",
+    "Unit UnitInOut UnitMultigrid",
+    &readUnitMultigrid,
+    &writeUnitMultigrid
+);
+
+osgDB::RegisterDotOsgWrapperProxy g_UnitTemporalResolveProxy
+(
+    new osgPPU::UnitTemporalResolve,
+    "UnitTemporalResolve",
+    "Unit UnitInOut UnitTemporalResolve",
+    &readUnitTemporalResolve,
+    &writeUnitTemporalResolve
+);
+
+osgDB::RegisterDotOsgWrapperProxy g_UnitInOutComputeProxy
+(
+    new osgPPU::UnitInOutCompute,
+    "UnitInOutCompute",
+    "Unit UnitInOut UnitInOutCompute",
+    &readUnitInOutCompute,
+    &writeUnitInOutCompute
+);
+
 // register the read and write functions with the osgDB::Registry.
 osgDB::RegisterDotOsgWrapperProxy g_UnitInMipmapOutProxy
 (
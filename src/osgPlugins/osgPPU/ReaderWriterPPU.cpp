@@ -196,6 +196,19 @@ public:
                 }
             }
 
+            // connect units to the outputs of their producers from the previous frame
+            for (ListReadOptions::PreviousFrameInputMap::const_iterator it = list->getPreviousFrameInputMap().begin(); it!= list->getPreviousFrameInputMap().end(); it++)
+            {
+                for (std::map<unsigned int, std::string>::const_iterator kt=it->second.begin(); kt!=it->second.end(); kt++)
+                {
+                    osgPPU::UnitInOut* unit = dynamic_cast<osgPPU::UnitInOut*>(fr.getObjectForUniqueID(kt->second));
+                    if (!unit)
+                        osg::notify(osg::WARN)<<"Unit " << it->first->getName() << " cannot find previous frame input " << kt->second << " for slot " << kt->first << std::endl;
+                    else
+                        osgPPU::Unit::connectPreviousFrame(unit, it->first, kt->first);
+                }
+            }
+
             // read processor's name
             std::string name;
             if (fr.readSequence("name", name))